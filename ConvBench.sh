@@ -0,0 +1,147 @@
+#!/bin/bash
+# Converter regression/benchmark runner
+#
+# Usage: ./ConvBench.sh [-build | -update] [corpusDir [results.csv]]
+#
+# corpusDir defaults to the synthetic fixture set in bench/ (generated by bench/MakeFixtures.sh).
+# -build only builds the converters of the corpus into corpusDir/.bin and runs nothing.
+# Additional compiler flags can be passed using the CFLAGS environment variable.
+#
+# The corpus directory has one subdirectory per converter, named after its source file:
+#   corpus/rcp2mid/song1.rcp
+#   corpus/rcp2mid/song2.g36
+#   corpus/gmd2mid/args          (optional: additional parameters, placed before the file names)
+#   corpus/rcp2mid/song1.rcp.args (optional: parameters for this file only, replace "args")
+#   corpus/golden.sha1           (reference hashes, written by -update)
+# Each converter is built from <name>.c and run as "<name> [args] input output.mid".
+# When the parameters contain {in}, they are used as the whole command line instead,
+# with {in} and {out} replaced by the input and output file names. (e.g. "-mus {in} {out} all")
+# The input is copied into the output directory first, so converters that name their
+# output files after the input file write them there as well.
+# Converters that write several files (sub-songs etc.) are hashed over all of their output files.
+#
+# For every file, a line is appended to the results file (default: corpus/results.csv):
+#   date, commit, converter, file, exit code, wall time [s], peak RSS [KB], output size, SHA-1, result
+# result is "ok" (matches golden.sha1), "CHANGED", "new" (no reference hash) or "updated".
+# With -update, runs that exit with an error keep their old reference hash and get the result "failed".
+# Peak RSS is only measured when GNU time (/usr/bin/time) is installed.
+# The script exits with 1 when any output changed or a converter failed to build.
+
+UPDATE=0
+BUILDONLY=0
+if [ "$1" == "-update" ]; then
+	UPDATE=1
+	shift
+elif [ "$1" == "-build" ]; then
+	BUILDONLY=1
+	shift
+elif [ "${1:0:1}" == "-" ]; then
+	echo "Usage: $0 [-build | -update] [corpusDir [results.csv]]"
+	exit 0
+fi
+
+SRCDIR="$(dirname "$0")"
+CORPUS="${1:-$SRCDIR/bench}"
+CORPUS="${CORPUS%/}"
+RESULTS="${2:-$CORPUS/results.csv}"
+GOLDEN="$CORPUS/golden.sha1"
+BINDIR="$CORPUS/.bin"
+OUTDIR="$CORPUS/.out"
+CFLAGS="${CFLAGS:--O2}"
+DATE="$(date +%Y-%m-%dT%H:%M:%S)"
+COMMIT="$(git -C "$SRCDIR" rev-parse --short HEAD 2>/dev/null)"
+
+mkdir -p "$BINDIR" "$OUTDIR"
+if [ $BUILDONLY -eq 0 ] && [ ! -f "$RESULTS" ]; then
+	echo "date,commit,converter,file,exit,wall_s,peak_rss_kb,out_bytes,sha1,result" > "$RESULTS"
+fi
+touch "$GOLDEN"
+NEWGOLDEN="$(mktemp)"
+
+changed=0
+for tooldir in "$CORPUS"/*/; do
+	tool="$(basename "$tooldir")"
+	[ -f "$SRCDIR/$tool.c" ] || continue
+
+	echo "Building $tool ..."
+	# some converters call the MSVC-only _stricmp
+	if ! gcc $CFLAGS -D_stricmp=strcasecmp -o "$BINDIR/$tool" "$SRCDIR/$tool.c" -lm -pthread 2> "$BINDIR/$tool.log"; then
+		echo "$tool: build failed, see $BINDIR/$tool.log"
+		# keep the reference hashes of converters that couldn't be run
+		grep " $tool/" "$GOLDEN" >> "$NEWGOLDEN"
+		changed=1
+		continue
+	fi
+	[ $BUILDONLY -ne 0 ] && continue
+	args=""
+	[ -f "$tooldir/args" ] && args="$(cat "$tooldir/args")"
+
+	for infile in "$tooldir"*; do
+		fname="$(basename "$infile")"
+		[ -f "$infile" ] && [ "$fname" != "args" ] && [ "${fname%.args}" == "$fname" ] || continue
+
+		# each input gets its own output directory, so that all output files can be hashed
+		outpath="$OUTDIR/$tool/$fname"
+		rm -rf "$outpath"
+		mkdir -p "$outpath"
+		cp "$infile" "$outpath/$fname"
+
+		fileargs="$args"
+		[ -f "$infile.args" ] && fileargs="$(cat "$infile.args")"
+		cmdline=()
+		for arg in $fileargs; do
+			case "$arg" in
+			"{in}")		cmdline+=("$outpath/$fname") ;;
+			"{out}")	cmdline+=("$outpath/out.mid") ;;
+			*)			cmdline+=("$arg") ;;
+			esac
+		done
+		[[ " $fileargs " == *" {in} "* ]] || cmdline+=("$outpath/$fname" "$outpath/out.mid")
+
+		rss="-"
+		start=$(date +%s%N)
+		if [ -x /usr/bin/time ]; then
+			/usr/bin/time -f "%M" -o "$outpath.rss" "$BINDIR/$tool" "${cmdline[@]}" > "$outpath.log" 2>&1 < /dev/null
+			exitcode=$?
+			rss="$(tail -n 1 "$outpath.rss")"
+		else
+			"$BINDIR/$tool" "${cmdline[@]}" > "$outpath.log" 2>&1 < /dev/null
+			exitcode=$?
+		fi
+		end=$(date +%s%N)
+		rm -f "$outpath/$fname"
+		wall=$(awk "BEGIN { printf \"%.3f\", ($end - $start) / 1000000000 }")
+
+		size=$(cat "$outpath"/* 2>/dev/null | wc -c)
+		hash=$( (cd "$outpath" && ls | LC_ALL=C sort | while read -r f; do cat "$f"; done) | sha1sum | cut -d ' ' -f 1)
+		ref=$(awk -v key="$tool/$fname" 'substr($0, 43) == key { print substr($0, 1, 40); exit }' "$GOLDEN")
+		if [ $UPDATE -ne 0 ] && [ $exitcode -ne 0 ]; then
+			# don't bless the output of failed runs
+			result="failed"
+			hash="$ref"
+			changed=1
+		elif [ $UPDATE -ne 0 ]; then
+			result="updated"
+		elif [ -z "$ref" ]; then
+			result="new"
+		elif [ "$ref" == "$hash" ]; then
+			result="ok"
+		else
+			result="CHANGED"
+			changed=1
+		fi
+		[ -n "$hash" ] && echo "$hash  $tool/$fname" >> "$NEWGOLDEN"
+
+		echo "$tool/$fname: $result ($wall s, $size bytes)"
+		echo "$DATE,$COMMIT,$tool,\"$fname\",$exitcode,$wall,$rss,$size,$hash,$result" >> "$RESULTS"
+	done
+done
+
+if [ $BUILDONLY -ne 0 ]; then
+	:
+elif [ $UPDATE -ne 0 ]; then
+	LC_ALL=C sort -k 2 "$NEWGOLDEN" > "$GOLDEN"
+fi
+rm -f "$NEWGOLDEN"
+
+exit $changed
@@ -5,10 +5,13 @@
 #include <stddef.h>
 #include <string.h>
 #include <ctype.h>
-#include <math.h>	// for powf()
 
 #include "stdtype.h"
 #include "Soundfont.h"
+#include "thread_funcs.h"
+#include "rom_cache.h"
+#define SCSP_TABLES
+#include "chip_tables.h"
 
 #ifndef INLINE
 #if defined(_MSC_VER)
@@ -36,24 +39,27 @@
 #endif
 
 
-typedef struct _rom_data ROM_DATA;
+typedef struct _paged_rom PAGED_ROM;
 typedef struct _sample_def SMPL_DEF;
+typedef struct _wav_job WAV_JOB;
+typedef struct _wav_plan WAV_PLAN;
+typedef struct _decoded_bank DECODED_BANK;
 
 static UINT8 LoadROMData(const char* FileName, UINT32* retSize, UINT8** retData);
-static UINT8 LoadROMsMerged(size_t romCount, const char** fileNames, UINT32* retSize, UINT8** retData);
+static UINT8 OpenROMsPaged(size_t romCount, const char** fileNames, PAGED_ROM* pRom);
+static void ClosePagedROM(PAGED_ROM* pRom);
+static UINT8 PagedROM_Load(PAGED_ROM* pRom, UINT32 Offset, UINT32 Length);
 static void RomByteswap(UINT32 Size, UINT8* Data);
 static UINT8 IsUpperCase(const char* text);
 static void NormalizePath(char* filePath);
 static void CreateDirTree(const char* dirPath);
 INLINE UINT32 GetGlobalPtr(UINT32 PtrID);
-INLINE const UINT8* GetRomPtr(UINT32 Address);
+INLINE UINT8 CheckRomRange(UINT32 Address, UINT32 Length);
+INLINE const UINT8* GetRomPtr(UINT32 Address, UINT32 Length);
 static void DecodeMidiData(UINT32 PtrBase, UINT8 SongID);
 static UINT32 DecodeMidiSegment(UINT32 ROMStPos, UINT32 MidStPos);
 static UINT32 DoCommandA0(UINT32 MidStPos, UINT8 Command, UINT8 Arg1, UINT8 Arg2);
 
-INLINE UINT8 TrkVol2MidiVol(UINT8 Volume);
-INLINE UINT8 NoteVel2MidiVol(UINT8 Velocity);
-INLINE UINT8 DB2MidiVol(float DB);
 
 INLINE UINT16 ReadBE16(const UINT8* Data);
 INLINE UINT32 ReadBE24(const UINT8* Data);
@@ -61,22 +67,26 @@ INLINE UINT32 ReadBE32(const UINT8* Data);
 INLINE void WriteBE16(UINT8* Buffer, UINT16 Value);
 INLINE void WriteBE32(UINT8* Buffer, UINT32 Value);
 
+static UINT8 PrepareBank(const char* FileName);
+static void SetBankPointers(DECODED_BANK* Bank);
+static UINT8 DecodeBank(UINT64 ROMHash, DECODED_BANK* Bank);
+static UINT8 CheckBank(const DECODED_BANK* Bank);
+static UINT8 LoadBankCache(const char* FileName, UINT64 ROMHash, DECODED_BANK* Bank);
+static UINT8 SaveBankCache(const char* FileName, const DECODED_BANK* Bank);
+static void FreeBank(DECODED_BANK* Bank);
+
 static void ExtractInstrumentSamples(const char* fNamePrefix);
-static void ExtractSample(const char* FileName, UINT16 SmplID, UINT8 FreqMod);
+static UINT8 PlanSample(WAV_PLAN* Plan, const char* FileName, UINT16 SmplID, UINT8 FreqMod);
+static void WaveWorker_Main(void* Param);
+static UINT8 WriteWaveFile(const WAV_JOB* Job, UINT8* Buffer);
 
 static void CreateSoundfont(const char* FileName);
-static UINT16 GenerateSampleTable(SF2_DATA* SF2Data, UINT8** RetLoopMsk);
-static UINT16 GenerateInstruments(SF2_DATA* SF2Data, UINT16 SmplCnt, const UINT8* LoopMsk, UINT8* RetDrmMask);
+static UINT16 GenerateSampleTable(SF2_DATA* SF2Data);
+static UINT16 GenerateInstruments(SF2_BUILDER* SF2Bld, UINT8* RetDrmMask);
 static void ReadInsData(const UINT8* Data, UINT8 LastNote, UINT8 CurNote, SMPL_DEF* RetSmplDef,
 						UINT16 SmplCnt, const UINT8* LoopMask);
-static INT16 SCSPtoSF2Rate(UINT16 SCSPRate, UINT8 IsAtk);
-static INT16 SCSPtoSF2Level(UINT16 SCSPLevel);
-static INT16 RoundTo16(double Value);
-static void AddInsBag(UINT16* BagAlloc, UINT16* BagCount, sfInstBag** Bags, UINT16 GenIdx, UINT16 ModIdx);
-static void AddInsGen_S16(UINT16* GenAlloc, UINT16* GenCount, sfInstGenList** Gens, UINT16 Type, INT16 Data);
-static void AddInsGen_U16(UINT16* GenAlloc, UINT16* GenCount, sfInstGenList** Gens, UINT16 Type, UINT16 Data);
-static void AddInsGen_8(UINT16* GenAlloc, UINT16* GenCount, sfInstGenList** Gens, UINT16 Type, UINT8 DataL, UINT8 DataH);
-static void GeneratePresets(SF2_DATA* SF2Data, UINT16 InsCnt, const UINT8* DrumMask);
+static void AddInsZone(SF2_BUILDER* SF2Bld, const SMPL_DEF* SmplDef, INT16 RelRate);
+static void GeneratePresets(SF2_BUILDER* SF2Bld, UINT16 InsCnt, const UINT8* DrumMask);
 
 
 static const UINT8 VELOC_DATA[0x80] =
@@ -102,11 +112,29 @@ static const UINT8 WAVE_Header[0x2C] =
 #define MODE_NONE	0xFF
 
 
-typedef struct _rom_data
+typedef struct _rom_file
 {
+	FILE* hFile;
+	UINT32 BaseOfs;	// offset of the file within the merged ROM
 	UINT32 Size;
-	UINT8* Data;
-} ROM_DATA;
+} ROM_FILE;
+
+// The sample ROMs are tens of MB large, but only a part of them is used by the instruments.
+// So they are read (and byteswapped) in 64 KB pages when they are accessed for the first time.
+// Note: The buffer for the whole ROM is still allocated, so that accessed ranges can span pages.
+//       Only pages that are loaded get written to, so with large allocations (which are taken
+//       from the OS directly) the physical memory of the unused pages is saved as well.
+#define ROM_PAGE_BITS	16
+#define ROM_PAGE_SIZE	(1 << ROM_PAGE_BITS)
+typedef struct _paged_rom
+{
+	UINT32 Size;
+	UINT8* Data;		// buffer for the whole ROM (allocated at once), filled on demand
+	UINT8* PageState;	// 00 - not loaded, 01 - loaded
+	UINT8 Byteswap;		// swap bytes when loading pages
+	size_t FileCount;
+	ROM_FILE* Files;
+} PAGED_ROM;
 
 typedef struct _sample_def
 {
@@ -122,9 +150,94 @@ typedef struct _sample_def
 	UINT16 SusLvl;	// Sustain Level
 } SMPL_DEF;
 
+typedef struct _wav_job
+{
+	char* FileName;
+	const UINT8* SmplPtr;	// sample data (already loaded from the ROM)
+	UINT32 SmplLen;
+	UINT32 SmplRate;
+	UINT16 SmplID;
+	size_t NextJob;			// next job that uses the same sample (WAV_NO_JOB = none)
+	UINT8 Result;			// 00 - OK, 80 - out of memory, FF - error opening the file
+} WAV_JOB;
+
+#define WAV_NO_JOB	((size_t)-1)
+typedef struct _wav_plan
+{
+	size_t JobCnt;
+	size_t JobAlloc;
+	WAV_JOB* Jobs;
+	size_t* SmplJob;	// first job of each sample, which converts the data for all jobs in its list
+	UINT32 MaxSmplLen;
+} WAV_PLAN;
+
+// The decoded instrument bank is a single memory block that can be written to a file as-is.
+// Layout: BANK_HEADER, BANK_SMPL[SmplCnt], BANK_INS[InsCnt], BANK_ZONE[ZoneCnt]
+// Note: The data is stored in native byte order.
+#define BANK_SIG	0x42443250	// 'P2DB'
+#define BANK_VER	0x0102
+typedef struct _bank_header
+{
+	UINT32 Signature;
+	UINT16 Version;
+	UINT16 HdrSize;
+	UINT64 ROMHash;		// hash of the sound program ROM
+	UINT32 SmpROMSize;	// size of all sample ROMs
+	UINT32 SmplCnt;
+	UINT32 InsCnt;
+	UINT32 ZoneCnt;
+} BANK_HEADER;
+
+#define BSMPL_VALID	0x01	// sample data is within the sample ROM
+#define BSMPL_LOOP	0x02
+typedef struct _bank_sample
+{
+	UINT32 Start;
+	UINT32 Len;
+	UINT32 LoopSt;
+	UINT32 LoopLen;
+	UINT32 Flags;
+} BANK_SMPL;
+
+#define BINS_DRUM	0x01
+typedef struct _bank_instrument
+{
+	UINT32 FirstZone;
+	UINT16 ZoneCnt;
+	UINT8 Flags;
+	UINT8 Reserved;
+} BANK_INS;
+
+typedef struct _bank_zone
+{
+	SMPL_DEF Def;		// converted to SF2 scale
+	UINT16 RawSmplID;	// sample ID from the instrument data (unchecked)
+	UINT8 Note;			// drums: note, melody: highest note of the zone
+	UINT8 FreqMod;
+} BANK_ZONE;
+
+typedef struct _decoded_bank
+{
+	UINT32 Size;
+	UINT8* Data;
+	BANK_HEADER* Hdr;
+	BANK_SMPL* Smpls;
+	BANK_INS* Ins;
+	BANK_ZONE* Zones;
+} DECODED_BANK;
+
+typedef struct _wav_worker
+{
+	OS_THREAD Thread;
+	WAV_PLAN* Plan;
+	size_t FirstJob;
+	size_t JobStep;
+} WAV_WORKER;
+
 static UINT32 ROMSize;
 static UINT8* ROMData;
-static ROM_DATA SmpROM;
+static PAGED_ROM SmpROM;
+static DECODED_BANK Bank;
 static UINT32 MidSize;
 static UINT8* MidData;
 
@@ -136,6 +249,8 @@ static UINT8 PatchDrumChn = 0;	// swap MIDI channels 0F and 09
 static UINT16 NUM_LOOPS = 2;
 static UINT32 GLOBAL_PTR_OFS = 0x008000;
 static const char* OUT_PREFIX = NULL;
+static UINT32 NumThreads = 0;	// 0 = number of CPUs
+static const char* BANK_FILE = NULL;
 static UINT8 Mode;
 
 #define SMPL_DATA_ID	0x00	// Offset 0x008000
@@ -179,6 +294,9 @@ int main(int argc, char* argv[])
 		printf("                0 - don't cut (default)\n");
 		printf("                1 - stop when replaying note or when segment ends\n");
 		printf("                2 - stop immediately\n");
+		printf("    -j n    use n threads for sample extraction (default: number of CPUs)\n");
+		printf("    -b file cache the decoded instrument bank in this file\n");
+		printf("            (It is used by wav/sf2 modes when the ROMs match.)\n");
 		printf("\n");
 		printf("The sound program ROM is the file loaded into the \"audiocpu\" region in MAME.\n");
 		printf("It is often called epr-XXXXX.30 or epr-XXXXX.31\n");
@@ -222,6 +340,18 @@ int main(int argc, char* argv[])
 			if (argbase < argc)
 				FixDrumNotes = (UINT8)strtoul(argv[argbase], NULL, 0);
 		}
+		else if (! stricmp(argv[argbase] + 1, "j"))
+		{
+			argbase ++;
+			if (argbase < argc)
+				NumThreads = (UINT32)strtoul(argv[argbase], NULL, 0);
+		}
+		else if (! stricmp(argv[argbase] + 1, "b"))
+		{
+			argbase ++;
+			if (argbase < argc)
+				BANK_FILE = argv[argbase];
+		}
 		else
 			break;
 		argbase ++;
@@ -244,6 +374,7 @@ int main(int argc, char* argv[])
 		printf("Invalid mode!\n");
 		return 1;
 	}
+	SCSP_InitTables(VELOC_DATA);
 	
 	retVal = LoadROMData(argv[argbase + 1], &ROMSize, &ROMData);
 	if (retVal > 0x00)
@@ -261,7 +392,12 @@ int main(int argc, char* argv[])
 			return 2;
 		}
 		
-		LoadROMsMerged(argc - (argbase + 2), (const char**)&argv[argbase + 2], &SmpROM.Size, &SmpROM.Data);
+		retVal = OpenROMsPaged(argc - (argbase + 2), (const char**)&argv[argbase + 2], &SmpROM);
+		if (retVal == 0xFF)
+		{
+			free(ROMData);
+			return 2;
+		}
 	}
 	
 	if (ReadBE16(&ROMData[0x04]) == 0x6000)
@@ -276,10 +412,9 @@ int main(int argc, char* argv[])
 		
 		if (SmpROM.Size > 0x00)
 		{
-			printf("    Sample ROM ...");
-			fflush(stdout);
-			RomByteswap(SmpROM.Size, SmpROM.Data);
-			printf("  Done.\n");
+			// sample ROM pages are swapped when they are loaded
+			printf("    Sample ROM ...  (deferred)\n");
+			SmpROM.Byteswap = 1;
 		}
 	}
 	
@@ -295,12 +430,23 @@ int main(int argc, char* argv[])
 	if (driverVer != 2)
 	{
 		printf("Unsupported sound driver version!\n");
-		if (SmpROM.Data != NULL)
-			free(SmpROM.Data);
+		ClosePagedROM(&SmpROM);
 		free(ROMData);
 		return 3;
 	}
 	
+	if (Mode & 0x10)
+	{
+		retVal = PrepareBank(BANK_FILE);
+		if (retVal)
+		{
+			printf("Error decoding the instrument bank!\n");
+			ClosePagedROM(&SmpROM);
+			free(ROMData);
+			return 4;
+		}
+	}
+	
 	switch(Mode)
 	{
 	case MODE_MIDI:
@@ -340,6 +486,8 @@ int main(int argc, char* argv[])
 		if (OUT_PREFIX == NULL)
 			OUT_PREFIX = "";
 		
+		if (! NumThreads)
+			NumThreads = Thread_GetCPUCount();
 		printf("Extracting Samples to .wav format ...");
 		fflush(stdout);
 		ExtractInstrumentSamples(OUT_PREFIX);
@@ -360,8 +508,8 @@ int main(int argc, char* argv[])
 	}
 	printf("  Done.\n");
 	
-	if (SmpROM.Data != NULL)
-		free(SmpROM.Data);
+	FreeBank(&Bank);
+	ClosePagedROM(&SmpROM);
 	free(ROMData);
 	
 #ifdef _DEBUG
@@ -400,64 +548,153 @@ static UINT8 LoadROMData(const char* FileName, UINT32* retSize, UINT8** retData)
 	return 0x00;
 }
 
-static UINT8 LoadROMsMerged(size_t romCount, const char** fileNames, UINT32* retSize, UINT8** retData)
+static UINT8 OpenROMsPaged(size_t romCount, const char** fileNames, PAGED_ROM* pRom)
 {
-	ROM_DATA* tmpROM;
+	ROM_FILE* curFile;
 	size_t curROM;
-	UINT32 baseOfs;
+	UINT32 pageCnt;
+	long fileSize;
 	UINT8 resVal;
-	UINT8 retVal;
 	
 	resVal = 0x00;
+	memset(pRom, 0x00, sizeof(PAGED_ROM));
 	
-	tmpROM = (ROM_DATA*)calloc(romCount, sizeof(ROM_DATA));
+	pRom->Files = (ROM_FILE*)calloc(romCount, sizeof(ROM_FILE));
+	if (pRom->Files == NULL)
+		return 0xFF;
 	for (curROM = 0; curROM < romCount; curROM ++)
 	{
-		retVal = LoadROMData(fileNames[curROM], &tmpROM[curROM].Size, &tmpROM[curROM].Data);
-		if (retVal > 0x00)
+		curFile = &pRom->Files[curROM];
+		curFile->hFile = fopen(fileNames[curROM], "rb");
+		if (curFile->hFile == NULL)
 		{
 			printf("Unable to load Sample ROM: %s\n", fileNames[curROM]);
 			resVal = 0x01;	// error loading one or more ROMs
 			break;
 		}
+		
+		fileSize = -1;
+		if (! fseek(curFile->hFile, 0, SEEK_END))
+			fileSize = ftell(curFile->hFile);
+		if (fileSize < 0 || (unsigned long)fileSize > 0xFFFFFFFFUL - pRom->Size)
+		{
+			printf("Unable to load Sample ROM: %s\n", fileNames[curROM]);
+			fclose(curFile->hFile);
+			curFile->hFile = NULL;
+			resVal = 0x01;
+			break;
+		}
+		curFile->Size = (UINT32)fileSize;
+		curFile->BaseOfs = pRom->Size;
+		pRom->Size += curFile->Size;
 	}
+	pRom->FileCount = curROM;
 	if (resVal && curROM == 0)
 	{
-		free(tmpROM);
+		ClosePagedROM(pRom);
 		return 0xFF;	// load fail for first ROM
 	}
-	for (curROM = 1; curROM < romCount; curROM ++)
+	for (curROM = 1; curROM < pRom->FileCount; curROM ++)
 	{
-		if (tmpROM[curROM].Size != tmpROM[0].Size)
+		if (pRom->Files[curROM].Size != pRom->Files[0].Size)
 		{
 			printf("Warning: Sample ROMs have different sizes!\n");
 			break;
 		}
 	}
 	
-	*retSize = 0x00;
-	for (curROM = 0; curROM < romCount; curROM ++)
-		*retSize += tmpROM[curROM].Size;
-	*retData = (UINT8*)malloc(*retSize);
+	if (! pRom->Size)
+	{
+		printf("The Sample ROMs are empty!\n");
+		ClosePagedROM(pRom);
+		return 0xFF;
+	}
 	
-	baseOfs = 0x00;
-	for (curROM = 0; curROM < romCount; curROM ++)
+	pageCnt = (pRom->Size >> ROM_PAGE_BITS) + ((pRom->Size & (ROM_PAGE_SIZE - 1)) ? 1 : 0);
+	pRom->Data = (UINT8*)malloc(pRom->Size);
+	pRom->PageState = (UINT8*)calloc(pageCnt, sizeof(UINT8));
+	if (pRom->Data == NULL || pRom->PageState == NULL)
 	{
-		memcpy(&(*retData)[baseOfs], tmpROM[curROM].Data, tmpROM[curROM].Size);
-		baseOfs += tmpROM[curROM].Size;
-		free(tmpROM[curROM].Data);
+		printf("Not enough memory for the Sample ROMs!\n");
+		ClosePagedROM(pRom);
+		return 0xFF;
 	}
-	free(tmpROM);
 	
 	return resVal;
 }
 
+static void ClosePagedROM(PAGED_ROM* pRom)
+{
+	size_t curROM;
+	
+	for (curROM = 0; curROM < pRom->FileCount; curROM ++)
+		fclose(pRom->Files[curROM].hFile);
+	free(pRom->Files);	pRom->Files = NULL;
+	free(pRom->PageState);	pRom->PageState = NULL;
+	free(pRom->Data);	pRom->Data = NULL;
+	pRom->FileCount = 0;
+	pRom->Size = 0x00;
+	
+	return;
+}
+
+static UINT8 PagedROM_Load(PAGED_ROM* pRom, UINT32 Offset, UINT32 Length)
+{
+	UINT32 curPage;
+	UINT32 lastPage;
+	UINT32 pageStart;
+	UINT32 pageEnd;
+	UINT32 readStart;
+	UINT32 readEnd;
+	size_t curROM;
+	const ROM_FILE* curFile;
+	
+	if (Offset >= pRom->Size || Length > pRom->Size - Offset)
+		return 0xFF;	// out of range
+	if (! Length)
+		return 0x00;
+	
+	lastPage = (Offset + Length - 1) >> ROM_PAGE_BITS;
+	for (curPage = Offset >> ROM_PAGE_BITS; curPage <= lastPage; curPage ++)
+	{
+		if (pRom->PageState[curPage])
+			continue;
+		
+		pageStart = curPage << ROM_PAGE_BITS;
+		pageEnd = pageStart + ROM_PAGE_SIZE;
+		if (pageEnd > pRom->Size)
+			pageEnd = pRom->Size;
+		// a page may span multiple files
+		for (curROM = 0; curROM < pRom->FileCount; curROM ++)
+		{
+			curFile = &pRom->Files[curROM];
+			readStart = (pageStart > curFile->BaseOfs) ? pageStart : curFile->BaseOfs;
+			readEnd = curFile->BaseOfs + curFile->Size;
+			if (readEnd > pageEnd)
+				readEnd = pageEnd;
+			if (readStart >= readEnd)
+				continue;
+			
+			if (fseek(curFile->hFile, readStart - curFile->BaseOfs, SEEK_SET))
+				return 0xFF;	// read error - the page stays unloaded
+			if (fread(&pRom->Data[readStart], 0x01, readEnd - readStart, curFile->hFile) != readEnd - readStart)
+				return 0xFF;
+		}
+		// pages start at even offsets, so swapping them separately works fine
+		if (pRom->Byteswap)
+			RomByteswap(pageEnd - pageStart, &pRom->Data[pageStart]);
+		pRom->PageState[curPage] = 0x01;
+	}
+	
+	return 0x00;
+}
+
 static void RomByteswap(UINT32 Size, UINT8* Data)
 {
 	UINT32 CurPos;
 	UINT8 TempByt;
 	
-	for (CurPos = 0x00; CurPos < Size; CurPos += 0x02)
+	for (CurPos = 0x00; CurPos + 0x01 < Size; CurPos += 0x02)
 	{
 		TempByt = Data[CurPos + 0x00];
 		Data[CurPos + 0x00] = Data[CurPos + 0x01];
@@ -517,6 +754,7 @@ static void CreateDirTree(const char* dirPath)
 		*dirSepPos = bakChr;
 		dirSepPos = strchr(dirSepPos + 1, '/');
 	}
+	free(tempPath);
 	
 	return;
 }
@@ -527,8 +765,30 @@ INLINE UINT32 GetGlobalPtr(UINT32 PtrID)
 	return ReadBE24(&ROMData[GLOBAL_PTR_OFS + PtrID * 0x04]);
 }
 
-INLINE const UINT8* GetRomPtr(UINT32 Address)
+INLINE UINT8 CheckRomRange(UINT32 Address, UINT32 Length)
 {
+	UINT32 Offset;
+	
+	switch((Address & 0xE00000) >> 16)
+	{
+	case 0x60:
+		Offset = Address & 0x1FFFFF;
+		return (Offset >= ROMSize || Length > ROMSize - Offset) ? 0xFF : 0x00;
+	case 0x80:
+	case 0xA0:
+	case 0xC0:
+	case 0xE0:
+		Offset = Address & 0x7FFFFF;
+		return (Offset >= SmpROM.Size || Length > SmpROM.Size - Offset) ? 0xFF : 0x00;
+	default:
+		return 0xFF;
+	}
+}
+
+INLINE const UINT8* GetRomPtr(UINT32 Address, UINT32 Length)
+{
+	UINT32 Offset;
+	
 	switch((Address & 0xE00000) >> 16)
 	{
 	/*case 0x00:
@@ -536,12 +796,19 @@ INLINE const UINT8* GetRomPtr(UINT32 Address)
 	case 0x40:
 		return NULL;*/
 	case 0x60:
-		return ROMData;
+		Offset = Address & 0x1FFFFF;
+		if (Offset >= ROMSize || Length > ROMSize - Offset)
+			return NULL;
+		return &ROMData[Offset];
 	case 0x80:
 	case 0xA0:
 	case 0xC0:
 	case 0xE0:
-		return &SmpROM.Data[Address & 0x600000];
+		// bank (bits 21-22) + offset (bits 0-20)
+		Offset = Address & 0x7FFFFF;
+		if (PagedROM_Load(&SmpROM, Offset, Length))
+			return NULL;
+		return &SmpROM.Data[Offset];
 	default:
 		return NULL;
 	}
@@ -774,7 +1041,7 @@ static UINT32 DecodeMidiSegment(UINT32 ROMStPos, UINT32 MidStPos)
 			if ((LastCmd & 0xF0) == 0xB0)
 			{
 				if (Param1 == 0x07 && FixVolume)
-					TempByt = TrkVol2MidiVol(TempByt);
+					TempByt = SCSP_Vol2Mid[TempByt];
 			}
 			MidData[MidPos] = TempByt;
 			CurPos ++;	MidPos ++;
@@ -820,7 +1087,7 @@ static UINT32 DecodeMidiSegment(UINT32 ROMStPos, UINT32 MidStPos)
 			}
 			
 			if (FixVolume)
-				TempByt = NoteVel2MidiVol(TempByt);
+				TempByt = SCSP_Vel2Mid[TempByt];
 			MidData[MidPos] = TempByt;
 			CurPos ++;	MidPos ++;
 			
@@ -1015,7 +1282,7 @@ static UINT32 DoCommandA0(UINT32 MidStPos, UINT8 Command, UINT8 Arg1, UINT8 Arg2
 			
 			TempByt = ROMData[CurPos + 0x03] / 2;
 			if (FixVolume)
-				TempByt = TrkVol2MidiVol(TempByt);
+				TempByt = SCSP_Vol2Mid[TempByt];
 			MidData[MidPos] = 0x00;				MidPos ++;
 			MidData[MidPos] = 0xB0 | MidChn;	MidPos ++;
 			MidData[MidPos] = 0x07;				MidPos ++;
@@ -1047,50 +1314,6 @@ static UINT32 DoCommandA0(UINT32 MidStPos, UINT8 Command, UINT8 Arg1, UINT8 Arg2
 }
 
 
-INLINE UINT8 TrkVol2MidiVol(UINT8 Volume)
-{
-	// Volume is 00..7F
-	// The driver scales it up to 00 (min) to FF (max). One step is 0.1875 db.
-	// So the non-scaled volume uses 0.375 db steps.
-	UINT8 DBVal;
-	float DBFlt;
-	
-	if (! Volume)
-		return 0x00;
-	
-	DBVal = Volume ^ 0x7F;	// 00..7F -> 7F..00
-	DBFlt = DBVal * -0.375f;
-	return DB2MidiVol(DBFlt);
-}
-
-INLINE UINT8 NoteVel2MidiVol(UINT8 Velocity)
-{
-	UINT8 DBVal;
-	float DBFlt;
-	
-	if (! Velocity)
-		return 0x00;
-	
-	DBVal = VELOC_DATA[Velocity & 0x7F];
-	// Every entry in the table has bit 0 set, so
-	// I'll scale it down to 00..7F here.
-	DBVal = (DBVal >> 1) ^ 0x7F;
-	DBFlt = DBVal * -0.375f;
-	return DB2MidiVol(DBFlt);
-}
-
-INLINE UINT8 DB2MidiVol(float DB)
-{
-	float TempSng;
-	
-	TempSng = (float)pow(10.0, DB / 40.0);
-	if (TempSng > 1.0f)
-		TempSng = 1.0f;
-	return (UINT8)(TempSng * 0x7F + 0.5);
-}
-
-
-
 INLINE UINT16 ReadBE16(const UINT8* Data)
 {
 	return (Data[0x00] << 8) | (Data[0x01] << 0);
@@ -1126,88 +1349,429 @@ INLINE void WriteBE32(UINT8* Buffer, UINT32 Value)
 }
 
 
-static void ExtractInstrumentSamples(const char* fNamePrefix)
+static UINT8 PrepareBank(const char* FileName)
 {
-	// TODO: just extract all samples once (instead of per-instrument) while still using the "base note" from instrument data
-	UINT32 InsBasePtr;
-	UINT32 CurPos;
-	UINT16 InsCnt;
-	UINT16 CurIns;
-	UINT8 CurNote;
-	UINT8 MaxNote;
-	UINT16 SmplID;
-	char* FileName;
-	const char* fnPrefExt;
+	UINT64 ROMHash;
+	UINT8 RetVal;
 	
-	fnPrefExt = IsUpperCase(fNamePrefix) ? "WAV" : "wav";
-	FileName = (char*)malloc(strlen(fNamePrefix) + 0x20);
+	// The decoded bank depends only on the program ROM and the size of the sample ROMs,
+	// so the sample ROMs are not hashed. (That would make every page resident.)
+	ROMHash = ROMCache_Hash(ROMSize, ROMData);
+	if (FileName != NULL)
+	{
+		RetVal = LoadBankCache(FileName, ROMHash, &Bank);
+		if (! RetVal)
+		{
+			printf("Using cached instrument bank %s.\n", FileName);
+			return 0x00;
+		}
+		else if (RetVal == 0x80)
+			printf("Instrument bank %s is invalid. Decoding again.\n", FileName);
+	}
 	
-	CreateDirTree(fNamePrefix);
+	RetVal = DecodeBank(ROMHash, &Bank);
+	if (RetVal)
+		return RetVal;
 	
-	InsBasePtr = GetGlobalPtr(INS_DATA_ID) & 0x7FFFF;
+	if (FileName != NULL)
+	{
+		RetVal = SaveBankCache(FileName, &Bank);
+		if (RetVal)
+			printf("Error writing instrument bank %s!\n", FileName);
+	}
 	
-	InsCnt = ReadBE16(&ROMData[InsBasePtr]) + 0x01;
-	for (CurIns = 0x00; CurIns < InsCnt; CurIns ++)
+	return 0x00;
+}
+
+static void SetBankPointers(DECODED_BANK* Bank)
+{
+	UINT8* DataPtr;
+	
+	DataPtr = Bank->Data;
+	Bank->Hdr = (BANK_HEADER*)DataPtr;		DataPtr += sizeof(BANK_HEADER);
+	Bank->Smpls = (BANK_SMPL*)DataPtr;		DataPtr += sizeof(BANK_SMPL) * Bank->Hdr->SmplCnt;
+	Bank->Ins = (BANK_INS*)DataPtr;			DataPtr += sizeof(BANK_INS) * Bank->Hdr->InsCnt;
+	Bank->Zones = (BANK_ZONE*)DataPtr;		DataPtr += sizeof(BANK_ZONE) * Bank->Hdr->ZoneCnt;
+	
+	return;
+}
+
+INLINE UINT32 GetBankSize(const BANK_HEADER* Hdr)
+{
+	return sizeof(BANK_HEADER) + sizeof(BANK_SMPL) * Hdr->SmplCnt +
+			sizeof(BANK_INS) * Hdr->InsCnt + sizeof(BANK_ZONE) * Hdr->ZoneCnt;
+}
+
+static UINT8 DecodeBank(UINT64 ROMHash, DECODED_BANK* Bank)
+{
+	BANK_HEADER TempHdr;
+	UINT32 SmplBase;
+	UINT32 InsBase;
+	UINT32 CurPos;
+	UINT32 CurSmpl;
+	UINT32 CurIns;
+	UINT32 ZoneCnt;
+	UINT16 CurNote;	// 16-bit to prevent endless loops with MaxNote = 0xFF
+	UINT16 MaxNote;
+	UINT8 LastNote;
+	UINT8* LoopMask;
+	BANK_SMPL* TempSmpl;
+	BANK_INS* TempIns;
+	BANK_ZONE* TempZone;
+	
+	memset(&TempHdr, 0x00, sizeof(BANK_HEADER));
+	TempHdr.Signature = BANK_SIG;
+	TempHdr.Version = BANK_VER;
+	TempHdr.HdrSize = sizeof(BANK_HEADER);
+	TempHdr.ROMHash = ROMHash;
+	TempHdr.SmpROMSize = SmpROM.Size;
+	
+	SmplBase = GetGlobalPtr(SMPL_DATA_ID) & 0x7FFFF;
+	TempHdr.SmplCnt = (ReadBE16(&ROMData[SmplBase]) + 0x01) / 0x10;	// the counter is given in number of bytes, not samples
+	SmplBase += 0x02;
+	
+	InsBase = GetGlobalPtr(INS_DATA_ID) & 0x7FFFF;
+	TempHdr.InsCnt = ReadBE16(&ROMData[InsBase]) + 0x01;
+	
+	// count all zones, so that the whole bank fits into one block
+	ZoneCnt = 0;
+	for (CurIns = 0x00; CurIns < TempHdr.InsCnt; CurIns ++)
+	{
+		CurPos = InsBase + ReadBE16(&ROMData[InsBase + 0x02 + CurIns * 0x02]);
+		if (ROMData[CurPos] & 0x80)
+		{
+			CurNote = ROMData[CurPos + 0x02];
+			MaxNote = ROMData[CurPos + 0x03];
+			if (CurNote <= MaxNote)
+				ZoneCnt += MaxNote - CurNote + 1;
+		}
+		else
+		{
+			do
+			{
+				CurNote = ROMData[CurPos + 0x00];
+				ZoneCnt ++;
+				CurPos += 0x0A;
+			} while(CurNote < 0x7F);
+		}
+	}
+	TempHdr.ZoneCnt = ZoneCnt;
+	
+	Bank->Size = GetBankSize(&TempHdr);
+	Bank->Data = (UINT8*)calloc(Bank->Size, 0x01);
+	if (Bank->Data == NULL)
+		return 0xFF;
+	memcpy(Bank->Data, &TempHdr, sizeof(BANK_HEADER));
+	SetBankPointers(Bank);
+	
+	// read the sample table
+	LoopMask = (UINT8*)calloc((TempHdr.SmplCnt + 0x07) / 0x08, 0x01);
+	CurPos = SmplBase;
+	for (CurSmpl = 0x00; CurSmpl < TempHdr.SmplCnt; CurSmpl ++, CurPos += 0x10)
+	{
+		TempSmpl = &Bank->Smpls[CurSmpl];
+		TempSmpl->Start =	ReadBE24(&ROMData[CurPos + 0x00]);
+		TempSmpl->Len =		ReadBE24(&ROMData[CurPos + 0x04]);
+		TempSmpl->LoopSt =	ReadBE24(&ROMData[CurPos + 0x08]);
+		TempSmpl->LoopLen =	ReadBE24(&ROMData[CurPos + 0x0C]);
+		TempSmpl->Flags = 0x00;
+		if (! CheckRomRange(TempSmpl->Start, TempSmpl->Len))
+		{
+			TempSmpl->Flags |= BSMPL_VALID;
+			if (TempSmpl->Len && TempSmpl->LoopLen)
+			{
+				TempSmpl->Flags |= BSMPL_LOOP;
+				LoopMask[CurSmpl >> 3] |= 1 << (CurSmpl & 0x07);
+			}
+		}
+	}
+	
+	// read all instruments
+	TempZone = Bank->Zones;
+	for (CurIns = 0x00; CurIns < TempHdr.InsCnt; CurIns ++)
 	{
-		CurPos = InsBasePtr + ReadBE16(&ROMData[InsBasePtr + 0x02 + CurIns * 0x02]);
+		TempIns = &Bank->Ins[CurIns];
+		TempIns->FirstZone = (UINT32)(TempZone - Bank->Zones);
+		
+		CurPos = InsBase + ReadBE16(&ROMData[InsBase + 0x02 + CurIns * 0x02]);
 		if (ROMData[CurPos] & 0x80)
 		{
 			// Drum Mode
+			TempIns->Flags = BINS_DRUM;
 			CurNote = ROMData[CurPos + 0x02];
 			MaxNote = ROMData[CurPos + 0x03];
 			CurPos += 0x04;
-			for (; CurNote <= MaxNote; CurNote ++, CurPos += 0x0C)
+			for (; CurNote <= MaxNote; CurNote ++, CurPos += 0x0C, TempZone ++)
 			{
-				SmplID = ReadBE16(&ROMData[CurPos + 0x00]);
-				sprintf(FileName, "%sIns%02X_d%02X_Smpl%02X.%s", fNamePrefix, CurIns, CurNote, SmplID, fnPrefExt);
-				ExtractSample(FileName, SmplID, ROMData[CurPos + 0x02]);
+				ReadInsData(&ROMData[CurPos], 0xFF, (UINT8)CurNote, &TempZone->Def, TempHdr.SmplCnt, LoopMask);
+				TempZone->RawSmplID = ReadBE16(&ROMData[CurPos + 0x00]);
+				TempZone->Note = (UINT8)CurNote;
+				TempZone->FreqMod = ROMData[CurPos + 0x02];
 			}
 		}
 		else
 		{
 			// Melody Instrument Mode
+			TempIns->Flags = 0x00;
+			LastNote = 0x00;
 			do
 			{
 				CurNote = ROMData[CurPos + 0x00];
-				SmplID = ReadBE16(&ROMData[CurPos + 0x04]);
-				sprintf(FileName, "%sIns%02X_n%02X_Smpl%02X.%s", fNamePrefix, CurIns, CurNote, SmplID, fnPrefExt);
-				ExtractSample(FileName, SmplID, 0xF0);
+				ReadInsData(&ROMData[CurPos], LastNote, (UINT8)CurNote, &TempZone->Def, TempHdr.SmplCnt, LoopMask);
+				TempZone->RawSmplID = ReadBE16(&ROMData[CurPos + 0x04]);
+				TempZone->Note = (UINT8)CurNote;
+				TempZone->FreqMod = 0xF0;
 				
 				CurPos += 0x0A;
+				LastNote = (UINT8)CurNote + 1;
+				TempZone ++;
 			} while(CurNote < 0x7F);
 		}
+		TempIns->ZoneCnt = (UINT16)((TempZone - Bank->Zones) - TempIns->FirstZone);
 	}
+	free(LoopMask);
 	
+	return 0x00;
+}
+
+static UINT8 CheckBank(const DECODED_BANK* Bank)
+{
+	// The cache file may be damaged or come from a different version, so all indices are checked.
+	const BANK_HEADER* Hdr;
+	const BANK_SMPL* TempSmpl;
+	const BANK_INS* TempIns;
+	const BANK_ZONE* TempZone;
+	UINT32 CurIdx;
+	
+	Hdr = Bank->Hdr;
+	for (CurIdx = 0x00; CurIdx < Hdr->SmplCnt; CurIdx ++)
+	{
+		TempSmpl = &Bank->Smpls[CurIdx];
+		if (TempSmpl->Flags & ~(BSMPL_VALID | BSMPL_LOOP))
+			return 0xFF;
+		if ((TempSmpl->Flags & BSMPL_VALID) && CheckRomRange(TempSmpl->Start, TempSmpl->Len))
+			return 0xFF;
+	}
+	for (CurIdx = 0x00; CurIdx < Hdr->InsCnt; CurIdx ++)
+	{
+		TempIns = &Bank->Ins[CurIdx];
+		if (TempIns->Flags & ~BINS_DRUM)
+			return 0xFF;
+		if (TempIns->FirstZone > Hdr->ZoneCnt || TempIns->ZoneCnt > Hdr->ZoneCnt - TempIns->FirstZone)
+			return 0xFF;
+	}
+	for (CurIdx = 0x00; CurIdx < Hdr->ZoneCnt; CurIdx ++)
+	{
+		TempZone = &Bank->Zones[CurIdx];
+		// ReadInsData sets invalid sample IDs to 0
+		if (TempZone->Def.SmplID >= Hdr->SmplCnt && TempZone->Def.SmplID != 0)
+			return 0xFF;
+	}
+	
+	return 0x00;
+}
+
+static UINT8 LoadBankCache(const char* FileName, UINT64 ROMHash, DECODED_BANK* Bank)
+{
+	FILE* hFile;
+	BANK_HEADER TempHdr;
+	long FileSize;
+	
+	hFile = fopen(FileName, "rb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	if (fseek(hFile, 0, SEEK_END))
+	{
+		fclose(hFile);
+		return 0x80;
+	}
+	FileSize = ftell(hFile);
+	if (FileSize < 0 || fseek(hFile, 0, SEEK_SET) ||
+		fread(&TempHdr, sizeof(BANK_HEADER), 1, hFile) != 1)
+	{
+		fclose(hFile);
+		return 0x80;
+	}
+	// The limits follow from the 16-bit counters in the ROM and keep GetBankSize() from overflowing.
+	if (TempHdr.Signature != BANK_SIG || TempHdr.Version != BANK_VER ||
+		TempHdr.HdrSize != sizeof(BANK_HEADER) || TempHdr.SmplCnt > 0x1000 ||
+		TempHdr.InsCnt > 0x10000 || TempHdr.ZoneCnt > 0x1000000 ||
+		(UINT32)FileSize != GetBankSize(&TempHdr))
+	{
+		fclose(hFile);
+		return 0x80;	// invalid file
+	}
+	if (TempHdr.ROMHash != ROMHash || TempHdr.SmpROMSize != SmpROM.Size)
+	{
+		fclose(hFile);
+		return 0x01;	// bank for a different set of ROMs
+	}
+	
+	Bank->Size = (UINT32)FileSize;
+	Bank->Data = (UINT8*)malloc(Bank->Size);
+	if (Bank->Data == NULL || fseek(hFile, 0, SEEK_SET) ||
+		fread(Bank->Data, 0x01, Bank->Size, hFile) != Bank->Size)
+	{
+		fclose(hFile);
+		FreeBank(Bank);
+		return 0x80;
+	}
+	fclose(hFile);
+	SetBankPointers(Bank);
+	if (memcmp(Bank->Hdr, &TempHdr, sizeof(BANK_HEADER)) || CheckBank(Bank))
+	{
+		FreeBank(Bank);
+		return 0x80;
+	}
+	
+	return 0x00;
+}
+
+static UINT8 SaveBankCache(const char* FileName, const DECODED_BANK* Bank)
+{
+	FILE* hFile;
+	size_t WrtBytes;
+	
+	hFile = fopen(FileName, "wb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	WrtBytes = fwrite(Bank->Data, 0x01, Bank->Size, hFile);
+	fclose(hFile);
+	
+	return (WrtBytes == Bank->Size) ? 0x00 : 0x80;
+}
+
+static void FreeBank(DECODED_BANK* Bank)
+{
+	free(Bank->Data);
+	memset(Bank, 0x00, sizeof(DECODED_BANK));
+	
+	return;
+}
+
+
+static void ExtractInstrumentSamples(const char* fNamePrefix)
+{
+	UINT32 CurIns;
+	UINT32 CurZone;
+	const BANK_INS* TempIns;
+	const BANK_ZONE* TempZone;
+	char* FileName;
+	const char* fnPrefExt;
+	WAV_PLAN Plan;
+	WAV_WORKER* Workers;
+	UINT32 CurThr;
+	UINT32 StartedThr;
+	size_t CurJob;
+	UINT32 CurSmpl;
+	
+	fnPrefExt = IsUpperCase(fNamePrefix) ? "WAV" : "wav";
+	memset(&Plan, 0x00, sizeof(WAV_PLAN));
+	Plan.SmplJob = (size_t*)malloc((Bank.Hdr->SmplCnt + 1) * sizeof(size_t));
+	FileName = (char*)malloc(strlen(fNamePrefix) + 0x20);
+	if (Plan.SmplJob == NULL || FileName == NULL)
+	{
+		printf("Not enough memory to extract the samples!\n");
+		free(Plan.SmplJob);
+		free(FileName);
+		return;
+	}
+	for (CurSmpl = 0; CurSmpl < Bank.Hdr->SmplCnt; CurSmpl ++)
+		Plan.SmplJob[CurSmpl] = WAV_NO_JOB;
+	
+	// All files go into the same directory, so it needs to be created only once.
+	CreateDirTree(fNamePrefix);
+	
+	// Step 1: collect all samples to be written
+	// This is done by the main thread only, as it loads the sample ROM pages.
+	// Instruments share many samples, so every sample is converted once and written to all of its files.
+	for (CurIns = 0x00; CurIns < Bank.Hdr->InsCnt; CurIns ++)
+	{
+		TempIns = &Bank.Ins[CurIns];
+		for (CurZone = 0x00; CurZone < TempIns->ZoneCnt; CurZone ++)
+		{
+			TempZone = &Bank.Zones[TempIns->FirstZone + CurZone];
+			sprintf(FileName, "%sIns%02X_%c%02X_Smpl%02X.%s", fNamePrefix, CurIns,
+					(TempIns->Flags & BINS_DRUM) ? 'd' : 'n', TempZone->Note, TempZone->RawSmplID, fnPrefExt);
+			if (PlanSample(&Plan, FileName, TempZone->RawSmplID, TempZone->FreqMod))
+				break;
+		}
+		if (CurZone < TempIns->ZoneCnt)
+		{
+			printf("Not enough memory to extract all samples!\n");
+			break;
+		}
+	}
 	free(FileName);
 	
+	// Step 2: convert and write the samples using multiple threads
+	if (NumThreads > Plan.JobCnt)
+		NumThreads = (Plan.JobCnt > 0) ? (UINT32)Plan.JobCnt : 1;
+	Workers = (WAV_WORKER*)calloc(NumThreads, sizeof(WAV_WORKER));
+	if (Workers == NULL)
+	{
+		// No job was run, so the loop below only frees the file names.
+		printf("Not enough memory to extract the samples!\n");
+	}
+	else
+	{
+		for (CurThr = 0; CurThr < NumThreads; CurThr ++)
+		{
+			Workers[CurThr].Plan = &Plan;
+			Workers[CurThr].FirstJob = CurThr;
+			Workers[CurThr].JobStep = NumThreads;
+		}
+		for (StartedThr = 1; StartedThr < NumThreads; StartedThr ++)
+		{
+			if (Thread_Start(&Workers[StartedThr].Thread, &WaveWorker_Main, &Workers[StartedThr]))
+				break;
+		}
+		// Jobs of threads that couldn't be started are done by the main thread.
+		WaveWorker_Main(&Workers[0]);
+		for (CurThr = StartedThr; CurThr < NumThreads; CurThr ++)
+			WaveWorker_Main(&Workers[CurThr]);
+		for (CurThr = 1; CurThr < StartedThr; CurThr ++)
+			Thread_Join(&Workers[CurThr].Thread);
+		free(Workers);
+	}
+	
+	// report errors in the original order
+	for (CurJob = 0; CurJob < Plan.JobCnt; CurJob ++)
+	{
+		if (Plan.Jobs[CurJob].Result == 0xFF)
+			printf("Error opening %s!\n", Plan.Jobs[CurJob].FileName);
+		else if (Plan.Jobs[CurJob].Result)
+			printf("Error converting %s!\n", Plan.Jobs[CurJob].FileName);
+		free(Plan.Jobs[CurJob].FileName);
+	}
+	free(Plan.Jobs);
+	free(Plan.SmplJob);
+	
 	return;
 }
 
-static void ExtractSample(const char* FileName, UINT16 SmplID, UINT8 FreqMod)
+// Returns 0x00 on success (also for skipped samples) and 0xFF when running out of memory.
+static UINT8 PlanSample(WAV_PLAN* Plan, const char* FileName, UINT16 SmplID, UINT8 FreqMod)
 {
-	UINT32 SmplBasePtr;
-	UINT32 SmplStart;
-	UINT32 SmplLen;
-	UINT32 SmplLoopSt;
-	UINT32 SmplLoopLen;
+	const BANK_SMPL* TempSmpl;
 	const UINT8* SmplPtr;
-	FILE* hFile;
-	UINT32 TempLng;
+	UINT32 SmplLen;
 	UINT32 SmplRate;
+	WAV_JOB* NewJobs;
+	WAV_JOB* Job;
+	size_t FirstJob;
 	
 	if (SmplID == 0xFFFF)
-		return;
-	
-	SmplBasePtr = GetGlobalPtr(SMPL_DATA_ID) & 0x7FFFF;
-	TempLng = (ReadBE16(&ROMData[SmplBasePtr]) + 1) / 0x10;
-	if (SmplID >= TempLng)
-		return;
-	SmplBasePtr += 0x02 + SmplID * 0x10;
+		return 0x00;
 	
-	SmplStart =		ReadBE24(&ROMData[SmplBasePtr + 0x00]);
-	SmplLen =		ReadBE24(&ROMData[SmplBasePtr + 0x04]);
-	SmplLoopSt =	ReadBE24(&ROMData[SmplBasePtr + 0x08]);
-	SmplLoopLen =	ReadBE24(&ROMData[SmplBasePtr + 0x0C]);
+	if (SmplID >= Bank.Hdr->SmplCnt)
+		return 0x00;
+	TempSmpl = &Bank.Smpls[SmplID];
+	if (! (TempSmpl->Flags & BSMPL_VALID))
+		return 0x00;
+	SmplLen = TempSmpl->Len;
 	
 	SmplRate = 44100;
 	if (FreqMod & 0x80)
@@ -1229,68 +1793,133 @@ static void ExtractSample(const char* FileName, UINT16 SmplID, UINT8 FreqMod)
 		}
 	}
 	
-	SmplPtr = GetRomPtr(SmplStart);
+	SmplPtr = GetRomPtr(TempSmpl->Start, SmplLen);
 	if (SmplPtr == NULL)
-		return;
-	SmplPtr += (SmplStart & 0x1FFFFF);
+		return 0x00;
 	//SmplLen += 0x202;	// Melody samples seem to be a bit longer
 	
-	hFile = fopen(FileName, "wb");
-	if (hFile == NULL)
+	if (Plan->JobCnt >= Plan->JobAlloc)
 	{
-		printf("Error opening %s!\n", FileName);
-		return;
+		size_t NewAlloc = Plan->JobAlloc ? (Plan->JobAlloc * 2) : 0x100;
+		
+		NewJobs = (WAV_JOB*)realloc(Plan->Jobs, NewAlloc * sizeof(WAV_JOB));
+		if (NewJobs == NULL)
+			return 0xFF;
+		Plan->Jobs = NewJobs;
+		Plan->JobAlloc = NewAlloc;
 	}
-	
-	if (0)
+	Job = &Plan->Jobs[Plan->JobCnt];
+	Job->FileName = strdup(FileName);
+	if (Job->FileName == NULL)
+		return 0xFF;
+	Job->SmplPtr = SmplPtr;
+	Job->SmplLen = SmplLen;
+	Job->SmplRate = SmplRate;
+	Job->SmplID = SmplID;
+	Job->Result = 0x00;
+	
+	// The first job of a sample keeps a list of all other jobs for it.
+	FirstJob = Plan->SmplJob[SmplID];
+	if (FirstJob == WAV_NO_JOB)
 	{
-		fwrite(SmplPtr, 0x01, SmplLen, hFile);
+		Job->NextJob = WAV_NO_JOB;
+		Plan->SmplJob[SmplID] = Plan->JobCnt;
 	}
 	else
 	{
-		UINT8* NewHead;
-		UINT8* NewData;
-		
-		NewHead = (UINT8*)malloc(0x2C);
-		memcpy(NewHead, WAVE_Header, 0x2C);
-		
-		TempLng = SmplLen + 0x24;
-		memcpy(&NewHead[0x04], &TempLng, 0x04);		// 'RIFF' chunk length
-		memcpy(&NewHead[0x18], &SmplRate, 0x04);	// Sample Rate
-		memcpy(&NewHead[0x1C], &SmplRate, 0x04);	// Bytes per Second
-		memcpy(&NewHead[0x28], &SmplLen, 0x04);		// 'data' chunk length
-		
-		NewData = (UINT8*)malloc(SmplLen);
-		for (TempLng = 0x00; TempLng < SmplLen; TempLng ++)
-			NewData[TempLng] = SmplPtr[TempLng] ^ 0x80;
+		Job->NextJob = Plan->Jobs[FirstJob].NextJob;
+		Plan->Jobs[FirstJob].NextJob = Plan->JobCnt;
+	}
+	Plan->JobCnt ++;
+	if (SmplLen > Plan->MaxSmplLen)
+		Plan->MaxSmplLen = SmplLen;
+	
+	return 0x00;
+}
+
+static void WaveWorker_Main(void* Param)
+{
+	WAV_WORKER* Wrk = (WAV_WORKER*)Param;
+	WAV_PLAN* Plan = Wrk->Plan;
+	size_t CurJob;
+	size_t FileJob;
+	const WAV_JOB* Job;
+	UINT32 CurPos;
+	UINT8* Buffer;
+	
+	// The buffer is allocated once and reused for all samples of this thread.
+	Buffer = (UINT8*)malloc(0x2C + Plan->MaxSmplLen);
+	for (CurJob = Wrk->FirstJob; CurJob < Plan->JobCnt; CurJob += Wrk->JobStep)
+	{
+		Job = &Plan->Jobs[CurJob];
+		if (Plan->SmplJob[Job->SmplID] != CurJob)
+			continue;	// The sample's first job writes this file.
 		
-		fwrite(NewHead, 0x01, 0x2C, hFile);
-		fwrite(NewData, 0x01, SmplLen, hFile);
-		free(NewData);
-		free(NewHead);
+		if (Buffer != NULL)
+		{
+			for (CurPos = 0x00; CurPos < Job->SmplLen; CurPos ++)
+				Buffer[0x2C + CurPos] = Job->SmplPtr[CurPos] ^ 0x80;	// signed -> unsigned
+		}
+		for (FileJob = CurJob; FileJob != WAV_NO_JOB; FileJob = Plan->Jobs[FileJob].NextJob)
+		{
+			if (Buffer == NULL)
+				Plan->Jobs[FileJob].Result = 0x80;
+			else
+				Plan->Jobs[FileJob].Result = WriteWaveFile(&Plan->Jobs[FileJob], Buffer);
+		}
 	}
+	free(Buffer);
 	
+	return;
+}
+
+// Buffer must contain the converted sample data at offset 0x2C. The header is written by this function.
+static UINT8 WriteWaveFile(const WAV_JOB* Job, UINT8* Buffer)
+{
+	FILE* hFile;
+	UINT32 TempLng;
+	
+	memcpy(Buffer, WAVE_Header, 0x2C);
+	TempLng = Job->SmplLen + 0x24;
+	memcpy(&Buffer[0x04], &TempLng, 0x04);			// 'RIFF' chunk length
+	memcpy(&Buffer[0x18], &Job->SmplRate, 0x04);	// Sample Rate
+	memcpy(&Buffer[0x1C], &Job->SmplRate, 0x04);	// Bytes per Second
+	memcpy(&Buffer[0x28], &Job->SmplLen, 0x04);		// 'data' chunk length
+	
+	hFile = fopen(Job->FileName, "wb");
+	if (hFile == NULL)
+		return 0xFF;
+	fwrite(Buffer, 0x01, 0x2C + Job->SmplLen, hFile);
 	fclose(hFile);
 	
-	return;
+	return 0x00;
 }
 
 
 static void CreateSoundfont(const char* FileName)
 {
 	SF2_DATA* SF2Data;
+	SF2_BUILDER* SF2Bld;
 	UINT16 SmplCnt;
 	UINT16 InsCnt;
-	UINT8* SmplLoopMask;
 	UINT8 DrumMask[0x10];
 	UINT8 RetVal;
 	
 	SF2Data = CreateSF2Base("SCSP Sound Bank");
+	SF2Bld = SF2Bld_Create();
 	
-	SmplCnt = GenerateSampleTable(SF2Data, &SmplLoopMask);
-	InsCnt = GenerateInstruments(SF2Data, SmplCnt, SmplLoopMask, DrumMask);
-	GeneratePresets(SF2Data, InsCnt, DrumMask);
-	free(SmplLoopMask);
+	SmplCnt = GenerateSampleTable(SF2Data);
+	InsCnt = GenerateInstruments(SF2Bld, DrumMask);
+	GeneratePresets(SF2Bld, InsCnt, DrumMask);
+	
+	RetVal = SF2Bld_Finalize(SF2Bld, SF2Data, SmplCnt);
+	SF2Bld_Free(SF2Bld);
+	if (RetVal)
+	{
+		printf("Error 0x%02X building instruments/presets!\n", RetVal);
+		FreeSF2Data(SF2Data);
+		return;
+	}
 	
 	SortSF2Chunks(SF2Data);
 	RetVal = WriteSF2toFile(SF2Data, FileName);
@@ -1301,12 +1930,11 @@ static void CreateSoundfont(const char* FileName)
 	return;
 }
 
-static UINT16 GenerateSampleTable(SF2_DATA* SF2Data, UINT8** RetLoopMsk)
+static UINT16 GenerateSampleTable(SF2_DATA* SF2Data)
 {
 	UINT16 SmplCnt;
 	UINT16 CurSmpl;
 	
-	UINT32 BasePtr;
 	UINT32 SmplDBSize;
 	INT16* SmplDB;
 	UINT32 SmplDBPos;
@@ -1314,50 +1942,31 @@ static UINT16 GenerateSampleTable(SF2_DATA* SF2Data, UINT8** RetLoopMsk)
 	sfSample* SmplHdrs;
 	sfSample* TempSHdr;
 	
-	UINT32 SmplStart;
-	UINT32 SmplLen;
-	UINT32 SmplLoopSt;
-	UINT32 SmplLoopLen;
+	const BANK_SMPL* BSmpl;
 	UINT32 CurPos;
 	const UINT8* SmplPtr;
 	
 	LIST_CHUNK* LstChk;
 	ITEM_CHUNK* ItmChk;
 	
-	BasePtr = GetGlobalPtr(SMPL_DATA_ID) & 0x7FFFF;
-	SmplCnt = ReadBE16(&ROMData[BasePtr]) + 0x01;
-	SmplCnt /= 0x10;	// the counter is given in number of bytes, not samples
-	BasePtr += 0x02;
+	SmplCnt = (UINT16)Bank.Hdr->SmplCnt;
 	
 	// Count all samples
-	CurPos = BasePtr + 0x04;	// Data+0x04 = Sample Length
 	SmplDBSize = 0x00;
-	for (CurSmpl = 0x00; CurSmpl < SmplCnt; CurSmpl ++, CurPos += 0x10)
-	{
-		SmplLen = ReadBE24(&ROMData[CurPos]);
-		//if (! SmplLen)
-		//	break;
-		SmplDBSize += SmplLen;
-	}
-	SmplCnt = CurSmpl;
+	for (CurSmpl = 0x00; CurSmpl < SmplCnt; CurSmpl ++)
+		SmplDBSize += Bank.Smpls[CurSmpl].Len;
 	// according to the SF2 spec., every sample MUST have 46 null-samples at the end.
 	SmplDBSize += SmplCnt * 46;
 	
 	SmplDB = (INT16*)malloc(SmplDBSize * 2);		// We have 8-bit, but need 16-bit samples.
 	SmplHdrSize = sizeof(sfSample) * (SmplCnt + 1);	// there's an EOS header
 	SmplHdrs = (sfSample*)malloc(SmplHdrSize);
-	CurPos = (SmplCnt + 0x07) / 0x08;
-	*RetLoopMsk = (UINT8*)malloc(CurPos);
-	memset(*RetLoopMsk, 0x00, CurPos);
 	
 	// fill Sample Structure and generate Sample Database
 	SmplDBPos = 0x00;
-	for (CurSmpl = 0x00; CurSmpl < SmplCnt; CurSmpl ++, BasePtr += 0x10)
+	for (CurSmpl = 0x00; CurSmpl < SmplCnt; CurSmpl ++)
 	{
-		SmplStart =		ReadBE24(&ROMData[BasePtr + 0x00]);
-		SmplLen =		ReadBE24(&ROMData[BasePtr + 0x04]);
-		SmplLoopSt =	ReadBE24(&ROMData[BasePtr + 0x08]);
-		SmplLoopLen =	ReadBE24(&ROMData[BasePtr + 0x0C]);
+		BSmpl = &Bank.Smpls[CurSmpl];
 		
 		TempSHdr = &SmplHdrs[CurSmpl];
 		memset(TempSHdr, 0x00, sizeof(sfSample));
@@ -1368,8 +1977,10 @@ static UINT16 GenerateSampleTable(SF2_DATA* SF2Data, UINT8** RetLoopMsk)
 		TempSHdr->wSampleLink = 0;
 		TempSHdr->sfSampleType = monoSample;
 		
-		SmplPtr = GetRomPtr(SmplStart);
-		if (SmplPtr == NULL || ! SmplLen)
+		SmplPtr = NULL;
+		if ((BSmpl->Flags & BSMPL_VALID) && BSmpl->Len)
+			SmplPtr = GetRomPtr(BSmpl->Start, BSmpl->Len);
+		if (SmplPtr == NULL)
 		{
 			sprintf(TempSHdr->achSampleName, "Sample %03X (null)", CurSmpl);
 			TempSHdr->dwEnd = SmplDBPos+1;
@@ -1378,17 +1989,13 @@ static UINT16 GenerateSampleTable(SF2_DATA* SF2Data, UINT8** RetLoopMsk)
 		}
 		else
 		{
-			SmplPtr += (SmplStart & 0x1FFFFF);
-			if (SmplLoopLen)
-				(*RetLoopMsk)[CurSmpl >> 3] |= 1 << (CurSmpl & 0x07);
-			
 			sprintf(TempSHdr->achSampleName, "Sample %03X", CurSmpl);
-			TempSHdr->dwEnd = SmplDBPos + SmplLen;
-			CurPos = SmplDBPos + (SmplLoopSt - SmplStart);
+			TempSHdr->dwEnd = SmplDBPos + BSmpl->Len;
+			CurPos = SmplDBPos + (BSmpl->LoopSt - BSmpl->Start);
 			TempSHdr->dwStartloop = CurPos;
-			TempSHdr->dwEndloop = CurPos + SmplLoopLen;
+			TempSHdr->dwEndloop = CurPos + BSmpl->LoopLen;
 			
-			for (CurPos = 0x00; CurPos < SmplLen; CurPos ++, SmplDBPos ++)
+			for (CurPos = 0x00; CurPos < BSmpl->Len; CurPos ++, SmplDBPos ++)
 				SmplDB[SmplDBPos] = SmplPtr[CurPos] << 8;	// 8-bit signed -> 16-bit signed
 		}
 		// add 46 null-samples
@@ -1401,10 +2008,6 @@ static UINT16 GenerateSampleTable(SF2_DATA* SF2Data, UINT8** RetLoopMsk)
 	memset(TempSHdr, 0x00, sizeof(sfSample));
 	strcpy(TempSHdr->achSampleName, "EOS");	// write "End Of Samples" header
 	
-	// Refresh Sample Count (we probably exited early)
-	SmplCnt = CurSmpl;
-	SmplHdrSize = sizeof(sfSample) * (SmplCnt + 1);
-	
 	// --- Add Chunks to SoundFont Data ---
 	LstChk = List_GetChunk(SF2Data->Lists, FCC_sdta);
 	ItmChk = Item_MakeChunk(FCC_smpl, SmplDBSize * 2, SmplDB, 0x00);
@@ -1418,96 +2021,43 @@ static UINT16 GenerateSampleTable(SF2_DATA* SF2Data, UINT8** RetLoopMsk)
 	return SmplCnt;
 }
 
-static UINT16 GenerateInstruments(SF2_DATA* SF2Data, UINT16 SmplCnt, const UINT8* LoopMsk, UINT8* RetDrmMask)
+static UINT16 GenerateInstruments(SF2_BUILDER* SF2Bld, UINT8* RetDrmMask)
 {
 	UINT16 InsCnt;
-	UINT16 InsAlloc;
 	UINT16 CurIns;
-	UINT32 BasePtr;
-	UINT32 CurPos;
-	
-	UINT32 DataSize;
-	sfInst* InsData;
-	sfInstBag* InsBags;
-	sfInstModList InsMod;
-	sfInstGenList* InsGen;
-	sfInstGenList* TempGen;
-	UINT16 InsBagCnt;
-	UINT16 InsBagAlloc;
-	UINT16 InsGenCnt;
-	UINT16 InsGenAlloc;
-	
-	UINT8 LastNote;
-	UINT8 CurNote;
-	UINT8 MaxNote;
-	SMPL_DEF SmplDef;
-	
-	LIST_CHUNK* LstChk;
-	ITEM_CHUNK* ItmChk;
+	UINT16 CurZone;
+	const BANK_INS* TempIns;
+	const BANK_ZONE* TempZone;
+	char InsName[0x20];
 	
-	BasePtr = GetGlobalPtr(INS_DATA_ID) & 0x7FFFF;
-	
-	InsCnt = ReadBE16(&ROMData[BasePtr]) + 0x01;
-	
-	InsAlloc = InsCnt + 1;
-	InsBagAlloc = InsAlloc * 2;
-	InsGenAlloc = InsBagAlloc * 3;
-	InsData = (sfInst*)malloc(sizeof(sfInst) * InsAlloc);
-	InsBags = (sfInstBag*)malloc(sizeof(sfInstBag) * InsBagAlloc);
-	//InsMod = (sfInstModList*)malloc(sizeof(sfInstModList) * 1);
-	InsGen = (sfInstGenList*)malloc(sizeof(sfInstGenList) * InsGenAlloc);
-	
-	InsBagCnt = 0;
-	InsGenCnt = 0;
+	InsCnt = (UINT16)Bank.Hdr->InsCnt;
 	for (CurIns = 0x00; CurIns < InsCnt; CurIns ++)
 	{
-		memset(&InsData[CurIns], 0x00, sizeof(sfInst));
-		sprintf(InsData[CurIns].achInstName, "Instrument %02X", CurIns);
-		InsData[CurIns].wInstBagNdx = InsBagCnt;
+		sprintf(InsName, "Instrument %02X", CurIns);
+		SF2Bld_AddInstrument(SF2Bld, InsName);
 		
-		// Instrument Generators format:
-		//	[keyRange]
-		//	[velRange]
-		//	... (more)
-		//	sampleID
-		CurPos = BasePtr + ReadBE16(&ROMData[BasePtr + 0x02 + CurIns * 0x02]);
-		if (ROMData[CurPos] & 0x80)
+		TempIns = &Bank.Ins[CurIns];
+		TempZone = &Bank.Zones[TempIns->FirstZone];
+		if (TempIns->Flags & BINS_DRUM)
 		{
 			// Drum Mode
 			RetDrmMask[CurIns >> 3] |= 1 << (CurIns & 0x07);
 			
 			// set Release Rate for drums
-			//AddInsBag(&InsBagAlloc, &InsBagCnt, &InsBags, InsGenCnt, 0);
+			//SF2Bld_AddInsZone(SF2Bld);
 			
 			// 10 seconds, 1200 * Log2(10) = 3986.31
-			//AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, releaseVolEnv, 3986);
+			//SF2Bld_AddInsGen_S16(SF2Bld, releaseVolEnv, 3986);
 			
-			CurNote = ROMData[CurPos + 0x02];
-			MaxNote = ROMData[CurPos + 0x03];
-			CurPos += 0x04;
-			for (; CurNote <= MaxNote; CurNote ++, CurPos += 0x0C)
+			for (CurZone = 0x00; CurZone < TempIns->ZoneCnt; CurZone ++, TempZone ++)
 			{
-				ReadInsData(&ROMData[CurPos], 0xFF, CurNote, &SmplDef, SmplCnt, LoopMsk);
-				
-				AddInsBag(&InsBagAlloc, &InsBagCnt, &InsBags, InsGenCnt, 0);
-				
-				AddInsGen_8(&InsGenAlloc, &InsGenCnt, &InsGen, keyRange, SmplDef.MinNote, SmplDef.MaxNote);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, overridingRootKey, SmplDef.RootNote);
-				
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, attackVolEnv, SmplDef.AtkRate);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, holdVolEnv, SmplDef.SusRate);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, decayVolEnv, SmplDef.DecRate);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, sustainVolEnv, SmplDef.SusLvl);
-				if (SmplDef.LoopMode)
+				if (TempZone->Def.LoopMode)
 					// Note Off goes to Release Phase
-					AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, releaseVolEnv, SmplDef.RelRate);
+					AddInsZone(SF2Bld, &TempZone->Def, TempZone->Def.RelRate);
 				else
 					// Note Off is ignored
 					// 100 seconds, 1200 * Log2(100) = 7972.63
-					AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, releaseVolEnv, 7973);
-				
-				AddInsGen_U16(&InsGenAlloc, &InsGenCnt, &InsGen, sampleModes, SmplDef.LoopMode);
-				AddInsGen_U16(&InsGenAlloc, &InsGenCnt, &InsGen, sampleID, SmplDef.SmplID);
+					AddInsZone(SF2Bld, &TempZone->Def, 7973);
 			}
 		}
 		else
@@ -1515,71 +2065,36 @@ static UINT16 GenerateInstruments(SF2_DATA* SF2Data, UINT16 SmplCnt, const UINT8
 			// Melody Instrument Mode
 			RetDrmMask[CurIns >> 3] &= ~(1 << (CurIns & 0x07));
 			
-			LastNote = 0x00;
-			do
-			{
-				CurNote = ROMData[CurPos + 0x00];
-				ReadInsData(&ROMData[CurPos], LastNote, CurNote, &SmplDef, SmplCnt, LoopMsk);
-				
-				AddInsBag(&InsBagAlloc, &InsBagCnt, &InsBags, InsGenCnt, 0);
-				
-				AddInsGen_8(&InsGenAlloc, &InsGenCnt, &InsGen, keyRange, SmplDef.MinNote, SmplDef.MaxNote);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, overridingRootKey, SmplDef.RootNote);
-				
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, attackVolEnv, SmplDef.AtkRate);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, holdVolEnv, SmplDef.SusRate);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, decayVolEnv, SmplDef.DecRate);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, sustainVolEnv, SmplDef.SusLvl);
-				AddInsGen_S16(&InsGenAlloc, &InsGenCnt, &InsGen, releaseVolEnv, SmplDef.RelRate);
-				
-				AddInsGen_U16(&InsGenAlloc, &InsGenCnt, &InsGen, sampleModes, SmplDef.LoopMode);
-				AddInsGen_U16(&InsGenAlloc, &InsGenCnt, &InsGen, sampleID, SmplDef.SmplID);
-				
-				CurPos += 0x0A;
-				LastNote = CurNote + 1;
-			} while(CurNote < 0x7F);
+			for (CurZone = 0x00; CurZone < TempIns->ZoneCnt; CurZone ++, TempZone ++)
+				AddInsZone(SF2Bld, &TempZone->Def, TempZone->Def.RelRate);
 		}
 	}
-	memset(&InsData[CurIns], 0x00, sizeof(sfInst));
-	strcpy(InsData[CurIns].achInstName, "EOI");
-	InsData[CurIns].wInstBagNdx = InsBagCnt;
-	
 	
-	AddInsBag(&InsBagAlloc, &InsBagCnt, &InsBags, InsGenCnt, 0);
-	
-	if (InsGenCnt >= InsGenAlloc)
-	{
-		InsGenAlloc = InsGenCnt + 1;
-		InsGen = (sfInstGenList*)realloc(InsGen, sizeof(sfInstGenList) * InsGenAlloc);
-	}
-	TempGen = &InsGen[InsGenCnt];
-	TempGen->sfGenOper = 0;	// 'End Of Generators' entry
-	TempGen->genAmount.shAmount = 0;
-	InsGenCnt ++;
-	
-	memset(&InsMod, 0x00, sizeof(sfInstModList));
-	
-	
-	LstChk = List_GetChunk(SF2Data->Lists, FCC_pdta);
-	
-	DataSize = sizeof(sfInst) * InsAlloc;
-	ItmChk = Item_MakeChunk(FCC_inst, DataSize, InsData, 0x00);
-	List_AddItem(LstChk, ItmChk);
+	return InsCnt;
+}
+
+static void AddInsZone(SF2_BUILDER* SF2Bld, const SMPL_DEF* SmplDef, INT16 RelRate)
+{
+	// Instrument Generators format:
+	//	[keyRange]
+	//	[velRange]
+	//	... (more)
+	//	sampleID
+	SF2Bld_AddInsZone(SF2Bld);
 	
-	DataSize = sizeof(sfInstBag) * InsBagCnt;
-	ItmChk = Item_MakeChunk(FCC_ibag, DataSize, InsBags, 0x00);
-	List_AddItem(LstChk, ItmChk);
+	SF2Bld_AddInsGen_8(SF2Bld, keyRange, SmplDef->MinNote, SmplDef->MaxNote);
+	SF2Bld_AddInsGen_S16(SF2Bld, overridingRootKey, SmplDef->RootNote);
 	
-	//DataSize = sizeof(sfInstModList) * 1;
-	DataSize = sizeof(sfInstModList);
-	ItmChk = Item_MakeChunk(FCC_imod, DataSize, &InsMod, 0x01);
-	List_AddItem(LstChk, ItmChk);
+	SF2Bld_AddInsGen_S16(SF2Bld, attackVolEnv, SmplDef->AtkRate);
+	SF2Bld_AddInsGen_S16(SF2Bld, holdVolEnv, SmplDef->SusRate);
+	SF2Bld_AddInsGen_S16(SF2Bld, decayVolEnv, SmplDef->DecRate);
+	SF2Bld_AddInsGen_S16(SF2Bld, sustainVolEnv, SmplDef->SusLvl);
+	SF2Bld_AddInsGen_S16(SF2Bld, releaseVolEnv, RelRate);
 	
-	DataSize = sizeof(sfInstGenList) * InsGenCnt;
-	ItmChk = Item_MakeChunk(FCC_igen, DataSize, InsGen, 0x00);
-	List_AddItem(LstChk, ItmChk);
+	SF2Bld_AddInsGen_U16(SF2Bld, sampleModes, SmplDef->LoopMode);
+	SF2Bld_AddInsGen_U16(SF2Bld, sampleID, SmplDef->SmplID);
 	
-	return InsCnt;
+	return;
 }
 
 static void ReadInsData(const UINT8* Data, UINT8 LastNote, UINT8 CurNote, SMPL_DEF* RetSmplDef,
@@ -1659,232 +2174,40 @@ static void ReadInsData(const UINT8* Data, UINT8 LastNote, UINT8 CurNote, SMPL_D
 	// convert to SF2 scale
 	// SF2 Rate = 1200 * Log2(seconds)
 	// SF2 Level = db * 10
-	RetSmplDef->AtkRate = SCSPtoSF2Rate(RetSmplDef->AtkRate, 1);
-	RetSmplDef->DecRate = SCSPtoSF2Rate(RetSmplDef->DecRate, 0);
-	RetSmplDef->SusRate = SCSPtoSF2Rate(RetSmplDef->SusRate, 0);
-	RetSmplDef->RelRate = SCSPtoSF2Rate(RetSmplDef->RelRate, 0);
-	RetSmplDef->SusLvl = SCSPtoSF2Level(RetSmplDef->SusLvl);
-	
-	return;
-}
-
-static INT16 SCSPtoSF2Rate(UINT16 SCSPRate, UINT8 IsAtk)
-{
-	// from MAME's scsp.c
-	static const double ARTimes[64] = 
-	{	100000,100000,8100.0,6900.0,6000.0,4800.0,4000.0,3400.0,3000.0,2400.0,2000.0,1700.0,1500.0,
-		1200.0,1000.0,860.0,760.0,600.0,500.0,430.0,380.0,300.0,250.0,220.0,190.0,150.0,130.0,110.0,95.0,
-		76.0,63.0,55.0,47.0,38.0,31.0,27.0,24.0,19.0,15.0,13.0,12.0,9.4,7.9,6.8,6.0,4.7,3.8,3.4,3.0,2.4,
-		2.0,1.8,1.6,1.3,1.1,0.93,0.85,0.65,0.53,0.44,0.40,0.35,0.0,0.0};
-	static const double DRTimes[64] =
-	{	100000,100000,118200.0,101300.0,88600.0,70900.0,59100.0,50700.0,44300.0,35500.0,29600.0,25300.0,22200.0,17700.0,
-		14800.0,12700.0,11100.0,8900.0,7400.0,6300.0,5500.0,4400.0,3700.0,3200.0,2800.0,2200.0,1800.0,1600.0,1400.0,1100.0,
-		920.0,790.0,690.0,550.0,460.0,390.0,340.0,270.0,230.0,200.0,170.0,140.0,110.0,98.0,85.0,68.0,57.0,49.0,43.0,34.0,
-		28.0,25.0,22.0,18.0,14.0,12.0,11.0,8.5,7.1,6.1,5.4,4.3,3.6,3.1};
-	double RateVal;
-	
-	if (SCSPRate == 0x00)
-		return 32767;	// infinite
-	
-	if (IsAtk)
-		RateVal = ARTimes[SCSPRate * 2];
-	else
-		RateVal = DRTimes[SCSPRate * 2];
-	if (RateVal == 0.0)	// I *can* do that here, since I just copied it from the table,
-		return -32768;	// instant
-	
-	return RoundTo16(1200 * log(RateVal / 1000.0) / log(2.0));
-}
-
-static INT16 SCSPtoSF2Level(UINT16 SCSPLevel)
-{
-	double LinLevel;
-	double DBLevel;
-	
-	if (SCSPLevel >= 0x1F)
-		return 32767;
-	
-	LinLevel = (SCSPLevel ^ 0x1F) / 31.0;
-	DBLevel = log(LinLevel) / log(2.0) * 6.0;
-	return (INT16)(DBLevel * -10.0 + 0.5);
-}
-
-static INT16 RoundTo16(double Value)
-{
-	if (Value <= -32768.0)
-		return -32768;
-	else if (Value >= 32767.0)
-		return 32767;
-	
-	if (Value < 0.0)
-		return (INT16)(Value - 0.5);
-	else
-		return (INT16)(Value + 0.5);
-}
-
-static void AddInsBag(UINT16* BagAlloc, UINT16* BagCount, sfInstBag** Bags, UINT16 GenIdx, UINT16 ModIdx)
-{
-	sfInstBag* CurBag;
-	if (*BagCount >= *BagAlloc)
-	{
-		(*BagAlloc) += 0x10;
-		*Bags = (sfInstBag*)realloc(*Bags, sizeof(sfInstBag) * *BagAlloc);
-	}
-	
-	CurBag = &(*Bags)[*BagCount];
-	CurBag->wInstGenNdx = GenIdx;
-	CurBag->wInstModNdx = ModIdx;
-	(*BagCount) ++;
+	RetSmplDef->AtkRate = SCSP_AR2SF2[RetSmplDef->AtkRate];
+	RetSmplDef->DecRate = SCSP_DR2SF2[RetSmplDef->DecRate];
+	RetSmplDef->SusRate = SCSP_DR2SF2[RetSmplDef->SusRate];
+	RetSmplDef->RelRate = SCSP_DR2SF2[RetSmplDef->RelRate];
+	RetSmplDef->SusLvl = SCSP_DL2SF2[RetSmplDef->SusLvl];
 	
 	return;
 }
 
-static void AddInsGen_S16(UINT16* GenAlloc, UINT16* GenCount, sfInstGenList** Gens, UINT16 Type, INT16 Data)
+static void GeneratePresets(SF2_BUILDER* SF2Bld, UINT16 InsCnt, const UINT8* DrumMask)
 {
-	sfInstGenList* CurGen;
-	
-	if (*GenCount >= *GenAlloc)
-	{
-		(*GenAlloc) += 0x40;
-		*Gens = (sfInstGenList*)realloc(*Gens, sizeof(sfInstGenList) * *GenAlloc);
-	}
-	
-	CurGen = &(*Gens)[*GenCount];
-	CurGen ->sfGenOper = Type;
-	CurGen ->genAmount.wAmount = Data;
-	(*GenCount) ++;
-	
-	return;
-}
-
-static void AddInsGen_U16(UINT16* GenAlloc, UINT16* GenCount, sfInstGenList** Gens, UINT16 Type, UINT16 Data)
-{
-	AddInsGen_S16(GenAlloc, GenCount, Gens, Type, (INT16)Data);
-	
-	return;
-}
-
-static void AddInsGen_8(UINT16* GenAlloc, UINT16* GenCount, sfInstGenList** Gens, UINT16 Type, UINT8 DataL, UINT8 DataH)
-{
-	sfInstGenList* CurGen;
-	
-	if (*GenCount >= *GenAlloc)
-	{
-		(*GenAlloc) += 0x40;
-		*Gens = (sfInstGenList*)realloc(*Gens, sizeof(sfInstGenList) * *GenAlloc);
-	}
-	
-	CurGen = &(*Gens)[*GenCount];
-	CurGen ->sfGenOper = Type;
-	CurGen ->genAmount.ranges.byLo = DataL;
-	CurGen ->genAmount.ranges.byHi = DataH;
-	(*GenCount) ++;
-	
-	return;
-}
-
-static void GeneratePresets(SF2_DATA* SF2Data, UINT16 InsCnt, const UINT8* DrumMask)
-{
-	UINT16 PrsCnt;
-	UINT16 PrsAlloc;
 	UINT16 CurIns;
-	UINT16 CurPrs;
-	
-	UINT32 DataSize;
-	sfPresetHeader* PrsDB;
-	sfPresetHeader* TempPHdr;
-	sfPresetBag* PrsBags;
-	sfModList PrsMod;
-	sfGenList* PrsGen;
-	
-	LIST_CHUNK* LstChk;
-	ITEM_CHUNK* ItmChk;
+	char PrsName[0x20];
 	
-	PrsCnt = InsCnt;
 	for (CurIns = 0x00; CurIns < InsCnt; CurIns ++)
 	{
-		if (DrumMask[CurIns >> 3] & (1 << (CurIns & 0x07)))
-			PrsCnt ++;
-	}
-	PrsAlloc = PrsCnt + 1;
-	
-	PrsDB = (sfPresetHeader*)malloc(sizeof(sfPresetHeader) * PrsAlloc);
-	PrsBags = (sfPresetBag*)malloc(sizeof(sfPresetBag) * PrsAlloc);
-	//PrsMod = (sfModList*)malloc(sizeof(sfModList) * 1);
-	PrsGen = (sfGenList*)malloc(sizeof(sfGenList) * PrsAlloc);
-	
-	for (CurIns = 0x00, CurPrs = 0x00; CurIns < InsCnt; CurIns ++, CurPrs ++)
-	{
-		TempPHdr = &PrsDB[CurPrs];
-		memset(TempPHdr, 0x00, sizeof(sfPresetHeader));
-		sprintf(TempPHdr->achPresetName, "Preset %02X", CurIns);
-		TempPHdr->wPreset = CurIns;			// MIDI Instrument ID
-		TempPHdr->wBank = 0x0000;			// Bank MSB 0, Bank LSB 0
-		TempPHdr->wPresetBagNdx = CurPrs;
-		TempPHdr->dwLibrary = 0;			// must be 0
-		TempPHdr->dwGenre = 0;				// must be 0
-		TempPHdr->dwMorphology = 0;			// must be 0
-		
-		PrsBags[CurPrs].wGenNdx = CurPrs;
-		PrsBags[CurPrs].wModNdx = 0;
-		
 		// Preset Generators format:
 		//	[keyRange]
 		//	[velRange]
 		//	... (more)
 		//	instrument
-		PrsGen[CurPrs].sfGenOper = instrument;
-		PrsGen[CurPrs].genAmount.shAmount = CurIns;
+		sprintf(PrsName, "Preset %02X", CurIns);
+		SF2Bld_AddPreset(SF2Bld, PrsName, CurIns, 0x0000);	// Bank MSB 0, Bank LSB 0
+		SF2Bld_AddPrsZone(SF2Bld);
+		SF2Bld_AddPrsGen_U16(SF2Bld, instrument, CurIns);
 		
 		if (DrumMask[CurIns >> 3] & (1 << (CurIns & 0x07)))
 		{
-			CurPrs ++;
-			TempPHdr = &PrsDB[CurPrs];
-			memset(TempPHdr, 0x00, sizeof(sfPresetHeader));
-			sprintf(TempPHdr->achPresetName, "Preset %02X (drum)", CurIns);
-			TempPHdr->wPreset = CurIns;			// MIDI Instrument ID
-			TempPHdr->wBank = 0x0080;			// Bank MSB 128, Bank LSB 0
-			TempPHdr->wPresetBagNdx = CurPrs;
-			TempPHdr->dwLibrary = 0;			// must be 0
-			TempPHdr->dwGenre = 0;				// must be 0
-			TempPHdr->dwMorphology = 0;			// must be 0
-			
-			PrsBags[CurPrs].wGenNdx = CurPrs;
-			PrsBags[CurPrs].wModNdx = 0;
-			PrsGen[CurPrs].sfGenOper = instrument;
-			PrsGen[CurPrs].genAmount.shAmount = CurIns;
+			sprintf(PrsName, "Preset %02X (drum)", CurIns);
+			SF2Bld_AddPreset(SF2Bld, PrsName, CurIns, 0x0080);	// Bank MSB 128, Bank LSB 0
+			SF2Bld_AddPrsZone(SF2Bld);
+			SF2Bld_AddPrsGen_U16(SF2Bld, instrument, CurIns);
 		}
 	}
-	TempPHdr = &PrsDB[CurPrs];
-	memset(TempPHdr, 0x00, sizeof(sfPresetHeader));
-	strcpy(TempPHdr->achPresetName, "EOP");	// write "End Of Presets" header
-	TempPHdr->wPresetBagNdx = CurPrs;
-	
-	PrsBags[CurPrs].wGenNdx = CurPrs;
-	PrsBags[CurPrs].wModNdx = 0;
-	PrsGen[CurPrs].sfGenOper = 0;		// 'End Of Generators' entry - all 00s
-	PrsGen[CurPrs].genAmount.shAmount = 0;
-	
-	memset(&PrsMod, 0x00, sizeof(sfModList));
-	
-	LstChk = List_GetChunk(SF2Data->Lists, FCC_pdta);
-	
-	DataSize = sizeof(sfPresetHeader) * PrsAlloc;
-	ItmChk = Item_MakeChunk(FCC_phdr, DataSize, PrsDB, 0x00);
-	List_AddItem(LstChk, ItmChk);
-	
-	DataSize = sizeof(sfPresetBag) * PrsAlloc;
-	ItmChk = Item_MakeChunk(FCC_pbag, DataSize, PrsBags, 0x00);
-	List_AddItem(LstChk, ItmChk);
-	
-	//DataSize = sizeof(sfModList) * 1;
-	DataSize = sizeof(sfModList);
-	ItmChk = Item_MakeChunk(FCC_pmod, DataSize, &PrsMod, 0x01);
-	List_AddItem(LstChk, ItmChk);
-	
-	DataSize = sizeof(sfGenList) * PrsAlloc;
-	ItmChk = Item_MakeChunk(FCC_pgen, DataSize, PrsGen, 0x00);
-	List_AddItem(LstChk, ItmChk);
 	
 	return;
 }
@@ -4,238 +4,117 @@
 #include <malloc.h>
 #include <memory.h>
 #include "stdbool.h"
+#include "midi_reader.h"
 
-const unsigned long int FCC_MTHD = 0x6468544D;
-const unsigned long int FCC_MTRK = 0x6B72544D;
+const unsigned long int FCC_MTRK = 0x4D54726B;	// "MTrk"
 
-typedef struct midi_track_info
+typedef struct midi_output_buffer
 {
-	unsigned long int TrkBase;
-	unsigned long int TrkEnd;
-	unsigned long int CurPos;
-	unsigned long int TickPos;
-	unsigned char LastEvent;	// all values are possible
-	unsigned char RmbrEvent;	// must not be F0 .. FF
-} MIDITRK_INF;
+	unsigned long int Alloc;
+	unsigned long int Pos;
+	unsigned char* Data;
+	unsigned long int LastTick;	// tick of the last written event
+	unsigned char LastEvent;	// running status (00 = none)
+} MIDIOUT_BUF;
 
 unsigned char MIDI1to0(unsigned long int SrcLen, unsigned char* SrcData,
 						unsigned long int* RetDstLen, unsigned char** RetDstData);
-static unsigned long int ReadMIDIValue(unsigned char* FileData, unsigned long int* Value);
 static unsigned long int WriteMIDIValue(unsigned char* FileData, unsigned long int Value);
-static unsigned char CopyMIDIEvent(unsigned char* SrcData, unsigned char* DstData,
-								   MIDITRK_INF* TrkSrc, MIDITRK_INF* TrkDst);
-static unsigned long int LittleBigEndianCnvL(unsigned long int Value);
-static unsigned short int LittleBigEndianCnvS(unsigned short int Value);
+static bool ReserveOutput(MIDIOUT_BUF* DstBuf, unsigned long int Bytes);
+static unsigned char CopyMIDIEvent(const SMF_EVENT* Evt, MIDIOUT_BUF* DstBuf);
+static void WriteBE32(unsigned char* Data, unsigned long int Value);
 
+// The tracks are read in merged order, i.e. sorted by tick and in track order for events on the same tick.
 unsigned char MIDI1to0(unsigned long int SrcLen, unsigned char* SrcData,
 						unsigned long int* RetDstLen, unsigned char** RetDstData)
 {
-	unsigned long int CurPos;
-	unsigned short int TrkCnt;
+	SMF_FILE Smf;
+	SMF_EVENT Evt;
 	unsigned short int CurTrk;
-	MIDITRK_INF MstTrk;
-	MIDITRK_INF* TrkData;
-	MIDITRK_INF* CurTData;
-	unsigned long int DstLen;
-	unsigned char* DstData;
-	unsigned long int DataLen;
-	unsigned long int LastTick;
-	unsigned char TempByt;
-	unsigned short int TempSht;
-	unsigned long int TempLng;
-	bool WriteDelay;
-	// Last Delay Backup Values
-	unsigned long int LD_Pos;
-	unsigned long int LD_Tick;
-	unsigned long int EvtsWritten;
-	
-	CurPos = 0x00;
-	memcpy(&TempLng, &SrcData[CurPos + 0x00], 0x04);
-	if (TempLng != FCC_MTHD)
-		return 0xF0;
-	memcpy(&TempLng, &SrcData[CurPos + 0x04], 0x04);
-	DataLen = LittleBigEndianCnvL(TempLng);
-	
-	DstLen = SrcLen * 2;
-	DstData = (unsigned char*)malloc(DstLen);
-	memcpy(&DstData[CurPos + 0x00], &FCC_MTHD, 0x04);
-	memcpy(&DstData[CurPos + 0x04], &TempLng, 0x04);
-	CurPos += 0x08;
-	
-	// Read Header
-	memcpy(&TrkCnt, &SrcData[CurPos + 0x02], 0x02);
-	TrkCnt = LittleBigEndianCnvS(TrkCnt);
-	// Write MIDI Format 0
-	TempSht = LittleBigEndianCnvS(0x0000);
-	memcpy(&DstData[CurPos + 0x00], &TempSht, 0x02);
-	// Write Track Count 1
-	TempSht = LittleBigEndianCnvS(0x0001);
-	memcpy(&DstData[CurPos + 0x02], &TempSht, 0x02);
-	// Write Resolution Rate (and other bytes, if used)
-	memcpy(&DstData[CurPos + 0x04], &SrcData[CurPos + 0x04], DataLen - 0x04);
-	CurPos += DataLen;
-	
-	TrkData = (MIDITRK_INF*)malloc(TrkCnt * sizeof(MIDITRK_INF));
-	for (CurTrk = 0x00; CurTrk < TrkCnt; CurTrk ++)
+	MIDIOUT_BUF DstBuf;
+	unsigned long int MstTrkBase;
+	unsigned long int HdrLen;
+	unsigned long int TrkDataLen;
+	unsigned long int EndTick;
+	unsigned char RetVal;
+	
+	RetVal = SMF_Open(&Smf, SrcLen, SrcData);
+	if (RetVal)
+		return (RetVal == 0x80) ? 0xF0 : (RetVal == 0x81) ? 0xE0 : 0xFF;
+	if (! Smf.trkCnt)
 	{
-		memcpy(&TempLng, &SrcData[CurPos + 0x00], 0x04);
-		if (TempLng != FCC_MTRK)
-			return 0xE0;
-		memcpy(&DataLen, &SrcData[CurPos + 0x04], 0x04);
-		DataLen = LittleBigEndianCnvL(DataLen);
-		
-		TrkData[CurTrk].TrkBase = CurPos;
-		TrkData[CurTrk].TrkEnd = CurPos + 0x08 + DataLen;
-		CurPos += 0x08 + DataLen;
+		SMF_Close(&Smf);
+		return 0xE0;
 	}
-	
-	MstTrk.TrkBase = TrkData[0x00].TrkBase;
-	MstTrk.CurPos = MstTrk.TrkBase;
-	memcpy(&DstData[MstTrk.CurPos + 0x00], &FCC_MTRK, 0x04);
-	TempLng = 0x00000000;
-	memcpy(&DstData[MstTrk.CurPos + 0x04], &TempLng, 0x04);
-	MstTrk.CurPos += 0x08;
-	MstTrk.TickPos = 0x00000000;
-	MstTrk.LastEvent = 0x00;
-	MstTrk.RmbrEvent = 0x00;
-	
-	for (CurTrk = 0x00; CurTrk < TrkCnt; CurTrk ++)
+	HdrLen = 0x08 + SMF_ReadBE32(&SrcData[0x04]);
+	
+	// The merged track is usually a bit smaller than all tracks together. It only grows when
+	// running status can't be kept across tracks, so there is some room for that.
+	TrkDataLen = Smf.tracks[Smf.trkCnt - 1].endPos - Smf.tracks[0].startPos;
+	DstBuf.Alloc = HdrLen + 0x08 + TrkDataLen + TrkDataLen / 8 + 0x10;
+	DstBuf.Data = (unsigned char*)malloc(DstBuf.Alloc);
+	if (DstBuf.Data == NULL)
+	{
+		SMF_Close(&Smf);
+		return 0xFF;
+	}
+	DstBuf.LastTick = 0x00000000;
+	DstBuf.LastEvent = 0x00;
+	
+	// Write Header: MIDI Format 0, Track Count 1, Resolution Rate (and other bytes, if used)
+	memcpy(&DstBuf.Data[0x00], &SrcData[0x00], HdrLen);
+	DstBuf.Data[0x08] = 0x00;	DstBuf.Data[0x09] = 0x00;
+	DstBuf.Data[0x0A] = 0x00;	DstBuf.Data[0x0B] = 0x01;
+	DstBuf.Pos = HdrLen;
+	
+	MstTrkBase = DstBuf.Pos;
+	WriteBE32(&DstBuf.Data[MstTrkBase + 0x00], FCC_MTRK);
+	WriteBE32(&DstBuf.Data[MstTrkBase + 0x04], 0x00000000);
+	DstBuf.Pos += 0x08;
+	
+	// tracks without events still count for the song length
+	EndTick = 0x00000000;
+	for (CurTrk = 0x00; CurTrk < Smf.trkCnt; CurTrk ++)
 	{
-		CurTData = TrkData + CurTrk;
-		CurTData->CurPos = CurTData->TrkBase + 0x08;
-		CurTData->TickPos = 0x00000000;
-		CurTData->LastEvent = 0x00;
-		CurTData->RmbrEvent = 0x00;
-		
-		ReadMIDIValue(SrcData + CurTData->CurPos, &TempLng);
-		CurTData->TickPos += TempLng;
+		if (Smf.tracks[CurTrk].ended && EndTick < Smf.tracks[CurTrk].tick)
+			EndTick = Smf.tracks[CurTrk].tick;
 	}
 	
-	LastTick = 0x00000000;
-	MstTrk.TickPos = 0x00000000;
-	do
+	SMF_MergeStart(&Smf);
+	while((RetVal = SMF_ReadMergedEvent(&Smf, &Evt)) != 0x01)
 	{
-		// Search Next Event
-		TempLng = MstTrk.TickPos;
-		TempSht = 0x0000;
-		for (CurTrk = 0x00; CurTrk < TrkCnt; CurTrk ++)
-		{
-			CurTData = TrkData + CurTrk;
-			if (CurTData->CurPos >= CurTData->TrkEnd)
-				continue;
-			if (! TempSht || CurTData->TickPos < TempLng)
-				TempLng = CurTData->TickPos;
-			TempSht ++;
-		}
-		MstTrk.TickPos = TempLng;
-		
-		LD_Pos = MstTrk.CurPos;
-		LD_Tick = LastTick;
-		DataLen = WriteMIDIValue(DstData + MstTrk.CurPos, MstTrk.TickPos - LastTick);
-		LastTick = MstTrk.TickPos;
-		MstTrk.CurPos += DataLen;
-		
-		// Write Events
-		TempSht = 0x0000;
-		EvtsWritten = 0x00000000;
-		WriteDelay = false;
-		for (CurTrk = 0x00; CurTrk < TrkCnt; CurTrk ++)
+		if (RetVal == 0x00)
+			RetVal = CopyMIDIEvent(&Evt, &DstBuf);
+		if (RetVal == 0xFF)
 		{
-			CurTData = TrkData + CurTrk;
-			if (CurTData->CurPos >= CurTData->TrkEnd)
-			{
-				TempSht ++;
-				continue;
-			}
-			if (CurTData->TickPos > MstTrk.TickPos)
-				continue;
-			
-			ReadMIDIValue(SrcData + CurTData->CurPos, &TempLng);
-			CurTData->TickPos -= TempLng;
-			while(CurTData->CurPos < CurTData->TrkEnd)
-			{
-				DataLen = ReadMIDIValue(SrcData + CurTData->CurPos, &TempLng);
-				CurTData->TickPos += TempLng;
-				if (CurTData->TickPos > MstTrk.TickPos)
-					break;
-				CurTData->CurPos += DataLen;
-				
-				if (WriteDelay)
-				{
-					LD_Pos = MstTrk.CurPos;
-					LD_Tick = LastTick;
-					DataLen = WriteMIDIValue(DstData + MstTrk.CurPos, 0);
-					MstTrk.CurPos += DataLen;
-					WriteDelay = false;
-				}
-				TempByt = CopyMIDIEvent(SrcData, DstData, CurTData, &MstTrk);
-				switch(TempByt)
-				{
-				case 0x00:
-					EvtsWritten ++;
-					WriteDelay = true;
-					break;
-				case 0x01:	// Event ignored
-					break;
-				case 0xFF:	// Error
-				default:
-					printf("Invalid Event at Pos %lX\n", CurTData->CurPos);
-					return 0xFF;
-				}
-			}
-			if (CurTData->CurPos >= CurTData->TrkEnd)
-				TempSht ++;
-		}
-		
-		if (! WriteDelay && (TempSht < TrkCnt))
-		{
-			MstTrk.CurPos = LD_Pos;
-			LastTick = LD_Tick;
+			printf("Invalid Event at Pos %X\n", Evt.filePos);
+			break;
 		}
-	} while(TempSht < TrkCnt);
-	
-	// Write Track End
-	if (WriteDelay)
+		if (Smf.tracks[Evt.trkID].ended && EndTick < Smf.tracks[Evt.trkID].tick)
+			EndTick = Smf.tracks[Evt.trkID].tick;
+	}
+	SMF_Close(&Smf);
+	if (RetVal == 0xFF || ! ReserveOutput(&DstBuf, 0x04 + 0x03))
 	{
-		DstData[MstTrk.CurPos + 0x00] = 0x00;
-		MstTrk.CurPos += 0x01;
+		free(DstBuf.Data);
+		return 0xFF;
 	}
-	DstData[MstTrk.CurPos + 0x00] = 0xFF;
-	DstData[MstTrk.CurPos + 0x01] = 0x2F;
-	DstData[MstTrk.CurPos + 0x02] = 0x00;
-	MstTrk.CurPos += 0x03;
 	
-	MstTrk.TrkEnd = MstTrk.CurPos;
-	TempLng = LittleBigEndianCnvL(MstTrk.TrkEnd - MstTrk.TrkBase - 0x08);
-	memcpy(&DstData[MstTrk.TrkBase + 0x04], &TempLng, 0x04);
-	DstLen = MstTrk.TrkEnd;
-	//DstData = (unsigned char*)realloc(DstData, DstLen);	// Free unused Bytes
+	// Write Track End (at the end of the longest track)
+	if (EndTick < DstBuf.LastTick)
+		EndTick = DstBuf.LastTick;
+	DstBuf.Pos += WriteMIDIValue(&DstBuf.Data[DstBuf.Pos], EndTick - DstBuf.LastTick);
+	DstBuf.Data[DstBuf.Pos + 0x00] = 0xFF;
+	DstBuf.Data[DstBuf.Pos + 0x01] = 0x2F;
+	DstBuf.Data[DstBuf.Pos + 0x02] = 0x00;
+	DstBuf.Pos += 0x03;
 	
-	*RetDstLen = DstLen;
-	*RetDstData = DstData;
+	WriteBE32(&DstBuf.Data[MstTrkBase + 0x04], DstBuf.Pos - (MstTrkBase + 0x08));
 	
-	return 0x00;
-}
-
-static unsigned long int ReadMIDIValue(unsigned char* FileData, unsigned long int* Value)
-{
-	unsigned char* DataPnt;
-	unsigned long int TempLng;
+	*RetDstLen = DstBuf.Pos;
+	*RetDstData = DstBuf.Data;
 	
-	DataPnt = FileData;
-	TempLng = 0x00000000;
-	while(*DataPnt & 0x80)
-	{
-		TempLng <<= 7;
-		TempLng |= *DataPnt & 0x7F;
-		DataPnt ++;
-	}
-	TempLng <<= 7;
-	TempLng |= *DataPnt & 0x7F;
-	DataPnt ++;
-	
-	*Value = TempLng;
-	return DataPnt - FileData;
+	return 0x00;
 }
 
 static unsigned long int WriteMIDIValue(unsigned char* FileData, unsigned long int Value)
@@ -267,103 +146,86 @@ static unsigned long int WriteMIDIValue(unsigned char* FileData, unsigned long i
 	return ByteCount;
 }
 
-static unsigned char CopyMIDIEvent(unsigned char* SrcData, unsigned char* DstData,
-								   MIDITRK_INF* TrkSrc, MIDITRK_INF* TrkDst)
+static bool ReserveOutput(MIDIOUT_BUF* DstBuf, unsigned long int Bytes)
 {
-	bool ShortEvt;
-	unsigned long int DataLen;
-	unsigned long int TempLng;
+	unsigned long int NewAlloc;
+	unsigned char* NewData;
+	
+	if (DstBuf->Pos + Bytes <= DstBuf->Alloc)
+		return true;
+	
+	NewAlloc = DstBuf->Alloc * 2;
+	if (NewAlloc < DstBuf->Pos + Bytes)
+		NewAlloc = DstBuf->Pos + Bytes;
+	NewData = (unsigned char*)realloc(DstBuf->Data, NewAlloc);
+	if (NewData == NULL)
+		return false;
+	DstBuf->Alloc = NewAlloc;
+	DstBuf->Data = NewData;
+	
+	return true;
+}
+
+// Returns 0x00 if the event was copied, 0x01 if it was ignored and 0xFF on errors.
+static unsigned char CopyMIDIEvent(const SMF_EVENT* Evt, MIDIOUT_BUF* DstBuf)
+{
+	unsigned char LenBuf[0x05];
+	unsigned long int LenSize;
+	bool WriteStatus;
 	
-	if (SrcData[TrkSrc->CurPos] & 0x80)
+	LenSize = 0x00;
+	if (Evt->status == 0xFF)
 	{
-		TrkSrc->LastEvent = SrcData[TrkSrc->CurPos];
-		if ((SrcData[TrkSrc->CurPos] & 0xF0) < 0xF0)
-			TrkSrc->RmbrEvent = SrcData[TrkSrc->CurPos];
-		TrkSrc->CurPos ++;
-		ShortEvt = false;
+		switch(Evt->metaType)
+		{
+		case 0x20:	// MIDI Channel Prefix
+		case 0x21:	// MIDI Port
+		case 0x2F:	// Track End
+			return 0x01;	// Ignore Event
+		}
+		LenBuf[0x00] = Evt->metaType;
+		LenSize = 0x01 + WriteMIDIValue(&LenBuf[0x01], Evt->len);
 	}
-	else
+	else if (Evt->status >= 0xF0)
 	{
-		if (! TrkSrc->RmbrEvent)
-			return 0xFF;
-		TrkSrc->LastEvent = TrkSrc->RmbrEvent;	// it's not valid to have short F? events
-		ShortEvt = true;
+		LenSize = WriteMIDIValue(&LenBuf[0x00], Evt->len);
 	}
 	
-	if (! ShortEvt || (ShortEvt && TrkDst->LastEvent != TrkSrc->LastEvent))
+	if (! ReserveOutput(DstBuf, 0x04 + 0x01 + LenSize + Evt->len))
+		return 0xFF;
+	DstBuf->Pos += WriteMIDIValue(&DstBuf->Data[DstBuf->Pos], Evt->tick - DstBuf->LastTick);
+	DstBuf->LastTick = Evt->tick;
+	
+	if (Evt->status < 0xF0)
 	{
-		DstData[TrkDst->CurPos] = TrkSrc->LastEvent;
-		TrkDst->LastEvent = TrkSrc->LastEvent;
-		TrkDst->CurPos ++;
+		// use running status whenever the last event of the merged track allows it
+		WriteStatus = (DstBuf->LastEvent != Evt->status);
+		DstBuf->LastEvent = Evt->status;
 	}
-	
-	switch(TrkSrc->LastEvent & 0xF0)
+	else
 	{
-	case 0x80:
-	case 0x90:
-	case 0xA0:
-	case 0xB0:
-	case 0xE0:
-		// Copy 2 Bytes
-		memcpy(&DstData[TrkDst->CurPos], &SrcData[TrkSrc->CurPos], 0x02);
-		TrkSrc->CurPos += 0x02;	TrkDst->CurPos += 0x02;
-		break;
-	case 0xC0:
-	case 0xD0:
-		// Copy 1 Byte
-		DstData[TrkDst->CurPos] = SrcData[TrkSrc->CurPos];
-		TrkSrc->CurPos += 0x01;	TrkDst->CurPos += 0x01;
-		break;
-	case 0xF0:
-		switch(TrkSrc->LastEvent)
-		{
-		case 0xF0:	// SysEx Data
-			// Read Data Length
-			TempLng = ReadMIDIValue(SrcData + TrkSrc->CurPos, &DataLen);
-			DataLen += TempLng;
-			// Copy Bytes
-			memcpy(&DstData[TrkDst->CurPos], &SrcData[TrkSrc->CurPos], DataLen);
-			TrkSrc->CurPos += DataLen;	TrkDst->CurPos += DataLen;
-			break;
-		case 0xFF:	// Meta Event
-			// Check & Copy Meta Event ID
-			switch(SrcData[TrkSrc->CurPos])
-			{
-			case 0x20:
-			case 0x21:
-			case 0x2F:
-				// Ignore Event
-				TrkSrc->CurPos += 0x01;
-				TempLng = ReadMIDIValue(SrcData + TrkSrc->CurPos, &DataLen);
-				TrkSrc->CurPos += DataLen + TempLng;
-				TrkDst->CurPos -= 0x01;
-				return 0x01;
-			}
-			DstData[TrkDst->CurPos] = SrcData[TrkSrc->CurPos];
-			TrkSrc->CurPos += 0x01;	TrkDst->CurPos += 0x01;
-			// Copy Meta Event Data
-			TempLng = ReadMIDIValue(SrcData + TrkSrc->CurPos, &DataLen);
-			DataLen += TempLng;
-			memcpy(&DstData[TrkDst->CurPos], &SrcData[TrkSrc->CurPos], DataLen);
-			TrkSrc->CurPos += DataLen;	TrkDst->CurPos += DataLen;
-			break;
-		}
-		break;
+		// SysEx and Meta Events cancel running status
+		WriteStatus = true;
+		DstBuf->LastEvent = 0x00;
+	}
+	if (WriteStatus)
+	{
+		DstBuf->Data[DstBuf->Pos] = Evt->status;
+		DstBuf->Pos ++;
 	}
+	memcpy(&DstBuf->Data[DstBuf->Pos], LenBuf, LenSize);
+	DstBuf->Pos += LenSize;
+	memcpy(&DstBuf->Data[DstBuf->Pos], Evt->data, Evt->len);
+	DstBuf->Pos += Evt->len;
 	
 	return 0x00;
 }
 
-static unsigned long int LittleBigEndianCnvL(unsigned long int Value)
+static void WriteBE32(unsigned char* Data, unsigned long int Value)
 {
-	return ((Value & 0xFF000000) >> 24) |
-			((Value & 0x00FF0000) >> 8) |
-			((Value & 0x0000FF00) << 8) |
-			((Value & 0x000000FF) << 24);
+	Data[0x00] = (unsigned char)((Value >> 24) & 0xFF);
+	Data[0x01] = (unsigned char)((Value >> 16) & 0xFF);
+	Data[0x02] = (unsigned char)((Value >>  8) & 0xFF);
+	Data[0x03] = (unsigned char)((Value >>  0) & 0xFF);
+	return;
 }
-
-static unsigned short int LittleBigEndianCnvS(unsigned short int Value)
-{
-	return ((Value & 0xFF00) >> 8) |
-			((Value & 0x00FF) << 8);
-}
\ No newline at end of file
@@ -244,6 +244,519 @@ UINT8 SortSF2Chunks(SF2_DATA* SF2Data)
 }
 
 
+// --- Preset/Instrument Builder ---
+static void Array_Init(SF2_ARRAY* Arr, UINT32 ItemSize)
+{
+	Arr->count = 0;
+	Arr->alloc = 0;
+	Arr->itemSize = ItemSize;
+	Arr->data = NULL;
+	
+	return;
+}
+
+static void Array_Free(SF2_ARRAY* Arr)
+{
+	free(Arr->data);
+	Arr->data = NULL;
+	Arr->count = 0;
+	Arr->alloc = 0;
+	
+	return;
+}
+
+static void* Array_Add(SF2_ARRAY* Arr)
+{
+	void* NewItem;
+	
+	if (Arr->count >= Arr->alloc)
+	{
+		UINT32 NewAlloc;
+		void* NewData;
+		
+		// grow exponentially, so that large soundfonts don't realloc all the time
+		NewAlloc = Arr->alloc ? (Arr->alloc * 2) : 0x10;
+		NewData = realloc(Arr->data, NewAlloc * Arr->itemSize);
+		if (NewData == NULL)
+			return NULL;
+		Arr->data = NewData;
+		Arr->alloc = NewAlloc;
+	}
+	
+	NewItem = (UINT8*)Arr->data + Arr->count * Arr->itemSize;
+	memset(NewItem, 0x00, Arr->itemSize);
+	Arr->count ++;
+	
+	return NewItem;
+}
+
+static void Level_Init(SF2_BLD_LEVEL* Lvl, UINT32 HdrSize)
+{
+	Array_Init(&Lvl->hdrs, HdrSize);
+	Array_Init(&Lvl->zoneCnt, sizeof(UINT32));
+	Array_Init(&Lvl->zones, sizeof(SF2_BLD_ZONE));
+	Array_Init(&Lvl->gens, sizeof(sfGenList));
+	Array_Init(&Lvl->mods, sizeof(sfModList));
+	Lvl->error = SF2BLD_ERR_OK;
+	
+	return;
+}
+
+static void Level_Free(SF2_BLD_LEVEL* Lvl)
+{
+	Array_Free(&Lvl->hdrs);
+	Array_Free(&Lvl->zoneCnt);
+	Array_Free(&Lvl->zones);
+	Array_Free(&Lvl->gens);
+	Array_Free(&Lvl->mods);
+	
+	return;
+}
+
+static void* Level_AddHeader(SF2_BLD_LEVEL* Lvl)
+{
+	void* Hdr;
+	UINT32* ZoneCnt;
+	
+	Hdr = Array_Add(&Lvl->hdrs);
+	ZoneCnt = (UINT32*)Array_Add(&Lvl->zoneCnt);
+	if (Hdr == NULL || ZoneCnt == NULL)
+	{
+		Lvl->error = SF2BLD_ERR_MEMORY;
+		return NULL;
+	}
+	
+	return Hdr;
+}
+
+static void Level_AddZone(SF2_BLD_LEVEL* Lvl)
+{
+	UINT32* ZoneCnt;
+	
+	if (! Lvl->hdrs.count)
+	{
+		Lvl->error = SF2BLD_ERR_GLOBAL_ZONE;	// zone without preset/instrument
+		return;
+	}
+	if (Array_Add(&Lvl->zones) == NULL)
+	{
+		Lvl->error = SF2BLD_ERR_MEMORY;
+		return;
+	}
+	ZoneCnt = (UINT32*)Lvl->zoneCnt.data;
+	ZoneCnt[Lvl->zoneCnt.count - 1] ++;
+	
+	return;
+}
+
+// returns the number of zones of the current preset/instrument
+static UINT32 Level_CurZoneCnt(const SF2_BLD_LEVEL* Lvl)
+{
+	if (! Lvl->zoneCnt.count)
+		return 0;
+	return ((const UINT32*)Lvl->zoneCnt.data)[Lvl->zoneCnt.count - 1];
+}
+
+static sfGenList* Level_AddGen(SF2_BLD_LEVEL* Lvl, UINT16 Type)
+{
+	SF2_BLD_ZONE* Zones;
+	sfGenList* Gen;
+	
+	// Generators added right after SF2Bld_AddInstrument/AddPreset open a zone implicitly.
+	if (! Level_CurZoneCnt(Lvl))
+		Level_AddZone(Lvl);
+	if (! Level_CurZoneCnt(Lvl))
+		return NULL;
+	
+	Gen = (sfGenList*)Array_Add(&Lvl->gens);
+	if (Gen == NULL)
+	{
+		Lvl->error = SF2BLD_ERR_MEMORY;
+		return NULL;
+	}
+	Gen->sfGenOper = Type;
+	Zones = (SF2_BLD_ZONE*)Lvl->zones.data;
+	Zones[Lvl->zones.count - 1].genCnt ++;
+	
+	return Gen;
+}
+
+static void Level_AddMod(SF2_BLD_LEVEL* Lvl, const sfModList* Mod)
+{
+	SF2_BLD_ZONE* Zones;
+	sfModList* NewMod;
+	
+	if (! Level_CurZoneCnt(Lvl))
+		Level_AddZone(Lvl);
+	if (! Level_CurZoneCnt(Lvl))
+		return;
+	
+	NewMod = (sfModList*)Array_Add(&Lvl->mods);
+	if (NewMod == NULL)
+	{
+		Lvl->error = SF2BLD_ERR_MEMORY;
+		return;
+	}
+	*NewMod = *Mod;
+	Zones = (SF2_BLD_ZONE*)Lvl->zones.data;
+	Zones[Lvl->zones.count - 1].modCnt ++;
+	
+	return;
+}
+
+// Checks the generator order of all zones and generates the bag list.
+// The bag list has an additional terminal entry.
+static UINT8 Level_MakeBags(const SF2_BLD_LEVEL* Lvl, UINT16 LinkGen, UINT16 LinkMax, sfInstBag** RetBags)
+{
+	const UINT32* ZoneCnt = (const UINT32*)Lvl->zoneCnt.data;
+	const SF2_BLD_ZONE* Zones = (const SF2_BLD_ZONE*)Lvl->zones.data;
+	const sfGenList* Gens = (const sfGenList*)Lvl->gens.data;
+	sfInstBag* Bags;
+	UINT32 CurHdr;
+	UINT32 CurZone;
+	UINT32 HdrZone;
+	UINT32 GenIdx;
+	UINT32 ModIdx;
+	UINT32 CurGen;
+	const sfGenList* ZGen;
+	const SF2_BLD_ZONE* Zone;
+	
+	*RetBags = NULL;
+	if (Lvl->hdrs.count >= 0xFFFF || Lvl->zones.count >= 0xFFFF ||
+		Lvl->gens.count >= 0xFFFF || Lvl->mods.count >= 0xFFFF)
+		return SF2BLD_ERR_OVERFLOW;
+	
+	Bags = (sfInstBag*)malloc(sizeof(sfInstBag) * (Lvl->zones.count + 1));
+	if (Bags == NULL)
+		return SF2BLD_ERR_MEMORY;
+	
+	GenIdx = 0;
+	ModIdx = 0;
+	CurZone = 0;
+	for (CurHdr = 0; CurHdr < Lvl->hdrs.count; CurHdr ++)
+	{
+		for (HdrZone = 0; HdrZone < ZoneCnt[CurHdr]; HdrZone ++, CurZone ++)
+		{
+			Zone = &Zones[CurZone];
+			ZGen = &Gens[GenIdx];
+			for (CurGen = 0; CurGen < Zone->genCnt; CurGen ++)
+			{
+				switch(ZGen[CurGen].sfGenOper)
+				{
+				case keyRange:	// must be the first generator
+					if (CurGen > 0)
+						break;
+					continue;
+				case velRange:	// may only be preceded by keyRange
+					if (CurGen > 1 || (CurGen == 1 && ZGen[0].sfGenOper != keyRange))
+						break;
+					continue;
+				default:
+					if (ZGen[CurGen].sfGenOper != LinkGen)
+						continue;
+					if (CurGen + 1 < Zone->genCnt)	// sampleID/instrument must be the last generator
+						break;
+					if (ZGen[CurGen].genAmount.wAmount >= LinkMax)
+					{
+						free(Bags);
+						return (LinkGen == sampleID) ? SF2BLD_ERR_SAMPLE_ID : SF2BLD_ERR_INST_ID;
+					}
+					continue;
+				}
+				free(Bags);
+				return SF2BLD_ERR_GEN_ORDER;
+			}
+			// Only the first zone may be a global zone. (no sampleID/instrument generator)
+			if (HdrZone > 0 && (! Zone->genCnt || ZGen[Zone->genCnt - 1].sfGenOper != LinkGen))
+			{
+				free(Bags);
+				return SF2BLD_ERR_GLOBAL_ZONE;
+			}
+			
+			Bags[CurZone].wInstGenNdx = (WORD)GenIdx;
+			Bags[CurZone].wInstModNdx = (WORD)ModIdx;
+			GenIdx += Zone->genCnt;
+			ModIdx += Zone->modCnt;
+		}
+	}
+	Bags[CurZone].wInstGenNdx = (WORD)GenIdx;
+	Bags[CurZone].wInstModNdx = (WORD)ModIdx;
+	
+	*RetBags = Bags;
+	return SF2BLD_ERR_OK;
+}
+
+// Adds the terminal records and makes 'pdta' chunks for all arrays.
+// The chunks aren't added to the list yet and the data still belongs to the level, so a failure
+// leaves the SF2 data untouched.
+static UINT8 Level_MakeChunks(SF2_BLD_LEVEL* Lvl, sfInstBag* Bags, const FOURCC* ChkIDs, ITEM_CHUNK** RetChks)
+{
+	void* TermHdr;
+	UINT32 BagCnt;
+	UINT8 CurChk;
+	
+	BagCnt = Lvl->zones.count + 1;
+	TermHdr = Array_Add(&Lvl->hdrs);
+	if (TermHdr == NULL || Array_Add(&Lvl->gens) == NULL || Array_Add(&Lvl->mods) == NULL)
+		return SF2BLD_ERR_MEMORY;
+	if (ChkIDs[0] == FCC_phdr)
+	{
+		sfPresetHeader* PHdr = (sfPresetHeader*)TermHdr;
+		strcpy(PHdr->achPresetName, "EOP");	// write "End Of Presets" header
+		PHdr->wPresetBagNdx = (WORD)Lvl->zones.count;
+	}
+	else
+	{
+		sfInst* IHdr = (sfInst*)TermHdr;
+		strcpy(IHdr->achInstName, "EOI");	// write "End Of Instruments" header
+		IHdr->wInstBagNdx = (WORD)Lvl->zones.count;
+	}
+	
+	RetChks[0] = Item_MakeChunk(ChkIDs[0], Lvl->hdrs.count * Lvl->hdrs.itemSize, Lvl->hdrs.data, 0x00);
+	RetChks[1] = Item_MakeChunk(ChkIDs[1], BagCnt * sizeof(sfInstBag), Bags, 0x00);
+	RetChks[2] = Item_MakeChunk(ChkIDs[2], Lvl->mods.count * Lvl->mods.itemSize, Lvl->mods.data, 0x00);
+	RetChks[3] = Item_MakeChunk(ChkIDs[3], Lvl->gens.count * Lvl->gens.itemSize, Lvl->gens.data, 0x00);
+	for (CurChk = 0; CurChk < 4; CurChk ++)
+	{
+		if (RetChks[CurChk] == NULL)
+			break;
+	}
+	if (CurChk < 4)
+	{
+		for (CurChk = 0; CurChk < 4; CurChk ++)
+		{
+			free(RetChks[CurChk]);	// only the chunk structures, not the data
+			RetChks[CurChk] = NULL;
+		}
+		return SF2BLD_ERR_MEMORY;
+	}
+	
+	return SF2BLD_ERR_OK;
+}
+
+// Adds the chunks of Level_MakeChunks to the 'pdta' list. They own the level's data afterwards.
+static void Level_AttachChunks(SF2_BLD_LEVEL* Lvl, LIST_CHUNK* LstChk, ITEM_CHUNK** Chks)
+{
+	UINT8 CurChk;
+	
+	for (CurChk = 0; CurChk < 4; CurChk ++)
+		List_AddItem(LstChk, Chks[CurChk]);
+	
+	Lvl->hdrs.data = NULL;
+	Lvl->mods.data = NULL;
+	Lvl->gens.data = NULL;
+	Level_Free(Lvl);
+	
+	return;
+}
+
+SF2_BUILDER* SF2Bld_Create(void)
+{
+	SF2_BUILDER* Bld;
+	
+	Bld = (SF2_BUILDER*)malloc(sizeof(SF2_BUILDER));
+	if (Bld == NULL)
+		return NULL;
+	
+	Level_Init(&Bld->ins, sizeof(sfInst));
+	Level_Init(&Bld->prs, sizeof(sfPresetHeader));
+	
+	return Bld;
+}
+
+void SF2Bld_Free(SF2_BUILDER* Bld)
+{
+	Level_Free(&Bld->ins);
+	Level_Free(&Bld->prs);
+	free(Bld);
+	
+	return;
+}
+
+UINT16 SF2Bld_AddInstrument(SF2_BUILDER* Bld, const char* Name)
+{
+	sfInst* Ins;
+	
+	Ins = (sfInst*)Level_AddHeader(&Bld->ins);
+	if (Ins != NULL)
+		strncpy(Ins->achInstName, Name, 20 - 1);
+	
+	return (UINT16)(Bld->ins.hdrs.count - 1);
+}
+
+void SF2Bld_AddInsZone(SF2_BUILDER* Bld)
+{
+	Level_AddZone(&Bld->ins);
+	return;
+}
+
+void SF2Bld_AddInsGen_S16(SF2_BUILDER* Bld, UINT16 Type, INT16 Data)
+{
+	sfGenList* Gen = Level_AddGen(&Bld->ins, Type);
+	if (Gen != NULL)
+		Gen->genAmount.shAmount = Data;
+	
+	return;
+}
+
+void SF2Bld_AddInsGen_U16(SF2_BUILDER* Bld, UINT16 Type, UINT16 Data)
+{
+	sfGenList* Gen = Level_AddGen(&Bld->ins, Type);
+	if (Gen != NULL)
+		Gen->genAmount.wAmount = Data;
+	
+	return;
+}
+
+void SF2Bld_AddInsGen_8(SF2_BUILDER* Bld, UINT16 Type, UINT8 DataL, UINT8 DataH)
+{
+	sfGenList* Gen = Level_AddGen(&Bld->ins, Type);
+	if (Gen != NULL)
+	{
+		Gen->genAmount.ranges.byLo = DataL;
+		Gen->genAmount.ranges.byHi = DataH;
+	}
+	
+	return;
+}
+
+void SF2Bld_AddInsMod(SF2_BUILDER* Bld, const sfInstModList* Mod)
+{
+	Level_AddMod(&Bld->ins, (const sfModList*)Mod);	// both structures have the same layout
+	return;
+}
+
+UINT16 SF2Bld_AddPreset(SF2_BUILDER* Bld, const char* Name, UINT16 Preset, UINT16 Bank)
+{
+	sfPresetHeader* Prs;
+	
+	Prs = (sfPresetHeader*)Level_AddHeader(&Bld->prs);
+	if (Prs != NULL)
+	{
+		strncpy(Prs->achPresetName, Name, 20 - 1);
+		Prs->wPreset = Preset;
+		Prs->wBank = Bank;
+		// dwLibrary, dwGenre and dwMorphology must be 0
+	}
+	
+	return (UINT16)(Bld->prs.hdrs.count - 1);
+}
+
+void SF2Bld_AddPrsZone(SF2_BUILDER* Bld)
+{
+	Level_AddZone(&Bld->prs);
+	return;
+}
+
+void SF2Bld_AddPrsGen_S16(SF2_BUILDER* Bld, UINT16 Type, INT16 Data)
+{
+	sfGenList* Gen = Level_AddGen(&Bld->prs, Type);
+	if (Gen != NULL)
+		Gen->genAmount.shAmount = Data;
+	
+	return;
+}
+
+void SF2Bld_AddPrsGen_U16(SF2_BUILDER* Bld, UINT16 Type, UINT16 Data)
+{
+	sfGenList* Gen = Level_AddGen(&Bld->prs, Type);
+	if (Gen != NULL)
+		Gen->genAmount.wAmount = Data;
+	
+	return;
+}
+
+void SF2Bld_AddPrsGen_8(SF2_BUILDER* Bld, UINT16 Type, UINT8 DataL, UINT8 DataH)
+{
+	sfGenList* Gen = Level_AddGen(&Bld->prs, Type);
+	if (Gen != NULL)
+	{
+		Gen->genAmount.ranges.byLo = DataL;
+		Gen->genAmount.ranges.byHi = DataH;
+	}
+	
+	return;
+}
+
+void SF2Bld_AddPrsMod(SF2_BUILDER* Bld, const sfModList* Mod)
+{
+	Level_AddMod(&Bld->prs, Mod);
+	return;
+}
+
+UINT8 SF2Bld_Finalize(SF2_BUILDER* Bld, SF2_DATA* SF2Data, UINT16 SmplCnt)
+{
+	static const FOURCC PRS_CHUNKS[4] = {FCC_phdr, FCC_pbag, FCC_pmod, FCC_pgen};
+	static const FOURCC INS_CHUNKS[4] = {FCC_inst, FCC_ibag, FCC_imod, FCC_igen};
+	LIST_CHUNK* LstChk;
+	sfInstBag* InsBags;
+	sfInstBag* PrsBags;
+	ITEM_CHUNK* InsChks[4];
+	ITEM_CHUNK* PrsChks[4];
+	sfInst* Ins;
+	sfPresetHeader* Prs;
+	UINT32 CurHdr;
+	UINT32 BagIdx;
+	const UINT32* ZoneCnt;
+	UINT8 CurChk;
+	UINT8 RetVal;
+	
+	if (Bld->ins.error)
+		return Bld->ins.error;
+	if (Bld->prs.error)
+		return Bld->prs.error;
+	LstChk = List_GetChunk(SF2Data->Lists, FCC_pdta);
+	if (LstChk == NULL)
+		return SF2BLD_ERR_MEMORY;
+	
+	// validate everything first, so that the SF2 data stays untouched in case of an error
+	RetVal = Level_MakeBags(&Bld->ins, sampleID, SmplCnt, &InsBags);
+	if (RetVal)
+		return RetVal;
+	RetVal = Level_MakeBags(&Bld->prs, instrument, (UINT16)Bld->ins.hdrs.count, &PrsBags);
+	if (RetVal)
+	{
+		free(InsBags);
+		return RetVal;
+	}
+	
+	// assign bag indices to the headers
+	Ins = (sfInst*)Bld->ins.hdrs.data;
+	ZoneCnt = (const UINT32*)Bld->ins.zoneCnt.data;
+	for (CurHdr = 0, BagIdx = 0; CurHdr < Bld->ins.hdrs.count; CurHdr ++)
+	{
+		Ins[CurHdr].wInstBagNdx = (WORD)BagIdx;
+		BagIdx += ZoneCnt[CurHdr];
+	}
+	Prs = (sfPresetHeader*)Bld->prs.hdrs.data;
+	ZoneCnt = (const UINT32*)Bld->prs.zoneCnt.data;
+	for (CurHdr = 0, BagIdx = 0; CurHdr < Bld->prs.hdrs.count; CurHdr ++)
+	{
+		Prs[CurHdr].wPresetBagNdx = (WORD)BagIdx;
+		BagIdx += ZoneCnt[CurHdr];
+	}
+	
+	// Both levels are prepared before anything is added, so that the 'pdta' list is never half-written.
+	memset(PrsChks, 0x00, sizeof(PrsChks));
+	memset(InsChks, 0x00, sizeof(InsChks));
+	RetVal = Level_MakeChunks(&Bld->prs, PrsBags, PRS_CHUNKS, PrsChks);
+	if (! RetVal)
+		RetVal = Level_MakeChunks(&Bld->ins, InsBags, INS_CHUNKS, InsChks);
+	if (RetVal)
+	{
+		for (CurChk = 0; CurChk < 4; CurChk ++)
+			free(PrsChks[CurChk]);
+		free(PrsBags);
+		free(InsBags);
+		return RetVal;
+	}
+	Level_AttachChunks(&Bld->prs, LstChk, PrsChks);
+	Level_AttachChunks(&Bld->ins, LstChk, InsChks);
+	
+	return SF2BLD_ERR_OK;
+}
+
+
 // --- List Chunk Handling ---
 LIST_CHUNK* List_MakeChunk(const FOURCC fccID)
 {
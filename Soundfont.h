@@ -304,12 +304,73 @@ RIFF 'sfbk'
 #define FCC_shdr		MAKEFOURCC('s', 'h', 'd', 'r')
 
 
+// --- Preset/Instrument Builder ---
+// Instruments/presets are built by adding zones and generators in the order they appear in the file.
+// Indices (bag -> generator/modulator) are assigned by SF2Bld_Finalize, which adds the terminal
+// records, validates the data and moves the arrays into the 'pdta' chunk.
+typedef struct _sf2_array
+{
+	UINT32 count;
+	UINT32 alloc;
+	UINT32 itemSize;
+	void* data;
+} SF2_ARRAY;
+
+typedef struct _sf2_bld_zone
+{
+	UINT32 genCnt;
+	UINT32 modCnt;
+} SF2_BLD_ZONE;
+
+typedef struct _sf2_bld_level	// one hierarchy level (either presets or instruments)
+{
+	SF2_ARRAY hdrs;		// sfPresetHeader or sfInst (bag index = number of zones)
+	SF2_ARRAY zoneCnt;	// UINT32, zones per header
+	SF2_ARRAY zones;	// SF2_BLD_ZONE
+	SF2_ARRAY gens;		// sfGenList or sfInstGenList
+	SF2_ARRAY mods;		// sfModList or sfInstModList
+	UINT8 error;		// sticky error from adding items (SF2BLD_ERR_*)
+} SF2_BLD_LEVEL;
+
+typedef struct _sf2_builder
+{
+	SF2_BLD_LEVEL ins;
+	SF2_BLD_LEVEL prs;
+} SF2_BUILDER;
+
+// SF2Bld_Finalize return codes
+#define SF2BLD_ERR_OK			0x00
+#define SF2BLD_ERR_OVERFLOW		0x01	// more than 0xFFFF headers/bags/generators/modulators
+#define SF2BLD_ERR_GEN_ORDER	0x02	// keyRange/velRange not at the beginning or sampleID/instrument not at the end
+#define SF2BLD_ERR_SAMPLE_ID	0x03	// sampleID >= number of samples
+#define SF2BLD_ERR_INST_ID		0x04	// instrument >= number of instruments
+#define SF2BLD_ERR_GLOBAL_ZONE	0x05	// zone without sampleID/instrument that is not the first zone
+#define SF2BLD_ERR_MEMORY		0xFF
+
+
 SF2_DATA* CreateSF2Base(const char* SoundfontName);
 void FreeSF2Data(SF2_DATA* SF2Data);
 void CalculateSF2BlockSizes(SF2_DATA* SF2Data);
 UINT8 WriteSF2toFile(SF2_DATA* SF2Data, const char* FileName);
 UINT8 SortSF2Chunks(SF2_DATA* SF2Data);
 
+// --- Preset/Instrument Builder ---
+SF2_BUILDER* SF2Bld_Create(void);
+void SF2Bld_Free(SF2_BUILDER* Bld);
+UINT16 SF2Bld_AddInstrument(SF2_BUILDER* Bld, const char* Name);
+void SF2Bld_AddInsZone(SF2_BUILDER* Bld);
+void SF2Bld_AddInsGen_S16(SF2_BUILDER* Bld, UINT16 Type, INT16 Data);
+void SF2Bld_AddInsGen_U16(SF2_BUILDER* Bld, UINT16 Type, UINT16 Data);
+void SF2Bld_AddInsGen_8(SF2_BUILDER* Bld, UINT16 Type, UINT8 DataL, UINT8 DataH);
+void SF2Bld_AddInsMod(SF2_BUILDER* Bld, const sfInstModList* Mod);
+UINT16 SF2Bld_AddPreset(SF2_BUILDER* Bld, const char* Name, UINT16 Preset, UINT16 Bank);
+void SF2Bld_AddPrsZone(SF2_BUILDER* Bld);
+void SF2Bld_AddPrsGen_S16(SF2_BUILDER* Bld, UINT16 Type, INT16 Data);
+void SF2Bld_AddPrsGen_U16(SF2_BUILDER* Bld, UINT16 Type, UINT16 Data);
+void SF2Bld_AddPrsGen_8(SF2_BUILDER* Bld, UINT16 Type, UINT8 DataL, UINT8 DataH);
+void SF2Bld_AddPrsMod(SF2_BUILDER* Bld, const sfModList* Mod);
+UINT8 SF2Bld_Finalize(SF2_BUILDER* Bld, SF2_DATA* SF2Data, UINT16 SmplCnt);
+
 // --- List Chunk Handling ---
 LIST_CHUNK* List_MakeChunk(const FOURCC fccID);
 LIST_CHUNK* List_GetChunk(const LIST_CHUNK* FirstChk, const FOURCC fccID);
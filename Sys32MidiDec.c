@@ -4,9 +4,10 @@
 #include <stdlib.h>
 #include <memory.h>	// for memcpy()
 #include <string.h>	// for strlen()
-#include <math.h>	// for powf()
 #include "stdtype.h"
 #include "stdbool.h"
+#define SCSP_TABLES
+#include "chip_tables.h"
 
 #define INLINE	static __inline
 
@@ -24,10 +25,6 @@ static UINT32 WriteMarker(const char* Text, UINT32 MidStPos);
 static UINT32 DecodeMidiSegment(UINT32 ROMStPos, UINT32 MidStPos);
 static UINT32 DoCommandB0(UINT32 MidStPos, UINT8 Command, UINT8 Arg1, UINT8 Arg2);
 
-INLINE UINT8 TrkVol2MidiVol(UINT8 Volume);
-INLINE UINT8 NoteVel2MidiVol(UINT8 Velocity);
-INLINE UINT8 DB2MidiVol(float DB);
-
 INLINE UINT16 ReadLE16(const UINT8* Data);
 INLINE void WriteBE16(UINT8* Buffer, UINT16 Value);
 INLINE void WriteBE32(UINT8* Buffer, UINT32 Value);
@@ -101,6 +98,7 @@ int main(int argc, char* argv[])
 	FixDrumNotes = true;
 	Mode = MODE_SF2;
 	Mode = MODE_MIDI;
+	SCSP_InitTables(NULL);	// velocity table unknown - keep velocities as they are
 	
 	hFile = fopen(SND_DRV_FILE, "rb");
 	if (hFile == NULL)
@@ -526,7 +524,7 @@ static UINT32 DecodeMidiSegment(UINT32 ROMStPos, UINT32 MidStPos)
 			if ((LastCmd & 0xF0) == 0xB0)
 			{
 				if (Param1 == 0x07 && FixVolume)
-					Param2 = TrkVol2MidiVol(Param2);
+					Param2 = SCSP_Vol2Mid[Param2];
 			}
 			MidData[MidPos] = Param2;
 			CurPos ++;	MidPos ++;
@@ -561,7 +559,7 @@ static UINT32 DecodeMidiSegment(UINT32 ROMStPos, UINT32 MidStPos)
 			}
 			
 			if (FixVolume)
-				Param2 = NoteVel2MidiVol(Param2);
+				Param2 = SCSP_Vel2Mid[Param2];
 			MidData[MidPos] = Param2;
 			CurPos ++;	MidPos ++;
 			
@@ -692,7 +690,7 @@ static UINT32 DoCommandB0(UINT32 MidStPos, UINT8 Command, UINT8 Arg1, UINT8 Arg2
 			
 			TempByt = ROMData[CurPos + 0x02] / 2;
 			if (FixVolume)
-				TempByt = TrkVol2MidiVol(TempByt);
+				TempByt = SCSP_Vol2Mid[TempByt];
 			MidData[MidPos] = 0x00;				MidPos ++;
 			MidData[MidPos] = 0xB0 | MidChn;	MidPos ++;
 			MidData[MidPos] = 0x07;				MidPos ++;
@@ -716,51 +714,6 @@ static UINT32 DoCommandB0(UINT32 MidStPos, UINT8 Command, UINT8 Arg1, UINT8 Arg2
 }
 
 
-INLINE UINT8 TrkVol2MidiVol(UINT8 Volume)
-{
-	// Volume is 00..7F
-	// The driver scales it up to 00 (min) to FF (max). One step is 0.1875 db.
-	// So the non-scaled volume uses 0.375 db steps.
-	UINT8 DBVal;
-	float DBFlt;
-	
-	if (! Volume)
-		return 0x00;
-	
-	DBVal = Volume ^ 0x7F;	// 00..7F -> 7F..00
-	DBFlt = DBVal * -0.375f;
-	return DB2MidiVol(DBFlt);
-}
-
-INLINE UINT8 NoteVel2MidiVol(UINT8 Velocity)
-{
-	/*UINT8 DBVal;
-	float DBFlt;
-	
-	if (! Velocity)
-		return 0x00;
-	
-	DBVal = VELOC_DATA[Velocity & 0x7F];
-	// Every entry in the table has bit 0 set, so
-	// I'll scale it down to 00..7F here.
-	DBVal = (DBVal >> 1) ^ 0x7F;
-	DBFlt = DBVal * -0.375f;
-	return DB2MidiVol(DBFlt);*/
-	return Velocity;
-}
-
-INLINE UINT8 DB2MidiVol(float DB)
-{
-	float TempSng;
-	
-	TempSng = (float)pow(10.0, DB / 40.0);
-	if (TempSng > 1.0f)
-		TempSng = 1.0f;
-	return (UINT8)(TempSng * 0x7F + 0.5);
-}
-
-
-
 INLINE UINT16 ReadLE16(const UINT8* Data)
 {
 	return (Data[0x00] << 0) | (Data[0x01] << 8);
@@ -8,12 +8,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 
 #include "midi_funcs.h"
 
 static UINT8 ConvertSong(UINT32);
 static void GetSongTable(UINT32);
+static UINT8 LoadROM(const char* fileName);
+static UINT8 WriteMidFile(const char* fileName);
+static UINT8 ConvertAllSongs(const char* romFileName, const char* outFileName);
 
 #define ROM_SIZE	0x080000
 
@@ -30,27 +34,51 @@ static UINT8 temp_bytes[8];
 
 int main(int argc, char* argv[])
 {
-	FILE* hFile;
+	int argbase;
+	int result;
 	
 	if (argc < 2)
 	{
-		printf("Usage: %s soundrom.bin [song_id out.mid]\n");
+		printf("Usage: %s soundrom.bin [song_id out.mid]\n", argv[0]);
 		printf("leave song_id blank to just get song count\n");
+		printf("Usage, all songs: %s -all soundrom.bin out.mid [soundrom2.bin out2.mid ...]\n", argv[0]);
+		printf("converts all songs of each ROM to out_0.mid, out_1.mid, ...\n");
 		return 0;
 	}
 	
-	hFile = fopen(argv[1], "rb");
-	if (hFile == NULL)
+	srcSize = ROM_SIZE;
+	// The padding prevents commands at the end of the ROM from reading beyond the buffer.
+	srcData = (UINT8*)calloc(srcSize + 0x10, 1);
+	if (srcData == NULL)
 	{
-		printf("Error opening file %s!\n", argv[1]);
+		printf("Not enough memory!\n");
 		return 1;
 	}
 	
-	srcSize = ROM_SIZE;
-	srcData = (UINT8*)malloc(srcSize);
-	fread(srcData, 1, srcSize, hFile);
+	if (! strcmp(argv[1], "-all"))
+	{
+		if (argc < 4 || (argc - 2) % 2)
+		{
+			printf("Error: -all needs pairs of ROM and output file names.\n");
+			free(srcData);	srcData = NULL;
+			return 1;
+		}
+		// batch mode: the ROMs are loaded only once and all songs are converted in a single run
+		result = 0;
+		for (argbase = 2; argbase + 1 < argc; argbase += 2)
+		{
+			if (ConvertAllSongs(argv[argbase + 0], argv[argbase + 1]))
+				result = 1;
+		}
+		free(srcData);	srcData = NULL;
+		return result;
+	}
 	
-	fclose(hFile);
+	if (LoadROM(argv[1]))
+	{
+		free(srcData);	srcData = NULL;
+		return 1;
+	}
 	
 	GetSongTable(0x7ff8);
 	
@@ -58,6 +86,7 @@ int main(int argc, char* argv[])
 	{
 		// convert all songs ?
 		printf("Song count = %d\n",songCount);
+		free(srcData);	srcData = NULL;
 		return 1;
 	}
 	else
@@ -68,21 +97,18 @@ int main(int argc, char* argv[])
 		{
 			ConvertSong(songTable[songid]);
 			
-			hFile = fopen(argv[3], "wb");
-			if (hFile == NULL)
+			result = WriteMidFile(argv[3]);
+			free(dstData);	dstData = NULL;
+			if (result)
 			{
-				printf("Error opening file %s!\n", argv[2]);
+				free(srcData);	srcData = NULL;
 				return 1;
 			}
-			
-			fwrite(dstData, 1, dstSize, hFile);
-			
-			fclose(hFile);
-			free(dstData);	dstData = NULL;
 		}
 		else
 		{
 			printf("Song count = %d\n",songCount);
+			free(srcData);	srcData = NULL;
 			return 1;
 		}
 	}
@@ -92,9 +118,102 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
+static UINT8 LoadROM(const char* fileName)
+{
+	FILE* hFile;
+	size_t readLen;
+	
+	hFile = fopen(fileName, "rb");
+	if (hFile == NULL)
+	{
+		printf("Error opening file %s!\n", fileName);
+		return 0xFF;
+	}
+	
+	memset(srcData, 0x00, srcSize);	// smaller ROMs must not leave data from the previous ROM
+	readLen = fread(srcData, 1, srcSize, hFile);
+	if (! readLen || ferror(hFile))
+	{
+		printf("Error reading file %s!\n", fileName);
+		fclose(hFile);
+		return 0xFF;
+	}
+	if (readLen < srcSize)
+		printf("Warning: %s has only 0x%X bytes, the rest of the 0x%X byte ROM is treated as zeros.\n",
+				fileName, (unsigned)readLen, srcSize);
+	
+	fclose(hFile);
+	
+	return 0x00;
+}
+
+static UINT8 WriteMidFile(const char* fileName)
+{
+	FILE* hFile;
+	
+	hFile = fopen(fileName, "wb");
+	if (hFile == NULL)
+	{
+		printf("Error opening file %s!\n", fileName);
+		return 0xFF;
+	}
+	
+	fwrite(dstData, 1, dstSize, hFile);
+	
+	fclose(hFile);
+	
+	return 0x00;
+}
+
+static UINT8 ConvertAllSongs(const char* romFileName, const char* outFileName)
+{
+	const char* fileExt;
+	char* outName;
+	char* outExt;
+	UINT16 curSong;
+	clock_t startTime;
+	clock_t totalTime;
+	UINT8 result;
+	
+	if (LoadROM(romFileName))
+		return 0xFF;
+	GetSongTable(0x7ff8);
+	printf("%s: Song count = %d\n", romFileName, songCount);
+	
+	// out.mid -> out_0.mid, out_1.mid, ...
+	fileExt = strrchr(outFileName, '.');
+	if (fileExt == NULL || strchr(fileExt, '/') != NULL || strchr(fileExt, '\\') != NULL)
+		fileExt = outFileName + strlen(outFileName);
+	outName = (char*)malloc(strlen(outFileName) + 0x10);
+	strcpy(outName, outFileName);
+	outExt = outName + (fileExt - outFileName);
+	
+	result = 0x00;
+	totalTime = 0;
+	for (curSong = 0; curSong < songCount; curSong ++)
+	{
+		sprintf(outExt, "_%u%s", curSong, fileExt);
+		
+		startTime = clock();
+		ConvertSong(songTable[curSong]);
+		startTime = clock() - startTime;
+		totalTime += startTime;
+		printf("converting song %u -> %s (%.2f ms)\n", curSong, outName,
+				startTime * 1000.0 / CLOCKS_PER_SEC);
+		
+		if (WriteMidFile(outName))
+			result = 0xFF;
+		free(dstData);	dstData = NULL;
+	}
+	printf("%u songs converted in %.2f ms\n", songCount, totalTime * 1000.0 / CLOCKS_PER_SEC);
+	free(outName);
+	
+	return result;
+}
+
 static inline UINT32 ReadUINT32(UINT32 offset)
 {
-	return (srcData[offset] << 0) | (srcData[offset + 0x01] << 8) | (srcData[offset + 0x02] << 16) | (srcData[offset + 0x03] << 24);
+	return (srcData[offset] << 0) | (srcData[offset + 0x01] << 8) | (srcData[offset + 0x02] << 16) | ((UINT32)srcData[offset + 0x03] << 24);
 }
 
 static inline UINT32 ReadUINT16(UINT32 offset)
@@ -107,14 +226,21 @@ static void GetSongTable(UINT32 start)
 	int i;
 	UINT32 songtab_pos = ReadUINT32(start) - 0x80000;
 	
+	if (songtab_pos + 2 > srcSize)
+	{
+		printf("Invalid song table offset 0x%06X!\n", songtab_pos);
+		songCount = 0;
+		return;
+	}
 	songCount = ReadUINT16(songtab_pos);
 	//songtab_pos += 2;
+	if (songCount > (srcSize - songtab_pos - 2) / 4)
+		songCount = (srcSize - songtab_pos - 2) / 4;
+	if (songCount > SONG_MAX)
+		songCount = SONG_MAX;
 
 	for(i=0; i<songCount; i++)
 	{
-		if(i == SONG_MAX)
-			break;
-
 		songTable[i] = ReadUINT32(songtab_pos + 2 + (i*4)) + songtab_pos;
 	}
 }
@@ -155,7 +281,7 @@ static UINT8 ConvertSong(UINT32 songpos)
 	{
 		/* read a deltatime */
 		temp = 0;
-		while(srcData[curPos] == 0xf8)
+		while(curPos < srcSize && srcData[curPos] == 0xf8)
 		{
 			temp += srcData[curPos++];
 			//printf("%02x ", srcData[curPos-1]);
@@ -200,6 +326,8 @@ static UINT8 ConvertSong(UINT32 songpos)
 				break;
 			case 0xF2: // change tempo
 				temp = (srcData[curPos + 0x01] << 0);
+				if (temp == 0)
+					temp = 120;	// avoid division by zero
 				WriteBE32(temp_bytes,60000000/temp);
 				WriteMetaEvent(&midFileInf,&MTS,0x51,0x03,temp_bytes+1);
 				curPos += 0x02;
@@ -4,14 +4,72 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#ifndef _WIN32
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
 
 
 #include "midi_funcs.h"
+#include "thread_funcs.h"
 
-static UINT16 DetectTrackCount(UINT32 ptrListOfs);
-static UINT8 ConvertDemoSong(void);
-static UINT32 ReadBE32(const UINT8* data);
+typedef struct _demo_song
+{
+	UINT32 ptrListOfs;
+	UINT16 trkCount;
+	UINT8 ptrMode;	// 0 - offset points to track data, 1 - offset points to track pointer list
+	UINT8 result;	// 00 - OK, FF - error writing the file
+	char name[0x20];	// song title (empty if the ROM has none)
+	char* fileName;
+} DEMO_SONG;
 
+typedef struct _rom_job
+{
+	const char* romPath;
+	char* outBase;	// output path without song number and extension
+	UINT8 result;	// 00 - OK, 01 - out of memory (song list incomplete), FF - error reading the ROM
+	UINT16 songCnt;
+	DEMO_SONG* songs;
+} ROM_JOB;
+
+typedef struct _rom_worker
+{
+	OS_THREAD thread;
+	UINT32 jobCnt;
+	ROM_JOB* jobs;
+	UINT32 firstJob;
+	UINT32 jobStep;
+	const char* outDir;
+} ROM_WORKER;
+
+typedef struct _file_list
+{
+	UINT32 count;
+	UINT32 alloc;
+	char** names;
+} FILE_LIST;
+
+static UINT8 LoadROM(const char* fileName, UINT32* romSize, UINT8** romData);
+static UINT8 WriteFileData(const char* fileName, UINT32 dataLen, const UINT8* data);
+static UINT16 DetectTrackCount(UINT32 romSize, const UINT8* romData, UINT32 ptrListOfs, UINT8 checkData);
+static UINT32 CheckTrackData(UINT32 romSize, const UINT8* romData, UINT32 trkOfs);
+static UINT8 ReadSongTitle(UINT32 romSize, const UINT8* romData, UINT32 ptrOfs, char* title, size_t maxLen);
+static DEMO_SONG* AddDemoSong(UINT16* songCnt, UINT16* songAlloc, DEMO_SONG** songs);
+static UINT8 FindDemoSongs(UINT32 romSize, const UINT8* romData, UINT16* retSongCnt, DEMO_SONG** retSongs);
+static UINT8 ConvertDemoSong(UINT32 romSize, const UINT8* romData, const DEMO_SONG* song,
+							 UINT32* outSize, UINT8** outData);
+static int CatalogROMs(const char* outDir, int romArgCnt, char* romArgs[]);
+static char* GetUniqueOutBase(const char* outDir, const char* romPath, UINT32 prevCnt, const ROM_JOB* prevJobs);
+static void ROMWorker_Main(void* param);
+static UINT8 WriteIndexFile(const char* fileName, UINT32 jobCnt, const ROM_JOB* jobs);
+static UINT8 FileList_Add(FILE_LIST* list, char* fileName);
+static int FileList_Compare(const void* a, const void* b);
+static UINT8 ListDirFiles(const char* dirPath, FILE_LIST* list);
+static char* JoinPath(const char* dirPath, const char* fileName);
+static const char* GetLastDirSepPos(const char* fileName);
+INLINE const char* GetFileTitle(const char* fileName);
+static UINT32 ReadBE32(const UINT8* data);
 
 // TG100 v1.10 (xk731c00.bin)
 //	Demo Song offset:	0x01959E
@@ -70,92 +128,349 @@ static UINT32 ReadBE32(const UINT8* data);
 
 #define MIDI_RES	200	// a resolution of 200 (= 400 Hz) results in a reasonable tempo
 
-static UINT32 srcSize;
-static UINT8* srcData;
-static UINT32 dstSize;
-static UINT8* dstData;
-
-static UINT32 ptrListOfs = 0;
-static UINT16 trkCount = 0;
-static UINT8 ptrMode = 0;
+static UINT32 NUM_THREADS = 0;	// 0 = number of CPUs
+static UINT8 showMsgs = 1;
 
 int main(int argc, char* argv[])
 {
-	FILE* hFile;
+	int argbase;
+	UINT32 srcSize;
+	UINT8* srcData;
+	UINT32 dstSize;
+	UINT8* dstData;
+	DEMO_SONG song;
 	
 	printf("Yamaha TG/MU Demo Song Dumper\n-----------------------------\n");
+	if (argc >= 2 && ! strcmp(argv[1], "-cat"))
+	{
+		argbase = 2;
+		if (argbase + 1 < argc && ! strcmp(argv[argbase], "-j"))
+		{
+			NUM_THREADS = (UINT32)strtoul(argv[argbase + 1], NULL, 0);
+			argbase += 2;
+		}
+		if (argc < argbase + 2)
+		{
+			printf("Not enough arguments.\n");
+			return 0;
+		}
+		return CatalogROMs(argv[argbase], argc - (argbase + 1), &argv[argbase + 1]);
+	}
 	if (argc < 4)
 	{
 		printf("Usage: %s rom.bin ptrListOffset out.mid\n", argv[0]);
+		printf("       %s -cat [-j n] outDir rom.bin/romDir [...]\n", argv[0]);
+		printf("\n");
+		printf("Catalog mode (-cat) searches all ROMs for demo song pointer lists and dumps every\n");
+		printf("song that is found to outDir/RomName_##.mid. Directories are processed file by file.\n");
+		printf("ROMs with the same name get a number appended, e.g. RomName_2_##.mid.\n");
+		printf("An index with song names, offsets and track counts is written to outDir/index.txt.\n");
+		printf("    -j n    number of ROMs to process in parallel (default: 0 = number of CPUs)\n");
 		return 0;
 	}
 	
-	ptrListOfs = (UINT32)strtoul(argv[2], NULL, 0);
+	song.ptrListOfs = (UINT32)strtoul(argv[2], NULL, 0);
 	
-	hFile = fopen(argv[1], "rb");
-	if (hFile == NULL)
+	if (LoadROM(argv[1], &srcSize, &srcData))
 	{
 		printf("Error opening file %s!\n", argv[1]);
 		return 1;
 	}
 	
-	fseek(hFile, 0, SEEK_END);
-	srcSize = ftell(hFile);
-	fseek(hFile, 0, SEEK_SET);
-	srcData = (UINT8*)malloc(srcSize);
-	fread(srcData, 1, srcSize, hFile);
-	
-	fclose(hFile);
-	
-	trkCount = DetectTrackCount(ptrListOfs);
-	if (! trkCount)
+	song.trkCount = DetectTrackCount(srcSize, srcData, song.ptrListOfs, 0);
+	if (! song.trkCount)
 	{
 		printf("Offset pointing to direct track data.\n");
-		ptrMode = 0;
-		trkCount = 1;
+		song.ptrMode = 0;
+		song.trkCount = 1;
 	}
 	else
 	{
 		printf("Offset pointing to track list.\n");
-		ptrMode = 1;
+		song.ptrMode = 1;
 	}
 	
-	ConvertDemoSong();
+	ConvertDemoSong(srcSize, srcData, &song, &dstSize, &dstData);
+	free(srcData);	srcData = NULL;
 	
-	hFile = fopen(argv[3], "wb");
-	if (hFile == NULL)
+	if (WriteFileData(argv[3], dstSize, dstData))
 	{
-		printf("Error opening file %s!\n", argv[2]);
-		free(srcData);	srcData = NULL;
+		free(dstData);	dstData = NULL;
 		return 1;
 	}
+	free(dstData);	dstData = NULL;
+	
+	return 0;
+}
+
+static UINT8 LoadROM(const char* fileName, UINT32* romSize, UINT8** romData)
+{
+	FILE* hFile;
+	
+	hFile = fopen(fileName, "rb");
+	if (hFile == NULL)
+		return 0xFF;
 	
-	fwrite(dstData, 1, dstSize, hFile);
+	fseek(hFile, 0, SEEK_END);
+	*romSize = ftell(hFile);
+	fseek(hFile, 0, SEEK_SET);
+	*romData = (UINT8*)malloc(*romSize);
+	*romSize = (UINT32)fread(*romData, 1, *romSize, hFile);
 	
 	fclose(hFile);
 	
-	free(srcData);	srcData = NULL;
-	free(dstData);	dstData = NULL;
+	return 0x00;
+}
+
+static UINT8 WriteFileData(const char* fileName, UINT32 dataLen, const UINT8* data)
+{
+	FILE* hFile;
 	
-	return 0;
+	hFile = fopen(fileName, "wb");
+	if (hFile == NULL)
+	{
+		printf("Error opening file %s!\n", fileName);
+		return 0xFF;
+	}
+	
+	fwrite(data, 1, dataLen, hFile);
+	fclose(hFile);
+	
+	return 0x00;
 }
 
-static UINT16 DetectTrackCount(UINT32 ptrListOfs)
+static UINT16 DetectTrackCount(UINT32 romSize, const UINT8* romData, UINT32 ptrListOfs, UINT8 checkData)
 {
 	UINT32 curPos;
 	UINT32 tempOfs;
 	
-	for (curPos = ptrListOfs; curPos < srcSize; curPos += 0x04)
+	for (curPos = ptrListOfs; curPos + 0x04 <= romSize; curPos += 0x04)
 	{
-		tempOfs = ReadBE32(&srcData[curPos]);
-		if (tempOfs >= srcSize)
+		tempOfs = ReadBE32(&romData[curPos]);
+		if (tempOfs >= romSize)
+			break;
+		if (checkData && ! CheckTrackData(romSize, romData, tempOfs))
 			break;
 	}
 	
 	return (curPos - ptrListOfs) / 0x04;
 }
 
-static UINT8 ConvertDemoSong(void)
+// Parses track data the same way ConvertDemoSong does, but more strictly.
+// Returns the number of Note On events when the track is valid and 0 when it isn't.
+static UINT32 CheckTrackData(UINT32 romSize, const UINT8* romData, UINT32 trkOfs)
+{
+	// data bytes of the usual MIDI events (index: (command >> 4) & 0x07)
+	static const UINT8 EVT_DATA_LEN[0x08] = {1, 2, 2, 2, 1, 1, 2, 0};
+	UINT32 curPos;
+	UINT32 noteCnt;
+	UINT32 dlyCnt;
+	UINT8 curCmd;
+	UINT8 dataLen;
+	UINT8 curByte;
+	UINT8 off3;
+	
+	noteCnt = 0;
+	dlyCnt = 0;
+	off3 = 0;
+	curPos = trkOfs;
+	while(curPos < romSize)
+	{
+		curCmd = romData[curPos];
+		if (curCmd < 0x80)
+			return 0;
+		if (curCmd < 0xF0)
+		{
+			dataLen = EVT_DATA_LEN[(curCmd >> 4) & 0x07];
+			if ((curCmd & 0xF0) == 0x80 && off3)
+				dataLen = 2;
+			if (curPos + 1 + dataLen > romSize)
+				return 0;
+			// real MIDI data never has the high bit set
+			for (curByte = 0; curByte < dataLen; curByte ++)
+			{
+				if (romData[curPos + 1 + curByte] & 0x80)
+					return 0;
+			}
+			if ((curCmd & 0xF0) == 0x90)
+				noteCnt ++;
+			curPos += 1 + dataLen;
+			continue;
+		}
+		
+		switch(curCmd)
+		{
+		case 0xF0:	// SysEx Event
+			for (curPos ++; curPos < romSize; curPos ++)
+			{
+				if (romData[curPos] == 0xF7)
+					break;
+				if (romData[curPos] & 0x80)
+					return 0;
+			}
+			curPos ++;
+			break;
+		case 0xF1:	// unknown
+			off3 = 1;
+			curPos += 0x02;
+			break;
+		case 0xF2:	// song end
+			// require notes and delays, so that random data doesn't pass as empty song
+			return dlyCnt ? noteCnt : 0;
+		case 0xF3:	// 8-bit delay
+			dlyCnt ++;
+			curPos += 0x02;
+			break;
+		case 0xF4:	// 16-bit delay
+			dlyCnt ++;
+			curPos += 0x03;
+			break;
+		case 0xF5:	// ??
+			curPos += 0x02;
+			break;
+		case 0xF9:	// unknown
+			curPos += 0x03;
+			break;
+		default:
+			return 0;
+		}
+	}
+	
+	return 0;	// no song end
+}
+
+// The VL70-m has a list of title pointers right after the song pointers.
+static UINT8 ReadSongTitle(UINT32 romSize, const UINT8* romData, UINT32 ptrOfs, char* title, size_t maxLen)
+{
+	UINT32 txtOfs;
+	size_t curLen;
+	
+	if (ptrOfs + 0x04 > romSize)
+		return 0xFF;
+	txtOfs = ReadBE32(&romData[ptrOfs]);
+	if (txtOfs >= romSize)
+		return 0xFF;
+	
+	for (curLen = 0; curLen < maxLen - 1 && txtOfs + curLen < romSize; curLen ++)
+	{
+		UINT8 curChr = romData[txtOfs + curLen];
+		if (curChr < 0x20 || curChr >= 0x7F)
+			break;
+		title[curLen] = (char)curChr;
+	}
+	while(curLen > 0 && title[curLen - 1] == ' ')
+		curLen --;
+	title[curLen] = '\0';
+	
+	return (curLen >= 4) ? 0x00 : 0x01;
+}
+
+static DEMO_SONG* AddDemoSong(UINT16* songCnt, UINT16* songAlloc, DEMO_SONG** songs)
+{
+	DEMO_SONG* song;
+	
+	if (*songCnt >= *songAlloc)
+	{
+		if (*songAlloc >= 0x10000 - 0x10)
+			return NULL;
+		song = (DEMO_SONG*)realloc(*songs, (*songAlloc + 0x10) * sizeof(DEMO_SONG));
+		if (song == NULL)
+			return NULL;
+		*songs = song;
+		*songAlloc += 0x10;
+	}
+	song = &(*songs)[*songCnt];
+	(*songCnt) ++;
+	memset(song, 0x00, sizeof(DEMO_SONG));
+	
+	return song;
+}
+
+// Returns 0xFF when running out of memory. The songs found until then are returned nevertheless.
+static UINT8 FindDemoSongs(UINT32 romSize, const UINT8* romData, UINT16* retSongCnt, DEMO_SONG** retSongs)
+{
+	UINT32 curPos;
+	UINT16 trkCnt;
+	UINT16 curTrk;
+	UINT16 curSong;
+	UINT16 songCnt;
+	UINT16 songAlloc;
+	DEMO_SONG* songs;
+	DEMO_SONG* song;
+	char title[0x20];
+	UINT8 retVal;
+	
+	songCnt = 0;
+	songAlloc = 0;
+	songs = NULL;
+	retVal = 0x00;
+	// The H8 CPU reads 32-bit values from even addresses only.
+	for (curPos = 0x00; curPos + 0x04 <= romSize; curPos += 0x02)
+	{
+		trkCnt = DetectTrackCount(romSize, romData, curPos, 1);
+		if (! trkCnt)
+			continue;
+		
+		for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+		{
+			if (ReadSongTitle(romSize, romData, curPos + (trkCnt + curTrk) * 0x04, title, sizeof(title)))
+				break;
+		}
+		if (curTrk < trkCnt)
+		{
+			// list of tracks (one per port) that form a single song
+			// Some ROMs have copies of the list, so skip those.
+			for (curSong = 0; curSong < songCnt; curSong ++)
+			{
+				song = &songs[curSong];
+				if (song->ptrMode == 1 && song->trkCount == trkCnt &&
+					! memcmp(&romData[song->ptrListOfs], &romData[curPos], trkCnt * 0x04))
+					break;
+			}
+			if (curSong >= songCnt)
+			{
+				song = AddDemoSong(&songCnt, &songAlloc, &songs);
+				if (song == NULL)
+				{
+					retVal = 0xFF;
+					break;
+				}
+				song->ptrListOfs = curPos;
+				song->trkCount = trkCnt;
+				song->ptrMode = 1;
+			}
+			curPos += trkCnt * 0x04;
+		}
+		else
+		{
+			// list of single-track songs, followed by a list of song titles
+			for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+			{
+				song = AddDemoSong(&songCnt, &songAlloc, &songs);
+				if (song == NULL)
+					break;
+				song->ptrListOfs = ReadBE32(&romData[curPos + curTrk * 0x04]);
+				song->trkCount = 1;
+				song->ptrMode = 0;
+				ReadSongTitle(romSize, romData, curPos + (trkCnt + curTrk) * 0x04, song->name, sizeof(song->name));
+			}
+			if (curTrk < trkCnt)
+			{
+				retVal = 0xFF;
+				break;
+			}
+			curPos += trkCnt * 0x08;
+		}
+		curPos -= 0x02;	// compensate for the loop increment
+	}
+	
+	*retSongCnt = songCnt;
+	*retSongs = songs;
+	return retVal;
+}
+
+static UINT8 ConvertDemoSong(UINT32 romSize, const UINT8* romData, const DEMO_SONG* song,
+							 UINT32* outSize, UINT8** outData)
 {
 	FILE_INF midFileInf;
 	MID_TRK_STATE MTS;
@@ -170,31 +485,32 @@ static UINT8 ConvertDemoSong(void)
 	midFileInf.data = (UINT8*)malloc(midFileInf.alloc);
 	midFileInf.pos = 0x00;
 	
-	if (trkCount <= 1)
-		WriteMidiHeader(&midFileInf, 0, trkCount, MIDI_RES);	// format 0 for single-track MIDIs
+	if (song->trkCount <= 1)
+		WriteMidiHeader(&midFileInf, 0, song->trkCount, MIDI_RES);	// format 0 for single-track MIDIs
 	else
-		WriteMidiHeader(&midFileInf, 1, trkCount, MIDI_RES);
+		WriteMidiHeader(&midFileInf, 1, song->trkCount, MIDI_RES);
 	
 	off3 = 0;
-	for (curTrk = 0; curTrk < trkCount; curTrk ++)
+	for (curTrk = 0; curTrk < song->trkCount; curTrk ++)
 	{
 	
-	printf("Converting track %u / %u ...\n", 1 + curTrk, trkCount);
+	if (showMsgs)
+		printf("Converting track %u / %u ...\n", 1 + curTrk, song->trkCount);
 	WriteMidiTrackStart(&midFileInf, &MTS);
 	MTS.curDly = 0;
 	MTS.midChn = 0x00;
 	
-	if (trkCount > 1)
+	if (song->trkCount > 1)
 		WriteMetaEvent(&midFileInf, &MTS, 0x21, 0x01, &curTrk);	// track ID == port number
 	
 	trkEnd = 0;
-	if (! ptrMode)
-		curPos = ptrListOfs;
+	if (! song->ptrMode)
+		curPos = song->ptrListOfs;
 	else
-		curPos = ReadBE32(&srcData[ptrListOfs + curTrk * 0x04]);
-	while(curPos < srcSize && ! trkEnd)
+		curPos = ReadBE32(&romData[song->ptrListOfs + curTrk * 0x04]);
+	while(curPos < romSize && ! trkEnd)
 	{
-		curCmd = srcData[curPos];
+		curCmd = romData[curPos];
 		switch(curCmd & 0xF0)
 		{
 		// usual MIDI events
@@ -202,7 +518,7 @@ static UINT8 ConvertDemoSong(void)
 			// velocity being 0x40 internally was verified using a MU100 ROM
 			if (! off3)
 			{
-				WriteEvent(&midFileInf, &MTS, srcData[curPos + 0x00], srcData[curPos + 0x01], 0x40);
+				WriteEvent(&midFileInf, &MTS, romData[curPos + 0x00], romData[curPos + 0x01], 0x40);
 				curPos += 0x02;
 			}
 			else
@@ -210,7 +526,7 @@ static UINT8 ConvertDemoSong(void)
 				// The MU5 demo song uses this format.
 				// ... and even then the MU5 demo code assumes the "no velocity" format and just
 				// skips over all unknown command codes.
-				WriteEvent(&midFileInf, &MTS, srcData[curPos + 0x00], srcData[curPos + 0x01], srcData[curPos + 0x02]);
+				WriteEvent(&midFileInf, &MTS, romData[curPos + 0x00], romData[curPos + 0x01], romData[curPos + 0x02]);
 				curPos += 0x03;
 			}
 			break;
@@ -218,12 +534,12 @@ static UINT8 ConvertDemoSong(void)
 		case 0xA0:
 		case 0xB0:
 		case 0xE0:
-			WriteEvent(&midFileInf, &MTS, srcData[curPos + 0x00], srcData[curPos + 0x01], srcData[curPos + 0x02]);
+			WriteEvent(&midFileInf, &MTS, romData[curPos + 0x00], romData[curPos + 0x01], romData[curPos + 0x02]);
 			curPos += 0x03;
 			break;
 		case 0xC0:
 		case 0xD0:
-			WriteEvent(&midFileInf, &MTS, srcData[curPos + 0x00], srcData[curPos + 0x01], 0x00);
+			WriteEvent(&midFileInf, &MTS, romData[curPos + 0x00], romData[curPos + 0x01], 0x00);
 			curPos += 0x02;
 			break;
 		// special events
@@ -231,17 +547,18 @@ static UINT8 ConvertDemoSong(void)
 			switch(curCmd)
 			{
 			case 0xF0:	// SysEx Event
-				for (syxLen = 0x01; curPos + syxLen < srcSize - 1; syxLen ++)
+				for (syxLen = 0x01; curPos + syxLen < romSize - 1; syxLen ++)
 				{
-					if (srcData[curPos + syxLen] == 0xF7)
+					if (romData[curPos + syxLen] == 0xF7)
 						break;
 				}
-				WriteLongEvent(&midFileInf, &MTS, 0xF0, syxLen, &srcData[curPos + 0x01]);
+				WriteLongEvent(&midFileInf, &MTS, 0xF0, syxLen, &romData[curPos + 0x01]);
 				curPos += 0x01 + syxLen;
 				break;
 			case 0xF1:	// unknown
 				// found in MU5 demo song, but ignored by playback routine
-				printf("Warning: Unknown event %02X at position 0x%06X\n", curCmd, curPos);
+				if (showMsgs)
+					printf("Warning: Unknown event %02X at position 0x%06X\n", curCmd, curPos);
 				off3 = 1;
 				curPos += 0x02;
 				break;
@@ -253,7 +570,7 @@ static UINT8 ConvertDemoSong(void)
 					// Note: Internally on the MU100, all delays are divided by 4 before being
 					//       used for timing. I omit this behaviour here, as I haven't checked
 					//       how other modules behave and all delays were multiples of 4 anyway.
-					UINT8 dly = srcData[curPos + 0x01];
+					UINT8 dly = romData[curPos + 0x01];
 					MTS.curDly += dly;
 				}
 				curPos += 0x02;
@@ -261,30 +578,34 @@ static UINT8 ConvertDemoSong(void)
 			case 0xF4:	// 16-bit delay
 				{
 					// formula verified with MU100 ROM disassembly
-					UINT16 dly = (srcData[curPos + 0x01] & 0x7F) | (srcData[curPos + 0x02] << 7);
+					UINT16 dly = (romData[curPos + 0x01] & 0x7F) | (romData[curPos + 0x02] << 7);
 					MTS.curDly += dly;
 				}
 				curPos += 0x03;
 				break;
 			case 0xF5:	// ?? (copied to straight to MIDI command buffer)
 				// Is this a "port select" flag? (The serial protocol allows this.)
-				printf("Warning: Unhandled event %02X %02X at position 0x%06X\n",
-					curCmd, srcData[curPos + 0x01], curPos);
+				if (showMsgs)
+					printf("Warning: Unhandled event %02X %02X at position 0x%06X\n",
+						curCmd, romData[curPos + 0x01], curPos);
 				curPos += 0x02;
 				break;
 			case 0xF9:	// unknown
 				// found in MU5 demo song, but ignored by playback routine
-				printf("Warning: Unknown event %02X at position 0x%06X\n", curCmd, curPos);
+				if (showMsgs)
+					printf("Warning: Unknown event %02X at position 0x%06X\n", curCmd, curPos);
 				curPos += 0x03;
 				break;
 			default:
-				printf("Encountered unknown event 0x%02X at position 0x%06X\n", curCmd, curPos);
+				if (showMsgs)
+					printf("Encountered unknown event 0x%02X at position 0x%06X\n", curCmd, curPos);
 				trkEnd = 1;
 				break;
 			}
 			break;
 		default:
-			printf("Encountered unknown event 0x%02X at position 0x%06X\n", curCmd, curPos);
+			if (showMsgs)
+				printf("Encountered unknown event 0x%02X at position 0x%06X\n", curCmd, curPos);
 			trkEnd = 1;
 			break;
 		}
@@ -295,13 +616,403 @@ static UINT8 ConvertDemoSong(void)
 	
 	}	// end for (curTrk)
 	
-	dstData = midFileInf.data;
-	dstSize = midFileInf.pos;
-	printf("Done.\n");
+	*outData = midFileInf.data;
+	*outSize = midFileInf.pos;
+	if (showMsgs)
+		printf("Done.\n");
+	
+	return 0x00;
+}
+
+static int CatalogROMs(const char* outDir, int romArgCnt, char* romArgs[])
+{
+	FILE_LIST romList;
+	ROM_JOB* jobs;
+	ROM_WORKER* workers;
+	char* fileName;
+	UINT32 threadCnt;
+	UINT32 curThr;
+	UINT32 startedThr;
+	UINT32 curJob;
+	UINT32 songTotal;
+	UINT16 curSong;
+	UINT32 listStart;
+	int curArg;
+	int retVal;
+	
+	romList.count = 0;
+	romList.alloc = 0;
+	romList.names = NULL;
+	for (curArg = 0; curArg < romArgCnt; curArg ++)
+	{
+		listStart = romList.count;
+		if (! ListDirFiles(romArgs[curArg], &romList))
+		{
+			// sort every directory by file name, so that the index doesn't depend on the file system
+			qsort(&romList.names[listStart], romList.count - listStart, sizeof(char*), &FileList_Compare);
+		}
+		else
+		{
+			fileName = (char*)malloc(strlen(romArgs[curArg]) + 1);
+			strcpy(fileName, romArgs[curArg]);
+			if (FileList_Add(&romList, fileName))
+			{
+				free(fileName);
+				printf("Out of memory!\n");
+				break;
+			}
+		}
+	}
+	if (! romList.count)
+	{
+		printf("No ROMs found.\n");
+		return 0;
+	}
+	
+	jobs = (ROM_JOB*)calloc(romList.count, sizeof(ROM_JOB));
+	if (jobs == NULL)
+	{
+		printf("Out of memory!\n");
+		for (curJob = 0; curJob < romList.count; curJob ++)
+			free(romList.names[curJob]);
+		free(romList.names);
+		return 1;
+	}
+	for (curJob = 0; curJob < romList.count; curJob ++)
+	{
+		jobs[curJob].romPath = romList.names[curJob];
+		// ROMs with the same name (from different directories) must not overwrite each other's files,
+		// so the names are made unique before the threads start.
+		jobs[curJob].outBase = GetUniqueOutBase(outDir, jobs[curJob].romPath, curJob, jobs);
+	}
+	
+	// The ROMs are completely independent, so they can be processed in parallel.
+	showMsgs = 0;
+	threadCnt = NUM_THREADS ? NUM_THREADS : Thread_GetCPUCount();
+	if (threadCnt > romList.count)
+		threadCnt = romList.count;
+	workers = (ROM_WORKER*)calloc(threadCnt, sizeof(ROM_WORKER));
+	if (workers == NULL)
+	{
+		printf("Out of memory!\n");
+		for (curJob = 0; curJob < romList.count; curJob ++)
+		{
+			free(jobs[curJob].outBase);
+			free(romList.names[curJob]);
+		}
+		free(jobs);
+		free(romList.names);
+		return 1;
+	}
+	for (curThr = 0; curThr < threadCnt; curThr ++)
+	{
+		workers[curThr].jobCnt = romList.count;
+		workers[curThr].jobs = jobs;
+		workers[curThr].firstJob = curThr;
+		workers[curThr].jobStep = threadCnt;
+		workers[curThr].outDir = outDir;
+	}
+	for (startedThr = 1; startedThr < threadCnt; startedThr ++)
+	{
+		if (Thread_Start(&workers[startedThr].thread, &ROMWorker_Main, &workers[startedThr]))
+			break;
+	}
+	// Jobs of threads that couldn't be started are done by the main thread.
+	ROMWorker_Main(&workers[0]);
+	for (curThr = startedThr; curThr < threadCnt; curThr ++)
+		ROMWorker_Main(&workers[curThr]);
+	for (curThr = 1; curThr < startedThr; curThr ++)
+		Thread_Join(&workers[curThr].thread);
+	free(workers);
+	showMsgs = 1;
+	
+	// report results in the original order
+	retVal = 0;
+	songTotal = 0;
+	for (curJob = 0; curJob < romList.count; curJob ++)
+	{
+		const ROM_JOB* job = &jobs[curJob];
+		
+		if (job->result == 0xFF)
+		{
+			printf("%s: Error opening file!\n", job->romPath);
+			retVal = 1;
+			continue;
+		}
+		else if (job->result)
+		{
+			printf("%s: Out of memory, the song list is incomplete!\n", job->romPath);
+			retVal = 1;
+		}
+		printf("%s: %u song%s\n", job->romPath, job->songCnt, (job->songCnt == 1) ? "" : "s");
+		for (curSong = 0; curSong < job->songCnt; curSong ++)
+		{
+			const DEMO_SONG* song = &job->songs[curSong];
+			printf("    0x%06X  %u track%s  %-16s  %s\n", song->ptrListOfs, song->trkCount,
+					(song->trkCount == 1) ? " " : "s", song->name[0] ? song->name : "-",
+					song->result ? "write error" : GetFileTitle(song->fileName));
+			if (song->result)
+				retVal = 1;
+		}
+		songTotal += job->songCnt;
+	}
+	
+	fileName = JoinPath(outDir, "index.txt");
+	if (WriteIndexFile(fileName, romList.count, jobs))
+		retVal = 1;
+	else
+		printf("%u songs from %u ROMs, index written to %s\n", songTotal, romList.count, fileName);
+	free(fileName);
+	
+	for (curJob = 0; curJob < romList.count; curJob ++)
+	{
+		for (curSong = 0; curSong < jobs[curJob].songCnt; curSong ++)
+			free(jobs[curJob].songs[curSong].fileName);
+		free(jobs[curJob].songs);
+		free(jobs[curJob].outBase);
+		free(romList.names[curJob]);
+	}
+	free(jobs);
+	free(romList.names);
+	
+	return retVal;
+}
+
+// returns outDir/RomTitle (without extension), with _2, _3, etc. appended if one of the previous jobs has the same name
+static char* GetUniqueOutBase(const char* outDir, const char* romPath, UINT32 prevCnt, const ROM_JOB* prevJobs)
+{
+	char* baseName;
+	char* result;
+	char* extPos;
+	UINT32 dupIdx;
+	UINT32 curIdx;
+	const char* chr1;
+	const char* chr2;
+	
+	baseName = JoinPath(outDir, GetFileTitle(romPath));
+	extPos = strrchr(baseName, '.');
+	if (extPos != NULL && extPos > GetLastDirSepPos(baseName))
+		*extPos = '\0';
+	result = (char*)malloc(strlen(baseName) + 0x10);
+	strcpy(result, baseName);
+	for (dupIdx = 2; ; dupIdx ++)
+	{
+		// compare case-insensitively, as some file systems do as well
+		for (curIdx = 0; curIdx < prevCnt; curIdx ++)
+		{
+			chr1 = prevJobs[curIdx].outBase;
+			chr2 = result;
+			while(*chr1 != '\0' && tolower((unsigned char)*chr1) == tolower((unsigned char)*chr2))
+			{
+				chr1 ++;
+				chr2 ++;
+			}
+			if (*chr1 == *chr2)
+				break;
+		}
+		if (curIdx >= prevCnt)
+			break;
+		sprintf(result, "%s_%u", baseName, dupIdx);
+	}
+	free(baseName);
+	
+	return result;
+}
+
+static void ROMWorker_Main(void* param)
+{
+	ROM_WORKER* wrk = (ROM_WORKER*)param;
+	UINT32 curJob;
+	UINT32 romSize;
+	UINT8* romData;
+	UINT32 midSize;
+	UINT8* midData;
+	UINT16 curSong;
+	
+	for (curJob = wrk->firstJob; curJob < wrk->jobCnt; curJob += wrk->jobStep)
+	{
+		ROM_JOB* job = &wrk->jobs[curJob];
+		
+		job->result = LoadROM(job->romPath, &romSize, &romData);
+		if (job->result)
+			continue;
+		
+		if (FindDemoSongs(romSize, romData, &job->songCnt, &job->songs))
+			job->result = 0x01;
+		
+		for (curSong = 0; curSong < job->songCnt; curSong ++)
+		{
+			DEMO_SONG* song = &job->songs[curSong];
+			
+			song->fileName = (char*)malloc(strlen(job->outBase) + 0x10);
+			if (song->fileName == NULL)
+			{
+				song->result = 0xFF;	// reported as write error, no index entry
+				continue;
+			}
+			sprintf(song->fileName, "%s_%02X.mid", job->outBase, curSong);
+			ConvertDemoSong(romSize, romData, song, &midSize, &midData);
+			song->result = WriteFileData(song->fileName, midSize, midData);
+			free(midData);
+		}
+		free(romData);
+	}
+	
+	return;
+}
+
+static UINT8 WriteIndexFile(const char* fileName, UINT32 jobCnt, const ROM_JOB* jobs)
+{
+	FILE* hFile;
+	UINT32 curJob;
+	UINT16 curSong;
+	
+	hFile = fopen(fileName, "wt");
+	if (hFile == NULL)
+	{
+		printf("Error opening file %s!\n", fileName);
+		return 0xFF;
+	}
+	
+	fprintf(hFile, "# ROM\tSong\tName\tOffset\tTracks\tMIDI\n");
+	for (curJob = 0; curJob < jobCnt; curJob ++)
+	{
+		const ROM_JOB* job = &jobs[curJob];
+		
+		for (curSong = 0; curSong < job->songCnt; curSong ++)
+		{
+			const DEMO_SONG* song = &job->songs[curSong];
+			if (song->result)
+				continue;
+			fprintf(hFile, "%s\t%u\t%s\t0x%06X\t%u\t%s\n", GetFileTitle(job->romPath), curSong,
+					song->name[0] ? song->name : "-", song->ptrListOfs, song->trkCount,
+					GetFileTitle(song->fileName));
+		}
+	}
+	
+	fclose(hFile);
+	
+	return 0x00;
+}
+
+static UINT8 FileList_Add(FILE_LIST* list, char* fileName)
+{
+	if (list->count >= list->alloc)
+	{
+		char** newNames = (char**)realloc(list->names, (list->alloc + 0x40) * sizeof(char*));
+		if (newNames == NULL)
+			return 0xFF;
+		list->names = newNames;
+		list->alloc += 0x40;
+	}
+	list->names[list->count] = fileName;
+	list->count ++;
 	
 	return 0x00;
 }
 
+static int FileList_Compare(const void* a, const void* b)
+{
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Adds all files of a directory to the list. (no subdirectories)
+// Returns 0xFF when the path isn't a directory.
+static UINT8 ListDirFiles(const char* dirPath, FILE_LIST* list)
+{
+#ifdef _WIN32
+	char* findPath;
+	HANDLE hFind;
+	WIN32_FIND_DATAA findData;
+	
+	findPath = JoinPath(dirPath, "*");
+	hFind = FindFirstFileA(findPath, &findData);
+	free(findPath);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return 0xFF;
+	
+	do
+	{
+		if (! (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+		{
+			char* filePath = JoinPath(dirPath, findData.cFileName);
+			if (FileList_Add(list, filePath))
+			{
+				free(filePath);
+				printf("Out of memory!\n");
+				break;
+			}
+		}
+	} while(FindNextFileA(hFind, &findData));
+	FindClose(hFind);
+#else
+	DIR* hDir;
+	struct dirent* dirEnt;
+	struct stat fileStat;
+	char* filePath;
+	
+	hDir = opendir(dirPath);
+	if (hDir == NULL)
+		return 0xFF;
+	
+	while((dirEnt = readdir(hDir)) != NULL)
+	{
+		filePath = JoinPath(dirPath, dirEnt->d_name);
+		if (! stat(filePath, &fileStat) && S_ISREG(fileStat.st_mode))
+		{
+			if (FileList_Add(list, filePath))
+			{
+				free(filePath);
+				printf("Out of memory!\n");
+				break;
+			}
+		}
+		else
+		{
+			free(filePath);
+		}
+	}
+	closedir(hDir);
+#endif
+	
+	return 0x00;
+}
+
+static char* JoinPath(const char* dirPath, const char* fileName)
+{
+	size_t dirLen;
+	char* result;
+	
+	dirLen = strlen(dirPath);
+	result = (char*)malloc(dirLen + 1 + strlen(fileName) + 1);
+	strcpy(result, dirPath);
+	if (dirLen > 0 && dirPath[dirLen - 1] != '/' && dirPath[dirLen - 1] != '\\')
+		result[dirLen ++] = '/';
+	strcpy(&result[dirLen], fileName);
+	
+	return result;
+}
+
+static const char* GetLastDirSepPos(const char* fileName)
+{
+	const char* sepPos;
+	const char* wSepPos;	// Windows separator
+	
+	sepPos = strrchr(fileName, '/');
+	wSepPos = strrchr(fileName, '\\');
+	if (wSepPos == NULL)
+		return sepPos;
+	else if (sepPos == NULL)
+		return wSepPos;
+	return (wSepPos > sepPos) ? wSepPos : sepPos;
+}
+
+INLINE const char* GetFileTitle(const char* fileName)
+{
+	const char* sepPos = GetLastDirSepPos(fileName);
+	return (sepPos == NULL) ? fileName : (sepPos + 1);
+}
+
 static UINT32 ReadBE32(const UINT8* data)
 {
 	return	(data[0x00] << 24) | (data[0x01] << 16) |
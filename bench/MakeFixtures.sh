@@ -0,0 +1,417 @@
+#!/bin/bash
+# Generates the synthetic input files of the ConvBench.sh corpus.
+# They are committed together with golden.sha1, so that the runner works on a fresh checkout.
+# Run it only when the fixture set itself changes, then bless the new outputs with
+#   ./ConvBench.sh -update bench
+
+cd "$(dirname "$0")"
+mkdir -p syx2mid mid2syx rcp2mid msdrv2mid cdmd2mid wtmd2mid zmd2mid pmd2mid gmd2mid tsd2mid gems2mid TaitoZoom dynamix_mus2mid
+
+# writes the bytes given as hex strings
+hexbytes()
+{
+	for b in "$@"; do
+		printf "\\x$b"
+	done
+}
+
+# prints a value as 2/4 big-endian hex bytes
+hex16()
+{
+	printf "%02X %02X" $(($1 >> 8 & 0xFF)) $(($1 & 0xFF))
+}
+
+hex32()
+{
+	printf "%02X %02X %02X %02X" $(($1 >> 24 & 0xFF)) $(($1 >> 16 & 0xFF)) $(($1 >> 8 & 0xFF)) $(($1 & 0xFF))
+}
+
+# prints a value as 2/4 little-endian hex bytes
+hex16le()
+{
+	printf "%02X %02X" $(($1 & 0xFF)) $(($1 >> 8 & 0xFF))
+}
+
+hex32le()
+{
+	printf "%02X %02X %02X %02X" $(($1 & 0xFF)) $(($1 >> 8 & 0xFF)) $(($1 >> 16 & 0xFF)) $(($1 >> 24 & 0xFF))
+}
+
+# prints a hex byte N times: count, byte
+fill()
+{
+	local i
+	for ((i = 0; i < $1; i ++)); do
+		printf "%s " "$2"
+	done
+}
+
+# prints a string as hex bytes, padded with spaces to the given length: length, string
+hexstr()
+{
+	local i
+	for ((i = 0; i < $1; i ++)); do
+		if [ $i -lt ${#2} ]; then
+			printf "%02X " "'${2:i:1}"
+		else
+			printf "20 "
+		fi
+	done
+}
+
+# prints the number of bytes in a list of hex strings
+bytecnt()
+{
+	wc -w <<< "$*"
+}
+
+# creates a file of the given size that is filled with zeros: file name, size
+zerofile()
+{
+	head -c $2 /dev/zero > "$1"
+}
+
+# overwrites bytes of a file with the bytes given as hex strings: file name, offset, data bytes
+putbytes()
+{
+	local file="$1"
+	local ofs=$(($2))
+	shift 2
+	hexbytes "$@" | dd of="$file" bs=1 seek=$ofs conv=notrunc status=none
+}
+
+# prints a Roland DT1 message (model ID 42 = GS) with checksum: address (3 bytes), data bytes
+roland_dt1()
+{
+	local sum=0
+	local b
+	for b in "$@"; do
+		sum=$((sum + 0x$b))
+	done
+	echo "F0 41 10 42 12 $* $(printf "%02X" $(((128 - sum % 128) % 128))) F7"
+}
+
+# prints a MIDI track chunk with the given event data
+midi_track()
+{
+	local data="$*"
+	echo "4D 54 72 6B $(hex32 $(wc -w <<< "$data")) $data"
+}
+
+# prints a SysEx event with delay 0 for a MIDI track, from a complete F0 .. F7 message
+midi_sysex()
+{
+	local msg=($*)
+	echo "00 F0 $(printf "%02X" $((${#msg[@]} - 1))) ${msg[*]:1}"
+}
+
+# --- syx2mid ---
+# GS reset + a few part settings
+{
+	roland_dt1 40 00 7F 00
+	roland_dt1 40 10 15 00
+	roland_dt1 40 11 02 7F
+	roland_dt1 40 01 30 01
+} | { read -r -d '' msgs; hexbytes $msgs; } > syx2mid/gs_setup.syx
+
+# MT-32 style bulk dump: 64 messages with 128 data bytes each, to test the receive buffer spacing
+{
+	for ((i = 0; i < 64; i ++)); do
+		data=""
+		for ((j = 0; j < 128; j ++)); do
+			data+=" $(printf "%02X" $(((i * 7 + j) & 0x7F)))"
+		done
+		sum=$((0x05 + i / 2 + (i % 2) * 0x40))
+		for b in $data; do
+			sum=$((sum + 0x$b))
+		done
+		echo "F0 41 10 16 12 05 $(printf "%02X %02X" $((i / 2)) $(((i % 2) * 0x40)))$data $(printf "%02X" $(((128 - sum % 128) % 128))) F7"
+	done
+} | { read -r -d '' msgs; hexbytes $msgs; } > syx2mid/mt32_bulk.syx
+
+# --- mid2syx ---
+# format 0: notes and controllers mixed with SysEx messages, running status
+{
+	trk="$(midi_sysex $(roland_dt1 40 00 7F 00))"
+	trk+=" $(midi_sysex F0 7E 7F 09 01 F7)"
+	for ((i = 0; i < 32; i ++)); do
+		trk+=" 00 90 $(printf "%02X" $((60 + i % 12))) 64 83 60 $(printf "%02X" $((60 + i % 12))) 00"
+		trk+=" 00 B0 07 $(printf "%02X" $((100 - i)))"
+		trk+=" $(midi_sysex $(roland_dt1 40 11 19 $(printf "%02X" $((i * 4)))))"
+	done
+	trk+=" 00 FF 2F 00"
+	hexbytes 4D 54 68 64 00 00 00 06 00 00 00 01 01 E0 $(midi_track $trk)
+} > mid2syx/format0.mid
+
+# format 1: SysEx messages spread over 3 tracks at interleaved ticks
+{
+	hdr="4D 54 68 64 00 00 00 06 00 01 00 03 01 E0"
+	trk0="00 FF 51 03 07 A1 20 $(midi_sysex F0 43 10 4C 00 00 7E 00 F7) 00 FF 2F 00"
+	trk1=""
+	trk2=""
+	for ((i = 0; i < 24; i ++)); do
+		trk1+=" 83 60 $(midi_sysex $(roland_dt1 40 1$((i % 10)) 19 $(printf "%02X" $i)) | cut -c 4-)"
+		trk2+=" 81 70 $(midi_sysex F0 43 10 4C 08 $(printf "%02X" $((i % 16))) 07 $(printf "%02X" $((i * 5))) F7 | cut -c 4-)"
+	done
+	trk1+=" 00 FF 2F 00"
+	trk2+=" 00 FF 2F 00"
+	hexbytes $hdr $(midi_track $trk0) $(midi_track $trk1) $(midi_track $trk2)
+} > mid2syx/format1.mid
+
+# --- rcp2mid ---
+# prints an RCP v2 track: track ID, MIDI channel, rhythm mode (00/80), mute, name, events (4 bytes each)
+# (The rhythm mode is also used as transposition, as bit 7 disables it.)
+rcp_track()
+{
+	local hdr="$(printf "%02X %02X %02X %02X" $1 $3 $2 $3) 00 $(printf "%02X" $4) $(hexstr 36 "$5")"
+	shift 5
+	echo "$(hex16le $((2 + 0x2A + $(bytecnt "$*")))) $hdr $*"
+}
+
+# RCP v2 file: 48 ticks/quarter, 120 BPM, 4/4, 4 tracks
+# with nested/infinite loops, repeated measures, Roland SysEx, a User SysEx and tempo changes
+{
+	hdr="$(echo -n "RCM-PC98V2.0(C)COME ON MUSIC" | od -An -tx1) 0D 0A 00 00"
+	hdr+=" $(hexstr 64 "ConvBench RCP fixture") $(hexstr 28 "synthetic test data") $(fill 324 20)"
+	hdr+=" 30 78 04 04 00 00 $(fill 32 00) 04 00 $(fill 30 00)"
+	rhythm="$(fill 512 00)"
+	usrsyx="$(hexstr 24 "Part 10 Rhythm") 41 10 42 12 83 40 1A 15 81 84 F7 $(fill 13 F7)"
+	for ((i = 1; i < 8; i ++)); do
+		usrsyx+=" $(hexstr 24 "") $(fill 24 F7)"
+	done
+
+	# melody: GS reset via DD/DE, User SysEx, loop with 3 passes, tempo changes
+	trk1="EC 00 00 00  EB 00 07 64  DF 00 10 42  DD 00 40 00  DE 00 7F 00  90 00 00 01  E7 00 40 00"
+	trk1+="  F9 00 00 00  3C 18 14 64  40 18 14 64  43 18 14 64  48 18 30 50  FD 00 00 00  F8 03 00 00"
+	trk1+="  E7 00 50 00  EE 00 00 50  3C 30 2C 64  EE 00 00 40  43 30 2C 64  E7 00 50 00  48 60 5C 64"
+	trk1+="  FD 00 00 00  FE 00 00 00"
+	# drums: measure 1 repeated twice with FC commands
+	trk2="24 30 10 64  26 30 10 64  24 30 10 64  26 30 10 64  FD 00 00 00"
+	trk2+="  FC 00 2C 00  FC 00 2C 00  FE 00 00 00"
+	# strings: infinite loop
+	trk3="E2 00 30 00  EB 00 0A 20  F9 00 00 00  30 C0 BC 50  37 C0 BC 50  FD 00 00 00  F8 00 00 00  FE 00 00 00"
+	# muted track
+	trk4="3C 30 30 64  FE 00 00 00"
+	hexbytes $hdr $rhythm $usrsyx \
+		$(rcp_track 1 0x00 0 0 "Piano" $trk1) \
+		$(rcp_track 2 0x09 0x80 0 "Drums" $trk2) \
+		$(rcp_track 3 0x01 0 0 "Strings" $trk3) \
+		$(rcp_track 4 0x02 0 1 "Muted" $trk4)
+} > rcp2mid/song.rcp
+# the same file as format 0 with a different resolution and without redundant tempo events
+cp rcp2mid/song.rcp rcp2mid/song_post.rcp
+echo "-SMF0 -OutRes 96 -TempoDedup" > rcp2mid/song_post.rcp.args
+
+# --- msdrv2mid ---
+# MsDRV v4 "light" file (24 tracks, no padding): MIDI track with GS SysEx, loop + subroutine,
+# FM track with 3-byte notes and an infinite loop
+{
+	trk0="8A 78  DF 00 10 42  DD 00 40 00  DE 00 7F 00  E6 00 00  E2 00 30 00  EB 00 07 64  9F C0  9C"
+	subStart=$(bytecnt $trk0)
+	trk0+="  3C 18 14 64  40 18 14 64  43 18 14 64  48 18 14 50"
+	subEnd=$(bytecnt $trk0)
+	trk0+="  9B 02  83 $(hex32le $subStart) $(hex32le $subEnd)  8B 01  3C 30 2C"
+	trk0+="  EE 00 00 08  37 30 2C  EE 00 00 00  9C  37 60 5C  9B 00  FE"
+	trk1="E6 00 51  82 05  85 10  8B 01  9C  30 18 14  34 18 14  37 30 2C  9B 00  FE"
+	hexbytes $(hex32le 0xA0) $(hex32le $((0xA0 + $(bytecnt $trk0)))) $(fill $((38 * 4)) 00) $trk0 $trk1
+} > msdrv2mid/song.bin
+cp msdrv2mid/song.bin msdrv2mid/song_post.bin
+echo "-SMF0 -OutRes 480" > msdrv2mid/song_post.bin.args
+
+# --- cdmd2mid ---
+# 64 KB ROM with a minimal Core Design sound driver (v2 command set): 68000 driver/bank loaders,
+# Z80 driver at 0x2000 (data base 0x0800), sound data bank 1 with two songs in the order table.
+# Song 1 uses all pitch effects and loops via a position jump, song 2 ends with a data end command.
+{
+	rom=cdmd2mid/rom.bin
+	drv=0x2000
+	snd=0x8000
+	zerofile $rom 65536
+	putbytes $rom 0x100 41 F9 $(hex32 $drv) 43 F9 00 A0 00 00 3E 3C 0F FF
+	putbytes $rom 0x120 13 FC 00 01 00 A0 00 40
+	putbytes $rom $((drv + 0x300)) 7E 23 66 6F ED 5B 00 08 19
+	putbytes $rom $((drv + 0x400)) FD 7E 00 32 50 04 FD 7E 01 32 51 04 7B C3
+	putbytes $rom $((drv + 0x450)) 00 00 80 06
+	# pattern pointer table at 0x0800 + 0x1700, instrument 0: algorithm 4, instrument 1: algorithm 7 (left only)
+	putbytes $rom $((drv + 0x800)) $(hex16le 0x1700)
+	putbytes $rom $((drv + 0x810)) 71 0D 33 01 23 2D 26 00 5F 99 5F 94 05 05 05 07 02 02 02 02 11 11 11 A6 00 00 00 00 04 C0
+	putbytes $rom $((drv + 0x830)) 01 01 01 01 10 18 20 08 1F 1F 1F 1F 00 00 00 00 00 00 00 00 0F 0F 0F 0F 00 00 00 00 07 80
+	for pat in 0 1 2 3 4; do
+		putbytes $rom $((drv + 0x1F00 + pat * 3)) 00 $(hex16le $((0x400 + pat * 0x40)))
+	done
+	putbytes $rom $snd $(hex16le 0) $(hex16le 3) $(hex16le 6) $(hex16le 9) $(hex16le 12) FF FF
+	# order 0: speed, instrument + notes on 3 channels, note off, pattern break
+	putbytes $rom $((snd + 0x400)) 14 05  01 03 30  21 40  41 48  C3  01 34  C3  02  C3  0E
+	# order 1: arpeggio, pitch up/down, tone portamento, vibrato
+	putbytes $rom $((snd + 0x440)) 05 47 30  C7  07 10 34  C3  09 10 38  C3  0B 08 30  C7  0D 62 3C  C7  02  C7  0E
+	# order 2: jump back to order 1
+	putbytes $rom $((snd + 0x480)) 21 44  C3  10 01
+	# orders 3/4: second song
+	putbytes $rom $((snd + 0x4C0)) 01 03 24  C1  21 28  C1  0E
+	putbytes $rom $((snd + 0x500)) 01 2C  C3  00
+}
+echo "-mus {in} {out} all" > cdmd2mid/args
+
+# --- wtmd2mid ---
+# Wolf Team 'B' song at offset 0 (the converter's command line has no song list mode):
+# 2 FM tracks (looped/unlooped, pitch bends, portamento, rests), 1 disabled track, DAC drums
+{
+	hdr_len=$((0x1E + 9 * 4))
+	segs=""
+	# appends a segment and stores its song offset in the given variable: variable, data bytes
+	wt_seg()
+	{
+		eval "$1=$((hdr_len + $(bytecnt $segs)))"
+		shift
+		segs+=" $*"
+	}
+	wt_seg fm1a E0 00 0F  E1 00 60  24 18 14  A7  FD
+	wt_seg fm1b 30 18 10  B4  B7  E2 00 40  E4 00 10 00  3C 30 2C  E4 00 00 00  FD
+	wt_seg fm1c 30 18 18  30 18 18  34 18 00  37 0C 18  3B 0C 0C  FD
+	wt_seg fm2a E0 00 21  E0 00 05  20 30 2C  27 30 2C  FD
+	wt_seg drma E1 00 7F  01 18  02 18  01 18  FD
+	wt_seg drmb 01 0C  01 0C  02 18  0A 18  09 18  FD
+	list_ofs=$((hdr_len + $(bytecnt $segs)))
+	lists="$(hex16le $fm1a) $(hex16le $fm1b) $(hex16le $fm1c) FF FF"
+	lists+=" $(hex16le $fm2a) FF FF"
+	lists+=" $(hex16le $drma) $(hex16le $drmb) FF FF"
+	chns="01 C0 $(hex16le $list_ofs)  01 80 $(hex16le $((list_ofs + 8)))"
+	chns+="  $(fill $((5 * 4)) 00)  00 00 00 00  01 C0 $(hex16le $((list_ofs + 12)))"
+	song_len=$((list_ofs + $(bytecnt $lists)))
+	hexbytes 00 42 $(hex16le $song_len) $(hex16le 0x20) $(hexstr 16 "Bench Song") 78 $(fill 7 00) $chns $segs $lists
+} > wtmd2mid/song.bin
+echo "dv {in}" > wtmd2mid/args
+
+# --- zmd2mid ---
+# ZMD v0x14 with title/tempo/init SysEx header blocks and 3 MIDI tracks:
+# master loop (Do/Loop) around nested loop conditions and exits, chords, pitch bends and SysEx,
+# a drum track with a master loop via loop count FF, and a track that switches its channel
+{
+	hdr="10 5A 6D 75 53 69 43 14  05 00 96  7F $(hexstr 10 "Bench Song") 00  63 $(hexstr 5 "BENCH") 00"
+	hdr+="  18 00 0B F0 41 10 42 12 40 00 7F 00 41 F7  FF"
+	if [ $(($(bytecnt $hdr) & 1)) -ne 0 ]; then
+		hdr+=" 00"
+	fi
+	body="40 0C 0A  C3 03 00 03  48 0C 0A  C4 00 06  45 0C 0A"
+	trk1="A0 01  B6 10  B9 64  B4 30  A8 0C  EB 41 10 42  ED 28 10 00  C0 09"
+	trk1+="  C1 CF 03  $body  C2 $(hex16 $((2 + $(bytecnt $body) + 3)))"
+	trk1+="  E2 00 30 00 2C 00 3C 40 43 FF FF FF FF FF  91 00 78"
+	trk1+="  D1 00 00 10 00  3C 18 14  96 01 00  97 02 00  CD 40  43 18 14  EA 40 01 33 7F 0D FF"
+	trk1+="  C0 0A  FF"
+	body="24 0C 0A  26 0C 20  BF  80 0C 00"
+	trk2="A7 7F  C1 CF FF  $body  C2 $(hex16 $((2 + $(bytecnt $body) + 3)))  FF"
+	trk3="D3 00 08  D2 01 08 40 80  B5 5B 28  E6 00 20  A3 0B  30 30 2C  AB 10  AA 08  B1  34 30 2C"
+	trk3+="  FC 34 40  B2  FD 37 64  37 30 10  F0  FF"
+	# track pointers are relative to the end of the track's pointer field
+	tbl=$(($(bytecnt $hdr) + 2))
+	ofs=$((tbl + 3 * 6))
+	hexbytes $hdr 00 03 \
+		00 00 $(hex16 $((ofs - tbl - 4))) 00 09 \
+		00 00 $(hex16 $((ofs + $(bytecnt $trk1) - tbl - 6 - 4))) 00 08 \
+		00 00 $(hex16 $((ofs + $(bytecnt $trk1 $trk2) - tbl - 12 - 4))) 00 0A \
+		$trk1 $trk2 $trk3
+} > zmd2mid/song.zmd
+
+# --- pmd2mid ---
+# PMD file (version byte + song data with 16-bit offsets relative to the song data):
+# FM 1 with a master loop around a counted loop with loop exit, ties, detune and early key off,
+# SSG 1 with a tie, and the rhythm track calling two rhythm subroutines
+{
+	pos=$((0x1A))
+	pre="FC C8  FF 05  FD 70  EC 02  F6"
+	body="30 18  FB 30 18  34 0C  F7 XX XX  37 0C"
+	lpStart=$((pos + $(bytecnt $pre)))
+	lpEnd=$((lpStart + 3 + $(bytecnt $body)))
+	body=${body/XX XX/$(hex16le $((lpEnd + 1)))}
+	fm1="$pre  F9 $(hex16le $((lpEnd + 1)))  $body  F8 03 00 $(hex16le $((lpStart + 1)))"
+	fm1+="  FA 10 00  F5 02  40 30  FE 04  32 18  FE 00  0F 18  F4  F3  E7 FE  45 18  80"
+	ssg1="FD 0C  45 30  FB 45 30  47 30  80"
+	rhy="E8 30  EA 3F  E9 22  EB 01  00  EB 81  01  00  80"
+	sub0="80 01 0C  00 0C  80 08 0C  FF"
+	sub1="80 21 18  FF"
+	fm1Pos=$pos
+	ssgPos=$((fm1Pos + $(bytecnt $fm1)))
+	rhyPos=$((ssgPos + $(bytecnt $ssg1)))
+	tblPos=$((rhyPos + $(bytecnt $rhy)))
+	sub0Pos=$((tblPos + 4))
+	sub1Pos=$((sub0Pos + $(bytecnt $sub0)))
+	hexbytes 00 $(hex16le $fm1Pos) $(fill 10 00) $(hex16le $ssgPos) $(fill 6 00) $(hex16le $rhyPos) \
+		$(hex16le $tblPos) 00 00 \
+		$fm1 $ssg1 $rhy $(hex16le $sub0Pos) $(hex16le $sub1Pos) $sub0 $sub1
+} > pmd2mid/song.m
+echo "V" > pmd2mid/args
+
+# --- tsd2mid ---
+# TSD file (16 track pointers, 16 channel modes): MIDI track with a counted loop, loop exit,
+# tie, portamento and a master loop via jump, FM track with a volume envelope, SSG track with a pitch slide
+{
+	pos=$((0x50))
+	pre="85 78  90 30  8D 64  8C 30  96 70  97 5B 28  87 50 00"
+	lpStart=$((pos + $(bytecnt $pre)))
+	body1="3C 18"
+	body2="40 18  83  40 18"
+	exitPos=$((lpStart + 3 + $(bytecnt $body1)))
+	lpEnd=$((exitPos + 3 + $(bytecnt $body2)))
+	midi="$pre  80 03 00  $body1  81 $(hex16le $((lpEnd - exitPos)))  $body2  82 $(hex16le $((lpStart - lpEnd - 1)))"
+	midi+="  86 20 00  88 04 02 10 00  48 30  3C 30 89 43 32  7F 18"
+	midi+="  8B $(hex16le $((lpStart - (pos + $(bytecnt $midi) + 3))))"
+	fm="90 05  8D 70  8C 02  92 7F 04 08 60 02 08  30 18  34 18  8E F0  8E F8  37 30  7F 10  8B 00 00"
+	ssg="8D 0C  95 02 04  48 18  4C 18  8B 00 00"
+	fmPos=$((pos + $(bytecnt $midi)))
+	ssgPos=$((fmPos + $(bytecnt $fm)))
+	hexbytes $(hex16le $pos) $(hex16le $fmPos) $(hex16le $ssgPos) $(fill 26 00) \
+		$(hex16le 0x14) $(hex16le 0x06) $(hex16le 0x0C) $(fill 26 00) $(fill 16 00) \
+		$midi $fm $ssg
+} > tsd2mid/song.tsd
+
+# --- gmd2mid ---
+# GMD0 v1.0 file with a song title chunk and 2 tracks (notes, loops, tempo, controllers, SysEx)
+{
+	hdr="47 4D 44 30  00 01 00 00 00 00  $(hex16le 120)  04 04  $(hex16le 48)  10 7F  $(fill 14 00)"
+	title="01 00 $(hexstr 4 "Test") 00 00"
+	trk1="E0 10 00 90 64 E6 03 3C 18 10 40 18 10 E7 98 64 00 8F 7F AE 07 64 B0 02 A1 20 E8 43 18 10"
+	trk1+=" E9 02 80 18 00 B5 10 42 B6 40 01 30 85 AF 7E 7F 09 81 E5 10 00 FF"
+	trk2="E0 10 09 E1 01 24 18 64 26 18 F0 EC F9 FF FF"
+	# track header: size, track ID, transposition, start tick, 8 unused bytes
+	hexbytes $hdr $(hex16le $(bytecnt $title)) $title $(fill 12 00) $(hex16le 2) \
+		$(hex16le $((0x10 + $(bytecnt $trk1)))) $(hex16le 0) 00 00 $(hex16le 0) $(fill 8 00) $trk1 \
+		$(hex16le $((0x10 + $(bytecnt $trk2)))) $(hex16le 1) 00 00 $(hex16le 0) $(fill 8 00) $trk2
+} > gmd2mid/song.gmd
+
+# --- gems2mid ---
+# GEMS song bank with 2-byte track pointers: song 0 with 2 tracks, song 1 with 1 track
+# (notes, durations, delays, loops, pitch bends, tempo and instrument changes)
+{
+	gems=gems2mid/bank.bin
+	seq="61 01 68 50 83 C6 30 32 64 02 34 65 6C 10 00 72 05 40 70 01 02 6F F0 FF 60"
+	zerofile $gems 512
+	# the song headers follow each other, which is what the version detection relies on
+	putbytes $gems 0x00 $(hex16le 0x04) $(hex16le 0x09)
+	putbytes $gems 0x04 02 $(hex16le 0x10) $(hex16le 0x30)
+	putbytes $gems 0x09 01 $(hex16le 0x50)
+	putbytes $gems 0x10 $seq
+	putbytes $gems 0x30 $seq
+	putbytes $gems 0x50 $seq
+}
+echo "{in}" > gems2mid/args
+
+# --- TaitoZoom ---
+# Zoom sound ROM with a song table of 2 entries at 0x8000 (notes, rests, controllers, pitch bends, loops)
+{
+	rom=TaitoZoom/sound.bin
+	song="78 00 90 3C 64 F8 10 80 3C 00 F2 78 05 B0 07 64 00 A0 05 00 E0 40 00 C0 03 00 F1 01 02 00 F3 01 00 00 FF"
+	zerofile $rom $((0x8200))
+	putbytes $rom 0x7FF8 $(hex32le 0x88000)
+	putbytes $rom 0x8000 $(hex16le 2) $(hex32le 0x20) $(hex32le 0x60)
+	putbytes $rom 0x8020 $song
+	putbytes $rom 0x8060 $song
+}
+echo "-all {in} {out}" > TaitoZoom/args
+
+# --- dynamix_mus2mid ---
+# song file with a TOC of 2 sub-songs, each a ready-made MIDI track behind an 8-byte header
+{
+	trk="00 90 3C 64 60 80 3C 00 00 FF 2F 00"
+	sub="$(hex16le $((8 + $(bytecnt $trk)))) $(hex16le 0) $(hex16le 96) $(hex16le 0xFFFF) $trk"
+	hexbytes $(hex32le 8) $(hex32le $((8 + $(bytecnt $sub)))) $sub $sub
+} > dynamix_mus2mid/song.mus
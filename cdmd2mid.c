@@ -9,6 +9,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <math.h>
+#include <stdarg.h>
 
 #include "stdtype.h"
 
@@ -24,12 +25,55 @@
 
 #ifdef _MSC_VER
 #define stricmp	_stricmp
+#if _MSC_VER < 1900
+#define vsnprintf	_vsnprintf
+#endif
 #else
 #define stricmp	strcasecmp
 #endif
 
 
+#include "conv_stats.h"
 #include "midi_funcs.h"
+#include "scan_funcs.h"
+#include "rom_cache.h"
+#include "thread_funcs.h"
+
+
+typedef struct _driver_info_cache
+{
+	UINT32 z80DrvPos;
+	UINT16 z80BaseBank;
+	UINT16 z80DrvDataBase;
+	UINT16 z80InsTblPos;
+	UINT8 z80DrvVer;
+	UINT8 reserved;
+} DRV_INFO_CACHE;
+
+// collects the messages of a song, so that songs converted in parallel don't mix their output
+typedef struct _message_log
+{
+	UINT32 alloc;
+	UINT32 len;
+	char* data;
+} MSG_LOG;
+
+typedef struct _song_job
+{
+	UINT16 orderId;
+	char* fileName;
+	UINT8 result;	// 00 - OK, 01 - conversion error, FF - error writing the file
+	MSG_LOG log;
+} SONG_JOB;
+
+typedef struct _song_worker
+{
+	OS_THREAD thread;
+	UINT16 jobCnt;
+	SONG_JOB* jobs;
+	UINT16 firstJob;
+	UINT16 jobStep;
+} SONG_WORKER;
 
 
 typedef struct _channel_info
@@ -69,15 +113,20 @@ typedef struct _sound_state
 
 static INT8 CompareFMIns(const UINT8* insA, const UINT8* insB);
 static void CreateInstrumentMap(UINT32 romLen, const UINT8* romData, UINT32 startOfs);
+static void CacheOrderTable(void);
 static UINT32 GetPatternDataPos(UINT16 orderId, UINT16* patternId);
-UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId);
-static void PreparseCoreDesign(UINT32 songLen, const UINT8* songData, UINT16 startOrderId, UINT32* loopOfs);
+static UINT16 FindSongStartOrders(UINT16 maxSongs, UINT16* startOrders);
+static UINT8 ConvertSongs(const char* outFileName, UINT16 songCnt, const UINT16* songOrders);
+static void SongWorker_Main(void* param);
+static void LogMsg(MSG_LOG* log, const char* format, ...);
+UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId, UINT32* outLen, UINT8** outData, MSG_LOG* log);
+static void PreparseCoreDesign(UINT32 songLen, const UINT8* songData, UINT16 startOrderId, UINT32* loopOfs, UINT8* orderUsage);
 static UINT8 Note2Octave(UINT8 note);
 static UINT16 NotePitch2YMFreq(UINT16 pitch, UINT8 preferredOct);
 static UINT16 YMFreq2NotePitch(UINT16 ymFreq);
 static void ApplyYMDeltaToPitch(UINT16* pitch, UINT8* oct, INT16 delta);
 static UINT8 ReadFileData(const char* fileName, UINT32* retSize, UINT8** retData, UINT32 maxFileSize);
-static UINT8 WriteFileData(const char* fileName, UINT32 dataLen, const UINT8* data);
+static UINT8 WriteFileData(const char* fileName, UINT32 dataLen, const UINT8* data, MSG_LOG* log);
 static void EnsurePBRange(FILE_INF* fInf, MID_TRK_STATE* MTS, CHN_INF* ci, INT16 pitchDiff);
 static void MinimizePBRange(FILE_INF* fInf, MID_TRK_STATE* MTS, CHN_INF* ci, INT16 pitchDiff);
 static void WriteNotePitch(FILE_INF* fInf, MID_TRK_STATE* MTS, CHN_INF* ci, UINT16 notePitch, UINT8 optional);
@@ -95,10 +144,8 @@ INLINE UINT32 ReadBE32(const UINT8* data);
 static const char* GetLastDirSepPos(const char* fileName);
 INLINE const char* GetFileTitle(const char* fileName);
 static UINT8 DetectDriverInfo(void);
-static int memcmp_wc(const UINT8* data, const UINT8* compare, UINT32 count);
-static UINT32 ScanForData_WC(UINT32 scanLen, const UINT8* scanData,
-							UINT32 matchLen, const UINT8* matchData, UINT32 startPos,
-							UINT32 step);
+static UINT8 LoadDriverInfoCache(const char* fileName, UINT64 romHash);
+static UINT8 SaveDriverInfoCache(const char* fileName, UINT64 romHash);
 
 
 // frequency values used by the sound driver
@@ -176,6 +223,8 @@ static UINT8 INS_MODE = INSMODE_CLEAN;
 static INT8 NOTE_VELO = 0;
 static UINT8 MOD_CC = 0;
 static UINT8 DEBUG_CC = 0;
+static UINT32 NUM_THREADS = 0;	// 0 = number of CPUs
+static UINT8 STATS_MODE = STATS_OFF;
 
 static UINT32 z80DrvPos = 0x006D5C;
 static UINT16 z80BaseBank = 0x3D;
@@ -189,6 +238,11 @@ static const UINT8* Z80DataPtr;	// pointer to Z80 sound driver data (points to e
 static UINT32 SndDataLen;
 static const UINT8* SndDataPtr;	// pointer to sound data (points to &ROMData[z80BaseBank << 15])
 
+// pattern data offset/ID for each order, resolved once and shared by all songs
+// (orders with invalid pointers have offset (UINT32)-1)
+static UINT32 orderPatPos[0x200];
+static UINT16 orderPatId[0x200];
+
 // This table remaps instruments so that there are only "unique" instruments.
 // i.e. when multiple instruments match aside from panning and volume, they will get the same ID
 static UINT8 insTableMap[0x80];
@@ -198,9 +252,11 @@ int main(int argc, char* argv[])
 	int argbase;
 	UINT8 retVal;
 	UINT32 orderParam;
+	UINT8 allOrders;
 	UINT8 convMode;
 	int result;
 	const char* z80DumpFileName;
+	const char* cacheFileName;
 	const char* romFileName;
 	const char* outFileName;
 	
@@ -214,6 +270,7 @@ int main(int argc, char* argv[])
 		printf("    -ins        Instrument Mode (dump instruments to GYB)\n");
 		printf("Options:\n");
 		printf("    -Z80Dump fn load file \"fn\" as Z80 sound driver data (use when autodetection fails)\n");
+		printf("    -Cache fn   store/reuse the results of the driver detection in file \"fn\"\n");
 		printf("    -Loops n    Loop song n times. (default: %u)\n", NUM_LOOPS);
 		printf("    -TpQ n      Convert with n Ticks per Quarter. (default: %u)\n", MIDI_RES);
 		printf("    -RpB n      Scale tempo to n Rows per (quarter) Beat. (default: off)\n");
@@ -225,17 +282,21 @@ int main(int argc, char* argv[])
 		printf("                Values <0 result in velocity |n| with pan-law compensation enabled.\n");
 		printf("    -ModCC      convert Vibrato effect to Modulation CCs instead of Pitch Bends\n");
 		printf("    -DebugCC    include MIDI CCs for effect commands (for debugging)\n");
+		printf("    -j n        use n threads when converting multiple songs (default: number of CPUs)\n");
+		printf("    -Stats      print profiling statistics (-StatsJSON: as JSON, requires compiling with CONV_STATS)\n");
 		printf("OrderValue parameter:\n");
 		printf("        This number has a different effect depending on its value.\n");
 		printf("    0x000 .. 0x1FF      dump single song: order ID where the song starts\n");
 		printf("    0x200 or larger     dump all songs: ROM offset where the BGM test song list is stored\n");
 		printf("                        (This is a list of 2-byte Big Endian order IDs.)\n");
+		printf("    all                 dump all songs: find the songs by following the order table\n");
 		//printf("Recommended settings: -RpB 8\n");
 		return 0;
 	}
 	
 	argbase = 1;
 	z80DumpFileName = NULL;
+	cacheFileName = NULL;
 	while(argbase < argc && argv[argbase][0] == '-')
 	{
 		if (! stricmp(argv[argbase] + 1, "Mus"))
@@ -252,6 +313,12 @@ int main(int argc, char* argv[])
 			if (argbase < argc)
 				z80DumpFileName = argv[argbase];
 		}
+		else if (! stricmp(argv[argbase] + 1, "Cache"))
+		{
+			argbase ++;
+			if (argbase < argc)
+				cacheFileName = argv[argbase];
+		}
 		else if (! stricmp(argv[argbase] + 1, "Loops"))
 		{
 			argbase ++;
@@ -315,10 +382,27 @@ int main(int argc, char* argv[])
 		{
 			DEBUG_CC = 1;
 		}
+		else if (! stricmp(argv[argbase] + 1, "j"))
+		{
+			argbase ++;
+			if (argbase < argc)
+				NUM_THREADS = (UINT32)strtoul(argv[argbase], NULL, 0);
+		}
+		else if (! stricmp(argv[argbase] + 1, "Stats"))
+		{
+			STATS_MODE = STATS_TEXT;
+		}
+		else if (! stricmp(argv[argbase] + 1, "StatsJSON"))
+		{
+			STATS_MODE = STATS_JSON;
+		}
 		else
 			break;
 		argbase ++;
 	}
+	STATS_ENABLE(STATS_MODE);
+	if (STATS_MODE != STATS_OFF)
+		NUM_THREADS = 1;	// The counters are not thread-safe.
 	
 	switch(convMode)
 	{
@@ -351,7 +435,24 @@ int main(int argc, char* argv[])
 	if (retVal)
 		return 1;
 	
-	retVal = DetectDriverInfo();
+	STATS_PHASE_BEGIN(STATS_DETECT);
+	retVal = 0xFF;
+	if (cacheFileName != NULL && Z80DumpData == NULL)
+	{
+		UINT64 romHash = ROMCache_Hash(ROMLen, ROMData);
+		retVal = LoadDriverInfoCache(cacheFileName, romHash);
+		if (retVal)
+		{
+			retVal = DetectDriverInfo();
+			if (! retVal && SaveDriverInfoCache(cacheFileName, romHash))
+				printf("Error writing cache file %s!\n", cacheFileName);
+		}
+	}
+	else
+	{
+		retVal = DetectDriverInfo();
+	}
+	STATS_PHASE_END(STATS_DETECT);
 	if (retVal)
 	{
 		free(ROMData);	ROMData = NULL;
@@ -373,6 +474,7 @@ int main(int argc, char* argv[])
 		Z80DataLen = 0x2000;	// limit to 8 KB, which is the MegaDrive Z80's RAM size
 	SndDataLen = ROMLen - (z80BaseBank << 15);
 	SndDataPtr = &ROMData[z80BaseBank << 15];
+	CacheOrderTable();
 	
 	CreateInstrumentMap(Z80DataLen, Z80DataPtr, z80InsTblPos);
 	
@@ -380,61 +482,44 @@ int main(int argc, char* argv[])
 	switch(convMode)
 	{
 	case MODE_MUS:
-		orderParam = (UINT32)strtoul(argv[argbase + 2], NULL, 0);
-		if (orderParam < 0x200)
+		allOrders = ! stricmp(argv[argbase + 2], "all");
+		orderParam = allOrders ? 0 : (UINT32)strtoul(argv[argbase + 2], NULL, 0);
+		if (! allOrders && orderParam < 0x200)
 		{
 			// single song mode
 			printf("Starting at order ID %u\n", orderParam);
-			retVal = CoreDesign2Mid(SndDataLen, SndDataPtr, (UINT16)orderParam);
+			retVal = CoreDesign2Mid(SndDataLen, SndDataPtr, (UINT16)orderParam, &MidLen, &MidData, NULL);
 			if (! retVal)
-				WriteFileData(outFileName, MidLen, MidData);
+				WriteFileData(outFileName, MidLen, MidData, NULL);
 			free(MidData);	MidData = NULL;
 			result = retVal;
 		}
 		else
 		{
 			// all songs
-			const char* fileExt;
-			char* outName;
-			char* outExt;
-			UINT16 curFile;
+			UINT16 songOrders[0x100];
 			UINT16 fileCnt;
 			
-			fileExt = strrchr(GetFileTitle(outFileName), '.');
-			if (fileExt == NULL)
-				fileExt = outFileName + strlen(outFileName);
-			outName = (char*)malloc(strlen(outFileName) + 0x10);
-			strcpy(outName, outFileName);
-			outExt = outName + (fileExt - outFileName);
-			
-			romSongListPos = orderParam;
-			
-			for (fileCnt = 0; fileCnt < 0x100; fileCnt ++)
+			if (allOrders)
 			{
-				UINT16 orderId = ReadBE16(&ROMData[romSongListPos + fileCnt * 0x02]);
-				if (orderId >= 0x200)
-					break;
+				fileCnt = FindSongStartOrders(0x100, songOrders);
+				printf("Found %u songs by order table analysis.\n", fileCnt);
 			}
-			printf("Song list offset: 0x%06X\n", romSongListPos);
-			
-			for (curFile = 0; curFile < fileCnt; curFile ++)
+			else
 			{
-				UINT16 orderId = ReadBE16(&ROMData[romSongListPos + curFile * 0x02]);
-				printf("File %u / %u (order %u) ...", 1 + curFile, fileCnt, orderId);
-				
-				retVal = CoreDesign2Mid(SndDataLen, SndDataPtr, orderId);
-				if (retVal)
+				romSongListPos = orderParam;
+				for (fileCnt = 0; fileCnt < 0x100; fileCnt ++)
 				{
-					result = retVal;
-					continue;
+					if (romSongListPos + fileCnt * 0x02 + 0x02 > ROMLen)
+						break;
+					songOrders[fileCnt] = ReadBE16(&ROMData[romSongListPos + fileCnt * 0x02]);
+					if (songOrders[fileCnt] >= 0x200)
+						break;
 				}
-				
-				sprintf(outExt, "_%02X%s", curFile, fileExt);
-				if (! retVal)
-					WriteFileData(outName, MidLen, MidData);
-				free(MidData);	MidData = NULL;
-				printf("\n");
+				printf("Song list offset: 0x%06X\n", romSongListPos);
 			}
+			
+			result = ConvertSongs(outFileName, fileCnt, songOrders);
 		}
 		break;
 	case MODE_INS:
@@ -453,13 +538,14 @@ int main(int argc, char* argv[])
 		
 		retVal = CoreDesign_InsDump(Z80DataLen - z80InsTblPos, &Z80DataPtr[z80InsTblPos]);
 		if (! retVal)
-			WriteFileData(outFileName, MidLen, MidData);
+			WriteFileData(outFileName, MidLen, MidData, NULL);
 		free(MidData);	MidData = NULL;
 		result = retVal;
 		break;
 	}
 	
 	printf("Done.\n");
+	STATS_PRINT(STATS_MODE);
 	
 	if (Z80DumpData != NULL)
 	{
@@ -556,16 +642,251 @@ static void CreateInstrumentMap(UINT32 romLen, const UINT8* romData, UINT32 star
 	return;
 }
 
-static UINT32 GetPatternDataPos(UINT16 orderId, UINT16* patternId)
+static void CacheOrderTable(void)
 {
-	UINT16 patternOfs = ReadLE16(&SndDataPtr[orderId * 0x02]);
-	UINT32 patPtrPos = z80DrvDataBase + ReadLE16(&Z80DataPtr[z80DrvDataBase]) + patternOfs;
+	UINT32 patTblPos;
+	UINT16 orderId;
+	
+	if ((UINT32)z80DrvDataBase + 0x02 <= Z80DataLen)
+		patTblPos = z80DrvDataBase + ReadLE16(&Z80DataPtr[z80DrvDataBase]);
+	else
+		patTblPos = Z80DataLen;
+	for (orderId = 0x000; orderId < 0x200; orderId ++)
+	{
+		UINT16 patternOfs;
+		UINT32 patPtrPos;
+		UINT8 patternBank;
+		UINT16 patternPos;
+		
+		orderPatPos[orderId] = (UINT32)-1;
+		orderPatId[orderId] = 0xFFFF;
+		if ((UINT32)orderId * 0x02 + 0x02 > SndDataLen)
+			continue;
+		patternOfs = ReadLE16(&SndDataPtr[orderId * 0x02]);
+		orderPatId[orderId] = patternOfs / 0x03;
+		patPtrPos = patTblPos + patternOfs;
+		if (patPtrPos + 0x03 > Z80DataLen)
+			continue;
+		
+		patternBank = Z80DataPtr[patPtrPos + 0x00];
+		patternPos = ReadLE16(&Z80DataPtr[patPtrPos + 0x01]);
+		orderPatPos[orderId] = (patternBank << 15) | (patternPos & 0x7FFF);
+	}
 	
-	UINT8 patternBank = Z80DataPtr[patPtrPos + 0x00];
-	UINT16 patternPos = ReadLE16(&Z80DataPtr[patPtrPos + 0x01]);
+	return;
+}
+
+// returns (UINT32)-1 for invalid order IDs
+static UINT32 GetPatternDataPos(UINT16 orderId, UINT16* patternId)
+{
+	if (orderId >= 0x200)
+	{
+		if (patternId != NULL)
+			*patternId = 0xFFFF;
+		return (UINT32)-1;
+	}
 	if (patternId != NULL)
-		*patternId = patternOfs / 0x03;
-	return (patternBank << 15) | (patternPos & 0x7FFF);
+		*patternId = orderPatId[orderId];
+	return orderPatPos[orderId];
+}
+
+static UINT16 FindSongStartOrders(UINT16 maxSongs, UINT16* startOrders)
+{
+	// Songs are stored as consecutive blocks in the order table.
+	// A song is played until it loops or ends, and the next song starts
+	// after the last order the previous one used.
+	UINT8 orderUsage[0x200 / 8];
+	UINT32 loopOfs;
+	UINT16 songCnt;
+	UINT16 orderId;
+	UINT16 curOrder;
+	
+	songCnt = 0;
+	orderId = 0x000;
+	while(orderId < 0x200 && songCnt < maxSongs)
+	{
+		if (orderPatPos[orderId] >= SndDataLen || SndDataPtr[orderPatPos[orderId]] == 0x00)
+			break;	// invalid pattern or empty song - assume the end of the table
+		
+		PreparseCoreDesign(SndDataLen, SndDataPtr, orderId, &loopOfs, orderUsage);
+		startOrders[songCnt] = orderId;
+		songCnt ++;
+		
+		for (curOrder = orderId + 1; curOrder < 0x200; curOrder ++)
+		{
+			if (orderUsage[curOrder / 8] & (1 << (curOrder & 0x07)))
+				orderId = curOrder;
+		}
+		orderId ++;
+	}
+	
+	return songCnt;
+}
+
+static UINT8 ConvertSongs(const char* outFileName, UINT16 songCnt, const UINT16* songOrders)
+{
+	const char* fileExt;
+	size_t extPos;
+	SONG_JOB* jobs;
+	SONG_WORKER* workers;
+	UINT32 threadCnt;
+	UINT32 curThr;
+	UINT32 startedThr;
+	UINT16 curFile;
+	UINT8 result;
+	
+	if (! songCnt)
+		return 0x00;
+	
+	fileExt = strrchr(GetFileTitle(outFileName), '.');
+	if (fileExt == NULL)
+		fileExt = outFileName + strlen(outFileName);
+	extPos = fileExt - outFileName;
+	
+	jobs = (SONG_JOB*)calloc(songCnt, sizeof(SONG_JOB));
+	if (jobs == NULL)
+	{
+		printf("Not enough memory!\n");
+		return 0xFF;
+	}
+	for (curFile = 0; curFile < songCnt; curFile ++)
+	{
+		jobs[curFile].orderId = songOrders[curFile];
+		jobs[curFile].fileName = (char*)malloc(strlen(outFileName) + 0x10);
+		if (jobs[curFile].fileName == NULL)
+			break;
+		strcpy(jobs[curFile].fileName, outFileName);
+		sprintf(jobs[curFile].fileName + extPos, "_%02X%s", curFile, fileExt);
+	}
+	
+	// The songs only read the ROM and the shared order table, so they can be converted in parallel.
+	threadCnt = NUM_THREADS ? NUM_THREADS : Thread_GetCPUCount();
+	if (threadCnt > songCnt)
+		threadCnt = songCnt;
+	workers = NULL;
+	if (curFile >= songCnt)
+		workers = (SONG_WORKER*)calloc(threadCnt, sizeof(SONG_WORKER));
+	if (workers == NULL)
+	{
+		printf("Not enough memory!\n");
+		for (curFile = 0; curFile < songCnt; curFile ++)
+			free(jobs[curFile].fileName);
+		free(jobs);
+		return 0xFF;
+	}
+	for (curThr = 0; curThr < threadCnt; curThr ++)
+	{
+		workers[curThr].jobCnt = songCnt;
+		workers[curThr].jobs = jobs;
+		workers[curThr].firstJob = (UINT16)curThr;
+		workers[curThr].jobStep = (UINT16)threadCnt;
+	}
+	for (startedThr = 1; startedThr < threadCnt; startedThr ++)
+	{
+		if (Thread_Start(&workers[startedThr].thread, &SongWorker_Main, &workers[startedThr]))
+			break;
+	}
+	// Jobs of threads that couldn't be started are done by the main thread.
+	SongWorker_Main(&workers[0]);
+	for (curThr = startedThr; curThr < threadCnt; curThr ++)
+		SongWorker_Main(&workers[curThr]);
+	for (curThr = 1; curThr < startedThr; curThr ++)
+		Thread_Join(&workers[curThr].thread);
+	free(workers);
+	
+	// report results in the original order
+	result = 0x00;
+	for (curFile = 0; curFile < songCnt; curFile ++)
+	{
+		printf("File %u / %u (order %u) ... ", 1 + curFile, songCnt, jobs[curFile].orderId);
+		if (jobs[curFile].result == 0xFF)
+			printf("write error\n");
+		else if (jobs[curFile].result)
+			printf("conversion error\n");
+		else
+			printf("OK\n");
+		if (jobs[curFile].log.len)
+			fputs(jobs[curFile].log.data, stdout);
+		if (jobs[curFile].result)
+			result = jobs[curFile].result;
+		free(jobs[curFile].log.data);
+		free(jobs[curFile].fileName);
+	}
+	free(jobs);
+	
+	return result;
+}
+
+static void SongWorker_Main(void* param)
+{
+	SONG_WORKER* wrk = (SONG_WORKER*)param;
+	UINT16 curJob;
+	UINT32 midLen;
+	UINT8* midData;
+	
+	for (curJob = wrk->firstJob; curJob < wrk->jobCnt; curJob += wrk->jobStep)
+	{
+		SONG_JOB* job = &wrk->jobs[curJob];
+		
+		midData = NULL;
+		job->result = CoreDesign2Mid(SndDataLen, SndDataPtr, job->orderId, &midLen, &midData, &job->log);
+		if (! job->result && WriteFileData(job->fileName, midLen, midData, &job->log))
+			job->result = 0xFF;
+		free(midData);
+	}
+	
+	return;
+}
+
+// Prints a message or, when "log" is not NULL, appends it to the log.
+static void LogMsg(MSG_LOG* log, const char* format, ...)
+{
+	va_list args;
+	int msgLen;
+	char* newData;
+	
+	va_start(args, format);
+	if (log == NULL)
+	{
+		vprintf(format, args);
+		va_end(args);
+		return;
+	}
+	msgLen = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if (msgLen <= 0)
+		return;
+	
+	if (log->len + msgLen + 1 > log->alloc)
+	{
+		UINT32 newAlloc = (log->len + msgLen + 1 + 0xFF) & ~0xFF;
+		newData = (char*)realloc(log->data, newAlloc);
+		if (newData == NULL)
+			return;	// drop the message
+		log->alloc = newAlloc;
+		log->data = newData;
+	}
+	va_start(args, format);
+	vsnprintf(&log->data[log->len], log->alloc - log->len, format, args);
+	va_end(args);
+	log->len += msgLen;
+	
+	return;
+}
+
+INLINE UINT8 HasActivePitchEffects(const SOUND_STATE* sndState)
+{
+	UINT8 curChn;
+	
+	for (curChn = 0; curChn < sndState->chnCnt; curChn ++)
+	{
+		const CHN_INF* ci = &sndState->chnInf[curChn];
+		if (ci->pitchBase == 0xFFFF)
+			continue;
+		if ((ci->flags & 0x09) || ((ci->flags & 0x02) && ci->pitchStep != 0))
+			return 1;
+	}
+	return 0;
 }
 
 static void ProcessDriverTicks(FILE_INF* fInf, MID_TRK_STATE* MTS, SOUND_STATE* sndState, UINT16 rows)
@@ -573,9 +894,24 @@ static void ProcessDriverTicks(FILE_INF* fInf, MID_TRK_STATE* MTS, SOUND_STATE*
 	for (; rows > 0; rows --)
 	{
 		UINT16 frm;
+		
+		// Effects are only enabled by sequence commands, so once there is no active effect,
+		// the remaining rows can be skipped without processing every frame.
+		if (! HasActivePitchEffects(sndState))
+		{
+			if (! sndState->rowTicks)
+				break;
+			if (TICK_TEMPO == TMODE_TPQ)
+				MTS->curDly += rows * sndState->rowTicks;
+			else if (TICK_TEMPO == TMODE_RPB)
+				MTS->curDly += rows * (BEAT_TICKS * RPB_TICK_MULT / BEAT_ROWS);
+			sndState->arpTick = (UINT8)((sndState->arpTick + rows * sndState->rowTicks) % 3);
+			break;
+		}
 		for (frm = 0; frm < sndState->rowTicks; frm ++)
 		{
 			UINT8 curChn;
+			STATS_FRAMES(1);
 			for (curChn = 0; curChn < sndState->chnCnt; curChn ++)
 			{
 				CHN_INF* ci = &sndState->chnInf[curChn];
@@ -590,7 +926,7 @@ static void ProcessDriverTicks(FILE_INF* fInf, MID_TRK_STATE* MTS, SOUND_STATE*
 					UINT16 arpPitch = ci->pitchBase;
 					if (sndState->arpTick > 0)
 						arpPitch += (ci->arpNotes[sndState->arpTick - 1] << 8);
-					WriteNotePitch(fInf, MTS, ci, arpPitch, 0);
+					WriteNotePitch(fInf, MTS, ci, arpPitch, 2);
 				}
 				else if ((ci->flags & 0x02) && ci->pitchStep != 0)
 				{
@@ -602,7 +938,7 @@ static void ProcessDriverTicks(FILE_INF* fInf, MID_TRK_STATE* MTS, SOUND_STATE*
 						ci->pitchOct = Note2Octave((UINT8)(ci->curPitch >> 8));
 						ci->flags &= ~0x02;
 					}
-					WriteNotePitch(fInf, MTS, ci, ci->curPitch, 0);
+					WriteNotePitch(fInf, MTS, ci, ci->curPitch, 2);
 				}
 				else if (ci->flags & 0x08)
 				{
@@ -616,7 +952,7 @@ static void ProcessDriverTicks(FILE_INF* fInf, MID_TRK_STATE* MTS, SOUND_STATE*
 					
 					ymFreq = (INT16)NotePitch2YMFreq(ci->curPitch, ci->pitchOct);
 					ymFreq += pitchMod;	// apply OPN frequency delta
-					WriteNotePitch(fInf, MTS, ci, YMFreq2NotePitch(ymFreq), 0);
+					WriteNotePitch(fInf, MTS, ci, YMFreq2NotePitch(ymFreq), 2);
 					// The vibrato frequency is applied only temporarily and not saved back.
 				}
 			}
@@ -637,7 +973,7 @@ static void ProcessDriverTicks(FILE_INF* fInf, MID_TRK_STATE* MTS, SOUND_STATE*
 	return;
 }
 
-UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId)
+UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId, UINT32* outLen, UINT8** outData, MSG_LOG* log)
 {
 	UINT16 patternId;
 	UINT32 inPos;
@@ -657,8 +993,11 @@ UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId)
 	midFileInf.data = (UINT8*)malloc(midFileInf.alloc);
 	midFileInf.pos = 0x00;
 	
+	STATS_PHASE_BEGIN(STATS_CONVERT);
 	loopOfs = 0x00;
-	PreparseCoreDesign(songLen, songData, orderId, &loopOfs);
+	STATS_PHASE_BEGIN(STATS_PREPARSE);
+	PreparseCoreDesign(songLen, songData, orderId, &loopOfs, NULL);
+	STATS_PHASE_END(STATS_PREPARSE);
 	
 	if (TICK_TEMPO == TMODE_RPB)
 		WriteMidiHeader(&midFileInf, 0x0000, 1, MIDI_RES * RPB_TICK_MULT);
@@ -702,7 +1041,7 @@ UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId)
 	{
 		if (midFileInf.pos >= 0x100000)	// 1 MB
 		{
-			printf("Cancelling conversion due to large output file! (possible infinite loop)\n");
+			LogMsg(log, "Cancelling conversion due to large output file! (possible infinite loop)\n");
 			break;
 		}
 		if (inPos == loopOfs && mstLoopCnt == 0)
@@ -713,6 +1052,7 @@ UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId)
 		}
 		
 		curCmd = songData[inPos];	inPos ++;
+		STATS_CMD((curCmd >= 0xC0) ? 0xC0 : (curCmd & 0x1E));	// count without channel/note bits
 		if (curCmd == 0x00)	// data end
 		{
 			trkEnd = 1;
@@ -809,6 +1149,11 @@ UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId)
 			case 'D':	// pattern break
 				procNote = 0;
 				orderId ++;
+				if (orderId >= 0x200)
+				{
+					trkEnd = 1;
+					break;
+				}
 				
 				ProcessDriverTicks(&midFileInf, &MTS, &sndState, 1);
 				
@@ -860,12 +1205,12 @@ UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId)
 				break;
 			case 'E':	// set game callback variable
 				tempU8 = songData[inPos];
-				printf("Game Callback = value %02X (chn %u) at %06X\n", tempU8, chn, inPos - 0x01);
+				LogMsg(log, "Game Callback = value %02X (chn %u) at %06X\n", tempU8, chn, inPos - 0x01);
 				WriteEvent(&midFileInf, &MTS, 0xB0, 0x10, tempU8);
 				inPos ++;
 				break;
 			default:
-				printf("Unknown event %02X (chn %u) at %06X\n", cmd, chn, inPos - 0x01);
+				LogMsg(log, "Unknown event %02X (chn %u) at %06X\n", cmd, chn, inPos - 0x01);
 				if (DEBUG_CC)
 					WriteEvent(&midFileInf, &MTS, 0xB0, 0x6E, cmd);
 				trkEnd = 1;
@@ -973,13 +1318,14 @@ UINT8 CoreDesign2Mid(UINT32 songLen, const UINT8* songData, UINT16 orderId)
 	WriteEvent(&midFileInf, &MTS, 0xFF, 0x2F, 0x00);
 	WriteMidiTrackEnd(&midFileInf, &MTS);
 	
-	MidData = midFileInf.data;
-	MidLen = midFileInf.pos;
+	*outData = midFileInf.data;
+	*outLen = midFileInf.pos;
+	STATS_PHASE_END(STATS_CONVERT);
 	
 	return 0x00;
 }
 	
-static void PreparseCoreDesign(UINT32 songLen, const UINT8* songData, UINT16 startOrderId, UINT32* loopOfs)
+static void PreparseCoreDesign(UINT32 songLen, const UINT8* songData, UINT16 startOrderId, UINT32* loopOfs, UINT8* orderUsage)
 {
 	UINT16 orderId;
 	UINT32 inPos;
@@ -987,12 +1333,14 @@ static void PreparseCoreDesign(UINT32 songLen, const UINT8* songData, UINT16 sta
 	UINT16 rowTicks;
 	UINT8 trkEnd;
 	UINT8 curCmd;
-	UINT8 orderUsage[0x200 / 8];
+	UINT8 usageBuf[0x200 / 8];
 	UINT8 orderMask;
 	
 	tickCnt = 0;
 	*loopOfs = 0x00;
-	memset(&orderUsage, 0x00, sizeof(orderUsage));
+	if (orderUsage == NULL)
+		orderUsage = usageBuf;	// The caller may want to know which orders the song uses.
+	memset(orderUsage, 0x00, 0x200 / 8);
 	orderId = startOrderId;
 	rowTicks = 1;
 	
@@ -1238,17 +1586,22 @@ static UINT8 ReadFileData(const char* fileName, UINT32* retSize, UINT8** retData
 	return 0x00;
 }
 
-static UINT8 WriteFileData(const char* fileName, UINT32 dataLen, const UINT8* data)
+static UINT8 WriteFileData(const char* fileName, UINT32 dataLen, const UINT8* data, MSG_LOG* log)
 {
-	FILE* hFile = fopen(fileName, "wb");
+	FILE* hFile;
+	
+	STATS_PHASE_BEGIN(STATS_WRITE);
+	hFile = fopen(fileName, "wb");
 	if (hFile == NULL)
 	{
-		printf("Error writing %s!\n", fileName);
+		LogMsg(log, "Error writing %s!\n", fileName);
+		STATS_PHASE_END(STATS_WRITE);
 		return 0xFF;
 	}
 	
 	fwrite(data, 0x01, dataLen, hFile);
 	fclose(hFile);
+	STATS_PHASE_END(STATS_WRITE);
 	
 	return 0x00;
 }
@@ -1299,13 +1652,14 @@ static void MinimizePBRange(FILE_INF* fInf, MID_TRK_STATE* MTS, CHN_INF* ci, INT
 	return;
 }
 
+// optional: 0 - always write, 1 - skip when not required, 2 - skip when the MIDI pitch bend doesn't change
 static void WriteNotePitch(FILE_INF* fInf, MID_TRK_STATE* MTS, CHN_INF* ci, UINT16 notePitch, UINT8 optional)
 {
 	INT16 pitchDiff = notePitch - ci->pitchBase;
 	INT32 pbVal;
 	UINT16 midPB;
 	
-	if (optional && pitchDiff == 0 && ci->pbRange == 0)
+	if (optional == 1 && pitchDiff == 0 && ci->pbRange == 0)
 		return;
 	EnsurePBRange(fInf, MTS, ci, pitchDiff);
 	
@@ -1550,9 +1904,58 @@ INLINE const char* GetFileTitle(const char* fileName)
 
 static UINT8 DetectDriverInfo(void)
 {
+	// --- 68000 code: sound driver loader ---
+	static const UINT8 Z80_DRV_LOADER[] = {
+		0x41, 0xF9, 0xAA, 0xAA, 0xAA, 0xAA,	//	LEA 	xxxxxxx.L, A0
+		0x43, 0xF9, 0x00, 0xA0, 0x00, 0x00,	//	LEA 	$A00000.L, A1
+		0x3E, 0x3C,							//	MOVE.W	#xxxx, D7
+	};
+	// --- 68000 code: Z80 ROM bank with sound data ---
+	static const UINT8 Z80_BANK_LOADER[] = {
+		0x13, 0xFC, 0x00, 0xAA, 0x00, 0xA0, 0x00, 0x40,	// MOVE.B	#xx, $A00040.L
+	};
+	// for Sega 32X games, the banking code looks like this:
+	//		13 FC 00 xx 00 A0 00 40	MOVE.B	#xx, $A00040.L	; sound driver bank
+	//		13 FC 00 xx 00 A1 51 04	MOVE.B	#xx, $A15404.L	; 32X ROM bank for 900000..9FFFFF
+	static const SCAN_PATTERN ROM_PATTERNS[2] = {
+		{sizeof(Z80_DRV_LOADER), Z80_DRV_LOADER, 0x02},
+		{sizeof(Z80_BANK_LOADER), Z80_BANK_LOADER, 0x02},
+	};
+	
+	// --- Z80 code: sound driver main data ---
+	static const UINT8 Z80_DRV_BASE[] = {
+		0x7E,					// LD	A, (HL)
+		0x23,					// INC	HL
+		0x66,					// LD	H, (HL)
+		0x6F,					// LD	L, A
+		0xED, 0x5B, 0xAA, 0xAA,	// LD	DE, (xxxx)
+		0x19,					// ADD	HL, DE
+	//	0x11, 0xAA, 0xAA,		// [variant 1]	LD	DE, xxxx	; Asterix and the Great Rescue
+	//	0xCB, 0xDC,				// [variant 2]	SET	3, H		; Asterix and the Power of The Gods, Bubba N Stix, Skeleton Krew
+	};
+	// --- Z80 code: sequence command jump table ---
+	static const UINT8 Z80_SEQCMD_LOADER[] = {
+		0xFD, 0x7E, 0x00,	// LD	A, (IY+00h)	; get 1st byte of address from jump table
+		0x32, 0xAA, 0xAA,	// LD	(xxxx), A	; copy into JP command, destination address low byte
+		0xFD, 0x7E, 0x01,	// LD	A, (IY+01h)	; get 2nd byte of address
+		0x32, 0xAA, 0xAA,	// LD	(xxxx), A	; copy into JP command, destination address high byte
+		0x7B,				// LD	A, E		; put command ID back into register A
+		0xC3,				// JP	xxxx		; jump to offset previously written
+	};
+	static const SCAN_PATTERN Z80_PATTERNS[2] = {
+		{sizeof(Z80_DRV_BASE), Z80_DRV_BASE, 0x01},
+		{sizeof(Z80_SEQCMD_LOADER), Z80_SEQCMD_LOADER, 0x01},
+	};
+	SCAN_SET scanSet;
+	UINT32 romPos[2];
+	UINT32 z80Pos[2];
 	UINT32 z80Len;
 	const UINT8* z80Data;
 
+	// The 68000 patterns are searched in a single pass over the ROM.
+	ScanSet_Init(&scanSet, 2, ROM_PATTERNS, 0xAA);
+	ScanSet_FindFirst(&scanSet, ROMLen, ROMData, romPos);
+	
 	if (Z80DumpData != NULL)
 	{
 		z80Len = Z80DumpLen;
@@ -1560,14 +1963,7 @@ static UINT8 DetectDriverInfo(void)
 	}
 	else
 	{
-		// --- search for sound driver ---
-		static const UINT8 Z80_DRV_LOADER[] = {
-			0x41, 0xF9, 0xAA, 0xAA, 0xAA, 0xAA,	//	LEA 	xxxxxxx.L, A0
-			0x43, 0xF9, 0x00, 0xA0, 0x00, 0x00,	//	LEA 	$A00000.L, A1
-			0x3E, 0x3C,							//	MOVE.W	#xxxx, D7
-		};
-		
-		UINT32 pos = ScanForData_WC(ROMLen, ROMData, sizeof(Z80_DRV_LOADER), Z80_DRV_LOADER, 0x00, 0x02);
+		UINT32 pos = romPos[0];
 		if (pos == (UINT32)-1)
 		{
 			printf("Unable to find Z80 sound driver.\n");
@@ -1595,15 +1991,8 @@ static UINT8 DetectDriverInfo(void)
 	}
 	
 	{
-		// --- search for Z80 ROM bank with sound data ---
-		static const UINT8 Z80_BANK_LOADER[] = {
-			0x13, 0xFC, 0x00, 0xAA, 0x00, 0xA0, 0x00, 0x40,	// MOVE.B	#xx, $A00040.L
-		};
-		// for Sega 32X games, the banking code looks like this:
-		//		13 FC 00 xx 00 A0 00 40	MOVE.B	#xx, $A00040.L	; sound driver bank
-		//		13 FC 00 xx 00 A1 51 04	MOVE.B	#xx, $A15404.L	; 32X ROM bank for 900000..9FFFFF
-		
-		UINT32 pos = ScanForData_WC(ROMLen, ROMData, sizeof(Z80_BANK_LOADER), Z80_BANK_LOADER, 0x00, 0x02);
+		// --- Z80 ROM bank with sound data ---
+		UINT32 pos = romPos[1];
 		if (pos == (UINT32)-1)
 		{
 			printf("Sound data bank ID not found.\n");
@@ -1628,20 +2017,13 @@ static UINT8 DetectDriverInfo(void)
 		}
 	}
 	
+	// Same for the Z80 driver patterns.
+	ScanSet_Init(&scanSet, 2, Z80_PATTERNS, 0xAA);
+	ScanSet_FindFirst(&scanSet, z80Len, z80Data, z80Pos);
+	
 	{
-		// --- search for sound driver main data --- (instruments, pattern pointers, etc.)
-		static const UINT8 Z80_DRV_BASE[] = {
-			0x7E,					// LD	A, (HL)
-			0x23,					// INC	HL
-			0x66,					// LD	H, (HL)
-			0x6F,					// LD	L, A
-			0xED, 0x5B, 0xAA, 0xAA,	// LD	DE, (xxxx)
-			0x19,					// ADD	HL, DE
-		//	0x11, 0xAA, 0xAA,		// [variant 1]	LD	DE, xxxx	; Asterix and the Great Rescue
-		//	0xCB, 0xDC,				// [variant 2]	SET	3, H		; Asterix and the Power of The Gods, Bubba N Stix, Skeleton Krew
-		};
-		
-		UINT32 pos = ScanForData_WC(z80Len, z80Data, sizeof(Z80_DRV_BASE), Z80_DRV_BASE, 0x00, 0x01);
+		// --- sound driver main data --- (instruments, pattern pointers, etc.)
+		UINT32 pos = z80Pos[0];
 		if (pos == (UINT32)-1)
 		{
 			printf("Z80 driver data offset not found.\n");
@@ -1659,18 +2041,10 @@ static UINT8 DetectDriverInfo(void)
 		// --- detect sound driver version ---
 		// "Asterix and the Great Rescue" uses an early version with different command IDs
 		// All other games seem to use a later version.
-		static const UINT8 Z80_SEQCMD_LOADER[] = {
-			0xFD, 0x7E, 0x00,	// LD	A, (IY+00h)	; get 1st byte of address from jump table
-			0x32, 0xAA, 0xAA,	// LD	(xxxx), A	; copy into JP command, destination address low byte
-			0xFD, 0x7E, 0x01,	// LD	A, (IY+01h)	; get 2nd byte of address
-			0x32, 0xAA, 0xAA,	// LD	(xxxx), A	; copy into JP command, destination address high byte
-			0x7B,				// LD	A, E		; put command ID back into register A
-			0xC3,				// JP	xxxx		; jump to offset previously written
-		};
 		UINT16 ptrTblPos;
 		UINT16 cmd02CodePos;
 		
-		UINT32 pos = ScanForData_WC(z80Len, z80Data, sizeof(Z80_SEQCMD_LOADER), Z80_SEQCMD_LOADER, 0x00, 0x01);
+		UINT32 pos = z80Pos[1];
 		if (pos == (UINT32)-1)
 		{
 			printf("Z80 driver sequence command table not found. Unable to determine sound driver version.\n");
@@ -1696,36 +2070,40 @@ static UINT8 DetectDriverInfo(void)
 	return 0x00;
 }
 
-// memcmp, wildcard version (the wildcard is 0xAA)
-static int memcmp_wc(const UINT8* data, const UINT8* compare, UINT32 count)
+static UINT8 LoadDriverInfoCache(const char* fileName, UINT64 romHash)
 {
-	for (; count > 0; count --)
-	{
-		if (*compare != 0xAA)
-		{
-			if (*data < *compare)
-				return -1;
-			else if (*data > *compare)
-				return +1;
-		}
-		data ++;	compare ++;
-	}
-	return 0;
+	DRV_INFO_CACHE dic;
+	UINT8 retVal;
+	
+	retVal = ROMCache_Load(fileName, ROMCACHE_ID('C', 'D', 'M', 'D'), ROMLen, romHash,
+							sizeof(DRV_INFO_CACHE), &dic, NULL, NULL);
+	if (retVal)
+		return retVal;
+	
+	z80DrvPos = dic.z80DrvPos;
+	z80BaseBank = dic.z80BaseBank;
+	z80DrvDataBase = dic.z80DrvDataBase;
+	z80InsTblPos = dic.z80InsTblPos;
+	z80DrvVer = dic.z80DrvVer;
+	if (z80DrvPos >= ROMLen || (UINT32)(z80BaseBank << 15) >= ROMLen)
+		return 0x80;
+	printf("Using cached driver info: driver 0x%06X, bank 0x%02X, data 0x%04X, version %u\n",
+			z80DrvPos, z80BaseBank, z80DrvDataBase, z80DrvVer);
+	
+	return 0x00;
 }
 
-static UINT32 ScanForData_WC(UINT32 scanLen, const UINT8* scanData,
-							UINT32 matchLen, const UINT8* matchData, UINT32 startPos,
-							UINT32 step)
+static UINT8 SaveDriverInfoCache(const char* fileName, UINT64 romHash)
 {
-	UINT32 curPos;
+	DRV_INFO_CACHE dic;
 	
-	if (scanLen < matchLen)
-		return (UINT32)-1;
-	for (curPos = startPos; curPos < scanLen - matchLen; curPos += step)
-	{
-		if (! memcmp_wc(&scanData[curPos], matchData, matchLen))
-			return curPos;
-	}
+	memset(&dic, 0x00, sizeof(DRV_INFO_CACHE));
+	dic.z80DrvPos = z80DrvPos;
+	dic.z80BaseBank = z80BaseBank;
+	dic.z80DrvDataBase = z80DrvDataBase;
+	dic.z80InsTblPos = z80InsTblPos;
+	dic.z80DrvVer = z80DrvVer;
 	
-	return (UINT32)-1;
+	return ROMCache_Save(fileName, ROMCACHE_ID('C', 'D', 'M', 'D'), ROMLen, romHash,
+						sizeof(DRV_INFO_CACHE), &dic, 0, NULL);
 }
@@ -0,0 +1,239 @@
+// Sound Chip Conversion Tables
+// ----------------------------
+// to be included as header file
+//
+// The volume and envelope curves of some sound chips need a few log/pow calls per conversion.
+// This header calculates them once for all possible register values, so that the
+// converters only need to do table lookups.
+//
+// Use the following macros to enable certain tables:
+//  SCSP_TABLES (Sega Model 2/System 32 sound driver)
+//      void SCSP_InitTables(const UINT8* velTable);
+//          Calculates the SCSP tables. Call this before using them.
+//          "velTable" is the sound driver's velocity table (0x80 entries, 00 = silent .. FF = max).
+//          When it is NULL, SCSP_Vel2Mid maps velocities 1:1.
+//      UINT8 SCSP_Vol2Mid[0x100]
+//          driver volume (00..7F, 0.375 db steps) -> MIDI volume
+//      UINT8 SCSP_Vel2Mid[0x100]
+//          note velocity -> MIDI volume (using velTable)
+//      INT16 SCSP_AR2SF2[0x20]
+//      INT16 SCSP_DR2SF2[0x20]
+//          SCSP attack/decay rate (00..1F) -> SF2 time (1200 * Log2(seconds))
+//      INT16 SCSP_DL2SF2[0x20]
+//          SCSP decay level (00..1F) -> SF2 sustain attenuation (db * 10)
+//
+//  SEGAPCM_TABLES (SegaPCM with separate left/right volume)
+//      void SegaPCM_InitTables(void);
+//          Calculates the SegaPCM tables. Call this before using them.
+//      UINT8 SegaPCM_Pan2Mid[0x40][0x40]
+//          [VolL][VolR] -> MIDI pan
+//      UINT8 SegaPCM_Vol2Mid[0x40][0x40]
+//          [VolL][VolR] -> MIDI volume (01..7F, includes the boost to compensate for MIDI panning)
+
+#ifndef __CHIP_TABLES_H__
+#define __CHIP_TABLES_H__
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stddef.h>	// for NULL
+#include "stdtype.h"
+
+#ifndef M_PI_2
+#define M_PI_2	1.57079632679489661923
+#endif
+#ifndef M_SQRT2
+#define M_SQRT2	1.41421356237309504880
+#endif
+
+
+#ifdef SCSP_TABLES
+
+static UINT8 SCSP_Vol2Mid[0x100];
+static UINT8 SCSP_Vel2Mid[0x100];
+static INT16 SCSP_AR2SF2[0x20];
+static INT16 SCSP_DR2SF2[0x20];
+static INT16 SCSP_DL2SF2[0x20];
+
+static UINT8 SCSP_DB2MidiVol(float DB)
+{
+	float TempSng;
+	
+	TempSng = (float)pow(10.0, DB / 40.0);
+	if (TempSng > 1.0f)
+		TempSng = 1.0f;
+	return (UINT8)(TempSng * 0x7F + 0.5);
+}
+
+static INT16 SCSP_RoundTo16(double Value)
+{
+	if (Value <= -32768.0)
+		return -32768;
+	else if (Value >= 32767.0)
+		return 32767;
+	
+	if (Value < 0.0)
+		return (INT16)(Value - 0.5);
+	else
+		return (INT16)(Value + 0.5);
+}
+
+static INT16 SCSP_CalcSF2Rate(UINT8 SCSPRate, UINT8 IsAtk)
+{
+	// from MAME's scsp.c
+	static const double ARTimes[64] =
+	{	100000,100000,8100.0,6900.0,6000.0,4800.0,4000.0,3400.0,3000.0,2400.0,2000.0,1700.0,1500.0,
+		1200.0,1000.0,860.0,760.0,600.0,500.0,430.0,380.0,300.0,250.0,220.0,190.0,150.0,130.0,110.0,95.0,
+		76.0,63.0,55.0,47.0,38.0,31.0,27.0,24.0,19.0,15.0,13.0,12.0,9.4,7.9,6.8,6.0,4.7,3.8,3.4,3.0,2.4,
+		2.0,1.8,1.6,1.3,1.1,0.93,0.85,0.65,0.53,0.44,0.40,0.35,0.0,0.0};
+	static const double DRTimes[64] =
+	{	100000,100000,118200.0,101300.0,88600.0,70900.0,59100.0,50700.0,44300.0,35500.0,29600.0,25300.0,22200.0,17700.0,
+		14800.0,12700.0,11100.0,8900.0,7400.0,6300.0,5500.0,4400.0,3700.0,3200.0,2800.0,2200.0,1800.0,1600.0,1400.0,1100.0,
+		920.0,790.0,690.0,550.0,460.0,390.0,340.0,270.0,230.0,200.0,170.0,140.0,110.0,98.0,85.0,68.0,57.0,49.0,43.0,34.0,
+		28.0,25.0,22.0,18.0,14.0,12.0,11.0,8.5,7.1,6.1,5.4,4.3,3.6,3.1};
+	double RateVal;
+	
+	if (SCSPRate == 0x00)
+		return 32767;	// infinite
+	
+	if (IsAtk)
+		RateVal = ARTimes[SCSPRate * 2];
+	else
+		RateVal = DRTimes[SCSPRate * 2];
+	if (RateVal == 0.0)	// I *can* do that here, since I just copied it from the table,
+		return -32768;	// instant
+	
+	return SCSP_RoundTo16(1200 * log(RateVal / 1000.0) / log(2.0));
+}
+
+static INT16 SCSP_CalcSF2Level(UINT8 SCSPLevel)
+{
+	double LinLevel;
+	double DBLevel;
+	
+	if (SCSPLevel >= 0x1F)
+		return 32767;
+	
+	LinLevel = (SCSPLevel ^ 0x1F) / 31.0;
+	DBLevel = log(LinLevel) / log(2.0) * 6.0;
+	return (INT16)(DBLevel * -10.0 + 0.5);
+}
+
+static void SCSP_InitTables(const UINT8* velTable)
+{
+	UINT16 curVal;
+	UINT8 dbVal;
+	
+	// Volume is 00..7F
+	// The driver scales it up to 00 (min) to FF (max). One step is 0.1875 db.
+	// So the non-scaled volume uses 0.375 db steps.
+	SCSP_Vol2Mid[0x00] = 0x00;
+	for (curVal = 0x01; curVal < 0x100; curVal ++)
+	{
+		dbVal = (UINT8)curVal ^ 0x7F;	// 00..7F -> 7F..00
+		SCSP_Vol2Mid[curVal] = SCSP_DB2MidiVol(dbVal * -0.375f);
+	}
+	
+	SCSP_Vel2Mid[0x00] = 0x00;
+	for (curVal = 0x01; curVal < 0x100; curVal ++)
+	{
+		if (velTable == NULL)
+		{
+			SCSP_Vel2Mid[curVal] = (UINT8)curVal;
+			continue;
+		}
+		dbVal = velTable[curVal & 0x7F];
+		// Every entry in the table has bit 0 set, so
+		// I'll scale it down to 00..7F here.
+		dbVal = (dbVal >> 1) ^ 0x7F;
+		SCSP_Vel2Mid[curVal] = SCSP_DB2MidiVol(dbVal * -0.375f);
+	}
+	
+	for (curVal = 0x00; curVal < 0x20; curVal ++)
+	{
+		SCSP_AR2SF2[curVal] = SCSP_CalcSF2Rate((UINT8)curVal, 1);
+		SCSP_DR2SF2[curVal] = SCSP_CalcSF2Rate((UINT8)curVal, 0);
+		SCSP_DL2SF2[curVal] = SCSP_CalcSF2Level((UINT8)curVal);
+	}
+	
+	return;
+}
+
+#endif	// SCSP_TABLES
+
+
+#ifdef SEGAPCM_TABLES
+
+static UINT8 SegaPCM_Pan2Mid[0x40][0x40];
+static UINT8 SegaPCM_Vol2Mid[0x40][0x40];
+
+static UINT8 SegaPCM_DB2Mid(double DB)
+{
+	if (DB > 0.0)
+		DB = 0.0;
+	return (UINT8)(pow(10.0, DB / 40.0) * 0x7F + 0.5);
+}
+
+static UINT8 SegaPCM_CalcPan(UINT8 VolL, UINT8 VolR, double* RetVolFact)
+{
+	// GM Pan Formula:
+	//	PanAmount = (PanCtrlVal - 1) / 126
+	//	Left  Channel Gain [dB] = 20 * log10(cos(Pi / 2 * PanAmount))
+	//	Right Channel Gain [dB] = 20 * log10(sin(Pi / 2 * PanAmount))
+	double VolDiff;
+	double PanAngle;
+	double PanVal;
+	UINT8 FinPan;
+	
+	if (VolL == VolR)
+	{
+		*RetVolFact = 1.0;
+		return 0x40;
+	}
+	VolDiff = VolR / (double)(VolL + VolR);
+	
+	PanAngle = atan2(VolDiff, 1.0 - VolDiff);
+	PanVal = PanAngle / M_PI_2;
+	
+	FinPan = (UINT8)(PanVal * 0x80 + 0.5);	// actually the range is 1..126, but this looks nicer
+	if (FinPan > 0x7F)
+		FinPan = 0x7F;
+	*RetVolFact = M_SQRT2 / (cos(PanAngle) + sin(PanAngle));
+	return FinPan;
+}
+
+static UINT8 SegaPCM_CalcVol(UINT8 VolL, UINT8 VolR, double VolMul)
+{
+	double DBVol;
+	UINT8 FinVol;
+	
+	//DBVol = log((VolL + VolR) * VolMul / 126.0) / log(2.0) * 6.0;
+	DBVol = log((VolL + VolR) * VolMul / 126.0) * 8.65617024533378;
+	FinVol = SegaPCM_DB2Mid(DBVol);
+	if (FinVol <= 0)
+		FinVol = 1;
+	else if (FinVol > 0x7F)
+		FinVol = 0x7F;
+	return FinVol;
+}
+
+static void SegaPCM_InitTables(void)
+{
+	UINT8 volL;
+	UINT8 volR;
+	double volMul;
+	
+	for (volL = 0x00; volL < 0x40; volL ++)
+	{
+		for (volR = 0x00; volR < 0x40; volR ++)
+		{
+			SegaPCM_Pan2Mid[volL][volR] = SegaPCM_CalcPan(volL, volR, &volMul);
+			SegaPCM_Vol2Mid[volL][volR] = SegaPCM_CalcVol(volL, volR, volMul);
+		}
+	}
+	
+	return;
+}
+
+#endif	// SEGAPCM_TABLES
+
+#endif	// __CHIP_TABLES_H__
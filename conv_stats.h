@@ -0,0 +1,203 @@
+// Conversion Statistics
+// ---------------------
+// to be included as header file
+//
+// Optional profiling counters for the converters that emulate a sound driver.
+// They are compiled in only when CONV_STATS is defined. Without it, the counting macros expand to nothing.
+// Include this file before midi_funcs.h, so that it counts the MIDI events and reallocations.
+//  STATS_ENABLE(mode)
+//      Turns the counters on for mode STATS_TEXT/STATS_JSON. They are off until then.
+//  STATS_CMD(cmd)
+//      Counts a sequence command. (by opcode 00..FF)
+//  STATS_FRAMES(n)
+//      Counts emulated sound driver frames/ticks.
+//  STATS_EVENT(evt)
+//      Counts a MIDI event. (by status byte: 8x..Ex = channel events, F0/F7 = SysEx, FF = meta events)
+//      Data bytes (00..7F, i.e. running status) are ignored.
+//      This is done by midi_funcs.h.
+//  STATS_REALLOC()
+//      Counts a reallocation of the output buffer. This is done by midi_funcs.h.
+//  STATS_PHASE_BEGIN(phase) / STATS_PHASE_END(phase)
+//      Measures the time spent in a phase. (STATS_DETECT, STATS_PREPARSE, STATS_CONVERT, STATS_WRITE)
+//      Phases can be nested. The time of the inner phase is not counted for the outer one.
+//  STATS_PRINT(mode)
+//      Prints a summary (STATS_TEXT) or a JSON object (STATS_JSON). STATS_OFF prints nothing.
+//
+// Note: The counters are global and not thread-safe. Converters with worker threads must use
+//       only one thread while the counters are enabled.
+
+#ifndef __CONV_STATS_H__
+#define __CONV_STATS_H__
+
+#include <stdio.h>
+
+#define STATS_OFF	0
+#define STATS_TEXT	1
+#define STATS_JSON	2
+
+#define STATS_DETECT	0
+#define STATS_PREPARSE	1
+#define STATS_CONVERT	2
+#define STATS_WRITE		3
+#define STATS_PHASES	4
+
+#ifdef CONV_STATS
+
+#include <time.h>
+#include <assert.h>
+#include "stdtype.h"
+
+#define STATS_ENABLE(mode)			ConvStats.active = ((mode) != STATS_OFF)
+#define STATS_CMD(cmd)				(ConvStats.active ? (void)ConvStats.cmdCnt[(UINT8)(cmd)] ++ : (void)0)
+#define STATS_FRAMES(n)				(ConvStats.active ? (void)(ConvStats.frameCnt += (n)) : (void)0)
+#define STATS_EVENT(evt)			ConvStats_Event((UINT8)(evt))
+#define STATS_REALLOC()				(ConvStats.active ? (void)ConvStats.reallocCnt ++ : (void)0)
+#define STATS_PHASE_BEGIN(phase)	ConvStats_Begin(phase)
+#define STATS_PHASE_END(phase)		ConvStats_End(phase)
+#define STATS_PRINT(mode)			ConvStats_Print(mode)
+
+#define STATS_EVT_TYPES	9	// 8x..Ex, SysEx, Meta
+#define STATS_MAX_DEPTH	8
+
+typedef struct _conv_stats
+{
+	UINT32 cmdCnt[0x100];
+	UINT64 frameCnt;
+	UINT32 evtCnt[STATS_EVT_TYPES];
+	UINT32 reallocCnt;
+	UINT32 phaseCalls[STATS_PHASES];
+	clock_t phaseTime[STATS_PHASES];
+	clock_t lastTime;
+	UINT8 depth;
+	UINT8 phaseStack[STATS_MAX_DEPTH];
+	UINT8 active;
+} CONV_STATS_DATA;
+
+static CONV_STATS_DATA ConvStats;
+
+static void ConvStats_Event(UINT8 evt)
+{
+	if (! ConvStats.active || evt < 0x80)
+		return;
+	
+	if (evt == 0xFF)
+		ConvStats.evtCnt[8] ++;
+	else if (evt >= 0xF0)
+		ConvStats.evtCnt[7] ++;
+	else
+		ConvStats.evtCnt[(evt >> 4) & 0x07] ++;
+	
+	return;
+}
+
+static void ConvStats_Begin(UINT8 phase)
+{
+	clock_t curTime;
+	
+	if (! ConvStats.active)
+		return;
+	curTime = clock();
+	if (ConvStats.depth > 0)
+		ConvStats.phaseTime[ConvStats.phaseStack[ConvStats.depth - 1]] += curTime - ConvStats.lastTime;
+	if (ConvStats.depth < STATS_MAX_DEPTH)
+		ConvStats.phaseStack[ConvStats.depth] = phase;
+	ConvStats.depth ++;
+	ConvStats.phaseCalls[phase] ++;
+	ConvStats.lastTime = curTime;
+	
+	return;
+}
+
+static void ConvStats_End(UINT8 phase)
+{
+	clock_t curTime;
+	
+	if (! ConvStats.active || ! ConvStats.depth)
+		return;
+	curTime = clock();
+	ConvStats.depth --;
+	if (ConvStats.depth < STATS_MAX_DEPTH)
+	{
+		assert(ConvStats.phaseStack[ConvStats.depth] == phase);	// BEGIN/END pairs must nest
+		ConvStats.phaseTime[ConvStats.phaseStack[ConvStats.depth]] += curTime - ConvStats.lastTime;
+	}
+	(void)phase;	// unused when assert() is compiled out
+	ConvStats.lastTime = curTime;
+	
+	return;
+}
+
+static void ConvStats_Print(UINT8 mode)
+{
+	static const char* PHASE_NAMES[STATS_PHASES] = {"detect", "preparse", "convert", "write"};
+	static const char* EVT_NAMES[STATS_EVT_TYPES] = {
+		"noteOff", "noteOn", "polyAftertouch", "control", "program", "chnAftertouch", "pitchBend",
+		"sysEx", "meta"};
+	UINT32 curIdx;
+	UINT32 cmdTotal;
+	UINT8 isFirst;
+	
+	cmdTotal = 0;
+	for (curIdx = 0x00; curIdx < 0x100; curIdx ++)
+		cmdTotal += ConvStats.cmdCnt[curIdx];
+	
+	if (mode == STATS_TEXT)
+	{
+		printf("--- Statistics ---\n");
+		for (curIdx = 0; curIdx < STATS_PHASES; curIdx ++)
+		{
+			printf("%-9s %6u calls, %10.3f ms\n", PHASE_NAMES[curIdx], ConvStats.phaseCalls[curIdx],
+					ConvStats.phaseTime[curIdx] * 1000.0 / CLOCKS_PER_SEC);
+		}
+		printf("emulated frames: %.0f\n", (double)ConvStats.frameCnt);
+		printf("commands: %u\n", cmdTotal);
+		for (curIdx = 0x00; curIdx < 0x100; curIdx ++)
+		{
+			if (ConvStats.cmdCnt[curIdx])
+				printf("    %02X: %u\n", curIdx, ConvStats.cmdCnt[curIdx]);
+		}
+		printf("MIDI events:\n");
+		for (curIdx = 0; curIdx < STATS_EVT_TYPES; curIdx ++)
+			printf("    %-14s %u\n", EVT_NAMES[curIdx], ConvStats.evtCnt[curIdx]);
+		printf("output buffer reallocations: %u\n", ConvStats.reallocCnt);
+	}
+	else if (mode == STATS_JSON)
+	{
+		printf("{\"phases\": {");
+		for (curIdx = 0; curIdx < STATS_PHASES; curIdx ++)
+		{
+			printf("%s\"%s\": {\"calls\": %u, \"ms\": %.3f}", curIdx ? ", " : "", PHASE_NAMES[curIdx],
+					ConvStats.phaseCalls[curIdx], ConvStats.phaseTime[curIdx] * 1000.0 / CLOCKS_PER_SEC);
+		}
+		printf("}, \"frames\": %.0f, \"commands\": {", (double)ConvStats.frameCnt);
+		isFirst = 1;
+		for (curIdx = 0x00; curIdx < 0x100; curIdx ++)
+		{
+			if (! ConvStats.cmdCnt[curIdx])
+				continue;
+			printf("%s\"%02X\": %u", isFirst ? "" : ", ", curIdx, ConvStats.cmdCnt[curIdx]);
+			isFirst = 0;
+		}
+		printf("}, \"events\": {");
+		for (curIdx = 0; curIdx < STATS_EVT_TYPES; curIdx ++)
+			printf("%s\"%s\": %u", curIdx ? ", " : "", EVT_NAMES[curIdx], ConvStats.evtCnt[curIdx]);
+		printf("}, \"reallocs\": %u}\n", ConvStats.reallocCnt);
+	}
+	
+	return;
+}
+
+#else	// ! CONV_STATS
+
+#define STATS_ENABLE(mode)
+#define STATS_CMD(cmd)
+#define STATS_FRAMES(n)
+#define STATS_EVENT(evt)
+#define STATS_REALLOC()
+#define STATS_PHASE_BEGIN(phase)
+#define STATS_PHASE_END(phase)
+#define STATS_PRINT(mode)	((mode) ? (void)printf("Statistics are not available. (compile with -DCONV_STATS)\n") : (void)0)
+
+#endif	// CONV_STATS
+
+#endif	// __CONV_STATS_H__
@@ -11,6 +11,8 @@
 
 #include "stdtype.h"
 #include <stdbool.h>
+#include "scan_funcs.h"
+#include "conv_stats.h"
 
 
 typedef struct _track_info
@@ -26,6 +28,9 @@ typedef struct _track_info
 
 
 static UINT16 DetectSongCount(UINT32 DataLen, const UINT8* Data, UINT32 MusPtrOfs);
+static UINT16 CountSongs(UINT32 DataLen, const UINT8* Data, UINT32 MusPtrOfs, bool CheckHeaders);
+static bool IsValidSongHeader(UINT32 DataLen, const UINT8* Data, UINT32 HdrPos);
+static UINT16 LocateMusicList(UINT32 DataLen, const UINT8* Data, UINT32* RetMusPtrOfs);
 static void DetectBanks(UINT32 DataLen, const UINT8* Data, UINT32 MusPtrOfs, UINT16 SongCount, UINT8* BankArray);
 UINT8 Cotton2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen, UINT8** OutData*/);
 static void PreparseKnm(UINT32 KnmLen, const UINT8* KnmData, UINT8* KnmBuf, TRK_INFO* TrkInf, UINT8 Mode);
@@ -53,6 +58,7 @@ UINT8* MidData;
 UINT16 TickpQrtr;
 UINT16 DefLoopCount;
 bool NoLoopExt;
+UINT8 StatsMode;
 
 int main(int argc, char* argv[])
 {
@@ -79,7 +85,8 @@ int main(int argc, char* argv[])
 	printf("Cotton -> Midi Converter\n------------------------\n");
 	if (argc < 2)
 	{
-		printf("Usage: cotton2mid.exe [-Mode] [-Options] cotton/opr-13893.a11 0x10C10 [SongCnt]\n");
+		printf("Usage: cotton2mid.exe [-Mode] [-Options] cotton/opr-13893.a11 [0x10C10 [SongCnt]]\n");
+		printf("The music list address is searched for when it is omitted.\n");
 		printf("Modes:\n");
 		printf("    -mus        Music Mode (convert sequences to MID)\n");
 		//printf("    -ins        Instrument Mode (dump instruments to GYB)\n");
@@ -89,12 +96,14 @@ int main(int argc, char* argv[])
 		printf("    -Loops n    Loop each track at least n times. (default: 2)\n");
 		printf("    -NoLpExt    No Loop Extention\n");
 		printf("                Do not fill short tracks to the length of longer ones.\n");
+		printf("    -Stats      print profiling statistics (-StatsJSON: as JSON, requires compiling with CONV_STATS)\n");
 		return 0;
 	}
 	
 	TickpQrtr = 24;
 	DefLoopCount = 2;
 	NoLoopExt = false;
+	StatsMode = STATS_OFF;
 	
 	Mode = MODE_MUS;
 	argbase = 1;
@@ -126,12 +135,17 @@ int main(int argc, char* argv[])
 		}
 		else if (! _stricmp(argv[argbase] + 1, "NoLpExt"))
 			NoLoopExt = true;
+		else if (! _stricmp(argv[argbase] + 1, "Stats"))
+			StatsMode = STATS_TEXT;
+		else if (! _stricmp(argv[argbase] + 1, "StatsJSON"))
+			StatsMode = STATS_JSON;
 		else
 			break;
 		argbase ++;
 	}
+	STATS_ENABLE(StatsMode);
 	
-	if (argc < argbase + 2)
+	if (argc < argbase + 1)
 	{
 		printf("Not enough arguments.\n");
 		return 0;
@@ -143,10 +157,13 @@ int main(int argc, char* argv[])
 		TempPnt = OutFileBase + strlen(OutFileBase);
 	*TempPnt = 0x00;
 	
-	SongPos = strtoul(argv[argbase + 1], NULL, 0x10);
+	if (argc > argbase + 1)
+		SongPos = strtoul(argv[argbase + 1], NULL, 0x10);
+	else
+		SongPos = (UINT32)-1;
 	
-	if (argc > argbase + 3)
-		FileCount = (UINT16)strtoul(argv[argbase + 3], NULL, 0);
+	if (argc > argbase + 2)
+		FileCount = (UINT16)strtoul(argv[argbase + 2], NULL, 0);
 	else
 		FileCount = 0x00;
 
@@ -171,11 +188,25 @@ int main(int argc, char* argv[])
 	switch(Mode)
 	{
 	case MODE_MUS:
+		STATS_PHASE_BEGIN(STATS_DETECT);
+		if (SongPos == (UINT32)-1)
+		{
+			CurFile = LocateMusicList(InLen, InData, &SongPos);
+			if (! CurFile)
+			{
+				printf("Unable to find the music list! Please specify its address.\n");
+				free(InData);
+				return 2;
+			}
+			if (! FileCount)
+				FileCount = CurFile;
+		}
 		if (! FileCount)
 			FileCount = DetectSongCount(InLen, InData, SongPos);
 		
 		Banks = (UINT8*)malloc(FileCount);
 		DetectBanks(InLen, InData, SongPos, FileCount, Banks);
+		STATS_PHASE_END(STATS_DETECT);
 		
 		for (CurFile = 0x00; CurFile < FileCount; CurFile ++)
 		{
@@ -197,9 +228,11 @@ int main(int argc, char* argv[])
 			
 			sprintf(OutFile, "%s_%02X.mid", OutFileBase, CurFile);
 			
+			STATS_PHASE_BEGIN(STATS_WRITE);
 			hFile = fopen(OutFile, "wb");
 			if (hFile == NULL)
 			{
+				STATS_PHASE_END(STATS_WRITE);
 				free(MidData);	MidData = NULL;
 				printf("Error opening file!\n");
 				continue;
@@ -207,11 +240,13 @@ int main(int argc, char* argv[])
 			fwrite(MidData, MidLen, 0x01, hFile);
 			
 			fclose(hFile);
+			STATS_PHASE_END(STATS_WRITE);
 			free(MidData);	MidData = NULL;
 			printf("\n");
 		}
 		free(Banks);	Banks = NULL;
 		printf("Done.\n");
+		STATS_PRINT(StatsMode);
 		break;
 	case MODE_INS:
 		sprintf(OutFile, "%s.gyb", OutFileBase);
@@ -230,13 +265,22 @@ int main(int argc, char* argv[])
 static UINT16 DetectSongCount(UINT32 DataLen, const UINT8* Data, UINT32 MusPtrOfs)
 {
 	// Song Count autodetection
+	UINT16 SongCnt;
+	
+	SongCnt = CountSongs(DataLen, Data, MusPtrOfs, false);
+	printf("Songs detected: 0x%02X (%u)\n", SongCnt, SongCnt);
+	return SongCnt;
+}
+
+static UINT16 CountSongs(UINT32 DataLen, const UINT8* Data, UINT32 MusPtrOfs, bool CheckHeaders)
+{
 	UINT32 CurPos;
-	UINT8 SongID;
+	UINT16 SongCnt;	// 16 bits, so that a list with all 256 song IDs can be counted
 	
-	SongID = 0x00;
-	for (CurPos = MusPtrOfs; CurPos < DataLen; CurPos += 0x18, SongID ++)
+	SongCnt = 0;
+	for (CurPos = MusPtrOfs; CurPos < DataLen && SongCnt < 0x100; CurPos += 0x18, SongCnt ++)
 	{
-		if (Data[CurPos] != SongID && ! Data[CurPos])
+		if (Data[CurPos] != SongCnt && ! Data[CurPos])
 		{
 			if (! Data[CurPos])
 			{
@@ -245,23 +289,85 @@ static UINT16 DetectSongCount(UINT32 DataLen, const UINT8* Data, UINT32 MusPtrOf
 					break;
 			}
 		}
-		if (Data[CurPos] != SongID)
+		if (Data[CurPos] != SongCnt)
+			break;
+		if (CheckHeaders && SongCnt > 0x00 && ! IsValidSongHeader(DataLen, Data, CurPos))
 			break;
 	}
 	
-	printf("Songs detected: 0x%02X (%u)\n", SongID, SongID);
-	return SongID;
+	return SongCnt;
+}
+
+static bool IsValidSongHeader(UINT32 DataLen, const UINT8* Data, UINT32 HdrPos)
+{
+	// Header: 1 byte song ID, 3 bytes ??, 2 bytes track mask, 9x2 bytes track pointers
+	// The pointers use Z80 addresses. (0000-7FFF = fixed ROM, 8000-BFFF = current bank)
+	UINT32 BnkBase;
+	UINT16 TrkMask;
+	UINT16 TrkPtr;
+	UINT8 CurTrk;
+	
+	if (HdrPos + 0x18 > DataLen)
+		return false;
+	TrkMask = ReadLE16(&Data[HdrPos + 0x04]);
+	if (! TrkMask || TrkMask >= (1 << 9))
+		return false;
+	
+	BnkBase = HdrPos & ~0x3FFF;
+	for (CurTrk = 0; CurTrk < 9; CurTrk ++, TrkMask >>= 1)
+	{
+		if (! (TrkMask & 0x01))
+			continue;
+		TrkPtr = ReadLE16(&Data[HdrPos + 0x06 + CurTrk * 0x02]);
+		if (TrkPtr >= 0xC000)
+			return false;
+		if (TrkPtr >= 0x8000 && BnkBase - 0x8000 + TrkPtr >= DataLen)
+			return false;
+	}
+	
+	return true;
+}
+
+// Music list autodetection
+// The list starts with a dummy entry with ID 00, followed by songs with the IDs 01, 02, ...
+// Candidates are ranked by the number of songs with valid headers.
+static UINT16 LocateMusicList(UINT32 DataLen, const UINT8* Data, UINT32* RetMusPtrOfs)
+{
+	SCAN_CAND ListCands[4];
+	UINT32 ListCandCnt;
+	UINT32 CurPos;
+	UINT16 SongCnt;
+	
+	ListCandCnt = 0;
+	for (CurPos = 0x8000; CurPos + 0x18 < DataLen; CurPos ++)
+	{
+		if (Data[CurPos] != 0x00 || Data[CurPos + 0x18] != 0x01)
+			continue;
+		SongCnt = CountSongs(DataLen, Data, CurPos, true);
+		if (SongCnt < 3)	// require at least the dummy entry and 2 songs
+			continue;
+		ScanCand_Add(4, &ListCandCnt, ListCands, CurPos, 0, SongCnt);
+	}
+	if (! ListCandCnt)
+		return 0;
+	
+	printf("Music list candidates:\n");
+	for (CurPos = 0; CurPos < ListCandCnt; CurPos ++)
+		printf("    Music List %06X: %u songs\n", ListCands[CurPos].pos, ListCands[CurPos].score);
+	*RetMusPtrOfs = ListCands[0].pos;
+	
+	return (UINT16)ListCands[0].score;
 }
 
 static void DetectBanks(UINT32 DataLen, const UINT8* Data, UINT32 MusPtrOfs, UINT16 SongCount, UINT8* BankArray)
 {
 	UINT32 CurPos;
-	UINT8 SongID;
+	UINT16 SongID;
 	
 	CurPos = MusPtrOfs;
 	for (SongID = 0x00; SongID < SongCount; SongID ++, CurPos += 0x18)
 	{
-		if (Data[CurPos] != SongID && ! Data[CurPos])
+		if (Data[CurPos] != (UINT8)SongID && ! Data[CurPos])
 		{
 			if (! Data[CurPos])
 			{
@@ -320,6 +426,8 @@ UINT8 Cotton2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 	TempSht = ReadLE16(&KnmData[InPos + 0x04]);
 	InPos += 0x06;
 	
+	STATS_PHASE_BEGIN(STATS_CONVERT);
+	STATS_PHASE_BEGIN(STATS_PREPARSE);
 	TrkCnt = 9;
 	TempBuf = (UINT8*)malloc(KnmLen);
 	RealTrkCnt = 0;
@@ -355,10 +463,15 @@ UINT8 Cotton2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 	}
 	free(TempBuf);	TempBuf = NULL;
 	if (! RealTrkCnt)
+	{
+		STATS_PHASE_END(STATS_PREPARSE);
+		STATS_PHASE_END(STATS_CONVERT);
 		return 0x01;
+	}
 	
 	if (! NoLoopExt)
 		GuessLoopTimes(TrkCnt, TrkInf);
+	STATS_PHASE_END(STATS_PREPARSE);
 	
 	MidLen = 0x20000;	// 128 KB should be enough
 	MidData = (UINT8*)malloc(MidLen);
@@ -447,11 +560,13 @@ UINT8 Cotton2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 				if (CurCmd == 0xF8)
 				{
 					CurDly += 240;
+					STATS_FRAMES(240);
 					ChnFlags &= ~0x02;
 				}
 				else
 				{
 					CurDly += CurCmd;
+					STATS_FRAMES(CurCmd);
 					ChnFlags |= 0x02;
 				}
 			}
@@ -464,6 +579,7 @@ UINT8 Cotton2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 					InPos ++;
 				}
 				CurCmd = LastCmd;
+				STATS_CMD(CurCmd);
 				switch(CurCmd & 0xF0)
 				{
 				case 0x80:	// Note Off
@@ -667,6 +783,7 @@ UINT8 Cotton2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 		WriteBE32(&MidData[TrkBase - 0x04], DstPos - TrkBase);	// write Track Length
 	}
 	MidLen = DstPos;
+	STATS_PHASE_END(STATS_CONVERT);
 	
 	return 0x00;
 }
@@ -1096,6 +1213,7 @@ static void WriteEvent(UINT8* Buffer, UINT32* Pos, UINT32* Delay, UINT8 Evt, UIN
 	WriteMidiValue(Buffer, Pos, *Delay);
 	*Delay = 0;
 	
+	STATS_EVENT(Evt);
 	switch(Evt & 0xF0)
 	{
 	case 0x80:
@@ -1132,6 +1250,7 @@ static void WriteMetaEvent_Data(UINT8* Buffer, UINT32* Pos, UINT32* Delay, UINT8
 	WriteMidiValue(Buffer, Pos, *Delay);
 	*Delay = 0;
 	
+	STATS_EVENT(0xFF);
 	Buffer[*Pos + 0x00] = 0xFF;
 	Buffer[*Pos + 0x01] = MetaType;
 	*Pos += 0x02;
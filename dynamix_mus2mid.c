@@ -0,0 +1,381 @@
+// Dynamix Song -> Midi Converter
+// ------------------------------
+// C port of dynamix_mus2mid.py (Python version written by Valley Bell, 2023-01-22)
+//
+// Dynamix song file
+// -----------------
+// 4 bytes - sub-song 1 file offset (absolute, Little Endian)
+// 4 bytes - sub-song 2 file offset (absolute, Little Endian)
+// ...
+//
+// sub-song data:
+// 2 bytes - sub-song size (includes this value, Little Endian)
+// 2 bytes - ??
+// 2 bytes - MIDI resolution (ticks per quarter, Little Endian)
+// 2 bytes - ?? (always FF FF)
+// rest of the data - MIDI track payload
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stdtype.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef INLINE
+#if defined(_MSC_VER)
+#define INLINE	static __inline
+#elif defined(__GNUC__)
+#define INLINE	static __inline__
+#else
+#define INLINE	static inline
+#endif
+#endif	// INLINE
+
+#include "midi_funcs.h"
+
+
+typedef struct _file_list
+{
+	UINT32 count;
+	UINT32 alloc;
+	char** names;
+} FILE_LIST;
+
+static UINT8 ConvertFile(const char* inName, const char* outName);
+static UINT8 WriteSubSong(const char* fileName, UINT16 resolution, UINT32 payloadLen, const UINT8* payload);
+static char* GetSubSongName(const char* outName, UINT16 songID);
+static int ConvertDirectory(const char* inDir, const char* outDir);
+static void FileList_Add(FILE_LIST* list, char* fileName);
+static int FileList_Compare(const void* a, const void* b);
+static UINT8 ListDirFiles(const char* dirPath, FILE_LIST* list);
+static char* JoinPath(const char* dirPath, const char* fileName);
+static const char* GetLastDirSepPos(const char* fileName);
+INLINE const char* GetFileTitle(const char* fileName);
+INLINE UINT16 ReadLE16(const UINT8* data);
+INLINE UINT32 ReadLE32(const UINT8* data);
+
+
+#define SUBSONG_HDR_SIZE	0x08
+
+int main(int argc, char* argv[])
+{
+	printf("Dynamix song -> MID converter\n-----------------------------\n");
+	if (argc < 3)
+	{
+		printf("Usage: dynamix_mus2mid.exe song.rol song.mid\n");
+		printf("       dynamix_mus2mid.exe -d inputDir outputDir\n");
+		printf("Sub-songs are written to song0.mid, song1.mid, etc.\n");
+		printf("Directory mode (-d) converts all files of inputDir.\n");
+		return 0;
+	}
+	
+	if (! strcmp(argv[1], "-d"))
+	{
+		if (argc < 4)
+		{
+			printf("Not enough arguments.\n");
+			return 0;
+		}
+		return ConvertDirectory(argv[2], argv[3]);
+	}
+	
+	return ConvertFile(argv[1], argv[2]) ? 1 : 0;
+}
+
+static UINT8 ConvertFile(const char* inName, const char* outName)
+{
+	FILE* hFile;
+	UINT32 musSize;
+	UINT8* musData;
+	UINT32 firstSongPos;
+	UINT32 tocPos;
+	UINT32 songOfs;
+	UINT32 songSize;
+	UINT16 songID;
+	char* songName;
+	UINT8 retVal;
+	
+	hFile = fopen(inName, "rb");
+	if (hFile == NULL)
+	{
+		printf("Error opening %s!\n", inName);
+		return 0xFF;
+	}
+	
+	fseek(hFile, 0x00, SEEK_END);
+	musSize = ftell(hFile);
+	fseek(hFile, 0x00, SEEK_SET);
+	musData = (UINT8*)malloc(musSize ? musSize : 1);
+	musSize = (UINT32)fread(musData, 0x01, musSize, hFile);
+	fclose(hFile);
+	
+	// read TOC (it ends where the first sub-song begins)
+	firstSongPos = musSize;
+	for (tocPos = 0x00; tocPos + 0x04 <= firstSongPos; tocPos += 0x04)
+	{
+		songOfs = ReadLE32(&musData[tocPos]);
+		if (firstSongPos > songOfs)
+			firstSongPos = songOfs;
+	}
+	
+	retVal = 0x00;
+	for (songID = 0; songID < tocPos / 0x04; songID ++)
+	{
+		songOfs = ReadLE32(&musData[songID * 0x04]);
+		if (songOfs < tocPos || musSize < SUBSONG_HDR_SIZE || songOfs > musSize - SUBSONG_HDR_SIZE)
+		{
+			printf("Song %u: invalid offset 0x%04X\n", songID, songOfs);
+			retVal = 0x80;
+			continue;
+		}
+		songSize = ReadLE16(&musData[songOfs + 0x00]);
+		printf("Song %u: offset = 0x%04X, size = 0x%04X, val2 = 0x%04X, resolution = %u, val4 = 0x%04X\n",
+				songID, songOfs, songSize, ReadLE16(&musData[songOfs + 0x02]),
+				ReadLE16(&musData[songOfs + 0x04]), ReadLE16(&musData[songOfs + 0x06]));
+		if (songSize < SUBSONG_HDR_SIZE)
+		{
+			printf("Song %u: invalid size\n", songID);
+			retVal = 0x80;
+			continue;
+		}
+		if (songSize > musSize - songOfs)
+		{
+			printf("Song %u: data ends early, truncated to 0x%04X bytes\n", songID, musSize - songOfs);
+			songSize = musSize - songOfs;
+		}
+		
+		songName = GetSubSongName(outName, songID);
+		if (WriteSubSong(songName, ReadLE16(&musData[songOfs + 0x04]),
+						songSize - SUBSONG_HDR_SIZE, &musData[songOfs + SUBSONG_HDR_SIZE]))
+			retVal = 0xFF;
+		free(songName);
+	}
+	if (! tocPos)
+		printf("%s: no songs found\n", inName);
+	
+	free(musData);
+	return retVal;
+}
+
+// The payload already is a complete MIDI track, so only the header is generated.
+// The payload is written straight from the song file buffer.
+static UINT8 WriteSubSong(const char* fileName, UINT16 resolution, UINT32 payloadLen, const UINT8* payload)
+{
+	FILE_INF midFInf;
+	MID_TRK_STATE MTS;
+	UINT8 midHdr[0x20];
+	FILE* hFile;
+	UINT8 retVal;
+	
+	midFInf.alloc = sizeof(midHdr);
+	midFInf.data = midHdr;
+	midFInf.pos = 0x00;
+	WriteMidiHeader(&midFInf, 0x0000, 1, resolution);
+	WriteMidiTrackStart(&midFInf, &MTS);
+	WriteBE32(&midFInf.data[MTS.trkBase - 0x04], payloadLen);	// write Track Length
+	
+	hFile = fopen(fileName, "wb");
+	if (hFile == NULL)
+	{
+		printf("Error opening %s!\n", fileName);
+		return 0xFF;
+	}
+	
+	retVal = 0x00;
+	if (fwrite(midFInf.data, 0x01, midFInf.pos, hFile) != midFInf.pos)
+		retVal = 0xFF;
+	else if (fwrite(payload, 0x01, payloadLen, hFile) != payloadLen)
+		retVal = 0xFF;
+	if (fclose(hFile))
+		retVal = 0xFF;
+	if (retVal)
+		printf("Error writing %s!\n", fileName);
+	
+	return retVal;
+}
+
+// "song.mid" -> "song0.mid", "song1.mid", ...
+static char* GetSubSongName(const char* outName, UINT16 songID)
+{
+	const char* extPos;
+	size_t baseLen;
+	char* songName;
+	
+	extPos = strrchr(outName, '.');
+	if (extPos == NULL || extPos < GetFileTitle(outName))
+		extPos = outName + strlen(outName);
+	baseLen = extPos - outName;
+	
+	songName = (char*)malloc(baseLen + 0x10 + strlen(extPos));
+	memcpy(songName, outName, baseLen);
+	sprintf(&songName[baseLen], "%u%s", songID, extPos);
+	
+	return songName;
+}
+
+// Converts all files of a directory in one run. The output files are named after the input files.
+static int ConvertDirectory(const char* inDir, const char* outDir)
+{
+	FILE_LIST fileList;
+	UINT32 curFile;
+	char* outName;
+	char* newName;
+	char* extPos;
+	int result;
+	
+	fileList.count = 0;
+	fileList.alloc = 0;
+	fileList.names = NULL;
+	if (ListDirFiles(inDir, &fileList))
+	{
+		printf("Error reading directory %s!\n", inDir);
+		return 1;
+	}
+	qsort(fileList.names, fileList.count, sizeof(char*), &FileList_Compare);
+	
+	result = 0;
+	for (curFile = 0; curFile < fileList.count; curFile ++)
+	{
+		printf("File %s\n", fileList.names[curFile]);
+		outName = JoinPath(outDir, GetFileTitle(fileList.names[curFile]));
+		newName = (outName != NULL) ? (char*)realloc(outName, strlen(outName) + 0x05) : NULL;
+		if (newName == NULL)
+		{
+			printf("Out of memory!\n");
+			free(outName);
+			free(fileList.names[curFile]);
+			result = 1;
+			continue;
+		}
+		outName = newName;
+		extPos = strrchr(outName, '.');
+		if (extPos == NULL || extPos < GetFileTitle(outName))
+			extPos = outName + strlen(outName);
+		strcpy(extPos, ".mid");
+		
+		if (ConvertFile(fileList.names[curFile], outName))
+			result = 1;
+		free(outName);
+		free(fileList.names[curFile]);
+	}
+	free(fileList.names);
+	printf("%u files processed.\n", fileList.count);
+	
+	return result;
+}
+
+static void FileList_Add(FILE_LIST* list, char* fileName)
+{
+	if (list->count >= list->alloc)
+	{
+		list->alloc += 0x40;
+		list->names = (char**)realloc(list->names, list->alloc * sizeof(char*));
+	}
+	list->names[list->count] = fileName;
+	list->count ++;
+	
+	return;
+}
+
+static int FileList_Compare(const void* a, const void* b)
+{
+	return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Adds all files of a directory to the list. (no subdirectories)
+// Returns 0xFF when the path isn't a directory.
+static UINT8 ListDirFiles(const char* dirPath, FILE_LIST* list)
+{
+#ifdef _WIN32
+	char* findPath;
+	HANDLE hFind;
+	WIN32_FIND_DATAA findData;
+	
+	findPath = JoinPath(dirPath, "*");
+	hFind = FindFirstFileA(findPath, &findData);
+	free(findPath);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return 0xFF;
+	
+	do
+	{
+		if (! (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			FileList_Add(list, JoinPath(dirPath, findData.cFileName));
+	} while(FindNextFileA(hFind, &findData));
+	FindClose(hFind);
+#else
+	DIR* hDir;
+	struct dirent* dirEnt;
+	struct stat fileStat;
+	char* filePath;
+	
+	hDir = opendir(dirPath);
+	if (hDir == NULL)
+		return 0xFF;
+	
+	while((dirEnt = readdir(hDir)) != NULL)
+	{
+		filePath = JoinPath(dirPath, dirEnt->d_name);
+		if (! stat(filePath, &fileStat) && S_ISREG(fileStat.st_mode))
+			FileList_Add(list, filePath);
+		else
+			free(filePath);
+	}
+	closedir(hDir);
+#endif
+	
+	return 0x00;
+}
+
+static char* JoinPath(const char* dirPath, const char* fileName)
+{
+	size_t dirLen;
+	char* result;
+	
+	dirLen = strlen(dirPath);
+	result = (char*)malloc(dirLen + 1 + strlen(fileName) + 1);
+	if (result == NULL)
+		return NULL;
+	strcpy(result, dirPath);
+	if (dirLen > 0 && dirPath[dirLen - 1] != '/' && dirPath[dirLen - 1] != '\\')
+		result[dirLen ++] = '/';
+	strcpy(&result[dirLen], fileName);
+	
+	return result;
+}
+
+static const char* GetLastDirSepPos(const char* fileName)
+{
+	const char* sepPos;
+	const char* wSepPos;	// Windows separator
+	
+	sepPos = strrchr(fileName, '/');
+	wSepPos = strrchr(fileName, '\\');
+	if (wSepPos == NULL)
+		return sepPos;
+	else if (sepPos == NULL)
+		return wSepPos;
+	return (wSepPos > sepPos) ? wSepPos : sepPos;
+}
+
+INLINE const char* GetFileTitle(const char* fileName)
+{
+	const char* sepPos = GetLastDirSepPos(fileName);
+	return (sepPos != NULL) ? (sepPos + 1) : fileName;
+}
+
+INLINE UINT16 ReadLE16(const UINT8* data)
+{
+	return (data[0x01] << 8) | (data[0x00] << 0);
+}
+
+INLINE UINT32 ReadLE32(const UINT8* data)
+{
+	return	(data[0x03] << 24) | (data[0x02] << 16) |
+			(data[0x01] <<  8) | (data[0x00] <<  0);
+}
@@ -8,6 +8,9 @@
 //  - insert a 0x586 byte RCP header at the beginning
 //  - overwrite offset 0x1C1..0x1C5 with the first 5 bytes of the original file
 // and that's it already.
+//
+// When compiled with RCP2MID_LIB and linked with rcp2mid.c, the RCP data can be converted to MIDI directly:
+//  gcc -DRCP2MID_LIB fuga2rcp.c rcp2mid.c
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -25,6 +28,9 @@ static UINT8 WriteFileData(UINT32 DataLen, const UINT8* Data, const char* FileNa
 void DecryptData(UINT32 len, UINT8* data, UINT8 key);
 UINT8 Fuga2Rcp(UINT32 songLen, const UINT8* songData);
 static UINT16 ReadLE16(const UINT8* data);
+#ifdef RCP2MID_LIB
+UINT8 RcpData2Mid(UINT32 rcpLen, const UINT8* rcpData, const char* filePath, UINT32* midLen, UINT8** midData);
+#endif
 
 
 static const UINT8 RCP_HEADER[0x0586] =
@@ -130,6 +136,9 @@ static UINT8* MidData;
 static UINT8 DECRYPT_KEY = 0xA5;
 static UINT8 CLEAN_RCP = 0;
 static const char* CTRL_FILE = NULL;
+#ifdef RCP2MID_LIB
+static UINT8 MIDI_OUT = 0;
+#endif
 
 int main(int argc, char* argv[])
 {
@@ -145,6 +154,9 @@ int main(int argc, char* argv[])
 		printf("    -Key n      specify decryption key (default: 0x%02X)\n", DECRYPT_KEY);
 		printf("    -Clean      clean up RCP file by stripping trailing garbage\n");
 		printf("    -Ctrl f.cm6 specify RCP Control File name\n");
+#ifdef RCP2MID_LIB
+		printf("    -Mid        convert to MIDI instead of RCP\n");
+#endif
 		return 0;
 	}
 	
@@ -167,6 +179,12 @@ int main(int argc, char* argv[])
 			if (argbase < argc)
 				CTRL_FILE = argv[argbase];
 		}
+#ifdef RCP2MID_LIB
+		else if (! stricmp(argv[argbase] + 1, "Mid"))
+		{
+			MIDI_OUT = 1;
+		}
+#endif
 		else
 			break;
 		argbase ++;
@@ -197,6 +215,20 @@ int main(int argc, char* argv[])
 	
 	DecryptData(ROMLen, ROMData, DECRYPT_KEY);
 	retVal = Fuga2Rcp(ROMLen, ROMData);
+#ifdef RCP2MID_LIB
+	if (! retVal && MIDI_OUT)
+	{
+		// hand the RCP data to the RCP converter instead of writing it
+		UINT32 smfLen;
+		UINT8* smfData;
+		
+		retVal = RcpData2Mid(MidLen, MidData, argv[argbase + 0], &smfLen, &smfData);
+		if (! retVal)
+			WriteFileData(smfLen, smfData, argv[argbase + 1]);
+		free(smfData);
+	}
+	else
+#endif
 	if (! retVal)
 		WriteFileData(MidLen, MidData, argv[argbase + 1]);
 	free(MidData);	MidData = NULL;
@@ -232,8 +264,21 @@ static UINT8 WriteFileData(UINT32 DataLen, const UINT8* Data, const char* FileNa
 
 void DecryptData(UINT32 len, UINT8* data, UINT8 key)
 {
+	// XOR a full machine word at once, only the unaligned start and the end are done byte by byte
+	size_t keyWord;
+	size_t curWord;
 	UINT32 curPos;
-	for (curPos = 0x00; curPos < len; curPos ++)
+	
+	memset(&keyWord, key, sizeof(size_t));
+	for (curPos = 0x00; curPos < len && ((size_t)&data[curPos] & (sizeof(size_t) - 1)); curPos ++)
+		data[curPos] ^= key;
+	for (; curPos + sizeof(size_t) <= len; curPos += sizeof(size_t))
+	{
+		memcpy(&curWord, &data[curPos], sizeof(size_t));	// compiles to a single load/store
+		curWord ^= keyWord;
+		memcpy(&data[curPos], &curWord, sizeof(size_t));
+	}
+	for (; curPos < len; curPos ++)
 		data[curPos] ^= key;
 	return;
 }
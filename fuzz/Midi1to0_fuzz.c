@@ -0,0 +1,28 @@
+// libFuzzer harness for Midi1to0 (MIDI1to0)
+// Build: clang -g -O1 -fsanitize=fuzzer,address,undefined -o Midi1to0_fuzz Midi1to0_fuzz.c
+// Run:   ./Midi1to0_fuzz -timeout=2 -rss_limit_mb=1024 -malloc_limit_mb=256 -max_len=0x10000 -close_fd_mask=1 corpus/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "../Midi1to0.c"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	unsigned char* srcData;
+	unsigned long int dstLen;
+	unsigned char* dstData;
+	
+	if (size > 0x1000000)
+		return 0;
+	// copy the data, so that reads beyond the end are caught by ASan
+	srcData = (unsigned char*)malloc(size ? size : 1);
+	if (srcData == NULL)
+		return 0;
+	memcpy(srcData, data, size);
+	
+	if (! MIDI1to0((unsigned long int)size, srcData, &dstLen, &dstData))
+		free(dstData);
+	free(srcData);
+	
+	return 0;
+}
@@ -0,0 +1,30 @@
+// libFuzzer harness for TaitoZoom (song table and ConvertSong for all songs)
+// Build: clang -g -O1 -fsanitize=fuzzer,address,undefined -o TaitoZoom_fuzz TaitoZoom_fuzz.c
+// Run:   ./TaitoZoom_fuzz -timeout=5 -rss_limit_mb=1024 -malloc_limit_mb=256 -max_len=0x80000 -close_fd_mask=1 corpus/
+#include <stdint.h>
+#include <stddef.h>
+#define main	TaitoZoom_main
+#include "../TaitoZoom.c"
+#undef main
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	UINT16 curSong;
+	
+	// same buffer as main() uses: the ROM size plus 0x10 bytes of padding
+	srcSize = ROM_SIZE;
+	srcData = (UINT8*)calloc(srcSize + 0x10, 1);
+	if (srcData == NULL)
+		return 0;
+	memcpy(srcData, data, (size < srcSize) ? size : srcSize);
+	
+	GetSongTable(0x7ff8);
+	for (curSong = 0; curSong < songCount; curSong ++)
+	{
+		ConvertSong(songTable[curSong]);
+		free(dstData);	dstData = NULL;
+	}
+	free(srcData);	srcData = NULL;
+	
+	return 0;
+}
@@ -0,0 +1,66 @@
+// Standalone driver for the fuzzing harnesses
+// --------------------------------------------
+// Runs LLVMFuzzerTestOneInput once for every file given on the command line.
+// It is used to reproduce crashes and to run a corpus with compilers that have no libFuzzer,
+// e.g. gcc or afl-gcc:
+//  gcc -g -O1 -fsanitize=address,undefined -o rcp2mid_fuzz fuzz_main.c rcp2mid_fuzz.c -DRCP2MID_LIB
+//  ./rcp2mid_fuzz corpus/*
+// Each input is stopped after TIMEOUT_SEC seconds (SIGALRM), so endless loops end the run like a crash.
+// The memory can be limited with "ulimit -v" (without ASan) or ASAN_OPTIONS=max_allocation_size_mb=n.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#ifndef _WIN32
+#include <unistd.h>	// for alarm()
+#endif
+
+#ifndef TIMEOUT_SEC
+#define TIMEOUT_SEC	5
+#endif
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int main(int argc, char* argv[])
+{
+	int curArg;
+	FILE* hFile;
+	long fileSize;
+	uint8_t* fileData;
+	
+	for (curArg = 1; curArg < argc; curArg ++)
+	{
+		hFile = fopen(argv[curArg], "rb");
+		if (hFile == NULL)
+		{
+			fprintf(stderr, "Error opening %s!\n", argv[curArg]);
+			continue;
+		}
+		fseek(hFile, 0, SEEK_END);
+		fileSize = ftell(hFile);
+		fseek(hFile, 0, SEEK_SET);
+		if (fileSize < 0)
+			fileSize = 0;
+		fileData = (uint8_t*)malloc(fileSize ? fileSize : 1);
+		if (fileData == NULL)
+		{
+			fprintf(stderr, "Out of memory for %s!\n", argv[curArg]);
+			fclose(hFile);
+			continue;
+		}
+		fileSize = (long)fread(fileData, 1, fileSize, hFile);
+		fclose(hFile);
+		
+		fprintf(stderr, "Running %s (%ld bytes)\n", argv[curArg], fileSize);
+#ifndef _WIN32
+		alarm(TIMEOUT_SEC);
+#endif
+		LLVMFuzzerTestOneInput(fileData, (size_t)fileSize);
+#ifndef _WIN32
+		alarm(0);
+#endif
+		free(fileData);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,50 @@
+// libFuzzer harness for gems2mid (song/version detection and Gems2Mid for all songs)
+// Build: clang -g -O1 -fsanitize=fuzzer,address,undefined -o gems2mid_fuzz gems2mid_fuzz.c
+// Run:   ./gems2mid_fuzz -timeout=2 -rss_limit_mb=1024 -malloc_limit_mb=256 -max_len=0x10000 -close_fd_mask=1 corpus/
+#include <stdint.h>
+#include <stddef.h>
+#ifndef _MSC_VER
+#include <strings.h>
+#define _stricmp	strcasecmp	// gems2mid uses the MSVC name
+#endif
+#define main	gems2mid_main
+#include "../gems2mid.c"
+#undef main
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	UINT8* inData;
+	UINT32 inLen;
+	UINT16 fileCount;
+	UINT16 curFile;
+	UINT32 curPos;
+	
+	if (size > 0x100000)
+		return 0;
+	// The loader pads the data with 0x10 zero bytes, so the harness does the same.
+	inLen = (UINT32)size;
+	inData = (UINT8*)malloc(inLen + 0x10);
+	if (inData == NULL)
+		return 0;
+	memcpy(inData, data, inLen);
+	memset(&inData[inLen], 0x00, 0x10);
+	
+	MidiDelayCallback = MidiDelayHandler;
+	StatsMode = STATS_OFF;
+	InsCount = 0x00;
+	fileCount = DetectSongCount(inLen, inData);
+	GemsVer = DetectGemsVer(inLen, inData);
+	if (! GemsVer)
+		GemsVer = GEMSVER_20;
+	
+	for (curFile = 0x00, curPos = 0x00; curFile < fileCount && curPos + 0x02 <= inLen; curFile ++, curPos += 0x02)
+	{
+		if (! Gems2Mid(inLen, inData, ReadLE16(&inData[curPos])))
+		{
+			free(MidData);	MidData = NULL;
+		}
+	}
+	free(inData);
+	
+	return 0;
+}
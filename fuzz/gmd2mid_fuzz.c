@@ -0,0 +1,31 @@
+// libFuzzer harness for gmd2mid (Gmd2Mid)
+// Build: clang -g -O1 -fsanitize=fuzzer,address,undefined -o gmd2mid_fuzz gmd2mid_fuzz.c
+// Run:   ./gmd2mid_fuzz -timeout=2 -rss_limit_mb=1024 -malloc_limit_mb=256 -max_len=0x10000 -close_fd_mask=1 corpus/
+#include <stdint.h>
+#include <stddef.h>
+#define main	gmd2mid_main
+#include "../gmd2mid.c"
+#undef main
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	UINT8* songData;
+	
+	if (size > 0x100000)	// same limit as the file loader
+		return 0;
+	// The loader pads the data with 0x10 zero bytes, so the harness does the same.
+	songData = (UINT8*)malloc(size + 0x10);
+	if (songData == NULL)
+		return 0;
+	memcpy(songData, data, size);
+	memset(&songData[size], 0x00, 0x10);
+	
+	MidiDelayCallback = MidiDelayHandler;
+	if (! Gmd2Mid((UINT32)size, songData))
+	{
+		free(MidData);	MidData = NULL;
+	}
+	free(songData);
+	
+	return 0;
+}
@@ -0,0 +1,38 @@
+// libFuzzer harness for msdrv2mid (MsDrv2Mid + PostProcessMidi)
+// Build: clang -g -O1 -fsanitize=fuzzer,address,undefined -o msdrv2mid_fuzz msdrv2mid_fuzz.c
+// Run:   ./msdrv2mid_fuzz -timeout=2 -rss_limit_mb=1024 -malloc_limit_mb=256 -max_len=0x10000 -close_fd_mask=1 corpus/
+#include <stdint.h>
+#include <stddef.h>
+#define main	msdrv2mid_main
+#include "../msdrv2mid.c"
+#undef main
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	UINT8* songData;
+	UINT8 retVal;
+	
+	if (size > 0x10000)	// same limit as the file loader
+		return 0;
+	// The loader pads the data with 0x100 zero bytes, so the harness does the same.
+	songData = (UINT8*)malloc(size + 0x100);
+	if (songData == NULL)
+		return 0;
+	memcpy(songData, data, size);
+	memset(&songData[size], 0x00, 0x100);
+	
+	// reset the state that main() would start with
+	MidiDelayCallback = MidiDelayHandler;
+	tempoChgTrk = 0xFF;
+	tempoChgTick = 0;
+	tempoChgPos = 0;
+	MidData = NULL;
+	
+	retVal = MsDrv2Mid((UINT32)size, songData);
+	if (! retVal)
+		PostProcessMidi();
+	free(MidData);	MidData = NULL;
+	free(songData);
+	
+	return 0;
+}
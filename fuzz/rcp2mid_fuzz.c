@@ -0,0 +1,28 @@
+// libFuzzer harness for rcp2mid (RcpData2Mid)
+// Build: clang -g -O1 -fsanitize=fuzzer,address,undefined -DRCP2MID_LIB -o rcp2mid_fuzz rcp2mid_fuzz.c
+// Run:   ./rcp2mid_fuzz -timeout=2 -rss_limit_mb=1024 -malloc_limit_mb=256 -max_len=0x10000 -close_fd_mask=1 corpus/
+#include <stdint.h>
+#include <stddef.h>
+#include "../rcp2mid.c"
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	UINT8* rcpData;
+	UINT32 midLen;
+	UINT8* midData;
+	
+	if (size > 0x100000)
+		return 0;
+	// copy the data, so that reads beyond the end are caught by ASan
+	rcpData = (UINT8*)malloc(size ? size : 1);
+	if (rcpData == NULL)
+		return 0;
+	memcpy(rcpData, data, size);
+	
+	midData = NULL;
+	RcpData2Mid((UINT32)size, rcpData, NULL, &midLen, &midData);
+	free(midData);
+	free(rcpData);
+	
+	return 0;
+}
@@ -24,7 +24,9 @@
 #endif
 #endif	// INLINE
 
+#include "conv_stats.h"
 #include "midi_funcs.h"
+#include "seq_guard.h"
 
 
 #define MODE_MUS	0x00
@@ -102,6 +104,7 @@ static UINT8 DacCount;
 static DAC_DATA DacData[0x80];
 
 static UINT8 NUM_LOOPS = 2;
+static UINT8 StatsMode;
 
 int main(int argc, char* argv[])
 {
@@ -141,6 +144,9 @@ int main(int argc, char* argv[])
 		printf("    v1 - GEMS 2.0-2.5 (2-byte track pointers)\n");
 		printf("    v2 - GEMS 2.8 (3-byte track pointers)\n");
 		printf("\n");
+		printf("Options:\n");
+		printf("    -Stats      print profiling statistics (-StatsJSON: as JSON, requires compiling with CONV_STATS)\n");
+		printf("\n");
 		return 0;
 	}
 	
@@ -148,6 +154,7 @@ int main(int argc, char* argv[])
 	
 	Mode = MODE_MUS;
 	GemsVer = 0;
+	StatsMode = STATS_OFF;
 	argbase = 1;
 	while(argbase < argc && argv[argbase][0] == '-')
 	{
@@ -158,6 +165,10 @@ int main(int argc, char* argv[])
 			Mode = MODE_DAC;
 		else if (! _stricmp(TempPnt, "Ins"))
 			Mode = MODE_INS;
+		else if (! _stricmp(TempPnt, "Stats"))
+			StatsMode = STATS_TEXT;
+		else if (! _stricmp(TempPnt, "StatsJSON"))
+			StatsMode = STATS_JSON;
 		else if (tolower(TempPnt[0]) == 'v')
 		{
 			GemsVer = TempPnt[1] - '0';
@@ -166,6 +177,7 @@ int main(int argc, char* argv[])
 		}
 		argbase ++;
 	}
+	STATS_ENABLE(StatsMode);
 	
 	if (argc <= argbase)
 	{
@@ -200,8 +212,10 @@ int main(int argc, char* argv[])
 			InLen = 0x800000;
 		
 		fseek(hFile, 0x00, SEEK_SET);
-		InData = (UINT8*)malloc(InLen);
-		fread(InData, 0x01, InLen, hFile);
+		// The padding prevents commands at the end of the data from reading beyond the buffer.
+		InData = (UINT8*)malloc(InLen + 0x10);
+		InLen = fread(InData, 0x01, InLen, hFile);
+		memset(&InData[InLen], 0x00, 0x10);
 		
 		fclose(hFile);
 		
@@ -211,6 +225,7 @@ int main(int argc, char* argv[])
 		if (argc > argbase + 2)
 			LoadInsData(argv[argbase + 2]);
 		
+		STATS_PHASE_BEGIN(STATS_DETECT);
 		if (! FileCount)
 		{
 			// Song Count autodetection
@@ -231,9 +246,10 @@ int main(int argc, char* argv[])
 				GemsVer = GEMSVER_20;
 			}
 		}
+		STATS_PHASE_END(STATS_DETECT);
 		
 		CurPos = SongPos;
-		for (CurFile = 0x00; CurFile < FileCount; CurFile ++, CurPos += 0x02)
+		for (CurFile = 0x00; CurFile < FileCount && CurPos + 0x02 <= InLen; CurFile ++, CurPos += 0x02)
 		{
 			printf("File %u / %u ...", CurFile + 1, FileCount);
 			TempSht = ReadLE16(&InData[CurPos]);
@@ -245,15 +261,22 @@ int main(int argc, char* argv[])
 					printf(" empty - ignored.\n");
 					continue;
 				}
+				if (RetVal == 0x80)
+				{
+					printf(" invalid offset - ignored.\n");
+					continue;
+				}
 				
 				return RetVal;
 			}
 			
 			sprintf(OutFile, "%s_%02X.mid", OutFileBase, CurFile);
 			
+			STATS_PHASE_BEGIN(STATS_WRITE);
 			hFile = fopen(OutFile, "wb");
 			if (hFile == NULL)
 			{
+				STATS_PHASE_END(STATS_WRITE);
 				free(MidData);	MidData = NULL;
 				printf("Error opening file!\n");
 				continue;
@@ -261,10 +284,12 @@ int main(int argc, char* argv[])
 			fwrite(MidData, MidLen, 0x01, hFile);
 			
 			fclose(hFile);
+			STATS_PHASE_END(STATS_WRITE);
 			free(MidData);	MidData = NULL;
 			printf("\n");
 		}
 		printf("Done.\n", CurFile + 1, FileCount);
+		STATS_PRINT(StatsMode);
 		break;
 	case MODE_DAC:
 		RetVal = LoadDACData(argv[argbase + 0]);
@@ -296,7 +321,7 @@ static UINT16 DetectSongCount(UINT32 InLen, const UINT8* InData)
 	
 	CurFile = 0x00;
 	MaxLen = InLen;
-	for (CurPos = 0x00, CurFile = 0x00; CurPos < MaxLen; CurPos += 0x02, CurFile ++)
+	for (CurPos = 0x00, CurFile = 0x00; CurPos < MaxLen && CurPos + 0x02 <= InLen; CurPos += 0x02, CurFile ++)
 	{
 		SongPtr = ReadLE16(&InData[CurPos]);
 		if (SongPtr < MaxLen)
@@ -308,19 +333,19 @@ static UINT16 DetectSongCount(UINT32 InLen, const UINT8* InData)
 static UINT8 DetectGemsVer(UINT32 InLen, const UINT8* InData)
 {
 	// detect GEMS Sequence type (2-byte or 3-byte pointers)
-	UINT16 BasePos;
+	UINT32 BasePos;
 	UINT16 MinPos1;
 	UINT16 MinPos2;
 	UINT16 CurPos;
 	UINT8 TrkCnt;
 	
 	MinPos1 = MinPos2 = 0xFFFF;
-	for (BasePos = 0x0000; BasePos < 0x200; BasePos += 0x02)
+	for (BasePos = 0x0000; BasePos < 0x200 && BasePos + 0x02 <= InLen; BasePos += 0x02)
 	{
 		if (BasePos >= MinPos1)
 			break;
 		CurPos = ReadLE16(&InData[BasePos]);
-		if (! InData[CurPos])	// skip empty songs
+		if (CurPos >= InLen || ! InData[CurPos])	// skip invalid and empty songs
 			continue;
 		
 		if (MinPos1 > CurPos)
@@ -329,6 +354,8 @@ static UINT8 DetectGemsVer(UINT32 InLen, const UINT8* InData)
 			MinPos2 = CurPos;
 	}
 	
+	if (MinPos1 >= InLen)
+		return 0;
 	TrkCnt = InData[MinPos1];
 	MinPos1 ++;
 	
@@ -427,7 +454,7 @@ UINT8 Gems2Mid(UINT32 GemsLen, UINT8* GemsData, UINT16 GemsAddr)
 	UINT8 LoopID;
 	UINT8 LoopCount[0x10];
 	UINT32 LoopAddr[0x10];
-	UINT8 LoopCur[0x10];
+	UINT16 LoopCur[0x10];	// 16-bit, so that a loop count of 0xFF can't overflow
 	UINT8 TempArr[0x04];
 	UINT8 JumpCount;
 	UINT32 TempLng;
@@ -442,12 +469,20 @@ UINT8 Gems2Mid(UINT32 GemsLen, UINT8* GemsData, UINT16 GemsAddr)
 	bool WrotePBDepth;
 	UINT8 ChnMode;
 	UINT8 PanMode;
+	UINT32 CurTick;
+	SEQ_GUARD SeqGuard;
+	UINT8 GrdRes;
 	
 	InPos = GemsAddr;
+	if (InPos >= GemsLen)
+		return 0x80;
 	
 	TrkCnt = GemsData[InPos];
 	if (! TrkCnt)
 		return 0x01;
+	if (InPos + 0x01 + TrkCnt * ((GemsVer == GEMSVER_28) ? 0x03 : 0x02) > GemsLen)
+		return 0x80;	// track pointer list exceeds the data
+	STATS_PHASE_BEGIN(STATS_CONVERT);
 	ChnPtrList = (UINT32*)malloc(TrkCnt * sizeof(UINT32));
 	InPos ++;
 	
@@ -490,12 +525,26 @@ UINT8 Gems2Mid(UINT32 GemsLen, UINT8* GemsData, UINT16 GemsAddr)
 		ChnVol = 0x7F;
 		PanMode = 0x00;
 		ChnDelay = 0x00;
+		CurTick = 0;
+		// Nested loops can repeat a few bytes billions of times, so the limits are much lower than the defaults.
+		// Real GEMS songs stay far below them. The output limit is checked against the whole file,
+		// as a song can have up to 255 tracks.
+		SeqGuard_Init(&SeqGuard);
+		SeqGuard.maxCmds = 0x20000;		// 128 K commands per track
+		SeqGuard.maxOutBytes = 0x100000;	// 1 MB per song
 		
 		while(! TrkEnd && InPos < GemsLen)
 		{
+			GrdRes = SeqGuard_Step(&SeqGuard, CurTick, midFileInf.pos);
+			if (GrdRes)
+			{
+				printf("Warning: %s on track %u at %04X - track cut!\n", SeqGuard_Reason(GrdRes), CurTrk, InPos);
+				break;
+			}
 			CurCmd = GemsData[InPos];
 			InPos ++;
 			ProcDelay = true;
+			STATS_CMD(CurCmd);
 			if (CurCmd < 0x60)	// 00-5F - Note
 			{
 				TempByt = CurCmd;
@@ -613,6 +662,13 @@ UINT8 Gems2Mid(UINT32 GemsLen, UINT8* GemsData, UINT16 GemsAddr)
 					//WriteEvent(&midFileInf, &MTS, 0xB0, 0x6D, CurCmd & 0x7F);
 					break;
 				case 0x64:	// Loop Start [originally MIDI Ctrl 81, value 1..127]
+					if (LoopID != 0xFF && LoopID >= 0x0F)
+					{
+						printf("Warning! Too many nested loops!\n");
+						ProcDelay = false;
+						InPos += 0x01;
+						break;
+					}
 					LoopID ++;
 					LoopCount[LoopID] = GemsData[InPos];
 					ProcDelay = false;
@@ -718,7 +774,7 @@ UINT8 Gems2Mid(UINT32 GemsLen, UINT8* GemsData, UINT16 GemsAddr)
 					InPos += TempOfs;
 					if (InPos >= GemsLen)
 					{
-						printf("Track %u, Pos 0x%04: Jumping to invalid offset %04X!\n", CurTrk, TempLng, InPos);
+						printf("Track %u, Pos 0x%04X: Jumping to invalid offset %04X!\n", CurTrk, TempLng, InPos);
 						TrkEnd = true;
 					}
 					break;
@@ -768,16 +824,23 @@ UINT8 Gems2Mid(UINT32 GemsLen, UINT8* GemsData, UINT16 GemsAddr)
 			}
 			
 			if (ProcDelay)
+			{
 				MTS.curDly += ChnDelay;
+				CurTick += ChnDelay;
+				STATS_FRAMES(ChnDelay);
+			}
 		}
+		SeqGuard_Free(&SeqGuard);
 		FlushRunningNotes(&midFileInf, &MTS);
 		
 		WriteEvent(&midFileInf, &MTS, 0xFF, 0x2F, 0x00);
 		
 		WriteMidiTrackEnd(&midFileInf, &MTS);
 	}
+	free(ChnPtrList);
 	MidData = midFileInf.data;
 	MidLen = midFileInf.pos;
+	STATS_PHASE_END(STATS_CONVERT);
 	
 	return 0x00;
 }
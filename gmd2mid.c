@@ -64,6 +64,7 @@ typedef struct _track_info
 #define RUNNING_NOTES
 #define BALANCE_TRACK_TIMES
 #include "midi_utils.h"
+#include "seq_guard.h"
 
 
 #define MCMD_INI_EXCLUDE	0x00	// exclude initial command
@@ -82,6 +83,8 @@ static void WriteRPN(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8* rpnCache,
 static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO* gmdInf,
 							TRK_INF* trkInf, FILE_INF* fInf, MID_TRK_STATE* MTS);
 static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_INFO* gmdInf, TRK_INF* trkInf);
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT32* loopPPos, const UINT32* loopPos,
+							const UINT16* loopMax, const UINT16* loopCnt, UINT32 parentPos);
 static void WritePitchBend(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT16 pbBase, INT16 pbDetune);
 INLINE UINT32 Tempo2Mid(UINT16 bpm, UINT16 scale);
 INLINE void RcpTimeSig2Mid(UINT8 buffer[4], UINT8 beatNum, UINT8 beatDen);
@@ -169,8 +172,10 @@ int main(int argc, char* argv[])
 		ROMLen = 0x100000;
 	
 	fseek(hFile, 0x00, SEEK_SET);
-	ROMData = (UINT8*)malloc(ROMLen);
-	fread(ROMData, 0x01, ROMLen, hFile);
+	// The padding prevents commands at the end of the data from reading beyond the buffer.
+	ROMData = (UINT8*)malloc(ROMLen + 0x10);
+	ROMLen = fread(ROMData, 0x01, ROMLen, hFile);
+	memset(&ROMData[ROMLen], 0x00, 0x10);
 	
 	fclose(hFile);
 	
@@ -234,6 +239,12 @@ static void ReadGMDChunk(UINT32 songLen, const UINT8* songData, GMD_CHUNK* gmdCh
 		*pos += 0x02 + gmdChk->itemCnt * gmdChk->itemSize;
 	else
 		*pos += gmdChk->itemCnt;
+	if (*pos > songLen)
+	{
+		// the chunk exceeds the file - ignore its data
+		gmdChk->itemCnt = 0;
+		gmdChk->data = NULL;
+	}
 	return;
 }
 
@@ -272,7 +283,7 @@ UINT8 Gmd2Mid(UINT32 songLen, const UINT8* songData)
 	FILE_INF midFInf;
 	MID_TRK_STATE MTS;
 	
-	if (memcmp(&songData[0x00], "GMD0", 0x04))
+	if (songLen < 0x20 || memcmp(&songData[0x00], "GMD0", 0x04))
 	{
 		printf("Not a GMDx file!\n");
 		return 0x80;
@@ -298,8 +309,13 @@ UINT8 Gmd2Mid(UINT32 songLen, const UINT8* songData)
 	ReadGMDChunk(songLen, songData, NULL, &inPos);	// ignored by the sound driver
 	ReadGMDChunk(songLen, songData, NULL, &inPos);	// TODO: the sound driver does something here
 	
-	gmdInf.trkCnt = ReadLE16(&songData[inPos]);
+	gmdInf.trkCnt = (inPos + 0x02 <= songLen) ? ReadLE16(&songData[inPos]) : 0;
 	inPos += 0x02;
+	if (gmdInf.trkCnt > 18)
+	{
+		printf("Warning: The song has %u tracks, only 18 are supported!\n", gmdInf.trkCnt);
+		gmdInf.trkCnt = 18;
+	}
 	gmdInf.trkDataPos = inPos;
 	
 	for (curTrk = 0; curTrk < gmdInf.trkCnt; curTrk ++)
@@ -450,6 +466,8 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 	UINT32 loopPos[8];
 	UINT16 loopMax[8];	// total loop count
 	UINT16 loopCnt[8];	// remaining loops
+	SEQ_GUARD seqGuard;
+	UINT8 grdRes;
 	UINT8 syxHdr[2];	// 0 device ID, 1 model ID
 	UINT32 syxBufSize;
 	UINT8* syxBuffer;
@@ -529,6 +547,7 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 	susPedState = 0x00;
 	loopIdx = 0x00;
 	curBar = 0;
+	SeqGuard_Init(&seqGuard);
 	tempoSldStpSize = 0;
 	tempoSldNextTick = (UINT32)-1;
 	tempoSldDir = 0;
@@ -540,6 +559,12 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 	{
 		UINT32 prevPos = inPos;
 		
+		grdRes = SeqGuard_Step(&seqGuard, trkTick, fInf->pos - MTS->trkBase);
+		if (grdRes)
+		{
+			printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+			break;
+		}
 		if (tempoSldStpSize > 0)
 		{
 			// handle tempo slides
@@ -1225,7 +1250,14 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 				if (repeatPos == inPos)
 					break;
 				inPos = repeatPos;
-			} while(songData[inPos] == 0xE5);
+				grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos));
+				if (grdRes)
+				{
+					printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+					trkEnd = 1;
+					break;
+				}
+			} while(inPos < songLen && songData[inPos] == 0xE5);
 			break;
 		case 0xE6:	// Loop Start (A)
 			{
@@ -1278,6 +1310,12 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 					parentPos = loopPPos[loopIdx];
 					inPos = loopPos[loopIdx];
 					loopIdx ++;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos));
+					if (grdRes)
+					{
+						printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+						trkEnd = 1;
+					}
 				}
 			}
 			break;
@@ -1332,6 +1370,12 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 					parentPos = loopPPos[loopIdx];
 					inPos = loopPos[loopIdx];
 					loopIdx ++;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos));
+					if (grdRes)
+					{
+						printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+						trkEnd = 1;
+					}
 				}
 			}
 			break;
@@ -1349,9 +1393,19 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 				
 				loopIdx --;
 				if (loopCnt[loopIdx] == loopMax[loopIdx] - 1)
+				{
 					inPos = trkInf->startOfs + exitOfs;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos));
+					if (grdRes)
+					{
+						printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+						trkEnd = 1;
+					}
+				}
 				else
+				{
 					loopIdx ++;
+				}
 			}
 			break;
 		//case 0xEB:	// special loop thing??
@@ -1360,6 +1414,12 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 			{
 				UINT16 exitOfs = ReadLE16(&songData[inPos + 0x01]);
 				inPos = trkInf->startOfs + exitOfs;
+				grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos));
+				if (grdRes)
+				{
+					printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+					trkEnd = 1;
+				}
 			}
 			break;
 		case 0xED:	//
@@ -1437,6 +1497,7 @@ static UINT8 GmdTrk2MidTrk(UINT32 songLen, const UINT8* songData, const GMD_INFO
 			break;
 		}	// end if (cmdType >= 0x80) / switch(cmdType)
 	}	// end while(! trkEnd)
+	SeqGuard_Free(&seqGuard);
 	FlushRunningNotes(fInf, &MTS->curDly, &RunNoteCnt, RunNotes, 0);
 	
 	free(syxBuffer);
@@ -1459,6 +1520,7 @@ static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_I
 	UINT32 loopTick[8];
 	UINT16 loopMax[8];
 	UINT16 loopCnt[8];
+	SEQ_GUARD seqGuard;
 	
 	trkInf->loopOfs = 0x00;
 	trkInf->tickCnt = 0;
@@ -1482,9 +1544,13 @@ static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_I
 	parentPos = 0x00;
 	loopIdx = 0x00;
 	noteMode = 0x00;
+	SeqGuard_Init(&seqGuard);
 	
 	while(inPos < trkEndPos && ! trkEnd)
 	{
+		// The conversion will hit the same limit and print the warning.
+		if (SeqGuard_Step(&seqGuard, trkInf->tickCnt, 0))
+			break;
 		cmdType = songData[inPos];
 		if (cmdType < 0x80)
 		{
@@ -1611,7 +1677,12 @@ static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_I
 				if (repeatPos == inPos)
 					break;
 				inPos = repeatPos;
-			} while(songData[inPos] == 0xE5);
+				if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos)))
+				{
+					trkEnd = 1;
+					break;
+				}
+			} while(inPos < songLen && songData[inPos] == 0xE5);
 			break;
 		case 0xE6:	// Loop Start (A)
 			{
@@ -1648,6 +1719,8 @@ static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_I
 					parentPos = loopPPos[loopIdx];
 					inPos = loopPos[loopIdx];
 					loopIdx ++;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos)))
+						trkEnd = 1;
 				}
 			}
 			break;
@@ -1688,6 +1761,8 @@ static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_I
 					parentPos = loopPPos[loopIdx];
 					inPos = loopPos[loopIdx];
 					loopIdx ++;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos)))
+						trkEnd = 1;
 				}
 			}
 			break;
@@ -1701,9 +1776,15 @@ static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_I
 				loopIdx --;
 				
 				if (loopCnt[loopIdx] == loopMax[loopIdx] - 1)
+				{
 					inPos = trkInf->startOfs + exitOfs;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos)))
+						trkEnd = 1;
+				}
 				else
+				{
 					loopIdx ++;
+				}
 			}
 			break;
 		//case 0xEB:	// special loop thing??
@@ -1711,6 +1792,8 @@ static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_I
 			{
 				UINT16 exitOfs = ReadLE16(&songData[inPos + 0x01]);
 				inPos = trkInf->startOfs + exitOfs;
+				if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPPos, loopPos, loopMax, loopCnt, parentPos)))
+					trkEnd = 1;
 			}
 			break;
 		case 0xFA:	// measure end / set measure counter
@@ -1738,10 +1821,30 @@ static UINT8 PreparseGmdTrack(UINT32 songLen, const UINT8* songData, const GMD_I
 			break;
 		}	// end switch(cmdType)
 	}	// end while(! trkEnd)
+	SeqGuard_Free(&seqGuard);
 	
 	return 0x00;
 }
 
+// Hashes everything that decides where the track goes after a jump.
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT32* loopPPos, const UINT32* loopPos,
+							const UINT16* loopMax, const UINT16* loopCnt, UINT32 parentPos)
+{
+	UINT64 state;
+	UINT8 curLvl;
+	
+	state = SeqGuard_Hash(0, parentPos);
+	state = SeqGuard_Hash(state, loopIdx);
+	for (curLvl = 0; curLvl < loopIdx; curLvl ++)
+	{
+		state = SeqGuard_Hash(state, loopPPos[curLvl]);
+		state = SeqGuard_Hash(state, loopPos[curLvl]);
+		state = SeqGuard_Hash(state, loopMax[curLvl]);
+		state = SeqGuard_Hash(state, loopCnt[curLvl]);
+	}
+	return state;
+}
+
 
 static void WritePitchBend(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT16 pbBase, INT16 pbDetune)
 {
@@ -1759,6 +1862,8 @@ INLINE UINT32 Tempo2Mid(UINT16 bpm, UINT16 scale)
 {
 	// formula: (60 000 000.0 / bpm) * (scale / 64.0)
 	UINT32 div = bpm * scale;
+	if (! div)
+		return 500000;	// tempo 0 would be infinite - use the MIDI default (120 BPM)
 	// I like rounding, but doing so make most MIDI programs display e.g. "144.99 BPM".
 	return 60000000U * 64U / div;
 	//return (60000000U * 64U + div / 2) / div;
@@ -23,7 +23,9 @@
 #endif
 
 
+#include "conv_stats.h"
 #include "midi_funcs.h"
+#include "scan_funcs.h"
 
 typedef struct _track_info
 {
@@ -42,6 +44,10 @@ typedef struct _track_info
 
 
 static UINT16 DetectSongCount(UINT32 MusLibLen, const UINT8* MusLibData, UINT32 BasePos);
+static UINT16 CountSongs(UINT32 MusLibLen, const UINT8* MusLibData, UINT32 BasePos);
+static bool IsValidSong(UINT32 MusLibLen, const UINT8* MusLibData, UINT32 BasePos, UINT16 SongOfs);
+static bool IsValidTrack(UINT32 MusLibLen, const UINT8* MusLibData, UINT32 TrkPos);
+static UINT16 LocateMusicList(UINT32 MusLibLen, const UINT8* MusLibData, UINT32* RetBasePos);
 UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, UINT8** OutData*/);
 static void PreparseGrc(UINT32 GrcLen, const UINT8* GrcData, UINT8* GrcBuf, TRK_INF* TrkInf, UINT8 Mode);
 static UINT16 ReadLE16(const UINT8* Buffer);
@@ -119,6 +125,7 @@ static UINT16 DefLoopCount;
 static bool OptVolWrites;
 static bool NoLoopExt;
 static bool EnableSMPSMod;
+static UINT8 StatsMode;
 
 int main(int argc, char* argv[])
 {
@@ -146,7 +153,8 @@ int main(int argc, char* argv[])
 	printf("GRC -> Midi Converter\n---------------------\n");
 	if (argc < 2)
 	{
-		printf("Usage: grc2mid.exe [-Mode] [-Options] ROM.bin MusicListAddr(hex) [Song Count]\n");
+		printf("Usage: grc2mid.exe [-Mode] [-Options] ROM.bin [MusicListAddr(hex) [Song Count]]\n");
+		printf("The music list address is searched for when it is omitted. (Music Mode only)\n");
 		printf("Modes:\n");
 		printf("    -mus        Music Mode (convert sequences to MID)\n");
 		printf("    -ins        Instrument Mode (dump instruments to GYB)\n");
@@ -159,6 +167,7 @@ int main(int argc, char* argv[])
 		printf("    -NoLpExt    No Loop Extention\n");
 		printf("                Do not fill short tracks to the length of longer ones.\n");
 		//printf("    -SMPSMod    Enable writing mid2smps Modulation Definitions (Decap Attack)\n");
+		printf("    -Stats      print profiling statistics (-StatsJSON: as JSON, requires compiling with CONV_STATS)\n");
 		return 0;
 	}
 	
@@ -167,6 +176,7 @@ int main(int argc, char* argv[])
 	DefLoopCount = 2;
 	NoLoopExt = false;
 	EnableSMPSMod = false;
+	StatsMode = STATS_OFF;
 	
 	Mode = MODE_MUS;
 	argbase = 1;
@@ -204,13 +214,17 @@ int main(int argc, char* argv[])
 			NoLoopExt = true;
 		else if (! stricmp(argv[argbase] + 1, "SMPSMod"))
 			EnableSMPSMod = true;
+		else if (! stricmp(argv[argbase] + 1, "Stats"))
+			StatsMode = STATS_TEXT;
+		else if (! stricmp(argv[argbase] + 1, "StatsJSON"))
+			StatsMode = STATS_JSON;
 		else
 			break;
 		argbase ++;
 	}
+	STATS_ENABLE(StatsMode);
 	
-	//if (argc <= argbase)
-	if (argc <= argbase + 1)
+	if (argc <= argbase || (argc <= argbase + 1 && Mode != MODE_MUS))
 	{
 		printf("Not enough arguments.\n");
 		return 0;
@@ -222,7 +236,10 @@ int main(int argc, char* argv[])
 		TempPnt = OutFileBase + strlen(OutFileBase);
 	*TempPnt = 0x00;
 	
-	SongPos = strtoul(argv[argbase + 1], NULL, 0x10);
+	if (argc > argbase + 1)
+		SongPos = strtoul(argv[argbase + 1], NULL, 0x10);
+	else
+		SongPos = (UINT32)-1;
 	
 	if (argc > argbase + 2)
 		FileCount = (UINT16)strtoul(argv[argbase + 2], NULL, 0);
@@ -250,8 +267,22 @@ int main(int argc, char* argv[])
 	switch(Mode)
 	{
 	case MODE_MUS:
+		STATS_PHASE_BEGIN(STATS_DETECT);
+		if (SongPos == (UINT32)-1)
+		{
+			CurFile = LocateMusicList(InLen, InData, &SongPos);
+			if (! CurFile)
+			{
+				printf("Unable to find the music list! Please specify its address.\n");
+				free(InData);
+				return 2;
+			}
+			if (! FileCount)
+				FileCount = CurFile;
+		}
 		if (! FileCount)
 			FileCount = DetectSongCount(InLen, InData, SongPos);
+		STATS_PHASE_END(STATS_DETECT);
 		
 		CurPos = SongPos;
 		for (CurFile = 0x00; CurFile < FileCount; CurFile ++, CurPos += 0x02)
@@ -272,9 +303,11 @@ int main(int argc, char* argv[])
 			
 			sprintf(OutFile, "%s_%02X.mid", OutFileBase, CurFile);
 			
+			STATS_PHASE_BEGIN(STATS_WRITE);
 			hFile = fopen(OutFile, "wb");
 			if (hFile == NULL)
 			{
+				STATS_PHASE_END(STATS_WRITE);
 				free(MidData);	MidData = NULL;
 				printf("Error opening file!\n");
 				continue;
@@ -282,10 +315,12 @@ int main(int argc, char* argv[])
 			fwrite(MidData, MidLen, 0x01, hFile);
 			
 			fclose(hFile);
+			STATS_PHASE_END(STATS_WRITE);
 			free(MidData);	MidData = NULL;
 			printf("\n");
 		}
 		printf("Done.\n");
+		STATS_PRINT(StatsMode);
 		break;
 	case MODE_DAC:
 		//SaveDACData(OutFileBase);
@@ -308,10 +343,21 @@ static UINT16 DetectSongCount(UINT32 MusLibLen, const UINT8* MusLibData, UINT32
 {
 	// Song Count autodetection
 	UINT16 CurFile;
+	
+	CurFile = CountSongs(MusLibLen, MusLibData, BasePos);
+	printf("Songs detected: 0x%02X (%u)\n", CurFile, CurFile);
+	return CurFile;
+}
+
+static UINT16 CountSongs(UINT32 MusLibLen, const UINT8* MusLibData, UINT32 BasePos)
+{
+	UINT16 CurFile;
 	UINT32 CurPos;
 	UINT32 SongPos;
 	UINT32 MaxPos;
 	
+	if (BasePos + 0x02 > MusLibLen)
+		return 0;
 	MaxPos = BasePos + ReadLE16(&MusLibData[BasePos]);
 	if (MaxPos > MusLibLen)
 		MaxPos = MusLibLen;
@@ -323,10 +369,143 @@ static UINT16 DetectSongCount(UINT32 MusLibLen, const UINT8* MusLibData, UINT32
 			MaxPos = SongPos;
 	}
 	
-	printf("Songs detected: 0x%02X (%u)\n", CurFile, CurFile);
 	return CurFile;
 }
 
+static bool IsValidSong(UINT32 MusLibLen, const UINT8* MusLibData, UINT32 BasePos, UINT16 SongOfs)
+{
+	// Header: 10 tracks with 1 byte flags (bit 7 = active) and 2 bytes start offset each
+	UINT32 HdrPos;
+	UINT8 CurTrk;
+	UINT8 TrkCnt;
+	
+	HdrPos = BasePos + SongOfs;
+	if (HdrPos + 0x0A * 0x03 > MusLibLen)
+		return false;
+	
+	TrkCnt = 0;
+	for (CurTrk = 0; CurTrk < 0x0A; CurTrk ++, HdrPos += 0x03)
+	{
+		if (! (MusLibData[HdrPos + 0x00] & 0x80))
+			continue;
+		if (! IsValidTrack(MusLibLen, MusLibData, BasePos + ReadLE16(&MusLibData[HdrPos + 0x01])))
+			return false;
+		TrkCnt ++;
+	}
+	
+	return (TrkCnt > 0);
+}
+
+static bool IsValidTrack(UINT32 MusLibLen, const UINT8* MusLibData, UINT32 TrkPos)
+{
+	// Do a quick, linear syntax check of the track data.
+	// (without following any jumps, see PreparseGrc for command lengths)
+	UINT32 EndPos;
+	UINT8 CurCmd;
+	
+	EndPos = TrkPos + 0x2000;
+	if (EndPos > MusLibLen)
+		EndPos = MusLibLen;
+	while(TrkPos < EndPos)
+	{
+		CurCmd = MusLibData[TrkPos];
+		TrkPos ++;
+		if (! (CurCmd & 0x80))
+		{
+			if (CurCmd & 0x10)
+				TrkPos ++;	// note with length
+		}
+		else if ((CurCmd & 0xE0) == 0x80)
+		{
+			// set Volume
+		}
+		else
+		{
+			switch(CurCmd)
+			{
+			case 0xEC:	// Note Stop
+			case 0xED:	// Noise Mode
+			case 0xEF:	// set Detune
+			case 0xF1:	// set Volume
+			case 0xF3:	// set Fade Speed
+			case 0xF5:	// set YM2612 Timer B
+			case 0xF6:	// set AMS/FMS
+			case 0xF7:	// set LFO rate
+			case 0xFB:	// Set Modulation
+			case 0xFC:	// set Instrument
+			case 0xFD:	// set Default Note Length
+				TrkPos ++;
+				break;
+			case 0xEE:	// Loop
+				TrkPos += 0x03;
+				break;
+			case 0xF9:	// GoSub
+				TrkPos += 0x02;
+				break;
+			case 0xF0:	// reset SFX ID
+			case 0xF2:	// Enable/Disable DAC
+			case 0xF4:	// synchronize all tracks
+			case 0xFE:	// Hold Note
+				break;
+			case 0xF8:	// Return from GoSub
+			case 0xFA:	// GoTo
+			case 0xFF:	// Track End
+				return true;
+			default:	// unknown command
+				return false;
+			}
+		}
+	}
+	
+	return false;
+}
+
+// Music list autodetection
+// The list consists of 16-bit offsets (relative to the list) and the first song
+// usually follows the list directly. Candidates are ranked by the number of songs,
+// but only lists whose songs all pass the header and track checks are considered.
+static UINT16 LocateMusicList(UINT32 MusLibLen, const UINT8* MusLibData, UINT32* RetBasePos)
+{
+	SCAN_CAND ListCands[4];
+	UINT32 ListCandCnt;
+	UINT32 CurPos;
+	UINT32 SongPos;
+	UINT16 ListSize;
+	UINT16 SongCnt;
+	UINT16 CurSong;
+	
+	ListCandCnt = 0;
+	for (CurPos = 0x00; CurPos + 0x02 <= MusLibLen; CurPos ++)
+	{
+		// quick check: at least 2 songs, at most 0x100 songs
+		ListSize = ReadLE16(&MusLibData[CurPos]);
+		if ((ListSize & 0x01) || ListSize < 0x04 || ListSize > 0x200)
+			continue;
+		
+		SongCnt = CountSongs(MusLibLen, MusLibData, CurPos);
+		if (SongCnt < 2 || CurPos + SongCnt * 0x02 > MusLibLen)
+			continue;
+		for (CurSong = 0; CurSong < SongCnt; CurSong ++)
+		{
+			SongPos = CurPos + CurSong * 0x02;
+			if (! IsValidSong(MusLibLen, MusLibData, CurPos, ReadLE16(&MusLibData[SongPos])))
+				break;
+		}
+		if (CurSong < SongCnt)
+			continue;
+		ScanCand_Add(4, &ListCandCnt, ListCands, CurPos, 0, SongCnt);
+	}
+	if (! ListCandCnt)
+		return 0;
+	
+	printf("Music list candidates:\n");
+	for (CurPos = 0; CurPos < ListCandCnt; CurPos ++)
+		printf("    Music List %06X: %u songs\n", ListCands[CurPos].pos, ListCands[CurPos].score);
+	*RetBasePos = ListCands[0].pos;
+	
+	return (UINT16)ListCands[0].score;
+}
+
 UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, UINT8** OutData*/)
 {
 	UINT8* TempBuf;
@@ -363,6 +542,7 @@ UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, U
 	UINT8 LastModType;
 	UINT8 ModDataMem[5];
 	
+	STATS_PHASE_BEGIN(STATS_CONVERT);
 	TrkCnt = 0x0A;
 	midFileInf.alloc = 0x20000;	// 128 KB should be enough
 	midFileInf.data = (UINT8*)malloc(midFileInf.alloc);
@@ -387,6 +567,7 @@ UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, U
 	WriteMidiTrackEnd(&midFileInf, &MTS);
 	
 	// Read Header
+	STATS_PHASE_BEGIN(STATS_PREPARSE);
 	TempBuf = (UINT8*)malloc(GrcLen);
 	InPos = GrcAddr;
 	for (CurTrk = 0; CurTrk < TrkCnt; CurTrk ++, InPos += 0x03)
@@ -411,6 +592,7 @@ UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, U
 		TempTInf->loopTimes = TempTInf->loopOfs ? DefLoopCount : 0;
 	}
 	free(TempBuf);	TempBuf = NULL;
+	STATS_PHASE_END(STATS_PREPARSE);
 	
 	if (! NoLoopExt)
 		BalanceTrackTimes(TrkCnt, TrkInf, 24 / 4, 0xFF);
@@ -470,6 +652,7 @@ UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, U
 			}
 			
 			CurCmd = GrcData[InPos];
+			STATS_CMD(CurCmd);
 			if (! (CurCmd & 0x80))
 			{
 				//	Bits 0-3 (0F): Note Value (07/0F = rest)
@@ -566,11 +749,13 @@ UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, U
 				if (! (CurCmd & 0x10))
 				{
 					MTS.curDly += DefNoteLen;
+					STATS_FRAMES(DefNoteLen);
 				}
 				else
 				{
 					InPos ++;
 					MTS.curDly += GrcData[InPos];
+					STATS_FRAMES(GrcData[InPos]);
 				}
 				InPos ++;
 				// TODO: add code to handle Note Stop here
@@ -642,7 +827,10 @@ UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, U
 							InPos --;
 							InPos += TempSht;
 							if (InPos >= GrcLen)
+							{
+								STATS_PHASE_END(STATS_CONVERT);
 								return 0x00;
+							}
 							break;
 						}
 					}
@@ -824,6 +1012,7 @@ UINT8 GRC2Mid(UINT32 GrcLen, UINT8* GrcData, UINT16 GrcAddr/*, UINT32* OutLen, U
 	}
 	MidData = midFileInf.data;
 	MidLen = midFileInf.pos;
+	STATS_PHASE_END(STATS_CONVERT);
 	
 	return 0x00;
 }
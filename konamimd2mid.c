@@ -20,7 +20,11 @@
 #endif
 
 
+#include "conv_stats.h"
 #include "midi_funcs.h"
+#include "scan_funcs.h"
+#include "rom_cache.h"
+#include "mem_map.h"
 
 typedef struct _track_info
 {
@@ -36,7 +40,13 @@ typedef struct _track_info
 
 
 static UINT16 DetectSongCount(UINT32 DataLen, const UINT8* Data, UINT32 MusBankList, UINT32 MusPtrOfs);
-UINT8 Konami2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen, UINT8** OutData*/);
+static UINT16 CountSongs(UINT32 DataLen, const UINT8* Data, UINT32 MusBankList, UINT32 MusPtrOfs, bool CheckHeaders);
+static bool IsValidSongHeader(UINT32 DataLen, const UINT8* Data, UINT32 HdrPos);
+static UINT16 CountTrackBoundaries(UINT32 DataLen, const UINT8* Data, UINT32 MusBankList, UINT32 MusPtrOfs, UINT16 SongCnt);
+static UINT16 LocateMusicList(UINT32 DataLen, const UINT8* Data, UINT32* RetMusPtrOfs, UINT32* RetMusBankList);
+static UINT16 LoadMusicListCache(const char* FileName, UINT32 DataLen, UINT64 ROMHash, UINT32* RetMusPtrOfs, UINT32* RetMusBankList);
+static UINT8 SaveMusicListCache(const char* FileName, UINT32 DataLen, UINT64 ROMHash, UINT32 MusPtrOfs, UINT32 MusBankList, UINT16 SongCnt);
+UINT8 Konami2Mid(UINT32 KnmLen, const UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen, UINT8** OutData*/);
 static void PreparseKnm(UINT32 KnmLen, const UINT8* KnmData, UINT8* KnmBuf, TRK_INF* TrkInf, UINT8 Mode);
 static UINT16 ReadLE16(const UINT8* Buffer);
 static INT8 GetSignMagByte(UINT8 value);
@@ -67,6 +77,7 @@ static UINT16 TickpQrtr;
 static UINT16 DefLoopCount;
 static bool OptVolWrites;
 static bool NoLoopExt;
+static UINT8 StatsMode;
 
 int main(int argc, char* argv[])
 {
@@ -88,13 +99,16 @@ int main(int argc, char* argv[])
 	UINT16 FileCount;
 	UINT16 CurFile;
 	UINT32 CurPos;
-	UINT32 BankBase;
 	UINT32 BankLen;
+	MEM_MAP Z80Map;
+	const char* CacheFile;
+	UINT64 ROMHash;
 	
 	printf("Konami MD -> Midi Converter\n---------------------------\n");
 	if (argc < 2)
 	{
-		printf("Usage: KonamiMD2Mid.exe [-Mode] [-Options] ROM.bin MusicListAddr(hex) MusicBankList(hex) [Song Count]\n");
+		printf("Usage: KonamiMD2Mid.exe [-Mode] [-Options] ROM.bin [MusicListAddr(hex) MusicBankList(hex) [Song Count]]\n");
+		printf("The music list is searched automatically when the addresses are omitted. (Music Mode only)\n");
 		printf("Modes:\n");
 		printf("    -mus        Music Mode (convert sequences to MID)\n");
 		printf("    -ins        Instrument Mode (dump instruments to GYB)\n");
@@ -107,6 +121,8 @@ int main(int argc, char* argv[])
 		printf("    -Loops n    Loop each track at least n times. (default: 2)\n");
 		printf("    -NoLpExt    No Loop Extension\n");
 		printf("                Do not fill short tracks to the length of longer ones.\n");
+		printf("    -Cache fn   store/reuse the result of the music list search in file fn\n");
+		printf("    -Stats      print profiling statistics (-StatsJSON: as JSON, requires compiling with CONV_STATS)\n");
 		return 0;
 	}
 	
@@ -115,6 +131,9 @@ int main(int argc, char* argv[])
 	TickpQrtr = 24;
 	DefLoopCount = 2;
 	NoLoopExt = false;
+	CacheFile = NULL;
+	ROMHash = 0;
+	StatsMode = STATS_OFF;
 	
 	Mode = MODE_MUS;
 	argbase = 1;
@@ -152,12 +171,23 @@ int main(int argc, char* argv[])
 		}
 		else if (! stricmp(argv[argbase] + 1, "NoLpExt"))
 			NoLoopExt = true;
+		else if (! stricmp(argv[argbase] + 1, "Stats"))
+			StatsMode = STATS_TEXT;
+		else if (! stricmp(argv[argbase] + 1, "StatsJSON"))
+			StatsMode = STATS_JSON;
+		else if (! stricmp(argv[argbase] + 1, "Cache"))
+		{
+			argbase ++;
+			if (argbase < argc)
+				CacheFile = argv[argbase];
+		}
 		else
 			break;
 		argbase ++;
 	}
+	STATS_ENABLE(StatsMode);
 	
-	if (argc <= argbase + 2)
+	if (argc <= argbase || (argc <= argbase + 2 && Mode != MODE_MUS))
 	{
 		printf("Not enough arguments.\n");
 		return 0;
@@ -169,8 +199,16 @@ int main(int argc, char* argv[])
 		TempPnt = OutFileBase + strlen(OutFileBase);
 	*TempPnt = 0x00;
 	
-	SongPos = strtoul(argv[argbase + 1], NULL, 0x10);
-	BankPos = strtoul(argv[argbase + 2], NULL, 0x10);
+	if (argc > argbase + 2)
+	{
+		SongPos = strtoul(argv[argbase + 1], NULL, 0x10);
+		BankPos = strtoul(argv[argbase + 2], NULL, 0x10);
+	}
+	else
+	{
+		SongPos = (UINT32)-1;	// autodetect
+		BankPos = (UINT32)-1;
+	}
 	
 	if (argc > argbase + 3)
 		FileCount = (UINT16)strtoul(argv[argbase + 3], NULL, 0);
@@ -195,22 +233,53 @@ int main(int argc, char* argv[])
 	
 	fclose(hFile);
 	
+	STATS_PHASE_BEGIN(STATS_DETECT);
+	if (SongPos == (UINT32)-1)
+	{
+		CurFile = 0;
+		if (CacheFile != NULL)
+		{
+			ROMHash = ROMCache_Hash(InLen, InData);
+			CurFile = LoadMusicListCache(CacheFile, InLen, ROMHash, &SongPos, &BankPos);
+		}
+		if (! CurFile)
+		{
+			CurFile = LocateMusicList(InLen, InData, &SongPos, &BankPos);
+			if (CurFile && CacheFile != NULL &&
+				SaveMusicListCache(CacheFile, InLen, ROMHash, SongPos, BankPos, CurFile))
+				printf("Error writing cache file %s!\n", CacheFile);
+		}
+		if (! CurFile)
+		{
+			printf("Unable to find the music list! Please specify its address.\n");
+			free(InData);
+			return 2;
+		}
+		if (! FileCount)
+			FileCount = CurFile;
+	}
+	if (Mode == MODE_MUS && ! FileCount)
+		FileCount = DetectSongCount(InLen, InData, BankPos, SongPos);
+	STATS_PHASE_END(STATS_DETECT);
+	
 	switch(Mode)
 	{
 	case MODE_MUS:
-		if (! FileCount)
-			FileCount = DetectSongCount(InLen, InData, BankPos, SongPos);
-		
-		for (CurFile = 0x00; CurFile < FileCount; CurFile ++)
+		// The sound driver accesses the music data through the Z80 bank window at 8000..FFFF.
+		MemMap_Init(&Z80Map, InLen, InData, 0x10000, 15);
+		for (CurFile = 0x00; CurFile < FileCount && BankPos + CurFile < InLen; CurFile ++)
 		{
-			BankBase = (InData[BankPos + CurFile] << 15);
+			MemMap_MapROM(&Z80Map, 0x8000, 0x8000, (UINT32)InData[BankPos + CurFile] << 15);
 			CurPos = (SongPos & 0x7FFF) + CurFile * 0x12;
 			printf("File %u / %u ...", CurFile + 1, FileCount);
 			
-			BankLen = InLen - BankBase;
-			if (BankLen > 0x8000)
-				BankLen = 0x8000;
-			RetVal = Konami2Mid(BankLen, &InData[BankBase], (UINT16)CurPos/*, &OutLen, &OutData*/);
+			BankLen = MemMap_GetAvail(&Z80Map, 0x8000);
+			if (! BankLen)
+			{
+				printf(" bank %02X is beyond the end of the ROM - ignored.\n", InData[BankPos + CurFile]);
+				continue;
+			}
+			RetVal = Konami2Mid(BankLen, MemMap_GetPtr(&Z80Map, 0x8000, BankLen), (UINT16)CurPos/*, &OutLen, &OutData*/);
 			if (RetVal)
 			{
 				if (RetVal == 0x01)
@@ -224,9 +293,11 @@ int main(int argc, char* argv[])
 			
 			sprintf(OutFile, "%s_%02X.mid", OutFileBase, CurFile);
 			
+			STATS_PHASE_BEGIN(STATS_WRITE);
 			hFile = fopen(OutFile, "wb");
 			if (hFile == NULL)
 			{
+				STATS_PHASE_END(STATS_WRITE);
 				free(MidData);	MidData = NULL;
 				printf("Error opening file!\n");
 				continue;
@@ -234,10 +305,12 @@ int main(int argc, char* argv[])
 			fwrite(MidData, MidLen, 0x01, hFile);
 			
 			fclose(hFile);
+			STATS_PHASE_END(STATS_WRITE);
 			free(MidData);	MidData = NULL;
 			printf("\n");
 		}
 		printf("Done.\n");
+		STATS_PRINT(StatsMode);
 		break;
 	case MODE_DAC:
 		//SaveDACData(OutFileBase);
@@ -259,26 +332,195 @@ int main(int argc, char* argv[])
 static UINT16 DetectSongCount(UINT32 DataLen, const UINT8* Data, UINT32 MusBankList, UINT32 MusPtrOfs)
 {
 	// Song Count autodetection
+	UINT16 SongCnt;
+	
+	SongCnt = CountSongs(DataLen, Data, MusBankList, MusPtrOfs, false);
+	printf("Songs detected: 0x%02X (%u)\n", SongCnt, SongCnt);
+	return SongCnt;
+}
+
+static UINT16 CountSongs(UINT32 DataLen, const UINT8* Data, UINT32 MusBankList, UINT32 MusPtrOfs, bool CheckHeaders)
+{
 	UINT32 CurPos;
 	UINT32 BankBase;
 	UINT32 SongPos;
 	UINT32 BankBit;
 	
 	SongPos = (Data[MusBankList] << 15) | (MusPtrOfs & 0x7FFF);
+	if (SongPos + 0x02 > DataLen)
+		return 0;
 	BankBit = ReadLE16(&Data[SongPos]) & 0x8000;
 	for (CurPos = MusBankList; CurPos < DataLen; CurPos ++, MusPtrOfs += 0x12)
 	{
 		BankBase = (Data[CurPos] << 15);
 		SongPos = BankBase | (MusPtrOfs & 0x7FFF);
-		if (SongPos >= DataLen)
+		if (SongPos + 0x02 > DataLen)
 			break;
 		if ((ReadLE16(&Data[SongPos]) & 0x8000) != BankBit)
 			break;
+		if (CheckHeaders && ! IsValidSongHeader(DataLen, Data, SongPos))
+			break;
+	}
+	
+	return (UINT16)(CurPos - MusBankList);
+}
+
+static bool IsValidSongHeader(UINT32 DataLen, const UINT8* Data, UINT32 HdrPos)
+{
+	// The header consists of 9 track pointers into the Z80 bank window (8000..FFFF).
+	UINT32 CurPos;
+	UINT16 TrkPtr;
+	bool AllEqual;
+	
+	if (HdrPos + 0x12 > DataLen || (HdrPos & 0x7FFF) > 0x8000 - 0x12)
+		return false;
+	AllEqual = true;
+	for (CurPos = HdrPos; CurPos < HdrPos + 0x12; CurPos += 0x02)
+	{
+		TrkPtr = ReadLE16(&Data[CurPos]);
+		if (! (TrkPtr & 0x8000))
+			return false;
+		if (((HdrPos & ~0x7FFF) | (TrkPtr & 0x7FFF)) >= DataLen)
+			return false;
+		if (TrkPtr != ReadLE16(&Data[HdrPos]))
+			AllEqual = false;
 	}
-	CurPos -= MusBankList;
 	
-	printf("Songs detected: 0x%02X (%u)\n", CurPos, CurPos);
-	return (UINT16)CurPos;
+	return ! AllEqual;	// reject padding (FF FF FF ...)
+}
+
+static UINT16 CountTrackBoundaries(UINT32 DataLen, const UINT8* Data, UINT32 MusBankList, UINT32 MusPtrOfs, UINT16 SongCnt)
+{
+	// Track data is stored back to back, so a real track usually begins
+	// right after the Track End (FF) or GoTo (F9 xx xx) command of the previous track.
+	// The previous bank is mapped below the bank window, so that this also works
+	// for tracks at the very beginning of a bank.
+	MEM_MAP Z80Map;
+	UINT16 CurSong;
+	UINT32 BankOfs;
+	UINT32 HdrAddr;
+	UINT32 TrkAddr;
+	UINT8 CurTrk;
+	UINT16 BndCnt;
+	
+	MemMap_Init(&Z80Map, DataLen, Data, 0x10000, 15);
+	BndCnt = 0;
+	for (CurSong = 0; CurSong < SongCnt && MusBankList + CurSong < DataLen; CurSong ++, MusPtrOfs += 0x12)
+	{
+		BankOfs = (UINT32)Data[MusBankList + CurSong] << 15;
+		if (BankOfs)
+			MemMap_MapROM(&Z80Map, 0x0000, 0x8000, BankOfs - 0x8000);
+		else
+			MemMap_Unmap(&Z80Map, 0x0000, 0x8000);
+		MemMap_MapROM(&Z80Map, 0x8000, 0x8000, BankOfs);
+		HdrAddr = 0x8000 | (MusPtrOfs & 0x7FFF);
+		for (CurTrk = 0; CurTrk < 9; CurTrk ++)
+		{
+			// (reads beyond the end of the ROM return 00)
+			TrkAddr = 0x8000 | MemMap_Read16LE(&Z80Map, HdrAddr + CurTrk * 0x02);
+			if (MemMap_Read8(&Z80Map, TrkAddr - 0x01) == 0xFF)
+				BndCnt ++;
+			else if (MemMap_Read8(&Z80Map, TrkAddr - 0x03) == 0xF9)
+				BndCnt ++;
+		}
+	}
+	
+	return BndCnt;
+}
+
+// Music list autodetection
+// 1. search for runs of valid song headers (9 track pointers each, 0x12 bytes)
+// 2. for the longest runs, search for a bank list whose entries lead to valid headers
+// Candidates are ranked by the number of valid songs. When shifting the list by a few bytes
+// results in the same number of songs, the number of proper track boundaries decides.
+static UINT16 LocateMusicList(UINT32 DataLen, const UINT8* Data, UINT32* RetMusPtrOfs, UINT32* RetMusBankList)
+{
+	SCAN_CAND RunCands[8];
+	SCAN_CAND ListCands[4];
+	UINT32 RunCandCnt;
+	UINT32 ListCandCnt;
+	UINT32 CurPos;
+	UINT32 HdrPos;
+	UINT32 RunLen;
+	UINT32 CurRun;
+	UINT8 RunBank;
+	UINT16 SongCnt;
+	UINT16 BndCnt;
+	
+	RunCandCnt = 0;
+	for (CurPos = 0x00; CurPos + 0x12 <= DataLen; CurPos ++)
+	{
+		if (! IsValidSongHeader(DataLen, Data, CurPos))
+			continue;
+		if (CurPos >= 0x12 && ((CurPos - 0x12) >> 15) == (CurPos >> 15) &&
+			IsValidSongHeader(DataLen, Data, CurPos - 0x12))
+			continue;	// not the beginning of a run
+		
+		RunLen = 0;
+		for (HdrPos = CurPos; IsValidSongHeader(DataLen, Data, HdrPos); HdrPos += 0x12)
+			RunLen ++;
+		if (RunLen >= 2)
+			ScanCand_Add(8, &RunCandCnt, RunCands, CurPos, 0, RunLen);
+	}
+	
+	ListCandCnt = 0;
+	for (CurRun = 0; CurRun < RunCandCnt; CurRun ++)
+	{
+		RunBank = (UINT8)(RunCands[CurRun].pos >> 15);
+		for (CurPos = 0x00; CurPos < DataLen; CurPos ++)
+		{
+			// Only check the first byte of a series of the same bank. (speeds up scanning padding)
+			if (Data[CurPos] != RunBank || (CurPos > 0x00 && Data[CurPos - 1] == RunBank))
+				continue;
+			SongCnt = CountSongs(DataLen, Data, CurPos, RunCands[CurRun].pos, true);
+			if (SongCnt < 2)
+				continue;
+			BndCnt = CountTrackBoundaries(DataLen, Data, CurPos, RunCands[CurRun].pos, SongCnt);
+			if (BndCnt < SongCnt)
+				continue;	// random data that happens to look like song headers
+			ScanCand_Add(4, &ListCandCnt, ListCands, CurPos, RunCands[CurRun].pos, (SongCnt << 16) | BndCnt);
+		}
+	}
+	if (! ListCandCnt)
+		return 0;
+	
+	printf("Music list candidates:\n");
+	for (CurRun = 0; CurRun < ListCandCnt; CurRun ++)
+		printf("    Music List %06X, Bank List %06X: %u songs, %u track boundaries\n",
+				ListCands[CurRun].param, ListCands[CurRun].pos,
+				ListCands[CurRun].score >> 16, ListCands[CurRun].score & 0xFFFF);
+	*RetMusPtrOfs = ListCands[0].param;
+	*RetMusBankList = ListCands[0].pos;
+	
+	return (UINT16)(ListCands[0].score >> 16);
+}
+
+static UINT16 LoadMusicListCache(const char* FileName, UINT32 DataLen, UINT64 ROMHash, UINT32* RetMusPtrOfs, UINT32* RetMusBankList)
+{
+	UINT32 CacheData[3];	// music list, bank list, song count
+	
+	if (ROMCache_Load(FileName, ROMCACHE_ID('K', 'N', 'M', 'D'), DataLen, ROMHash,
+						sizeof(CacheData), CacheData, NULL, NULL))
+		return 0;
+	if (CacheData[1] > DataLen || CacheData[2] > DataLen - CacheData[1])
+		return 0;
+	
+	printf("Using cached music list: Music List %06X, Bank List %06X, %u songs\n",
+			CacheData[0], CacheData[1], CacheData[2]);
+	*RetMusPtrOfs = CacheData[0];
+	*RetMusBankList = CacheData[1];
+	return (UINT16)CacheData[2];
+}
+
+static UINT8 SaveMusicListCache(const char* FileName, UINT32 DataLen, UINT64 ROMHash, UINT32 MusPtrOfs, UINT32 MusBankList, UINT16 SongCnt)
+{
+	UINT32 CacheData[3];
+	
+	CacheData[0] = MusPtrOfs;
+	CacheData[1] = MusBankList;
+	CacheData[2] = SongCnt;
+	return ROMCache_Save(FileName, ROMCACHE_ID('K', 'N', 'M', 'D'), DataLen, ROMHash,
+						sizeof(CacheData), CacheData, 0, NULL);
 }
 
 static void WriteEvent_Chn(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 chn, UINT8 evt, UINT8 val1, UINT8 val2)
@@ -291,7 +533,7 @@ static void WriteEvent_Chn(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 chn, UINT8
 	return;
 }
 
-UINT8 Konami2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen, UINT8** OutData*/)
+UINT8 Konami2Mid(UINT32 KnmLen, const UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen, UINT8** OutData*/)
 {
 	UINT8* TempBuf;
 	TRK_INF TrkInf[0x09];
@@ -341,6 +583,7 @@ UINT8 Konami2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 	INT8 cmdEE_VolMod;
 	INT8 cmdEE_NoteMod;
 	
+	STATS_PHASE_BEGIN(STATS_CONVERT);
 	TrkCnt = 0x09;
 	midFileInf.alloc = 0x20000;	// 128 KB should be enough
 	midFileInf.data = (UINT8*)malloc(midFileInf.alloc);
@@ -362,6 +605,7 @@ UINT8 Konami2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 #endif
 	
 	// Read Header
+	STATS_PHASE_BEGIN(STATS_PREPARSE);
 	TempBuf = (UINT8*)malloc(KnmLen);
 	InPos = KnmAddr;
 	for (CurTrk = 0; CurTrk < TrkCnt; CurTrk ++, InPos += 0x02)
@@ -381,6 +625,7 @@ UINT8 Konami2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 		TempTInf->loopTimes = TempTInf->loopOfs ? DefLoopCount : 0;
 	}
 	free(TempBuf);	TempBuf = NULL;
+	STATS_PHASE_END(STATS_PREPARSE);
 	
 	if (! NoLoopExt)
 		BalanceTrackTimes(TrkCnt, TrkInf, TickpQrtr / 4, 0xFF);
@@ -439,6 +684,7 @@ UINT8 Konami2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 			
 			CurCmd = KnmData[InPos];
 			InPos ++;
+			STATS_CMD(CurCmd);
 			if (CurCmd < 0xD0 || (ChnFlags & 0x90))
 			{
 				UINT8 NoteDelay;
@@ -551,6 +797,7 @@ UINT8 Konami2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 					if (MTS.midChn >= 0x09)
 						NoteLen = 0;	// don't stop early for drum/PSG
 				}
+				STATS_FRAMES(NoteDelay);
 				if (NoteLen > 0 && NoteLen < NoteDelay && LastNote != 0xFF)
 				{
 					// Note: on PSG channels, the "note length" seems to trigger the "release" phase,
@@ -1001,6 +1248,7 @@ UINT8 Konami2Mid(UINT32 KnmLen, UINT8* KnmData, UINT16 KnmAddr/*, UINT32* OutLen
 	}
 	MidData = midFileInf.data;
 	MidLen = midFileInf.pos;
+	STATS_PHASE_END(STATS_CONVERT);
 	
 	return 0x00;
 }
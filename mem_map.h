@@ -0,0 +1,212 @@
+// Memory Map Routines
+// -------------------
+// to be included as header file
+//
+// Translates CPU addresses of banked systems to ROM offsets using a page table.
+// The table is built once (and updated when the driver switches banks), so reading
+// doesn't need to redo the bank arithmetic and range checks of every platform.
+//  void MemMap_Init(MEM_MAP* map, UINT32 romSize, const UINT8* romData, UINT32 addrSize, UINT8 pageBits);
+//      Initializes an address space of "addrSize" bytes with pages of (1 << pageBits) bytes.
+//      All pages are unmapped.
+//  void MemMap_MapROM(MEM_MAP* map, UINT32 addr, UINT32 len, UINT32 romOfs);
+//      Maps the pages at addr..addr+len-1 to the ROM, starting at romOfs.
+//      "addr" and "len" should be multiples of the page size.
+//  void MemMap_Unmap(MEM_MAP* map, UINT32 addr, UINT32 len);
+//      Unmaps the pages at addr..addr+len-1.
+//  UINT32 MemMap_GetROMOfs(const MEM_MAP* map, UINT32 addr);
+//      Returns the ROM offset of an address or MEMMAP_BADOFS if it isn't mapped or is beyond the end of the ROM.
+//  UINT32 MemMap_GetAvail(const MEM_MAP* map, UINT32 addr);
+//      Returns the number of bytes that can be read from "addr" up to the end of its page.
+//  const UINT8* MemMap_GetPtr(const MEM_MAP* map, UINT32 addr, UINT32 len);
+//      Returns a pointer to the data at "addr" or NULL if the "len" bytes aren't all in the same page.
+//  UINT8 MemMap_Read8(MEM_MAP* map, UINT32 addr);
+//  UINT16 MemMap_Read16LE/BE(MEM_MAP* map, UINT32 addr);
+//  UINT32 MemMap_Read24LE/BE(MEM_MAP* map, UINT32 addr);
+//      Bounds-checked reads. (Values can cross page boundaries.)
+//      Unmapped bytes and bytes beyond the end of the ROM read as 00 and set map->badRead.
+
+#ifndef __MEM_MAP_H__
+#define __MEM_MAP_H__
+
+#include <stddef.h>	// for NULL
+#include "stdtype.h"
+
+// All functions are inline, so that includers get no warnings about the ones they don't use.
+// (The INLINE macro of the includer can't be used for this, as it may be just "static".)
+#if defined(_MSC_VER)
+#define MEMMAP_INLINE	static __inline
+#elif defined(__GNUC__)
+#define MEMMAP_INLINE	static __inline__
+#else
+#define MEMMAP_INLINE	static inline
+#endif
+
+#define MEMMAP_MAX_PAGES	0x100
+#define MEMMAP_BADOFS		(UINT32)-1
+
+typedef struct _mem_page
+{
+	const UINT8* data;	// ROM data at the beginning of the page
+	UINT32 romOfs;
+	UINT32 size;	// number of valid bytes (0 = unmapped, less than the page size at the end of the ROM)
+} MEM_PAGE;
+
+typedef struct _mem_map
+{
+	UINT32 romSize;
+	const UINT8* romData;
+	UINT8 pageBits;
+	UINT32 pageMask;
+	UINT32 pageCnt;
+	UINT8 badRead;	// set when reading unmapped memory
+	MEM_PAGE pages[MEMMAP_MAX_PAGES];
+} MEM_MAP;
+
+
+MEMMAP_INLINE void MemMap_Init(MEM_MAP* map, UINT32 romSize, const UINT8* romData, UINT32 addrSize, UINT8 pageBits)
+{
+	UINT32 curPage;
+	
+	map->romSize = romSize;
+	map->romData = romData;
+	map->pageBits = pageBits;
+	map->pageMask = (1UL << pageBits) - 1;
+	map->pageCnt = (addrSize + map->pageMask) >> pageBits;
+	if (map->pageCnt > MEMMAP_MAX_PAGES)
+		map->pageCnt = MEMMAP_MAX_PAGES;
+	map->badRead = 0;
+	for (curPage = 0; curPage < map->pageCnt; curPage ++)
+	{
+		map->pages[curPage].data = NULL;
+		map->pages[curPage].romOfs = MEMMAP_BADOFS;
+		map->pages[curPage].size = 0;
+	}
+	
+	return;
+}
+
+MEMMAP_INLINE void MemMap_MapROM(MEM_MAP* map, UINT32 addr, UINT32 len, UINT32 romOfs)
+{
+	UINT32 curPage;
+	UINT32 endPage;
+	UINT32 pageSize;
+	MEM_PAGE* page;
+	
+	pageSize = map->pageMask + 1;
+	curPage = addr >> map->pageBits;
+	endPage = (addr + len + map->pageMask) >> map->pageBits;
+	if (endPage > map->pageCnt)
+		endPage = map->pageCnt;
+	for (; curPage < endPage; curPage ++, romOfs += pageSize)
+	{
+		page = &map->pages[curPage];
+		if (romOfs >= map->romSize)
+		{
+			page->data = NULL;
+			page->romOfs = MEMMAP_BADOFS;
+			page->size = 0;
+			continue;
+		}
+		page->data = &map->romData[romOfs];
+		page->romOfs = romOfs;
+		page->size = map->romSize - romOfs;
+		if (page->size > pageSize)
+			page->size = pageSize;
+	}
+	
+	return;
+}
+
+MEMMAP_INLINE void MemMap_Unmap(MEM_MAP* map, UINT32 addr, UINT32 len)
+{
+	UINT32 curPage;
+	UINT32 endPage;
+	
+	curPage = addr >> map->pageBits;
+	endPage = (addr + len + map->pageMask) >> map->pageBits;
+	if (endPage > map->pageCnt)
+		endPage = map->pageCnt;
+	for (; curPage < endPage; curPage ++)
+	{
+		map->pages[curPage].data = NULL;
+		map->pages[curPage].romOfs = MEMMAP_BADOFS;
+		map->pages[curPage].size = 0;
+	}
+	
+	return;
+}
+
+MEMMAP_INLINE UINT32 MemMap_GetAvail(const MEM_MAP* map, UINT32 addr)
+{
+	UINT32 pageID = addr >> map->pageBits;
+	UINT32 pageOfs = addr & map->pageMask;
+	
+	if (pageID >= map->pageCnt || pageOfs >= map->pages[pageID].size)
+		return 0;
+	return map->pages[pageID].size - pageOfs;
+}
+
+MEMMAP_INLINE UINT32 MemMap_GetROMOfs(const MEM_MAP* map, UINT32 addr)
+{
+	if (! MemMap_GetAvail(map, addr))
+		return MEMMAP_BADOFS;
+	return map->pages[addr >> map->pageBits].romOfs + (addr & map->pageMask);
+}
+
+MEMMAP_INLINE const UINT8* MemMap_GetPtr(const MEM_MAP* map, UINT32 addr, UINT32 len)
+{
+	if (MemMap_GetAvail(map, addr) < len || ! len)
+		return NULL;
+	return &map->pages[addr >> map->pageBits].data[addr & map->pageMask];
+}
+
+MEMMAP_INLINE UINT8 MemMap_Read8(MEM_MAP* map, UINT32 addr)
+{
+	UINT32 pageID = addr >> map->pageBits;
+	UINT32 pageOfs = addr & map->pageMask;
+	
+	if (pageID >= map->pageCnt || pageOfs >= map->pages[pageID].size)
+	{
+		map->badRead = 1;
+		return 0x00;
+	}
+	return map->pages[pageID].data[pageOfs];
+}
+
+MEMMAP_INLINE UINT16 MemMap_Read16LE(MEM_MAP* map, UINT32 addr)
+{
+	const UINT8* data = MemMap_GetPtr(map, addr, 0x02);
+	if (data != NULL)
+		return (data[0x01] << 8) | (data[0x00] << 0);
+	return (MemMap_Read8(map, addr + 0x01) << 8) | (MemMap_Read8(map, addr + 0x00) << 0);
+}
+
+MEMMAP_INLINE UINT16 MemMap_Read16BE(MEM_MAP* map, UINT32 addr)
+{
+	const UINT8* data = MemMap_GetPtr(map, addr, 0x02);
+	if (data != NULL)
+		return (data[0x00] << 8) | (data[0x01] << 0);
+	return (MemMap_Read8(map, addr + 0x00) << 8) | (MemMap_Read8(map, addr + 0x01) << 0);
+}
+
+MEMMAP_INLINE UINT32 MemMap_Read24LE(MEM_MAP* map, UINT32 addr)
+{
+	const UINT8* data = MemMap_GetPtr(map, addr, 0x03);
+	if (data != NULL)
+		return (data[0x02] << 16) | (data[0x01] << 8) | (data[0x00] << 0);
+	return	(MemMap_Read8(map, addr + 0x02) << 16) |
+			(MemMap_Read8(map, addr + 0x01) <<  8) |
+			(MemMap_Read8(map, addr + 0x00) <<  0);
+}
+
+MEMMAP_INLINE UINT32 MemMap_Read24BE(MEM_MAP* map, UINT32 addr)
+{
+	const UINT8* data = MemMap_GetPtr(map, addr, 0x03);
+	if (data != NULL)
+		return (data[0x00] << 16) | (data[0x01] << 8) | (data[0x02] << 0);
+	return	(MemMap_Read8(map, addr + 0x00) << 16) |
+			(MemMap_Read8(map, addr + 0x01) <<  8) |
+			(MemMap_Read8(map, addr + 0x02) <<  0);
+}
+
+#endif	// __MEM_MAP_H__
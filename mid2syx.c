@@ -7,6 +7,12 @@
 #include <string.h>
 
 #include "stdtype.h"
+#include "midi_reader.h"
+
+#ifdef _WIN32
+#include <io.h>	// for _setmode()
+#include <fcntl.h>
+#endif
 
 #ifndef INLINE
 #if defined(_MSC_VER)
@@ -19,214 +25,397 @@
 #endif	// INLINE
 
 
-UINT8 Mid2Syx(void);
-static UINT32 ReadVarLenValue(UINT32* inPos);
-static UINT8 WriteFileData(UINT32 dataLen, const UINT8* data, const char* fileName);
+#define MAX_MFG_IDS	0x10
+#define READ_BLOCK_SIZE	0x10000	// track data is read in blocks of this size
+
+typedef struct syx_filter
+{
+	UINT8 mfgCnt;
+	UINT32 mfgIDs[MAX_MFG_IDS];	// 1-byte IDs (00..7F) or 3-byte IDs (00xxxx)
+	UINT8 useAddr;
+	UINT32 addrStart;
+	UINT32 addrEnd;
+} SYX_FILTER;
+
+
+static UINT8 ConvertFile(const char* inName, const char* outName);
+static char* GetBatchOutName(const char* inName, const char* newExt);
+static const char* GetLastDirSepPos(const char* fileName);
+UINT8 Mid2Syx(FILE* hFileIn, FILE* hFileOut);
+static UINT8 CheckSyxFilter(UINT32 dataLen, const UINT8* data);
+static UINT8 ReadChunkHeader(FILE* hFile, UINT8* chkHdr, UINT32* chkLen);
+static UINT8 ReadChunkData(FILE* hFile, UINT32 chkLen, UINT32* bufSize, UINT8** buffer, UINT32* readLen);
+static UINT8 SkipFileData(FILE* hFile, UINT32 len);
 
-INLINE UINT16 ReadBE16(const UINT8* Data);
-INLINE UINT32 ReadBE32(const UINT8* Data);
+INLINE UINT32 ReadBE32(const UINT8* data);
 
 
-static UINT32 midLen;
-static UINT8* midData;
-static UINT32 syxLen;
-static UINT8* syxData;
+static SYX_FILTER Filter;
 
 int main(int argc, char* argv[])
 {
 	int argbase;
-	FILE* hFile;
+	UINT8 batchMode;
 	UINT8 retVal;
+	char* outName;
 	
 	if (argc < 3)
 	{
-		printf("Usage: mid2syx.exe input.mid output.syx\n");
+		printf("Usage: mid2syx.exe [options] input.mid output.syx\n");
+		printf("       mid2syx.exe [options] -b input1.mid [input2.mid ...]\n");
 		printf("The SYX file will contain all SysEx commands from the MID file.\n");
+		printf("Batch mode (-b) writes input1.syx, input2.syx, etc. Use - for stdin/stdout.\n");
+		printf("\n");
+		printf("Options:\n");
+		printf("    -m id       extract only SysEx messages with this manufacturer ID (hex)\n");
+		printf("                can be used multiple times, e.g. -m 41 -m 43 -m 002109\n");
+		printf("    -a beg-end  extract only Roland/Yamaha parameter messages whose address\n");
+		printf("                is in this range (hex), e.g. -a 400000-40FFFF\n");
 		return 0;
 	}
 	
 	argbase = 1;
-	if (argc < argbase + 2)
+	batchMode = 0;
+	memset(&Filter, 0x00, sizeof(SYX_FILTER));
+	while(argbase < argc && argv[argbase][0] == '-' && argv[argbase][1] != '\0')
 	{
-		printf("Not enough arguments.\n");
+		if (! strcmp(argv[argbase], "-b"))
+		{
+			batchMode = 1;
+		}
+		else if (! strcmp(argv[argbase], "-m") && argbase + 1 < argc)
+		{
+			argbase ++;
+			if (Filter.mfgCnt >= MAX_MFG_IDS)
+			{
+				fprintf(stderr, "Too many manufacturer IDs!\n");
+				return 1;
+			}
+			Filter.mfgIDs[Filter.mfgCnt] = (UINT32)strtoul(argv[argbase], NULL, 0x10);
+			Filter.mfgCnt ++;
+		}
+		else if (! strcmp(argv[argbase], "-a") && argbase + 1 < argc)
+		{
+			char* endPtr;
+			
+			argbase ++;
+			Filter.addrStart = (UINT32)strtoul(argv[argbase], &endPtr, 0x10);
+			Filter.addrEnd = (*endPtr == '-') ? (UINT32)strtoul(endPtr + 1, NULL, 0x10) : Filter.addrStart;
+			Filter.useAddr = 1;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option %s!\n", argv[argbase]);
+			return 1;
+		}
+		argbase ++;
+	}
+	if (argc < argbase + (batchMode ? 1 : 2))
+	{
+		fprintf(stderr, "Not enough arguments.\n");
 		return 0;
 	}
 	
-	hFile = fopen(argv[argbase + 0], "rb");
-	if (hFile == NULL)
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	
+	if (! batchMode)
+		return ConvertFile(argv[argbase + 0], argv[argbase + 1]) ? 1 : 0;
+	
+	retVal = 0;
+	for (; argbase < argc; argbase ++)
 	{
-		printf("Error opening file!\n");
-		return 1;
+		outName = GetBatchOutName(argv[argbase], ".syx");
+		if (ConvertFile(argv[argbase], outName))
+			retVal = 1;
+		free(outName);
 	}
 	
-	fseek(hFile, 0x00, SEEK_END);
-	midLen = ftell(hFile);
-	if (midLen > 0x100000)
-		midLen = 0x100000;
+	return retVal;
+}
+
+static UINT8 ConvertFile(const char* inName, const char* outName)
+{
+	FILE* hFileIn;
+	FILE* hFileOut;
+	UINT8 retVal;
+	
+	hFileIn = strcmp(inName, "-") ? fopen(inName, "rb") : stdin;
+	if (hFileIn == NULL)
+	{
+		fprintf(stderr, "Error opening %s!\n", inName);
+		return 0xFF;
+	}
+	hFileOut = strcmp(outName, "-") ? fopen(outName, "wb") : stdout;
+	if (hFileOut == NULL)
+	{
+		fprintf(stderr, "Error opening %s!\n", outName);
+		if (hFileIn != stdin)
+			fclose(hFileIn);
+		return 0xFF;
+	}
+	
+	retVal = Mid2Syx(hFileIn, hFileOut);
+	if (retVal == 0x80)
+		fprintf(stderr, "Error writing %s!\n", outName);
 	
-	fseek(hFile, 0x00, SEEK_SET);
-	midData = (UINT8*)malloc(midLen);
-	fread(midData, 0x01, midLen, hFile);
+	if (hFileOut != stdout)
+		fclose(hFileOut);
+	else
+		fflush(stdout);
+	if (hFileIn != stdin)
+		fclose(hFileIn);
 	
-	fclose(hFile);
+	return retVal;
+}
+
+static char* GetBatchOutName(const char* inName, const char* newExt)
+{
+	char* outName;
+	char* extPos;
 	
-	retVal = Mid2Syx();
-	if (! retVal)
-		WriteFileData(syxLen, syxData, argv[argbase + 1]);
-	free(syxData);	syxData = NULL;
-	free(midData);	midData = NULL;
+	if (! strcmp(inName, "-"))
+	{
+		outName = (char*)malloc(0x02);
+		strcpy(outName, "-");
+		return outName;
+	}
+	outName = (char*)malloc(strlen(inName) + strlen(newExt) + 1);
+	strcpy(outName, inName);
+	extPos = strrchr(outName, '.');
+	if (extPos != NULL && extPos > GetLastDirSepPos(outName))
+		*extPos = '\0';
+	strcat(outName, newExt);
 	
-	return 0;
+	return outName;
 }
 
-UINT8 Mid2Syx(void)
+static const char* GetLastDirSepPos(const char* fileName)
 {
-	UINT32 syxPos;
+	const char* sepPos;
+	const char* wSepPos;	// Windows separator
+	
+	sepPos = strrchr(fileName, '/');
+	wSepPos = strrchr(fileName, '\\');
+	if (wSepPos == NULL)
+		return sepPos;
+	else if (sepPos == NULL)
+		return wSepPos;
+	return (wSepPos > sepPos) ? wSepPos : sepPos;
+}
+
+// The MIDI file is read chunk by chunk and the SysEx data is written right away,
+// so only the largest track has to fit into memory.
+// Returns 0x80 for write errors and 0xFF for invalid data or when running out of memory.
+UINT8 Mid2Syx(FILE* hFileIn, FILE* hFileOut)
+{
+	SMF_FILE smf;
+	SMF_EVENT evt;
+	UINT8 chkHdr[0x08];
+	UINT8 midHdr[0x06];
+	UINT32 chkLen;
+	UINT32 filePos;
+	UINT32 trkAlloc;
 	UINT32 trkLen;
-	UINT32 inPos;
+	UINT8* trkData;
 	UINT16 trkCnt;
 	UINT16 curTrk;
-	UINT8 trkEnd;
-	
-	syxLen = midLen;
-	syxData = (UINT8*)malloc(syxLen);
-	syxPos = 0x00;
+	UINT8 passSyx;
+	UINT8 retVal;
 	
-	inPos = 0x00;
-	if (memcmp(&midData[inPos + 0x00], "MThd", 0x04))
+	if (ReadChunkHeader(hFileIn, chkHdr, &chkLen) || memcmp(&chkHdr[0x00], "MThd", 0x04) ||
+		chkLen < 0x06 || fread(midHdr, 0x01, 0x06, hFileIn) != 0x06 || SkipFileData(hFileIn, chkLen - 0x06))
 	{
-		printf("Not a MID file!\n");
+		fprintf(stderr, "Not a MID file!\n");
 		return 0xFF;
 	}
-	trkLen = ReadBE32(&midData[inPos + 0x04]);
-	trkCnt = ReadBE16(&midData[inPos + 0x0A]);
-	inPos += 0x08 + trkLen;
+	trkCnt = (midHdr[0x02] << 8) | (midHdr[0x03] << 0);
+	filePos = 0x08 + chkLen;
 	
-	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+	trkAlloc = 0x00;
+	trkData = NULL;
+	passSyx = 1;
+	retVal = 0x00;
+	for (curTrk = 0; curTrk < trkCnt && ! retVal; )
 	{
-		UINT32 trkBasePos;
-		UINT8 curCmd = 0x00;
+		if (ReadChunkHeader(hFileIn, chkHdr, &chkLen))
+		{
+			fprintf(stderr, "Track %u (pos 0x%04X): Invalid track signature!\n", curTrk, filePos);
+			retVal = 0xFF;
+			break;
+		}
+		filePos += 0x08;
+		if (memcmp(&chkHdr[0x00], "MTrk", 0x04))
+		{
+			if (SkipFileData(hFileIn, chkLen))
+				break;
+			filePos += chkLen;
+			continue;	// skip unknown chunks
+		}
 		
-		if (memcmp(&midData[inPos + 0x00], "MTrk", 0x04))
+		if (ReadChunkData(hFileIn, chkLen, &trkAlloc, &trkData, &trkLen))
 		{
-			printf("Track %u (pos 0x%04X): Invalid track signature!\n", curTrk, inPos);
-			return 0xFF;
+			fprintf(stderr, "Track %u: Not enough memory for 0x%X bytes of track data!\n", curTrk, chkLen);
+			retVal = 0xFF;
+			break;
 		}
-		trkLen = ReadBE32(&midData[inPos + 0x04]);
-		inPos += 0x08;
-		trkBasePos = inPos;
+		if (trkLen < chkLen)
+			fprintf(stderr, "Track %u: Track data is incomplete!\n", curTrk);
 		
-		trkEnd = 0;
-		while(!trkEnd && inPos < trkBasePos + trkLen)
+		if (SMF_OpenTrack(&smf, trkLen, trkData))
 		{
-			UINT8 newRS;	// new "running status" byte
-			UINT32 cmdLen;
-			
-			ReadVarLenValue(&inPos);	// skip delay
-			
-			newRS = (midData[inPos] & 0x80);
-			if (newRS)
-			{
-				curCmd = midData[inPos];
-				inPos ++;
-			}
-			switch(curCmd & 0xF0)
+			retVal = 0xFF;
+			break;
+		}
+		while((retVal = SMF_ReadTrackEvent(&smf, 0, &evt)) == 0x00)
+		{
+			switch(evt.status)
 			{
-			case 0x80:	// Note Off
-			case 0x90:	// Note On
-			case 0xA0:	// Note Aftertouch
-			case 0xB0:	// Control Change
-			case 0xE0:	// Pitch Bend
-				inPos += 0x02;
-				break;
-			case 0xC0:	// Instrument
-			case 0xD0:	// Channel Aftertouch
-				inPos += 0x01;
-				break;
-			case 0xF0:	// special
-				switch(curCmd)
-				{
-				case 0xF0:	// SysEx
-					cmdLen = ReadVarLenValue(&inPos);
-					syxData[syxPos] = 0xF0;	syxPos ++;
-					memcpy(&syxData[syxPos], &midData[inPos], cmdLen);
-					syxPos += cmdLen;
-					inPos += cmdLen;
-					break;
-				case 0xF7:	// SysEx Continuation
-					cmdLen = ReadVarLenValue(&inPos);
-					// do NOT insert an additional byte
-					memcpy(&syxData[syxPos], &midData[inPos], cmdLen);
-					syxPos += cmdLen;
-					inPos += cmdLen;
+			case 0xF0:	// SysEx
+				passSyx = CheckSyxFilter(evt.len, evt.data);
+				if (! passSyx)
 					break;
-				case 0xFF:	// Meta Event
-					curCmd = midData[inPos];	inPos ++;
-					if (curCmd == 0x2F)	// Track End event
-						trkEnd = 1;	// normal end
-					cmdLen = ReadVarLenValue(&inPos);
-					inPos += cmdLen;
-					break;
-				default:
-					printf("Unknown event %02X at %06X\n", curCmd, inPos);
-					inPos += 0x01;
-					trkEnd = 1;
-					break;
-				}
+				if (fputc(0xF0, hFileOut) == EOF || fwrite(evt.data, 0x01, evt.len, hFileOut) != evt.len)
+					retVal = 0x80;
 				break;
-			default:
-				printf("Unknown event %02X at %06X\n", curCmd, inPos);
-				inPos += 0x01;
-				trkEnd = 1;
+			case 0xF7:	// SysEx Continuation
+				// do NOT insert an additional byte
+				if (! passSyx)
+					break;	// continuation of a filtered message
+				if (fwrite(evt.data, 0x01, evt.len, hFileOut) != evt.len)
+					retVal = 0x80;
 				break;
 			}
+			if (retVal)
+				break;
 		}
-		
-		inPos = trkBasePos + trkLen;
+		SMF_Close(&smf);
+		if (retVal == 0xFF)
+			fprintf(stderr, "Track %u: Invalid event %02X at %06X\n", curTrk,
+					trkData[evt.filePos], filePos + evt.filePos);
+		if (retVal != 0x80)
+			retVal = 0x00;	// skip the rest of a broken track
+		if (trkLen < chkLen)
+			break;
+		filePos += chkLen;
+		curTrk ++;
 	}
+	free(trkData);
 	
-	syxLen = syxPos;
-	return 0x00;
+	return retVal;
 }
 
-static UINT32 ReadVarLenValue(UINT32* inPos)
+// Returns 1 if the SysEx message (data without F0) passes the filters.
+static UINT8 CheckSyxFilter(UINT32 dataLen, const UINT8* data)
 {
-	UINT32 pos = *inPos;
-	UINT32 value = 0x00;
-	while(midData[pos] & 0x80)
+	UINT32 mfgID;
+	UINT32 addr;
+	UINT8 curID;
+	
+	if (! dataLen)
+		return (! Filter.mfgCnt && ! Filter.useAddr);
+	
+	if (data[0x00] == 0x00 && dataLen >= 0x03)
+		mfgID = (data[0x00] << 16) | (data[0x01] << 8) | (data[0x02] << 0);	// 3-byte ID
+	else
+		mfgID = data[0x00];
+	if (Filter.mfgCnt)
 	{
-		value |= (midData[pos] & 0x7F);	pos ++;
-		value <<= 7;
+		for (curID = 0; curID < Filter.mfgCnt; curID ++)
+		{
+			if (Filter.mfgIDs[curID] == mfgID)
+				break;
+		}
+		if (curID >= Filter.mfgCnt)
+			return 0;
+	}
+	
+	if (Filter.useAddr)
+	{
+		// F0 41 dev model 11/12 aa aa aa ... (Roland RQ1/DT1)
+		// F0 43 1n model aa aa aa ... (Yamaha Parameter Change)
+		// F0 43 0n model cnt cnt aa aa aa ... (Yamaha Bulk Dump)
+		if (mfgID == 0x41 && dataLen >= 0x07 && (data[0x03] == 0x11 || data[0x03] == 0x12))
+			addr = (data[0x04] << 16) | (data[0x05] << 8) | (data[0x06] << 0);
+		else if (mfgID == 0x43 && dataLen >= 0x06 && (data[0x01] & 0xF0) == 0x10)
+			addr = (data[0x03] << 16) | (data[0x04] << 8) | (data[0x05] << 0);
+		else if (mfgID == 0x43 && dataLen >= 0x08 && (data[0x01] & 0xF0) == 0x00)
+			addr = (data[0x05] << 16) | (data[0x06] << 8) | (data[0x07] << 0);
+		else
+			return 0;	// no address
+		if (addr < Filter.addrStart || addr > Filter.addrEnd)
+			return 0;
 	}
-	value |= midData[pos];	pos ++;
-	*inPos = pos;
-	return value;
+	
+	return 1;
+}
+
+static UINT8 ReadChunkHeader(FILE* hFile, UINT8* chkHdr, UINT32* chkLen)
+{
+	if (fread(chkHdr, 0x01, 0x08, hFile) != 0x08)
+		return 0xFF;
+	*chkLen = ReadBE32(&chkHdr[0x04]);
+	return 0x00;
 }
 
-static UINT8 WriteFileData(UINT32 dataLen, const UINT8* data, const char* fileName)
+// Reads up to chkLen bytes. The buffer only grows with the data that was actually read,
+// so a bogus chunk length in a small file doesn't allocate gigabytes.
+// Returns 0xFF when running out of memory.
+static UINT8 ReadChunkData(FILE* hFile, UINT32 chkLen, UINT32* bufSize, UINT8** buffer, UINT32* readLen)
 {
-	FILE* hFile;
+	UINT32 blkLen;
+	UINT32 newSize;
+	UINT8* newBuf;
 	
-	hFile = fopen(fileName, "wb");
-	if (hFile == NULL)
+	*readLen = 0x00;
+	while(*readLen < chkLen)
 	{
-		printf("Error opening %s!\n", fileName);
-		return 0xFF;
+		blkLen = chkLen - *readLen;
+		if (blkLen > READ_BLOCK_SIZE)
+			blkLen = READ_BLOCK_SIZE;
+		if (*bufSize < *readLen + blkLen)
+		{
+			newSize = *bufSize ? *bufSize : READ_BLOCK_SIZE;
+			while(newSize < *readLen + blkLen && newSize < 0x80000000)
+				newSize *= 2;
+			if (newSize < *readLen + blkLen)
+				newSize = *readLen + blkLen;
+			newBuf = (UINT8*)realloc(*buffer, newSize);
+			if (newBuf == NULL)
+				return 0xFF;
+			*bufSize = newSize;
+			*buffer = newBuf;
+		}
+		blkLen = (UINT32)fread(&(*buffer)[*readLen], 0x01, blkLen, hFile);
+		*readLen += blkLen;
+		if (! blkLen)
+			break;	// end of file
 	}
 	
-	fwrite(data, 0x01, dataLen, hFile);
-	fclose(hFile);
-	
-	return 0;
+	return 0x00;
 }
 
-INLINE UINT16 ReadBE16(const UINT8* Data)
+static UINT8 SkipFileData(FILE* hFile, UINT32 len)
 {
-	return (Data[0x00] << 8) | (Data[0x01] << 0);
+	UINT8 buffer[0x400];
+	UINT32 readLen;
+	
+	// fseek doesn't work with pipes, so just read the data
+	while(len > 0)
+	{
+		readLen = (len < sizeof(buffer)) ? len : sizeof(buffer);
+		if (fread(buffer, 0x01, readLen, hFile) != readLen)
+			return 0xFF;
+		len -= readLen;
+	}
+	
+	return 0x00;
 }
 
-INLINE UINT32 ReadBE32(const UINT8* Data)
+INLINE UINT32 ReadBE32(const UINT8* data)
 {
-	return	(Data[0x00] << 24) | (Data[0x01] << 16) |
-			(Data[0x02] <<  8) | (Data[0x03] <<  0);
+	return	(data[0x00] << 24) | (data[0x01] << 16) |
+			(data[0x02] <<  8) | (data[0x03] <<  0);
 }
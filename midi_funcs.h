@@ -12,6 +12,14 @@
 
 #include "stdtype.h"
 
+// counting hooks for conv_stats.h (which must be included first to use them)
+#ifndef STATS_EVENT
+#define STATS_EVENT(evt)
+#endif
+#ifndef STATS_REALLOC
+#define STATS_REALLOC()
+#endif
+
 typedef struct _midi_track_state
 {
 	UINT32 trkBase;
@@ -28,21 +36,22 @@ typedef struct file_information
 } FILE_INF;
 
 
+// Define INLINE as "static inline" before including this file to silence warnings about unused functions.
 #ifndef INLINE
 #define INLINE static
 #endif
 
 INLINE void WriteMidiDelay(FILE_INF* fInf, UINT32* delay);
-static void WriteEventOpt(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT8 val1, UINT8 val2);
+INLINE void WriteEventOpt(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT8 val1, UINT8 val2);
 INLINE void WriteEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT8 val1, UINT8 val2);
 INLINE void WriteEvent2(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 opt, UINT8 evt, UINT8 val1, UINT8 val2);
-static void WriteLongEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT32 dataLen, const void* data);
-static void WriteMetaEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 metaType, UINT32 dataLen, const void* data);
-static void WriteMidiValue(FILE_INF* fInf, UINT32 value);
-static void File_CheckRealloc(FILE_INF* FileInf, UINT32 bytesNeeded);
-static void WriteMidiHeader(FILE_INF* fInf, UINT16 format, UINT16 tracks, UINT16 resolution);
-static void WriteMidiTrackStart(FILE_INF* fInf, MID_TRK_STATE* MTS);
-static void WriteMidiTrackEnd(FILE_INF* fInf, MID_TRK_STATE* MTS);
+INLINE void WriteLongEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT32 dataLen, const void* data);
+INLINE void WriteMetaEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 metaType, UINT32 dataLen, const void* data);
+INLINE void WriteMidiValue(FILE_INF* fInf, UINT32 value);
+INLINE void File_CheckRealloc(FILE_INF* FileInf, UINT32 bytesNeeded);
+INLINE void WriteMidiHeader(FILE_INF* fInf, UINT16 format, UINT16 tracks, UINT16 resolution);
+INLINE void WriteMidiTrackStart(FILE_INF* fInf, MID_TRK_STATE* MTS);
+INLINE void WriteMidiTrackEnd(FILE_INF* fInf, MID_TRK_STATE* MTS);
 
 INLINE void WriteBE32(UINT8* buffer, UINT32 value);
 INLINE void WriteBE16(UINT8* buffer, UINT16 value);
@@ -63,12 +72,13 @@ INLINE void WriteMidiDelay(FILE_INF* fInf, UINT32* delay)
 	return;
 }
 
-static void WriteEventOpt(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT8 val1, UINT8 val2)
+INLINE void WriteEventOpt(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT8 val1, UINT8 val2)
 {
 	UINT8 chnEvt = evt | MTS->midChn;
 	
 	WriteMidiDelay(fInf, &MTS->curDly);
 	
+	STATS_EVENT(evt);
 	File_CheckRealloc(fInf, 0x03);
 	switch(evt & 0xF0)
 	{
@@ -139,38 +149,42 @@ INLINE void WriteEvent2(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 opt, UINT8 evt
 	return;
 }
 
-static void WriteLongEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT32 dataLen, const void* data)
+INLINE void WriteLongEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 evt, UINT32 dataLen, const void* data)
 {
 	WriteMidiDelay(fInf, &MTS->curDly);
 	
+	STATS_EVENT(evt);
 	File_CheckRealloc(fInf, 0x01 + 0x04 + dataLen);	// worst case: 4 bytes of data length
 	MTS->runStat = 0x00;
 	fInf->data[fInf->pos + 0x00] = evt;
 	fInf->pos += 0x01;
 	WriteMidiValue(fInf, dataLen);
-	memcpy(&fInf->data[fInf->pos], data, dataLen);
+	if (dataLen > 0)
+		memcpy(&fInf->data[fInf->pos], data, dataLen);
 	fInf->pos += dataLen;
 	
 	return;
 }
 
-static void WriteMetaEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 metaType, UINT32 dataLen, const void* data)
+INLINE void WriteMetaEvent(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 metaType, UINT32 dataLen, const void* data)
 {
 	WriteMidiDelay(fInf, &MTS->curDly);
 	
+	STATS_EVENT(0xFF);
 	File_CheckRealloc(fInf, 0x02 + 0x05 + dataLen);	// worst case: 5 bytes of data length
 	MTS->runStat = 0x00;
 	fInf->data[fInf->pos + 0x00] = 0xFF;
 	fInf->data[fInf->pos + 0x01] = metaType;
 	fInf->pos += 0x02;
 	WriteMidiValue(fInf, dataLen);
-	memcpy(&fInf->data[fInf->pos], data, dataLen);
+	if (dataLen > 0)
+		memcpy(&fInf->data[fInf->pos], data, dataLen);
 	fInf->pos += dataLen;
 	
 	return;
 }
 
-static void WriteMidiValue(FILE_INF* fInf, UINT32 value)
+INLINE void WriteMidiValue(FILE_INF* fInf, UINT32 value)
 {
 	UINT8 valSize;
 	UINT8* valData;
@@ -202,7 +216,7 @@ static void WriteMidiValue(FILE_INF* fInf, UINT32 value)
 	return;
 }
 
-static void File_CheckRealloc(FILE_INF* fInf, UINT32 bytesNeeded)
+INLINE void File_CheckRealloc(FILE_INF* fInf, UINT32 bytesNeeded)
 {
 #define REALLOC_STEP	0x8000	// 32 KB block
 	UINT32 minPos;
@@ -213,12 +227,13 @@ static void File_CheckRealloc(FILE_INF* fInf, UINT32 bytesNeeded)
 	
 	while(minPos > fInf->alloc)
 		fInf->alloc += REALLOC_STEP;
+	STATS_REALLOC();
 	fInf->data = (UINT8*)realloc(fInf->data, fInf->alloc);
 	
 	return;
 }
 
-static void WriteMidiHeader(FILE_INF* fInf, UINT16 format, UINT16 tracks, UINT16 resolution)
+INLINE void WriteMidiHeader(FILE_INF* fInf, UINT16 format, UINT16 tracks, UINT16 resolution)
 {
 	File_CheckRealloc(fInf, 0x08 + 0x06);
 	
@@ -234,7 +249,7 @@ static void WriteMidiHeader(FILE_INF* fInf, UINT16 format, UINT16 tracks, UINT16
 	return;
 }
 
-static void WriteMidiTrackStart(FILE_INF* fInf, MID_TRK_STATE* MTS)
+INLINE void WriteMidiTrackStart(FILE_INF* fInf, MID_TRK_STATE* MTS)
 {
 	File_CheckRealloc(fInf, 0x08);
 	
@@ -249,7 +264,7 @@ static void WriteMidiTrackStart(FILE_INF* fInf, MID_TRK_STATE* MTS)
 	return;
 }
 
-static void WriteMidiTrackEnd(FILE_INF* fInf, MID_TRK_STATE* MTS)
+INLINE void WriteMidiTrackEnd(FILE_INF* fInf, MID_TRK_STATE* MTS)
 {
 	UINT32 trkLen;
 	
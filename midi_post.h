@@ -0,0 +1,432 @@
+// MIDI Post-Processing
+// --------------------
+// to be included as header file
+//
+// Rewrites a MIDI file in memory. All stages are done in a single pass over the events,
+// which are read in merged order using midi_reader.h.
+// Stages (see MIDPOST_OPTS):
+//  - merge all tracks into a single track (MIDI format 0)
+//  - rescale to a different resolution (ticks per quarter)
+//  - remove redundant tempo events
+//  UINT8 MidPost_IsActive(const MIDPOST_OPTS* opts);
+//      Returns 1 if any stage is enabled, else 0.
+//  UINT8 MidPost_Process(const MIDPOST_OPTS* opts, UINT32 inLen, const UINT8* inData, UINT32* outLen, UINT8** outData);
+//      Processes the MIDI file "inData" and returns a new buffer in "outData". (to be freed by the caller)
+//      Returns 0x00 on success, 0x80/0x81 for invalid MIDI files (see SMF_Open), 0xFE for invalid
+//      event data or delays that don't fit into a MIDI file and 0xFF if memory allocation failed.
+//
+// Rescaling rounds the absolute tick of each event, so rounding errors don't add up over time.
+// Notes that would get a length of 0 are extended to 1 tick. Their Note Offs are held back until
+// the next tick, so that other events aren't moved. (The exception is a note that is played again
+// on the same tick: Its Note Off is written right before the new Note On.)
+// Format 2 files aren't merged and files with SMPTE timing aren't rescaled.
+
+#ifndef __MIDI_POST_H__
+#define __MIDI_POST_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "stdtype.h"
+#include "midi_reader.h"
+
+typedef struct _midpost_options
+{
+	UINT8 toFormat0;	// merge all tracks into a single track
+	UINT16 resolution;	// new ticks per quarter (0 = keep)
+	UINT8 tempoDedup;	// remove tempo events that don't change the tempo, keep only the last one on a tick
+} MIDPOST_OPTS;
+
+typedef struct _midpost_track
+{
+	UINT32 alloc;
+	UINT32 pos;
+	UINT8* data;
+	UINT32 lastTick;
+	UINT32 endTick;
+	UINT8 runStatus;
+} MIDPOST_TRK;
+
+typedef struct _midpost_note_off
+{
+	UINT16 trkID;
+	UINT32 tick;
+	UINT8 status;
+	UINT8 data[0x02];
+} MIDPOST_NOTEOFF;
+
+typedef struct _midpost_state
+{
+	UINT32 oldRes;
+	UINT32 newRes;
+	UINT16 trkCnt;
+	MIDPOST_TRK* trks;
+	UINT8 memError;
+	UINT8 dlyError;		// a delay was too large for a MIDI file
+	UINT32 curTempo;
+	UINT8 tempoPend;	// a tempo event is waiting for the end of its tick
+	UINT16 tempoTrk;
+	UINT32 tempoTick;
+	UINT8 tempoData[0x03];
+	UINT32 noteTick[0x10][0x80];	// rescaled tick + 1 of the last Note On (0 = note is off)
+	UINT32 noteOrgTick[0x10][0x80];	// original tick of the last Note On
+	UINT16 offCnt;
+	MIDPOST_NOTEOFF offList[0x10 * 0x80];	// delayed Note Offs (at most one per channel/note)
+} MIDPOST_STATE;
+
+
+INLINE UINT8 MidPost_IsActive(const MIDPOST_OPTS* opts)
+{
+	return (opts->toFormat0 || opts->resolution || opts->tempoDedup) ? 1 : 0;
+}
+
+INLINE UINT32 MidPost_ScaleTick(const MIDPOST_STATE* mps, UINT32 tick)
+{
+	if (mps->newRes == mps->oldRes)
+		return tick;
+	return (UINT32)(((UINT64)tick * mps->newRes + mps->oldRes / 2) / mps->oldRes);
+}
+
+INLINE UINT8* MidPost_Reserve(MIDPOST_STATE* mps, MIDPOST_TRK* trk, UINT32 bytes)
+{
+	UINT32 newAlloc;
+	UINT8* newData;
+	
+	if (trk->pos + bytes > trk->alloc)
+	{
+		newAlloc = trk->alloc * 2;
+		if (newAlloc < trk->pos + bytes)
+			newAlloc = trk->pos + bytes;
+		newData = (UINT8*)realloc(trk->data, newAlloc);
+		if (newData == NULL)
+		{
+			mps->memError = 1;
+			return NULL;
+		}
+		trk->alloc = newAlloc;
+		trk->data = newData;
+	}
+	return &trk->data[trk->pos];
+}
+
+// "value" must be 0x0FFFFFFF or less.
+INLINE UINT32 MidPost_WriteVarLen(UINT8* buffer, UINT32 value)
+{
+	UINT8 valSize;
+	UINT8 curByte;
+	
+	valSize = 1;
+	while(valSize < 4 && (value >> (valSize * 7)))
+		valSize ++;
+	for (curByte = 0; curByte < valSize; curByte ++)
+	{
+		buffer[curByte] = (value >> ((valSize - 1 - curByte) * 7)) & 0x7F;
+		if (curByte < valSize - 1)
+			buffer[curByte] |= 0x80;
+	}
+	return valSize;
+}
+
+INLINE void MidPost_PutEvent(MIDPOST_STATE* mps, UINT16 trkID, UINT32 tick,
+								UINT8 status, UINT8 metaType, UINT32 len, const UINT8* data)
+{
+	MIDPOST_TRK* trk = &mps->trks[trkID];
+	UINT8* buffer;
+	UINT32 bufPos;
+	
+	buffer = MidPost_Reserve(mps, trk, 0x04 + 0x02 + 0x04 + len);
+	if (buffer == NULL)
+		return;
+	
+	// events can't go back in time (only the Track End can be earlier than a delayed Note Off)
+	if (tick < trk->lastTick)
+		tick = trk->lastTick;
+	if (tick - trk->lastTick > 0x0FFFFFFF)
+	{
+		mps->dlyError = 1;
+		return;
+	}
+	bufPos = MidPost_WriteVarLen(buffer, tick - trk->lastTick);
+	trk->lastTick = tick;
+	
+	if (status < 0xF0)
+	{
+		if (trk->runStatus != status)
+			buffer[bufPos ++] = status;
+		trk->runStatus = status;
+	}
+	else
+	{
+		buffer[bufPos ++] = status;
+		if (status == 0xFF)
+			buffer[bufPos ++] = metaType;
+		bufPos += MidPost_WriteVarLen(&buffer[bufPos], len);
+		trk->runStatus = 0x00;
+	}
+	if (len > 0)
+		memcpy(&buffer[bufPos], data, len);
+	trk->pos += bufPos + len;
+	
+	return;
+}
+
+// writes all delayed Note Offs of a track up to "tick"
+INLINE void MidPost_FlushNoteOffs(MIDPOST_STATE* mps, UINT16 trkID, UINT32 tick)
+{
+	MIDPOST_NOTEOFF* noff;
+	UINT16 curOff;
+	UINT16 keepCnt;
+	
+	keepCnt = 0;
+	for (curOff = 0; curOff < mps->offCnt; curOff ++)
+	{
+		noff = &mps->offList[curOff];
+		if (noff->trkID == trkID && noff->tick <= tick)
+			MidPost_PutEvent(mps, noff->trkID, noff->tick, noff->status, 0x00, 0x02, noff->data);
+		else
+			mps->offList[keepCnt ++] = *noff;
+	}
+	mps->offCnt = keepCnt;
+	
+	return;
+}
+
+// writes the delayed Note Off of a note that is played again, at "tick" at the latest
+INLINE void MidPost_RetriggerNote(MIDPOST_STATE* mps, UINT8 chn, UINT8 note, UINT32 tick)
+{
+	MIDPOST_NOTEOFF* noff;
+	UINT16 curOff;
+	
+	for (curOff = 0; curOff < mps->offCnt; curOff ++)
+	{
+		noff = &mps->offList[curOff];
+		if ((noff->status & 0x0F) == chn && noff->data[0x00] == note)
+		{
+			if (noff->tick > tick)
+				noff->tick = tick;
+			MidPost_PutEvent(mps, noff->trkID, noff->tick, noff->status, 0x00, 0x02, noff->data);
+			mps->offCnt --;
+			memmove(noff, noff + 1, (mps->offCnt - curOff) * sizeof(MIDPOST_NOTEOFF));
+			return;
+		}
+	}
+	
+	return;
+}
+
+INLINE void MidPost_WriteEvent(MIDPOST_STATE* mps, UINT16 trkID, UINT32 tick,
+								UINT8 status, UINT8 metaType, UINT32 len, const UINT8* data)
+{
+	if (mps->offCnt)
+		MidPost_FlushNoteOffs(mps, trkID, tick);
+	MidPost_PutEvent(mps, trkID, tick, status, metaType, len, data);
+	
+	return;
+}
+
+INLINE void MidPost_FlushTempo(MIDPOST_STATE* mps)
+{
+	UINT32 tempo;
+	
+	if (! mps->tempoPend)
+		return;
+	mps->tempoPend = 0;
+	tempo = (mps->tempoData[0x00] << 16) | (mps->tempoData[0x01] << 8) | (mps->tempoData[0x02] << 0);
+	if (tempo == mps->curTempo)
+		return;
+	mps->curTempo = tempo;
+	MidPost_WriteEvent(mps, mps->tempoTrk, mps->tempoTick, 0xFF, 0x51, 0x03, mps->tempoData);
+	
+	return;
+}
+
+INLINE UINT8 MidPost_Process(const MIDPOST_OPTS* opts, UINT32 inLen, const UINT8* inData, UINT32* outLen, UINT8** outData)
+{
+	SMF_FILE smf;
+	SMF_EVENT evt;
+	MIDPOST_STATE* mps;
+	MIDPOST_TRK* trk;
+	UINT16 curTrk;
+	UINT16 outTrk;
+	UINT32 tick;
+	UINT32 fileLen;
+	UINT8* fileData;
+	UINT8 merge;
+	UINT8 retVal;
+	
+	retVal = SMF_Open(&smf, inLen, inData);
+	if (retVal)
+		return retVal;
+	mps = (MIDPOST_STATE*)calloc(1, sizeof(MIDPOST_STATE));
+	if (mps == NULL)
+	{
+		SMF_Close(&smf);
+		return 0xFF;
+	}
+	
+	merge = (opts->toFormat0 && smf.format != 2);
+	mps->oldRes = smf.division;
+	mps->newRes = smf.division;
+	if (opts->resolution && smf.division && ! (smf.division & 0x8000))
+		mps->newRes = opts->resolution;
+	mps->curTempo = 500000;	// default: 120 BPM
+	mps->trkCnt = merge ? 1 : smf.trkCnt;
+	mps->trks = (MIDPOST_TRK*)calloc(mps->trkCnt ? mps->trkCnt : 1, sizeof(MIDPOST_TRK));
+	if (mps->trks == NULL)
+	{
+		free(mps);
+		SMF_Close(&smf);
+		return 0xFF;
+	}
+	for (curTrk = 0; curTrk < smf.trkCnt; curTrk ++)
+	{
+		// start with the size of the source tracks, the buffers grow as needed
+		trk = &mps->trks[merge ? 0 : curTrk];
+		trk->alloc += smf.tracks[curTrk].endPos - smf.tracks[curTrk].startPos;
+	}
+	for (curTrk = 0; curTrk < mps->trkCnt; curTrk ++)
+	{
+		trk = &mps->trks[curTrk];
+		trk->alloc += 0x10;
+		trk->data = (UINT8*)malloc(trk->alloc);
+		if (trk->data == NULL)
+			mps->memError = 1;
+	}
+	
+	retVal = 0x00;
+	SMF_MergeStart(&smf);
+	while(! mps->memError && (retVal = SMF_ReadMergedEvent(&smf, &evt)) != 0x01)
+	{
+		if (retVal == 0xFF)
+		{
+			retVal = 0xFE;
+			break;
+		}
+		outTrk = merge ? 0 : evt.trkID;
+		tick = MidPost_ScaleTick(mps, evt.tick);
+		if (mps->tempoPend && mps->tempoTick != tick)
+			MidPost_FlushTempo(mps);
+		
+		if (evt.status == 0xFF)
+		{
+			if (evt.metaType == 0x2F)
+				continue;	// Track End is written after all events
+			if (merge && (evt.metaType == 0x20 || evt.metaType == 0x21))
+				continue;	// MIDI Channel Prefix/MIDI Port don't work with merged tracks
+			if (opts->tempoDedup && evt.metaType == 0x51 && evt.len == 0x03)
+			{
+				// a later tempo event on the same tick replaces this one
+				mps->tempoPend = 1;
+				mps->tempoTrk = outTrk;
+				mps->tempoTick = tick;
+				memcpy(mps->tempoData, evt.data, 0x03);
+				continue;
+			}
+		}
+		else if ((evt.status & 0xE0) == 0x80 && mps->newRes != mps->oldRes)
+		{
+			UINT8 chn = evt.status & 0x0F;
+			UINT8 note = evt.data[0x00] & 0x7F;
+			
+			if ((evt.status & 0xF0) == 0x90 && evt.data[0x01] > 0)
+			{
+				if (mps->offCnt)
+					MidPost_RetriggerNote(mps, chn, note, tick);
+				MidPost_WriteEvent(mps, outTrk, tick, evt.status, evt.metaType, evt.len, evt.data);
+				// use the tick the Note On was actually written at
+				mps->noteTick[chn][note] = mps->trks[outTrk].lastTick + 1;
+				mps->noteOrgTick[chn][note] = evt.tick;
+				continue;
+			}
+			
+			// keep notes that had a length in the source file
+			if (mps->noteTick[chn][note] == tick + 1 && mps->noteOrgTick[chn][note] < evt.tick &&
+				mps->offCnt < 0x10 * 0x80 && evt.len == 0x02)
+			{
+				MIDPOST_NOTEOFF* noff = &mps->offList[mps->offCnt ++];
+				
+				noff->trkID = outTrk;
+				noff->tick = tick + 1;
+				noff->status = evt.status;
+				memcpy(noff->data, evt.data, 0x02);
+				mps->noteTick[chn][note] = 0;
+				continue;
+			}
+			mps->noteTick[chn][note] = 0;
+		}
+		MidPost_WriteEvent(mps, outTrk, tick, evt.status, evt.metaType, evt.len, evt.data);
+	}
+	MidPost_FlushTempo(mps);
+	for (curTrk = 0; curTrk < mps->trkCnt; curTrk ++)
+		MidPost_FlushNoteOffs(mps, curTrk, (UINT32)-1);
+	if (retVal == 0x01)
+		retVal = 0x00;
+	if (mps->dlyError)
+		retVal = 0xFE;
+	if (mps->memError)
+		retVal = 0xFF;
+	
+	// write Track End events (at the end of the longest source track when merging)
+	for (curTrk = 0; curTrk < smf.trkCnt && ! retVal; curTrk ++)
+	{
+		trk = &mps->trks[merge ? 0 : curTrk];
+		tick = MidPost_ScaleTick(mps, smf.tracks[curTrk].tick);
+		if (trk->endTick < tick)
+			trk->endTick = tick;
+	}
+	for (curTrk = 0; curTrk < mps->trkCnt && ! retVal; curTrk ++)
+	{
+		trk = &mps->trks[curTrk];
+		MidPost_WriteEvent(mps, curTrk, trk->endTick, 0xFF, 0x2F, 0x00, NULL);
+	}
+	if (mps->dlyError)
+		retVal = 0xFE;
+	if (mps->memError)
+		retVal = 0xFF;
+	
+	fileData = NULL;
+	fileLen = 0x0E;
+	if (! retVal)
+	{
+		for (curTrk = 0; curTrk < mps->trkCnt; curTrk ++)
+			fileLen += 0x08 + mps->trks[curTrk].pos;
+		fileData = (UINT8*)malloc(fileLen);
+		if (fileData == NULL)
+			retVal = 0xFF;
+	}
+	if (! retVal)
+	{
+		UINT32 filePos;
+		UINT16 format = merge ? 0 : smf.format;
+		
+		memcpy(&fileData[0x00], "MThd", 0x04);
+		fileData[0x04] = 0x00;	fileData[0x05] = 0x00;
+		fileData[0x06] = 0x00;	fileData[0x07] = 0x06;
+		fileData[0x08] = (format >> 8) & 0xFF;			fileData[0x09] = (format >> 0) & 0xFF;
+		fileData[0x0A] = (mps->trkCnt >> 8) & 0xFF;		fileData[0x0B] = (mps->trkCnt >> 0) & 0xFF;
+		fileData[0x0C] = (mps->newRes >> 8) & 0xFF;		fileData[0x0D] = (mps->newRes >> 0) & 0xFF;
+		filePos = 0x0E;
+		for (curTrk = 0; curTrk < mps->trkCnt; curTrk ++)
+		{
+			trk = &mps->trks[curTrk];
+			memcpy(&fileData[filePos + 0x00], "MTrk", 0x04);
+			fileData[filePos + 0x04] = (trk->pos >> 24) & 0xFF;
+			fileData[filePos + 0x05] = (trk->pos >> 16) & 0xFF;
+			fileData[filePos + 0x06] = (trk->pos >>  8) & 0xFF;
+			fileData[filePos + 0x07] = (trk->pos >>  0) & 0xFF;
+			memcpy(&fileData[filePos + 0x08], trk->data, trk->pos);
+			filePos += 0x08 + trk->pos;
+		}
+		*outLen = fileLen;
+		*outData = fileData;
+	}
+	
+	for (curTrk = 0; curTrk < mps->trkCnt; curTrk ++)
+		free(mps->trks[curTrk].data);
+	free(mps->trks);
+	free(mps);
+	SMF_Close(&smf);
+	
+	return retVal;
+}
+
+#endif	// __MIDI_POST_H__
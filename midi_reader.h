@@ -0,0 +1,578 @@
+// MIDI File Reader
+// ----------------
+// to be included as header file
+//
+// Bounds-checked reader for Standard MIDI Files. Events are not copied - they point into the file data.
+//  UINT8 SMF_Open(SMF_FILE* smf, UINT32 dataLen, const UINT8* data);
+//      Parses the header and the track chunks and rewinds all tracks.
+//      Tracks whose length exceeds the file are clipped. (smf->truncated is set in that case)
+//      Returns 0x00 on success, 0x80 if it isn't a MIDI file, 0x81 if a track chunk is missing
+//      and 0xFF if memory allocation failed.
+//  UINT8 SMF_OpenTrack(SMF_FILE* smf, UINT32 dataLen, const UINT8* data);
+//      Sets up a file with a single track from the contents of an MTrk chunk. (without the chunk header)
+//      This allows reading large files chunk by chunk. Format and division are set to 0.
+//      Returns 0x00 on success and 0xFF if memory allocation failed.
+//  void SMF_Close(SMF_FILE* smf);
+//      Frees the track list and the tempo map.
+//  void SMF_RewindTrack(SMF_FILE* smf, UINT16 trkID);
+//      Restarts reading the track from its beginning.
+//  UINT8 SMF_ReadTrackEvent(SMF_FILE* smf, UINT16 trkID, SMF_EVENT* evt);
+//      Reads the next event of a track.
+//      Returns 0x00 if an event was read, 0x01 at the end of the track and 0xFF for invalid data.
+//      (evt->filePos contains the offset of the invalid event.)
+//  void SMF_MergeStart(SMF_FILE* smf);
+//      Rewinds all tracks and prepares reading them in merged order.
+//  UINT8 SMF_ReadMergedEvent(SMF_FILE* smf, SMF_EVENT* evt);
+//      Reads the next event of all tracks, sorted by tick. Events on the same tick are returned
+//      in track order. Return values are the same as for SMF_ReadTrackEvent.
+//  UINT8 SMF_BuildTempoMap(SMF_FILE* smf);
+//      Collects the Set Tempo events of all tracks. Afterwards, events have their absolute time
+//      in evt->time. (in microseconds, else it is 0)
+//      All tracks are rewound, so call SMF_MergeStart again for merged reading.
+//      Returns 0x00 on success, 0xFF if memory allocation failed.
+//  UINT64 SMF_Tick2Time(const SMF_FILE* smf, UINT32 tick);
+//      Converts an absolute tick into microseconds using the tempo map.
+//
+// The event status is always set, i.e. running status is expanded.
+// evt->data points to the data bytes of channel events, to the bytes after the length of
+// SysEx events (F0/F7) and to the bytes after the length of meta events (FF, type in evt->metaType).
+// A track ends after its last event or at the Track End meta event. (which is returned as well)
+
+#ifndef __MIDI_READER_H__
+#define __MIDI_READER_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include "stdtype.h"
+
+// All functions are INLINE, because most includers need only a part of the reader.
+#ifndef INLINE
+#if defined(_MSC_VER)
+#define INLINE	static __inline
+#elif defined(__GNUC__)
+#define INLINE	static __inline__
+#else
+#define INLINE	static inline
+#endif
+#endif	// INLINE
+
+typedef struct _smf_event
+{
+	UINT32 tick;	// absolute tick
+	UINT64 time;	// absolute time in microseconds (needs a tempo map)
+	UINT16 trkID;
+	UINT8 status;	// 80..EF = channel events, F0/F7 = SysEx, FF = meta event
+	UINT8 metaType;
+	UINT32 len;
+	const UINT8* data;
+	UINT32 filePos;	// offset of the event (after the delay)
+} SMF_EVENT;
+
+typedef struct _smf_track
+{
+	UINT32 startPos;	// position of the first delay (after the chunk header)
+	UINT32 endPos;
+	UINT32 curPos;	// position of the next event (after its delay)
+	UINT32 tick;	// tick of the next event or tick of the track's end, when it ended
+	UINT8 runStatus;
+	UINT8 ended;
+} SMF_TRACK;
+
+typedef struct _smf_tempo
+{
+	UINT32 tick;
+	UINT64 time;	// in microseconds
+	UINT32 tempo;	// microseconds per quarter
+} SMF_TEMPO;
+
+typedef struct _smf_file
+{
+	UINT32 dataLen;
+	const UINT8* data;
+	UINT16 format;
+	UINT16 trkCnt;
+	UINT16 division;	// ticks per quarter or SMPTE format (bit 15 set)
+	UINT8 truncated;
+	SMF_TRACK* tracks;
+	UINT16 heapSize;	// merged reading: heap of track IDs, sorted by the next event's tick
+	UINT16* heap;
+	UINT8 useTime;	// set by SMF_BuildTempoMap
+	UINT32 tempoCnt;
+	SMF_TEMPO* tempos;
+} SMF_FILE;
+
+
+INLINE UINT32 SMF_ReadBE32(const UINT8* data)
+{
+	return	((UINT32)data[0x00] << 24) | ((UINT32)data[0x01] << 16) |
+			((UINT32)data[0x02] <<  8) | ((UINT32)data[0x03] <<  0);
+}
+
+// Returns the number of bytes read or 0 if the value is incomplete or longer than 4 bytes.
+INLINE UINT32 SMF_ReadVarLen(const UINT8* data, UINT32 maxLen, UINT32* value)
+{
+	UINT32 curPos;
+	UINT32 val;
+	
+	if (maxLen > 0x04)
+		maxLen = 0x04;
+	val = 0x00;
+	for (curPos = 0x00; curPos < maxLen; curPos ++)
+	{
+		val = (val << 7) | (data[curPos] & 0x7F);
+		if (! (data[curPos] & 0x80))
+		{
+			*value = val;
+			return curPos + 0x01;
+		}
+	}
+	
+	return 0x00;
+}
+
+// reads the delay of the next event
+INLINE void SMF_TrackNextDelay(SMF_TRACK* trk, const UINT8* data)
+{
+	UINT32 delay;
+	UINT32 readLen;
+	
+	if (trk->curPos >= trk->endPos)
+	{
+		trk->ended = 1;
+		return;
+	}
+	readLen = SMF_ReadVarLen(&data[trk->curPos], trk->endPos - trk->curPos, &delay);
+	if (! readLen)
+	{
+		trk->curPos = trk->endPos;	// broken delay - treat as end of track
+		trk->ended = 1;
+		return;
+	}
+	trk->curPos += readLen;
+	trk->tick += delay;
+	if (trk->curPos >= trk->endPos)
+		trk->ended = 1;
+	
+	return;
+}
+
+INLINE void SMF_RewindTrack(SMF_FILE* smf, UINT16 trkID)
+{
+	SMF_TRACK* trk = &smf->tracks[trkID];
+	
+	trk->curPos = trk->startPos;
+	trk->tick = 0;
+	trk->runStatus = 0x00;
+	trk->ended = 0;
+	SMF_TrackNextDelay(trk, smf->data);
+	
+	return;
+}
+
+INLINE void SMF_Close(SMF_FILE* smf)
+{
+	free(smf->tracks);	smf->tracks = NULL;
+	free(smf->heap);	smf->heap = NULL;
+	free(smf->tempos);	smf->tempos = NULL;
+	smf->trkCnt = 0;
+	smf->heapSize = 0;
+	smf->useTime = 0;
+	smf->tempoCnt = 0;
+	
+	return;
+}
+
+INLINE UINT8 SMF_Open(SMF_FILE* smf, UINT32 dataLen, const UINT8* data)
+{
+	UINT32 curPos;
+	UINT32 chkLen;
+	UINT16 curTrk;
+	
+	smf->dataLen = dataLen;
+	smf->data = data;
+	smf->trkCnt = 0;
+	smf->tracks = NULL;
+	smf->heap = NULL;
+	smf->heapSize = 0;
+	smf->useTime = 0;
+	smf->tempoCnt = 0;
+	smf->tempos = NULL;
+	smf->truncated = 0;
+	
+	if (dataLen < 0x0E || memcmp(&data[0x00], "MThd", 0x04))
+		return 0x80;
+	chkLen = SMF_ReadBE32(&data[0x04]);
+	if (chkLen < 0x06 || chkLen > dataLen - 0x08)
+		return 0x80;
+	smf->format = (data[0x08] << 8) | (data[0x09] << 0);
+	smf->trkCnt = (data[0x0A] << 8) | (data[0x0B] << 0);
+	smf->division = (data[0x0C] << 8) | (data[0x0D] << 0);
+	
+	smf->tracks = (SMF_TRACK*)malloc((smf->trkCnt ? smf->trkCnt : 1) * sizeof(SMF_TRACK));
+	smf->heap = (UINT16*)malloc((smf->trkCnt ? smf->trkCnt : 1) * sizeof(UINT16));
+	if (smf->tracks == NULL || smf->heap == NULL)
+	{
+		SMF_Close(smf);
+		return 0xFF;
+	}
+	
+	curPos = 0x08 + chkLen;
+	for (curTrk = 0; curTrk < smf->trkCnt; curTrk ++)
+	{
+		// skip unknown chunks
+		while(curPos + 0x08 <= dataLen && memcmp(&data[curPos], "MTrk", 0x04))
+		{
+			chkLen = SMF_ReadBE32(&data[curPos + 0x04]);
+			if (chkLen > dataLen - (curPos + 0x08))
+				break;
+			curPos += 0x08 + chkLen;
+		}
+		if (curPos + 0x08 > dataLen || memcmp(&data[curPos], "MTrk", 0x04))
+		{
+			SMF_Close(smf);
+			return 0x81;
+		}
+		chkLen = SMF_ReadBE32(&data[curPos + 0x04]);
+		curPos += 0x08;
+		if (chkLen > dataLen - curPos)
+		{
+			chkLen = dataLen - curPos;
+			smf->truncated = 1;
+		}
+		smf->tracks[curTrk].startPos = curPos;
+		smf->tracks[curTrk].endPos = curPos + chkLen;
+		SMF_RewindTrack(smf, curTrk);
+		curPos += chkLen;
+	}
+	
+	return 0x00;
+}
+
+INLINE UINT8 SMF_OpenTrack(SMF_FILE* smf, UINT32 dataLen, const UINT8* data)
+{
+	smf->dataLen = dataLen;
+	smf->data = data;
+	smf->format = 0;
+	smf->trkCnt = 0;
+	smf->division = 0;
+	smf->truncated = 0;
+	smf->heapSize = 0;
+	smf->useTime = 0;
+	smf->tempoCnt = 0;
+	smf->tempos = NULL;
+	smf->tracks = (SMF_TRACK*)malloc(sizeof(SMF_TRACK));
+	smf->heap = (UINT16*)malloc(sizeof(UINT16));
+	if (smf->tracks == NULL || smf->heap == NULL)
+	{
+		SMF_Close(smf);
+		return 0xFF;
+	}
+	
+	smf->trkCnt = 1;
+	smf->tracks[0].startPos = 0x00;
+	smf->tracks[0].endPos = dataLen;
+	SMF_RewindTrack(smf, 0);
+	
+	return 0x00;
+}
+
+INLINE UINT64 SMF_Tick2Time(const SMF_FILE* smf, UINT32 tick)
+{
+	const SMF_TEMPO* tmp;
+	UINT32 idxMin;
+	UINT32 idxMax;
+	UINT32 idxMid;
+	UINT32 tempo;
+	UINT64 time;
+	
+	if (smf->division & 0x8000)
+	{
+		// SMPTE: frames per second (negative) * ticks per frame
+		UINT32 fps = 0x100 - (smf->division >> 8);
+		UINT32 tpf = smf->division & 0xFF;
+		if (fps == 29)
+			return (UINT64)tick * 1001000000 / (30000 * (tpf ? tpf : 1));	// 29.97 fps (drop frame)
+		return (UINT64)tick * 1000000 / (fps * (tpf ? tpf : 1));
+	}
+	
+	// find the last tempo event at or before "tick"
+	tmp = NULL;
+	idxMin = 0;
+	idxMax = smf->tempoCnt;
+	while(idxMin < idxMax)
+	{
+		idxMid = (idxMin + idxMax) / 2;
+		if (smf->tempos[idxMid].tick <= tick)
+			idxMin = idxMid + 1;
+		else
+			idxMax = idxMid;
+	}
+	if (idxMin > 0)
+		tmp = &smf->tempos[idxMin - 1];
+	
+	if (! smf->division)
+		return 0;
+	if (tmp == NULL)
+	{
+		tempo = 500000;	// default: 120 BPM
+		time = 0;
+	}
+	else
+	{
+		tempo = tmp->tempo;
+		time = tmp->time;
+		tick -= tmp->tick;
+	}
+	return time + (UINT64)tick * tempo / smf->division;
+}
+
+// Returns 0x00 if an event was read, 0x01 at the end of the track and 0xFF for invalid data.
+INLINE UINT8 SMF_ReadTrackEvent(SMF_FILE* smf, UINT16 trkID, SMF_EVENT* evt)
+{
+	SMF_TRACK* trk = &smf->tracks[trkID];
+	const UINT8* data = smf->data;
+	UINT32 evtPos;
+	UINT32 dataPos;
+	UINT32 readLen;
+	UINT32 evtLen;
+	UINT8 status;
+	
+	if (trk->ended)
+		return 0x01;
+	
+	evtPos = trk->curPos;
+	evt->trkID = trkID;
+	evt->tick = trk->tick;
+	evt->time = smf->useTime ? SMF_Tick2Time(smf, trk->tick) : 0;
+	evt->filePos = evtPos;
+	evt->metaType = 0x00;
+	
+	dataPos = evtPos;
+	if (data[dataPos] & 0x80)
+	{
+		status = data[dataPos];
+		dataPos ++;
+		if (status < 0xF0)
+			trk->runStatus = status;
+	}
+	else
+	{
+		status = trk->runStatus;
+		if (! status)
+			goto invalid_event;
+	}
+	evt->status = status;
+	
+	switch(status & 0xF0)
+	{
+	case 0x80:
+	case 0x90:
+	case 0xA0:
+	case 0xB0:
+	case 0xE0:
+		evtLen = 0x02;
+		break;
+	case 0xC0:
+	case 0xD0:
+		evtLen = 0x01;
+		break;
+	default:	// F0..FF
+		if (status == 0xFF)
+		{
+			if (dataPos >= trk->endPos)
+				goto invalid_event;
+			evt->metaType = data[dataPos];
+			dataPos ++;
+		}
+		else if (status != 0xF0 && status != 0xF7)
+		{
+			goto invalid_event;	// F1 .. FE are not allowed in MIDI files
+		}
+		if (dataPos >= trk->endPos)
+			goto invalid_event;
+		readLen = SMF_ReadVarLen(&data[dataPos], trk->endPos - dataPos, &evtLen);
+		if (! readLen)
+			goto invalid_event;
+		dataPos += readLen;
+		break;
+	}
+	if (evtLen > trk->endPos - dataPos || dataPos > trk->endPos)
+		goto invalid_event;
+	evt->len = evtLen;
+	evt->data = &data[dataPos];
+	trk->curPos = dataPos + evtLen;
+	
+	if (status == 0xFF && evt->metaType == 0x2F)
+	{
+		trk->curPos = trk->endPos;
+		trk->ended = 1;
+		return 0x00;
+	}
+	SMF_TrackNextDelay(trk, data);
+	return 0x00;
+	
+invalid_event:
+	trk->curPos = trk->endPos;
+	trk->ended = 1;
+	return 0xFF;
+}
+
+INLINE UINT8 SMF_HeapLess(const SMF_FILE* smf, UINT16 trkA, UINT16 trkB)
+{
+	if (smf->tracks[trkA].tick != smf->tracks[trkB].tick)
+		return (smf->tracks[trkA].tick < smf->tracks[trkB].tick);
+	return (trkA < trkB);
+}
+
+INLINE void SMF_HeapSiftDown(SMF_FILE* smf, UINT16 heapIdx)
+{
+	UINT16* heap = smf->heap;
+	UINT32 childIdx;
+	UINT16 tempID;
+	
+	while(1)
+	{
+		childIdx = heapIdx * 2 + 1;
+		if (childIdx >= smf->heapSize)
+			break;
+		if (childIdx + 1 < smf->heapSize && SMF_HeapLess(smf, heap[childIdx + 1], heap[childIdx]))
+			childIdx ++;
+		if (! SMF_HeapLess(smf, heap[childIdx], heap[heapIdx]))
+			break;
+		
+		tempID = heap[heapIdx];
+		heap[heapIdx] = heap[childIdx];
+		heap[childIdx] = tempID;
+		heapIdx = (UINT16)childIdx;
+	}
+	
+	return;
+}
+
+INLINE void SMF_MergeStart(SMF_FILE* smf)
+{
+	UINT16 curTrk;
+	
+	smf->heapSize = 0;
+	for (curTrk = 0; curTrk < smf->trkCnt; curTrk ++)
+	{
+		SMF_RewindTrack(smf, curTrk);
+		if (! smf->tracks[curTrk].ended)
+		{
+			smf->heap[smf->heapSize] = curTrk;
+			smf->heapSize ++;
+		}
+	}
+	for (curTrk = smf->heapSize / 2; curTrk > 0; curTrk --)
+		SMF_HeapSiftDown(smf, curTrk - 1);
+	
+	return;
+}
+
+INLINE UINT8 SMF_ReadMergedEvent(SMF_FILE* smf, SMF_EVENT* evt)
+{
+	UINT16 trkID;
+	UINT8 retVal;
+	
+	if (! smf->heapSize)
+		return 0x01;
+	
+	trkID = smf->heap[0];
+	retVal = SMF_ReadTrackEvent(smf, trkID, evt);
+	if (smf->tracks[trkID].ended)
+	{
+		smf->heapSize --;
+		smf->heap[0] = smf->heap[smf->heapSize];
+	}
+	else if (smf->tracks[trkID].tick == evt->tick)
+	{
+		return retVal;	// more events on the same tick - the track stays first
+	}
+	SMF_HeapSiftDown(smf, 0);
+	
+	return retVal;
+}
+
+INLINE UINT8 SMF_BuildTempoMap(SMF_FILE* smf)
+{
+	SMF_EVENT evt;
+	UINT32 tmpAlloc;
+	UINT32 tmpCnt;
+	SMF_TEMPO* tmpList;
+	SMF_TEMPO* newList;
+	UINT32 insIdx;
+	UINT32 curIdx;
+	UINT16 curTrk;
+	UINT8 retVal;
+	
+	free(smf->tempos);
+	smf->tempos = NULL;
+	smf->tempoCnt = 0;
+	smf->useTime = 0;
+	
+	tmpAlloc = 0x10;
+	tmpCnt = 0;
+	tmpList = (SMF_TEMPO*)malloc(tmpAlloc * sizeof(SMF_TEMPO));
+	if (tmpList == NULL)
+		return 0xFF;
+	
+	// Scanning the tracks one by one is faster than merging them.
+	// The tempo events are inserted sorted by tick. On the same tick, later tracks win, like in merged order.
+	for (curTrk = 0; curTrk < smf->trkCnt; curTrk ++)
+	{
+		SMF_RewindTrack(smf, curTrk);
+		while((retVal = SMF_ReadTrackEvent(smf, curTrk, &evt)) != 0x01)
+		{
+			if (retVal || evt.status != 0xFF || evt.metaType != 0x51 || evt.len < 0x03)
+				continue;
+			
+			if (tmpCnt >= tmpAlloc)
+			{
+				tmpAlloc *= 2;
+				newList = (SMF_TEMPO*)realloc(tmpList, tmpAlloc * sizeof(SMF_TEMPO));
+				if (newList == NULL)
+				{
+					free(tmpList);
+					return 0xFF;
+				}
+				tmpList = newList;
+			}
+			for (insIdx = tmpCnt; insIdx > 0; insIdx --)
+			{
+				if (tmpList[insIdx - 1].tick <= evt.tick)
+					break;
+			}
+			for (curIdx = tmpCnt; curIdx > insIdx; curIdx --)
+				tmpList[curIdx] = tmpList[curIdx - 1];
+			tmpList[insIdx].tick = evt.tick;
+			tmpList[insIdx].tempo = (evt.data[0x00] << 16) | (evt.data[0x01] << 8) | (evt.data[0x02] << 0);
+			tmpCnt ++;
+		}
+		SMF_RewindTrack(smf, curTrk);
+	}
+	
+	// calculate the absolute time of each tempo change
+	for (curIdx = 0; curIdx < tmpCnt; curIdx ++)
+	{
+		if (! curIdx)
+			tmpList[curIdx].time = (UINT64)tmpList[curIdx].tick * 500000;	// default: 120 BPM
+		else
+			tmpList[curIdx].time = tmpList[curIdx - 1].time +
+				(UINT64)(tmpList[curIdx].tick - tmpList[curIdx - 1].tick) * tmpList[curIdx - 1].tempo;
+	}
+	for (curIdx = 0; curIdx < tmpCnt; curIdx ++)
+	{
+		if (smf->division && ! (smf->division & 0x8000))
+			tmpList[curIdx].time /= smf->division;
+		else
+			tmpList[curIdx].time = 0;
+	}
+	
+	smf->tempoCnt = tmpCnt;
+	smf->tempos = tmpList;
+	smf->useTime = 1;
+	
+	return 0x00;
+}
+
+#endif	// __MIDI_READER_H__
@@ -191,7 +191,7 @@ static UINT16 BalanceTrackTimes(UINT16 trkCnt, TRK_INF* trkInf, UINT32 minLoopTi
 	{
 		tInf = &trkInf[curTrk];
 		loopTicks = tInf->loopTimes ? (tInf->tickCnt - tInf->loopTick) : 0;
-		if (loopTicks < minLoopTicks)
+		if (loopTicks == 0 || loopTicks < minLoopTicks)
 		{
 			if (loopTicks > 0 && (verbose & 0x02))
 				printf("Trk %u: ignoring micro-loop (%u ticks)\n", curTrk, loopTicks);
@@ -96,6 +96,8 @@ typedef struct _track_info
 #define RUNNING_NOTES
 #define BALANCE_TRACK_TIMES
 #include "midi_utils.h"
+#include "midi_post.h"
+#include "seq_guard.h"
 
 
 UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData);
@@ -104,11 +106,13 @@ static UINT8 CacheSysExData(UINT16 sxBufSize, UINT8* sxBuf, UINT8* sxBufPos, UIN
 							FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 curCmd, UINT8 curTrk, UINT16 cmdPos);
 static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* trkInf, UINT8 Mode);
 static void PreparseMsDrvTrack_v1(UINT32 SongLen, const UINT8* SongData, TRK_INF* trkInf, UINT8 fileVer, UINT8 Mode);
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT16* loopCount, UINT32 subEndOfs, UINT32 subRetOfs, UINT8 trkFlags);
 static void WritePitchBend(FILE_INF* fInf, MID_TRK_STATE* MTS, INT16 bend);
 static UINT8 NeedPBRangeFix(UINT8* curPBRange, INT16 PBend);
 static UINT8 MidiDelayHandler(FILE_INF* fInf, UINT32* delay);
 
 static UINT8 WriteFileData(UINT32 DataLen, const UINT8* Data, const char* FileName);
+static UINT8 PostProcessMidi(void);
 static double OPN2DB(UINT8 TL);
 static UINT8 DB2Mid(double DB);
 static UINT8 PanBits2MidiPan(UINT8 Pan);
@@ -152,6 +156,7 @@ static UINT8 FixVolume = 0;
 static UINT8 DebugCtrls = 0;
 static UINT8 forcedFileVer = 0xFF;
 static UINT8 DEFAULT_FM_MODE = 0;
+static MIDPOST_OPTS PostOpts;
 
 static UINT8 tempoChgTrk = 0xFF;
 static UINT32 tempoChgTick = 0;
@@ -175,6 +180,9 @@ int main(int argc, char* argv[])
 		printf("    -VolFix     OPN/OPL: convert db levels to logarithmic MIDI\n");
 		printf("    -ForceVer x enforce a file format version x (can be: v1a, v1c, v2, v4, v4l)\n");
 		printf("    -FM         MsDRV v1: assume FM/SSG channels (defaults to MIDI)\n");
+		printf("    -SMF0       merge all tracks into a single track (MIDI format 0)\n");
+		printf("    -OutRes n   rescale the MIDI to n ticks per quarter\n");
+		printf("    -TempoDedup remove redundant tempo events\n");
 		printf("\n");
 		printf("Supported/verified games: \n");
 		printf("    MsDRV v1: Sweet Emotion, Mirage, Kagami - Mirror\n");
@@ -233,6 +241,16 @@ int main(int argc, char* argv[])
 		}
 		else if (! stricmp(argv[argbase] + 1, "FM"))
 			DEFAULT_FM_MODE = 1;
+		else if (! stricmp(argv[argbase] + 1, "SMF0"))
+			PostOpts.toFormat0 = 1;
+		else if (! stricmp(argv[argbase] + 1, "OutRes"))
+		{
+			argbase ++;
+			if (argbase < argc)
+				PostOpts.resolution = (UINT16)strtoul(argv[argbase], NULL, 0);
+		}
+		else if (! stricmp(argv[argbase] + 1, "TempoDedup"))
+			PostOpts.tempoDedup = 1;
 		else
 			break;
 		argbase ++;
@@ -256,12 +274,17 @@ int main(int argc, char* argv[])
 		ROMLen = 0x10000;
 	
 	fseek(hFile, 0x00, SEEK_SET);
-	ROMData = (UINT8*)malloc(ROMLen);
-	fread(ROMData, 0x01, ROMLen, hFile);
+	// The padding covers the track pointer table of small files and
+	// prevents commands at the end of the data from reading beyond the buffer.
+	ROMData = (UINT8*)malloc(ROMLen + 0x100);
+	ROMLen = fread(ROMData, 0x01, ROMLen, hFile);
+	memset(&ROMData[ROMLen], 0x00, 0x100);
 	
 	fclose(hFile);
 	
 	retVal = MsDrv2Mid(ROMLen, ROMData);
+	if (! retVal)
+		retVal = PostProcessMidi();
 	if (! retVal)
 		WriteFileData(MidLen, MidData, argv[argbase + 1]);
 	free(MidData);	MidData = NULL;
@@ -303,6 +326,8 @@ UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData)
 	UINT8 loopIdx;
 	UINT16 loopCount[8];
 	UINT32 loopPos[8];
+	SEQ_GUARD seqGuard;
+	UINT8 grdRes;
 	
 	UINT32 tempLng;
 	UINT16 tempSht;
@@ -462,11 +487,18 @@ UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData)
 		if (fileVer == FILEVER_V2)
 			trkFlags |= 0x02;	// default to 3-byte note mode
 		lastNote = 48;
+		SeqGuard_Init(&seqGuard);
 		
 		trkTick = MTS.curDly;
 		while(! (trkFlags & 0x80) && inPos < SongLen)
 		{
 			UINT8 evtDly = 0;
+			grdRes = SeqGuard_Step(&seqGuard, trkTick, midFileInf.pos - MTS.trkBase);
+			if (grdRes)
+			{
+				printf("Warning Track %u: %s at 0x%04X - track cut!\n", curTrk, SeqGuard_Reason(grdRes), inPos);
+				break;
+			}
 			if (pSldDelta != 0)
 			{
 				// handle pitch slides
@@ -613,6 +645,13 @@ UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData)
 						subRetOfs = inPos;
 						inPos = tempTInf->startOfs + startPos;
 						subEndOfs = tempTInf->startOfs + endPos;
+						grdRes = SeqGuard_Jump(&seqGuard, inPos,
+									GetLoopState(loopIdx, loopCount, subEndOfs, subRetOfs, trkFlags));
+						if (grdRes)
+						{
+							printf("Warning Track %u: %s at 0x%04X - track cut!\n", curTrk, SeqGuard_Reason(grdRes), inPos);
+							trkFlags |= 0x80;
+						}
 						// In MsDRV v4, it works like this:
 						//  - enable "subroutine mode" + save old offset
 						//  - jump to subroutine offset
@@ -634,6 +673,13 @@ UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData)
 							trkFlags |= 0x80;
 						}
 						inPos += tempSSht;
+						grdRes = SeqGuard_Jump(&seqGuard, inPos,
+									GetLoopState(loopIdx, loopCount, subEndOfs, subRetOfs, trkFlags));
+						if (grdRes)
+						{
+							printf("Warning Track %u: %s at 0x%04X - track cut!\n", curTrk, SeqGuard_Reason(grdRes), inPos);
+							trkFlags |= 0x80;
+						}
 					}
 					else	// Subroutine Return
 					{
@@ -739,6 +785,13 @@ UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData)
 						// loop back
 						inPos = loopPos[loopIdx];
 						loopIdx ++;
+						grdRes = SeqGuard_Jump(&seqGuard, inPos,
+									GetLoopState(loopIdx, loopCount, subEndOfs, subRetOfs, trkFlags));
+						if (grdRes)
+						{
+							printf("Warning Track %u: %s at 0x%04X - track cut!\n", curTrk, SeqGuard_Reason(grdRes), inPos);
+							trkFlags |= 0x80;
+						}
 					}
 					else
 					{
@@ -750,6 +803,11 @@ UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData)
 					if (inPos == tempTInf->loopOfs)
 						WriteEvent(&midFileInf, &MTS, 0xB0, 0x6F, 0);
 					inPos += 0x01;
+					if (loopIdx >= 8)
+					{
+						printf("Error Track %u: Trying to do more than 8 nested loops at 0x%04X!\n", curTrk, inPos - 0x01);
+						break;
+					}
 					loopPos[loopIdx] = inPos;
 					loopCount[loopIdx] = 0;
 					loopIdx ++;
@@ -930,6 +988,8 @@ UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData)
 					break;
 				case 0xC5:	// send multiple bytes of SysEx data
 					tempSht = ReadLE16(&SongData[inPos + 0x01]);
+					if (inPos + 0x03 + tempSht > SongLen)	// data exceeds the file
+						tempSht = (inPos + 0x03 < SongLen) ? (UINT16)(SongLen - (inPos + 0x03)) : 0;
 					for (syxPos = 0x00; syxPos < tempSht; syxPos ++)
 					{
 						tempByt = SongData[inPos + 0x03 + syxPos];
@@ -1132,6 +1192,7 @@ UINT8 MsDrv2Mid(UINT32 SongLen, const UINT8* SongData)
 			if (fileVer == FILEVER_V4)
 				inPos = (inPos + 0x03) & ~0x03;	// 4-byte padding
 		}
+		SeqGuard_Free(&seqGuard);
 		if (inPos >= SongLen && ! (trkFlags & 0x80))
 			printf("Warning: Reached EOF early on track %u!\n", curTrk);
 		FlushRunningNotes(&midFileInf, &MTS.curDly, &RunNoteCnt, RunNotes, 0);
@@ -1167,6 +1228,8 @@ UINT8 MsDrv2Mid_v1(UINT32 SongLen, const UINT8* SongData)
 	UINT8 loopIdx;
 	UINT16 loopCount[8];
 	UINT32 loopPos[8];
+	SEQ_GUARD seqGuard;
+	UINT8 grdRes;
 	
 	UINT32 tempLng;
 	UINT16 tempSht;
@@ -1300,11 +1363,18 @@ UINT8 MsDrv2Mid_v1(UINT32 SongLen, const UINT8* SongData)
 		curNoteLen = 48;
 		noteLenMod = 8;
 		tieFlag = 0x00;
+		SeqGuard_Init(&seqGuard);
 		
 		trkTick = MTS.curDly;
 		while(! (trkFlags & 0x80) && inPos < SongLen)
 		{
 			UINT8 evtDly = 0;
+			grdRes = SeqGuard_Step(&seqGuard, trkTick, midFileInf.pos - MTS.trkBase);
+			if (grdRes)
+			{
+				printf("Warning Track %u: %s at 0x%04X - track cut!\n", curTrk, SeqGuard_Reason(grdRes), inPos);
+				break;
+			}
 			
 			curCmd = SongData[inPos];
 			if (curCmd >= 0x01 && curCmd <= 0x0D)
@@ -1401,6 +1471,12 @@ UINT8 MsDrv2Mid_v1(UINT32 SongLen, const UINT8* SongData)
 							trkFlags |= 0x80;
 						}
 						inPos = tempSht;
+						grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCount, 0, 0, trkFlags));
+						if (grdRes)
+						{
+							printf("Warning Track %u: %s at 0x%04X - track cut!\n", curTrk, SeqGuard_Reason(grdRes), inPos);
+							trkFlags |= 0x80;
+						}
 					}
 					break;
 				case 0x85:	// set Volume
@@ -1520,6 +1596,12 @@ UINT8 MsDrv2Mid_v1(UINT32 SongLen, const UINT8* SongData)
 						// loop back
 						inPos = loopPos[loopIdx];
 						loopIdx ++;
+						grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCount, 0, 0, trkFlags));
+						if (grdRes)
+						{
+							printf("Warning Track %u: %s at 0x%04X - track cut!\n", curTrk, SeqGuard_Reason(grdRes), inPos);
+							trkFlags |= 0x80;
+						}
 					}
 					else
 					{
@@ -1531,6 +1613,11 @@ UINT8 MsDrv2Mid_v1(UINT32 SongLen, const UINT8* SongData)
 					if (inPos == tempTInf->loopOfs)
 						WriteEvent(&midFileInf, &MTS, 0xB0, 0x6F, 0);
 					inPos += 0x01;
+					if (loopIdx >= 8)
+					{
+						printf("Error Track %u: Trying to do more than 8 nested loops at 0x%04X!\n", curTrk, inPos - 0x01);
+						break;
+					}
 					loopPos[loopIdx] = inPos;
 					loopCount[loopIdx] = 0;
 					loopIdx ++;
@@ -1561,6 +1648,7 @@ UINT8 MsDrv2Mid_v1(UINT32 SongLen, const UINT8* SongData)
 			MTS.curDly += evtDly;
 			trkTick += evtDly;
 		}
+		SeqGuard_Free(&seqGuard);
 		if (lastNote != 0xFF)
 			WriteEvent(&midFileInf, &MTS, 0x90, lastNote, 0x00);
 		if (inPos >= SongLen && ! (trkFlags & 0x80))
@@ -1605,7 +1693,7 @@ static UINT8 CacheSysExData(UINT16 sxBufSize, UINT8* sxBuffer, UINT8* sxBufPos,
 	{
 		printf("Event %02X Warning: buffer overflow! (track %u at %04X)\n",
 				curCmd, curTrk, cmdPos);
-		*sxBufPos --;
+		(*sxBufPos) --;
 	}
 	sxBuffer[*sxBufPos] = data;
 	(*sxBufPos) ++;
@@ -1626,13 +1714,15 @@ static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* t
 	UINT32 inPos;
 	UINT8 curCmd;
 	UINT8 trkFlags;
+	UINT8 trkEnd;
 	
 	UINT32 subEndOfs;
 	UINT32 subRetOfs;
 	
 	UINT8 loopIdx;
-	UINT8 loopCount[8];
+	UINT16 loopCount[8];
 	UINT32 loopPos[8];
+	SEQ_GUARD seqGuard;
 	
 	inPos = trkInf->startOfs;
 	if (! Mode)
@@ -1644,8 +1734,13 @@ static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* t
 	subRetOfs = 0x00;
 	if (fileVer == FILEVER_V2)
 		trkFlags |= 0x02;	// default to 3-byte note mode
-	while(inPos < SongLen)
+	trkEnd = 0;
+	SeqGuard_Init(&seqGuard);
+	while(inPos < SongLen && ! trkEnd)
 	{
+		// The conversion will hit the same limit and print the warning.
+		if (SeqGuard_Step(&seqGuard, Mode ? trkInf->loopTick : trkInf->tickCnt, 0))
+			break;
 		if (subEndOfs && inPos >= subEndOfs)
 		{
 			subEndOfs = 0x00;
@@ -1653,7 +1748,7 @@ static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* t
 		}
 		
 		if (Mode && inPos == trkInf->loopOfs)
-			return;
+			break;
 		
 		curCmd = SongData[inPos];
 		if (curCmd < 0x80)
@@ -1695,13 +1790,16 @@ static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* t
 				if (! SongData[inPos + 0x01] || SongData[inPos + 0x01] >= 0xF0)	// infinite loop
 				{
 					trkInf->loopOfs = loopPos[loopIdx] - 0x01;
-					return;
+					trkEnd = 1;
+					break;
 				}
 				if (loopCount[loopIdx] < SongData[inPos + 0x01])
 				{
 					// loop back
 					inPos = loopPos[loopIdx];
 					loopIdx ++;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCount, subEndOfs, subRetOfs, trkFlags)))
+						trkEnd = 1;
 				}
 				else
 				{
@@ -1711,6 +1809,8 @@ static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* t
 				break;
 			case 0x9C:	// Loop Start
 				inPos += 0x01;
+				if (loopIdx >= 8)
+					break;
 				loopPos[loopIdx] = inPos;
 				loopCount[loopIdx] = 0;
 				loopIdx ++;
@@ -1733,6 +1833,8 @@ static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* t
 					subRetOfs = inPos;
 					inPos = trkInf->startOfs + startPos;
 					subEndOfs = trkInf->startOfs + endPos;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCount, subEndOfs, subRetOfs, trkFlags)))
+						trkEnd = 1;
 				}
 				break;
 			case 0x84:	// Return / GoTo
@@ -1740,12 +1842,17 @@ static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* t
 				{
 					INT16 jumpPos = (INT16)ReadLE16(&SongData[inPos + 0x01]);
 					if (jumpPos < 0)
-						return;
+					{
+						trkEnd = 1;
+						break;
+					}
 					inPos += jumpPos;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCount, subEndOfs, subRetOfs, trkFlags)))
+						trkEnd = 1;
 				}
 				else	// Subroutine Return
 				{
-					return;
+					trkEnd = 1;
 				}
 				break;
 			case 0x8B:	// switch note format (3/4 bytes)
@@ -1841,12 +1948,14 @@ static void PreparseMsDrvTrack(UINT32 SongLen, const UINT8* SongData, TRK_INF* t
 			case 0xFF:	// Song End
 			default:
 				inPos += 0x01;
-				return;
+				trkEnd = 1;
+				break;
 			}
 		}
 		if (fileVer == FILEVER_V4)
 			inPos = (inPos + 0x03) & ~0x03;	// 4-byte padding
 	}
+	SeqGuard_Free(&seqGuard);
 	
 	return;
 }
@@ -1858,12 +1967,14 @@ static void PreparseMsDrvTrack_v1(UINT32 SongLen, const UINT8* SongData, TRK_INF
 	UINT32 inPos;
 	UINT8 curCmd;
 	UINT8 curNoteLen;
+	UINT8 trkEnd;
 	
 	UINT16 tempSht;
 	
 	UINT8 loopIdx;
-	UINT8 loopCount[8];
+	UINT16 loopCount[8];
 	UINT32 loopPos[8];
+	SEQ_GUARD seqGuard;
 	
 	inPos = trkInf->startOfs;
 	if (! Mode)
@@ -1871,10 +1982,15 @@ static void PreparseMsDrvTrack_v1(UINT32 SongLen, const UINT8* SongData, TRK_INF
 	
 	curNoteLen = 48;
 	loopIdx = 0;
-	while(inPos < SongLen)
+	trkEnd = 0;
+	SeqGuard_Init(&seqGuard);
+	while(inPos < SongLen && ! trkEnd)
 	{
+		// The conversion will hit the same limit and print the warning.
+		if (SeqGuard_Step(&seqGuard, Mode ? trkInf->loopTick : trkInf->tickCnt, 0))
+			break;
 		if (Mode && inPos == trkInf->loopOfs)
-			return;
+			break;
 		
 		curCmd = SongData[inPos];
 		if (curCmd >= 0x01 && curCmd <= 0x0D)
@@ -1901,8 +2017,13 @@ static void PreparseMsDrvTrack_v1(UINT32 SongLen, const UINT8* SongData, TRK_INF
 				{
 					tempSht = ReadLE16(&SongData[inPos + 0x01]);
 					if (tempSht < inPos)
-						return;
+					{
+						trkEnd = 1;
+						break;
+					}
 					inPos = tempSht;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCount, 0, 0, 0x00)))
+						trkEnd = 1;
 				}
 				break;
 			case 0x8A:	// Tempo in BPM
@@ -1919,7 +2040,8 @@ static void PreparseMsDrvTrack_v1(UINT32 SongLen, const UINT8* SongData, TRK_INF
 				inPos += 0x02;
 				break;
 			case 0x9A:	// Return
-				return;	// invalid for sequences
+				trkEnd = 1;	// invalid for sequences
+				break;
 			case 0x9B:	// Loop End
 				if (! loopIdx)
 				{
@@ -1931,13 +2053,16 @@ static void PreparseMsDrvTrack_v1(UINT32 SongLen, const UINT8* SongData, TRK_INF
 				if (! SongData[inPos + 0x01] || SongData[inPos + 0x01] >= 0xF0)	// infinite loop
 				{
 					trkInf->loopOfs = loopPos[loopIdx] - 0x01;
-					return;
+					trkEnd = 1;
+					break;
 				}
 				if (loopCount[loopIdx] < SongData[inPos + 0x01])
 				{
 					// loop back
 					inPos = loopPos[loopIdx];
 					loopIdx ++;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCount, 0, 0, 0x00)))
+						trkEnd = 1;
 				}
 				else
 				{
@@ -1947,6 +2072,8 @@ static void PreparseMsDrvTrack_v1(UINT32 SongLen, const UINT8* SongData, TRK_INF
 				break;
 			case 0x9C:	// Loop Start
 				inPos += 0x01;
+				if (loopIdx >= 8)
+					break;
 				loopPos[loopIdx] = inPos;
 				loopCount[loopIdx] = 0;
 				loopIdx ++;
@@ -1980,14 +2107,31 @@ static void PreparseMsDrvTrack_v1(UINT32 SongLen, const UINT8* SongData, TRK_INF
 			case 0xFF:	// Song End
 			default:
 				inPos += 0x01;
-				return;
+				trkEnd = 1;
+				break;
 			}
 		}
 	}
+	SeqGuard_Free(&seqGuard);
 	
 	return;
 }
 
+// Hashes everything that decides where the track goes after a jump.
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT16* loopCount, UINT32 subEndOfs, UINT32 subRetOfs, UINT8 trkFlags)
+{
+	UINT64 state;
+	UINT8 curLvl;
+	
+	state = SeqGuard_Hash(0, subEndOfs);
+	state = SeqGuard_Hash(state, subRetOfs);
+	state = SeqGuard_Hash(state, trkFlags);
+	state = SeqGuard_Hash(state, loopIdx);
+	for (curLvl = 0; curLvl < loopIdx; curLvl ++)
+		state = SeqGuard_Hash(state, loopCount[curLvl]);
+	return state;
+}
+
 static void WritePitchBend(FILE_INF* fInf, MID_TRK_STATE* MTS, INT16 bend)
 {
 	UINT16 bendVal;
@@ -2052,6 +2196,29 @@ static UINT8 WriteFileData(UINT32 DataLen, const UINT8* Data, const char* FileNa
 	return 0;
 }
 
+static UINT8 PostProcessMidi(void)
+{
+	UINT32 newLen;
+	UINT8* newData;
+	UINT8 retVal;
+	
+	if (! MidPost_IsActive(&PostOpts))
+		return 0x00;
+	newLen = 0x00;
+	newData = NULL;
+	retVal = MidPost_Process(&PostOpts, MidLen, MidData, &newLen, &newData);
+	if (retVal)
+	{
+		printf("MIDI post-processing failed! (error 0x%02X)\n", retVal);
+		return retVal;
+	}
+	free(MidData);
+	MidData = newData;
+	MidLen = newLen;
+	
+	return 0x00;
+}
+
 static double OPN2DB(UINT8 TL)
 {
 	return -(TL * 3 / 4.0f);
@@ -2093,6 +2260,8 @@ INLINE UINT32 Tempo2Mid(UINT16 bpm, UINT8 scale)
 {
 	// formula: 60 000 000 / (bpm * (scale / 64.0))
 	UINT32 div = bpm * scale;
+	if (! div)
+		return 500000;	// tempo 0 would be infinite - use the MIDI default (120 BPM)
 	return 60000000U * 64U / div;
 }
 
@@ -2104,6 +2273,6 @@ INLINE UINT16 ReadLE16(const UINT8* Data)
 
 INLINE UINT32 ReadLE32(const UINT8* Data)
 {
-	return	(Data[0x03] << 24) | (Data[0x02] << 16) |
+	return	((UINT32)Data[0x03] << 24) | (Data[0x02] << 16) |
 			(Data[0x01] <<  8) | (Data[0x00] <<  0);
 }
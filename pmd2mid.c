@@ -22,7 +22,9 @@
 #endif	// INLINE
 
 
+#include "conv_stats.h"
 #include "midi_funcs.h"
+#include "seq_guard.h"
 
 
 UINT8 PMD2Mid(UINT8 fileVer, UINT16 songLen, UINT8* songData);
@@ -98,6 +100,7 @@ static UINT16 MIDI_RES = 24;
 static UINT16 NUM_LOOPS = 2;
 static UINT8 VOL_MODE = 0;	// 0  - Controller: Main Volume, 1 - Note Velocity
 static double VOL_BOOST = 6.0;
+static UINT8 STATS_MODE = STATS_OFF;
 
 int main(int argc, char* argv[])
 {
@@ -108,7 +111,9 @@ int main(int argc, char* argv[])
 	if (argc < 3)
 	{
 		printf("Usage: pmd2mid.exe Options input.bin output.mid\n");
-		printf("Options: [none current]\n");
+		printf("Options: (letters, e.g. VS)\n");
+		printf("    V   use note velocity for volume\n");
+		printf("    S   print profiling statistics (J: as JSON, requires compiling with CONV_STATS)\n");
 		return 0;
 	}
 	
@@ -122,9 +127,16 @@ int main(int argc, char* argv[])
 		case 'V':
 			VOL_MODE = 1;
 			break;
+		case 'S':
+			STATS_MODE = STATS_TEXT;
+			break;
+		case 'J':
+			STATS_MODE = STATS_JSON;
+			break;
 		}
 		StrPtr ++;
 	}
+	STATS_ENABLE(STATS_MODE);
 	
 	hFile = fopen(argv[2], "rb");
 	if (hFile == NULL)
@@ -139,7 +151,9 @@ int main(int argc, char* argv[])
 		ROMLen = 0xFFFF;
 	
 	fseek(hFile, 0x00, SEEK_SET);
-	ROMData = (UINT8*)malloc(ROMLen);
+	// The sequence uses 16-bit offsets and writes loop counters into the song data,
+	// so allocate the full 64 KB range to keep runaway tracks inside the buffer.
+	ROMData = (UINT8*)calloc(0x10000 + 0x10, 1);
 	fread(ROMData, 0x01, ROMLen, hFile);
 	
 	fclose(hFile);
@@ -149,6 +163,7 @@ int main(int argc, char* argv[])
 	free(MidData);	MidData = NULL;
 	
 	printf("Done.\n");
+	STATS_PRINT(STATS_MODE);
 	
 	free(ROMData);	ROMData = NULL;
 	
@@ -200,6 +215,9 @@ UINT8 PMD2Mid(UINT8 fileVer, UINT16 songLen, UINT8* songData)
 	UINT8 curDly;
 	UINT8 lastNote;
 	UINT8 didInitCmds;
+	SEQ_GUARD seqGuard;
+	UINT8 grdRes;
+	UINT32 curTick;
 	
 	if (fileVer >= 0x10)
 		return 0x80;	// invalid file version
@@ -219,6 +237,7 @@ UINT8 PMD2Mid(UINT8 fileVer, UINT16 songLen, UINT8* songData)
 	if (trkInf[0].dataOfs != 0x001A)
 		return 0x81;	// invalid header size
 	
+	STATS_PHASE_BEGIN(STATS_CONVERT);
 	midFileInf.alloc = 0x20000;	// 128 KB should be enough
 	midFileInf.data = (UINT8*)malloc(midFileInf.alloc);
 	midFileInf.pos = 0x00;
@@ -326,9 +345,19 @@ UINT8 PMD2Mid(UINT8 fileVer, UINT16 songLen, UINT8* songData)
 			WriteEvent(&midFileInf, &MTS, 0xB0, 0x0A, 0x40);	// center panning
 		}
 		
+		// The loop counters are stored in the song data, so only the work limits are checked.
+		curTick = 0;
+		SeqGuard_Init(&seqGuard);
 		while(! (chnInf.flags & CHNFLAG_STOP))
 		{
+			grdRes = SeqGuard_Step(&seqGuard, curTick, midFileInf.pos - MTS.trkBase);
+			if (grdRes)
+			{
+				printf("Warning: %s on track %u at %04X - track cut!\n", SeqGuard_Reason(grdRes), trkID, inPos);
+				break;
+			}
 			curCmd = songData[inPos];	inPos ++;
+			STATS_CMD(curCmd);
 			if (chnInf.trkMode == TRKMODE_RHYTHM)	// special rhythm channel handling
 			{
 				if (! rhyStackPos)
@@ -394,6 +423,8 @@ UINT8 PMD2Mid(UINT8 fileVer, UINT16 songLen, UINT8* songData)
 				
 				curDly = songData[inPos];	inPos ++;
 				MTS.curDly += curDly;
+				curTick += curDly;
+				STATS_FRAMES(curDly);
 			}
 			else if (curCmd < 0x80)	// note
 			{
@@ -430,6 +461,8 @@ UINT8 PMD2Mid(UINT8 fileVer, UINT16 songLen, UINT8* songData)
 				chnInf.flags &= ~CHNFLAG_HOLD;
 				
 				curDly = songData[inPos];	inPos ++;
+				curTick += curDly;
+				STATS_FRAMES(curDly);
 				if (chnInf.earlyOff && songData[inPos] != 0xFB && songData[inPos] != 0xC1)
 				{
 					// The PMD driver instantly cuts of the note when earlyOff >= noteLen. (used by RUSTY/MUSS.M)
@@ -931,6 +964,7 @@ UINT8 PMD2Mid(UINT8 fileVer, UINT16 songLen, UINT8* songData)
 				}
 			}
 		}
+		SeqGuard_Free(&seqGuard);
 		if (lastNote != 0xFF)
 			WriteEvent(&midFileInf, &MTS, 0x90, lastNote, 0x00);
 		if (chnInf.ssgRhyKeyMask)
@@ -960,6 +994,7 @@ UINT8 PMD2Mid(UINT8 fileVer, UINT16 songLen, UINT8* songData)
 	
 	MidData = midFileInf.data;
 	MidLen = midFileInf.pos;
+	STATS_PHASE_END(STATS_CONVERT);
 	
 	return 0x00;
 }
@@ -969,15 +1004,18 @@ static UINT8 WriteFileData(UINT32 DataLen, const UINT8* Data, const char* FileNa
 {
 	FILE* hFile;
 	
+	STATS_PHASE_BEGIN(STATS_WRITE);
 	hFile = fopen(FileName, "wb");
 	if (hFile == NULL)
 	{
+		STATS_PHASE_END(STATS_WRITE);
 		printf("Error opening %s!\n", FileName);
 		return 0xFF;
 	}
 	
 	fwrite(Data, 0x01, DataLen, hFile);
 	fclose(hFile);
+	STATS_PHASE_END(STATS_WRITE);
 	
 	return 0;
 }
@@ -113,6 +113,9 @@ typedef struct _gsd_info
 #define RUNNING_NOTES
 #define BALANCE_TRACK_TIMES
 #include "midi_utils.h"
+#include "syx_sched.h"
+#include "midi_post.h"
+#include "seq_guard.h"
 
 
 #define MCMD_INI_EXCLUDE	0x00	// exclude initial command
@@ -120,20 +123,28 @@ typedef struct _gsd_info
 #define MCMD_RET_CMDCOUNT	0x00	// return number of commands
 #define MCMD_RET_DATASIZE	0x02	// return number of data bytes
 
-#define SYXOPT_DELAY	0x01
+#define SYXOPT_DELAY	0x01	// schedule the message for the device in syxSched
+#define SYXOPT_RESET	0x02	// message resets the device
 
 
 static UINT8 ReadFileData(FILE_DATA* fData, const char* fileName);
+#ifndef RCP2MID_LIB
 static UINT8 WriteFileData(const FILE_DATA* fData, const char* fileName);
+static UINT8 PostProcessMidi(FILE_DATA* midFile);
+#endif
 static const char* GetFileTitle(const char* filePath);
+#ifndef RCP2MID_LIB
 static const char* GetFileExt(const char* fileName);
+#endif
 
 static UINT8 GetFileVer(const FILE_DATA* rcpFile);
 UINT8 Rcp2Mid(const FILE_DATA* rcpFile, FILE_DATA* midFile);
+UINT8 RcpData2Mid(UINT32 rcpLen, const UINT8* rcpData, const char* filePath, UINT32* midLen, UINT8** midData);
 static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO* rcpInf,
 							UINT32* rcpInPos, TRK_INF* trkInf, FILE_INF* fInf, MID_TRK_STATE* MTS);
 static UINT8 PreparseRcpTrack(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO* rcpInf,
 							UINT32 startPos, TRK_INF* trkInf);
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT16* loopCnt, UINT32 parentPos, UINT16 measPosCount);
 static UINT16 GetMultiCmdDataSize(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO* rcpInf,
 									UINT32 startPos, UINT8 flags);
 static UINT16 ReadMultiCmdData(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO* rcpInf,
@@ -153,6 +164,7 @@ static void WriteRolandSyxData(FILE_INF* fInf, MID_TRK_STATE* MTS, const UINT8*
 	UINT32 address, UINT32 len, const UINT8* data, UINT8 opts);
 static void WriteRolandSyxBulk(FILE_INF* fInf, MID_TRK_STATE* MTS, const UINT8* syxHdr,
 	UINT32 address, UINT32 len, const UINT8* data, UINT32 bulkSize, UINT8 opts);
+static void WaitSyxSchedule(MID_TRK_STATE* MTS);
 static void WriteMetaEventFromStr(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 metaType, const char* text);
 static UINT8 Cm62MidTrk(const CM6_INFO* cm6Inf, FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 mode);
 static UINT8 ParseCM6File(const FILE_DATA* cm6File, CM6_INFO* cm6Inf);
@@ -162,8 +174,6 @@ static void GsdPartParam2BulkDump(UINT8* bulkData, const UINT8* partData);
 static UINT8 Gsd2MidTrk(const GSD_INFO* gsdInf, FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 mode);
 UINT8 Control2Mid(const FILE_DATA* ctrlFile, FILE_DATA* midFile, UINT8 fileType, UINT8 outMode);
 
-INLINE UINT32 MulDivCeil(UINT32 val, UINT32 mul, UINT32 div);
-INLINE UINT32 MulDivRound(UINT32 val, UINT32 mul, UINT32 div);
 INLINE UINT16 ReadLE16(const UINT8* data);
 INLINE UINT32 ReadLE32(const UINT8* data);
 
@@ -179,6 +189,7 @@ static RUN_NOTE RunNotes[MAX_RUN_NOTES];
 static UINT16 midiTickRes = 0;
 static UINT32 midiTickCount = 0;
 static UINT32 midiTempoTicks = 500000;
+static SYX_SCHED syxSched;
 static const char* inputFilePath = NULL;
 
 static UINT16 NUM_LOOPS = 2;
@@ -187,7 +198,11 @@ static UINT8 BAR_MARKERS = 0;
 static UINT8 WOLFTEAM_LOOP = 0;
 static UINT8 KEEP_DUMMY_CH = 0;
 static UINT8 INCLUDE_CTRL_DATA = 1;
+#ifndef RCP2MID_LIB
+static MIDPOST_OPTS PostOpts;	// The library build leaves post-processing to the caller.
+#endif
 
+#ifndef RCP2MID_LIB	// define when linking rcp2mid.c into other tools (see fuga2rcp)
 int main(int argc, char* argv[])
 {
 	int argbase;
@@ -217,6 +232,9 @@ int main(int argc, char* argv[])
 		printf("    -WtLoop     Wolfteam Loop mode (loop from measure 2 on)\n");
 		printf("    -KeepDummyCh convert data with MIDI channel set to -1\n");
 		printf("                channel -1 is invalid, some RCPs use it for muting\n");
+		printf("    -SMF0       merge all tracks into a single track (MIDI format 0)\n");
+		printf("    -OutRes n   rescale the MIDI to n ticks per quarter\n");
+		printf("    -TempoDedup remove redundant tempo events\n");
 		return 0;
 	}
 	
@@ -241,6 +259,16 @@ int main(int argc, char* argv[])
 			WOLFTEAM_LOOP = 1;
 		else if (! stricmp(argv[argbase] + 1, "KeepDummyCh"))
 			KEEP_DUMMY_CH = 1;
+		else if (! stricmp(argv[argbase] + 1, "SMF0"))
+			PostOpts.toFormat0 = 1;
+		else if (! stricmp(argv[argbase] + 1, "OutRes"))
+		{
+			argbase ++;
+			if (argbase < argc)
+				PostOpts.resolution = (UINT16)strtoul(argv[argbase], NULL, 0);
+		}
+		else if (! stricmp(argv[argbase] + 1, "TempoDedup"))
+			PostOpts.tempoDedup = 1;
 		else
 			break;
 		argbase ++;
@@ -263,6 +291,8 @@ int main(int argc, char* argv[])
 	if (fileType < 0x10)
 	{
 		retVal = Rcp2Mid(&inFile, &outFile);
+		if (! retVal)
+			retVal = PostProcessMidi(&outFile);
 		if (! retVal)
 		{
 			WriteFileData(&outFile, argv[argbase + 1]);
@@ -291,6 +321,8 @@ int main(int argc, char* argv[])
 		else
 		{
 			retVal = Control2Mid(&inFile, &outFile, fileType, outMode);
+			if (! retVal && (outMode & 0x01))
+				retVal = PostProcessMidi(&outFile);
 			if (! retVal)
 			{
 				WriteFileData(&outFile, argv[argbase + 1]);
@@ -314,6 +346,7 @@ int main(int argc, char* argv[])
 	
 	return result;
 }
+#endif	// RCP2MID_LIB
 
 static UINT8 ReadFileData(FILE_DATA* fData, const char* fileName)
 {
@@ -340,6 +373,7 @@ static UINT8 ReadFileData(FILE_DATA* fData, const char* fileName)
 	return 0x00;
 }
 
+#ifndef RCP2MID_LIB	// only used by main()
 static UINT8 WriteFileData(const FILE_DATA* fData, const char* fileName)
 {
 	FILE* hFile;
@@ -357,6 +391,30 @@ static UINT8 WriteFileData(const FILE_DATA* fData, const char* fileName)
 	return 0x00;
 }
 
+static UINT8 PostProcessMidi(FILE_DATA* midFile)
+{
+	UINT32 newLen;
+	UINT8* newData;
+	UINT8 retVal;
+	
+	if (! MidPost_IsActive(&PostOpts))
+		return 0x00;
+	newLen = 0x00;
+	newData = NULL;
+	retVal = MidPost_Process(&PostOpts, midFile->len, midFile->data, &newLen, &newData);
+	if (retVal)
+	{
+		printf("MIDI post-processing failed! (error 0x%02X)\n", retVal);
+		return retVal;
+	}
+	free(midFile->data);
+	midFile->data = newData;
+	midFile->len = newLen;
+	
+	return 0x00;
+}
+#endif	// RCP2MID_LIB
+
 static const char* GetFileTitle(const char* filePath)
 {
 	const char* dirSep;
@@ -371,11 +429,13 @@ static const char* GetFileTitle(const char* filePath)
 	return (dirSep != NULL) ? (dirSep + 1) : filePath;
 }
 
+#ifndef RCP2MID_LIB
 static const char* GetFileExt(const char* fileName)
 {
 	const char* ext = strrchr(GetFileTitle(fileName), '.');
 	return (ext != NULL) ? (ext + 1) : "";
 }
+#endif
 
 
 static UINT8 GetFileVer(const FILE_DATA* rcpFile)
@@ -428,6 +488,12 @@ UINT8 Rcp2Mid(const FILE_DATA* rcpFile, FILE_DATA* midFile)
 	if (rcpInf.fileVer >= 0x10)
 		return 0x10;
 	printf("RCP file version %u.\n", rcpInf.fileVer);
+	// header + rhythm definitions + User SysEx data
+	if (rcpFile->len < ((rcpInf.fileVer == 2) ? 0x586 : 0xC98))
+	{
+		printf("File too small!\n");
+		return 0x11;
+	}
 	
 	midFInf.alloc = 0x20000;	// 128 KB should be enough
 	midFInf.data = (UINT8*)malloc(midFInf.alloc);
@@ -583,6 +649,7 @@ UINT8 Rcp2Mid(const FILE_DATA* rcpFile, FILE_DATA* midFile)
 				}
 			}
 		}
+		free(ctrlFilePath);
 	}
 	
 	WriteMidiHeader(&midFInf, 0x0001, 1 + ctrlTrkCnt + rcpInf.trkCnt, rcpInf.tickRes);
@@ -642,9 +709,8 @@ UINT8 Rcp2Mid(const FILE_DATA* rcpFile, FILE_DATA* midFile)
 			midiTickCount = 0;
 			WriteMetaEvent(&midFInf, &MTS, 0x03, rcpInf.cm6File.length, rcpInf.cm6File.data);
 			
-			WriteRolandSyxData(&midFInf, &MTS, MT32_SYX_HDR, 0x7F0000, 0x00, NULL, 0x00);	// MT-32 Reset
-			// (N ms / 1000 ms) / (tempoTicks / 1 000 000)
-			MTS.curDly += MulDivRound(400, midiTickRes * 1000, midiTempoTicks);	// add delay of ~400 ms
+			SyxSched_Init(&syxSched, SyxSched_FindDevice("mt32"));
+			WriteRolandSyxData(&midFInf, &MTS, MT32_SYX_HDR, 0x7F0000, 0x00, NULL, SYXOPT_DELAY | SYXOPT_RESET);	// MT-32 Reset
 			
 			Cm62MidTrk(&cm6Inf, &midFInf, &MTS, 0x11);
 			initDelay += midiTickCount;
@@ -664,6 +730,7 @@ UINT8 Rcp2Mid(const FILE_DATA* rcpFile, FILE_DATA* midFile)
 				WriteMetaEvent(&midFInf, &MTS, 0x21, 0x01, tempArr);
 			}
 			
+			SyxSched_Init(&syxSched, SyxSched_FindDevice("sc55"));
 			Gsd2MidTrk(&gsd1Inf, &midFInf, &MTS, 0x11);
 			initDelay += midiTickCount;
 			
@@ -679,8 +746,11 @@ UINT8 Rcp2Mid(const FILE_DATA* rcpFile, FILE_DATA* midFile)
 			tempArr[0x00] = 0x01;	// Port B
 			WriteMetaEvent(&midFInf, &MTS, 0x21, 0x01, tempArr);
 			
+			SyxSched_Init(&syxSched, SyxSched_FindDevice("sc55"));
 			Gsd2MidTrk(&gsd2Inf, &midFInf, &MTS, 0x11);
-			initDelay += midiTickCount;
+			// port B is sent in parallel to port A
+			if (initDelay < midiTickCount)
+				initDelay = midiTickCount;
 			
 			WriteEvent(&midFInf, &MTS, 0xFF, 0x2F, 0x00);
 			WriteMidiTrackEnd(&midFInf, &MTS);
@@ -744,6 +814,27 @@ UINT8 Rcp2Mid(const FILE_DATA* rcpFile, FILE_DATA* midFile)
 	return retVal;
 }
 
+// Converts RCP data that is already in memory. (used by tools that link rcp2mid.c, see RCP2MID_LIB)
+// filePath is the path of the original file, control files are searched in its directory.
+UINT8 RcpData2Mid(UINT32 rcpLen, const UINT8* rcpData, const char* filePath, UINT32* midLen, UINT8** midData)
+{
+	FILE_DATA rcpFile;
+	FILE_DATA midFile;
+	UINT8 retVal;
+	
+	MidiDelayCallback = MidiDelayHandler;
+	inputFilePath = (filePath != NULL) ? filePath : "";
+	rcpFile.len = rcpLen;
+	rcpFile.data = (UINT8*)rcpData;
+	midFile.len = 0x00;
+	midFile.data = NULL;
+	
+	retVal = Rcp2Mid(&rcpFile, &midFile);
+	*midLen = midFile.len;
+	*midData = midFile.data;
+	return retVal;
+}
+
 static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO* rcpInf,
 							UINT32* rcpInPos, TRK_INF* trkInf, FILE_INF* fInf, MID_TRK_STATE* MTS)
 {
@@ -767,22 +858,26 @@ static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO*
 	UINT32* measurePos;
 	UINT16 curBar;
 	UINT8 trkEnd;
+	UINT8 cmdSize;
 	UINT8 cmdType;
 	UINT8 cmdP1;
 	UINT8 cmdP2;
 	UINT16 cmdP0Delay;
 	UINT16 cmdDurat;
+	UINT32 curTick;
 	UINT8 loopIdx;
 	UINT32 loopPPos[8];
 	UINT32 loopPos[8];
 	UINT16 loopCnt[8];
+	SEQ_GUARD seqGuard;
+	UINT8 grdRes;
 	UINT8 gsParams[6];	// 0 device ID, 1 model ID, 2 address high, 3 address low
 	UINT8 xgParams[6];	// 0 device ID, 1 model ID, 2 address high, 3 address low
 	UINT32 txtBufSize;
 	UINT8* txtBuffer;
 	
 	inPos = *rcpInPos;
-	if (inPos >= rcpLen)
+	if (inPos + 0x04 > rcpLen)
 		return 0x01;
 	
 	trkBasePos = inPos;
@@ -872,6 +967,8 @@ static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO*
 	MTS->midChn = midChn;
 	loopIdx = 0x00;
 	curBar = 0;
+	curTick = 0;
+	SeqGuard_Init(&seqGuard);
 	
 	// add "startTick" offset to initial delay
 	if (startTick >= 0 || -startTick <= (INT32)MTS->curDly)
@@ -887,10 +984,17 @@ static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO*
 	
 	measurePos[measPosCount] = inPos;
 	measPosCount ++;
-	while(inPos < trkEndPos && ! trkEnd)
+	cmdSize = (rcpInf->fileVer == 2) ? 0x04 : 0x06;
+	while(inPos + cmdSize <= trkEndPos && ! trkEnd)
 	{
 		UINT32 prevPos = inPos;
 		
+		grdRes = SeqGuard_Step(&seqGuard, curTick, fInf->pos - MTS->trkBase);
+		if (grdRes)
+		{
+			printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+			break;
+		}
 		if (rcpInf->fileVer == 2)
 		{
 			cmdType = rcpData[inPos + 0x00];
@@ -1264,6 +1368,12 @@ static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO*
 					parentPos = loopPPos[loopIdx];
 					inPos = loopPos[loopIdx];
 					loopIdx ++;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCnt, parentPos, measPosCount));
+					if (grdRes)
+					{
+						printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+						trkEnd = 1;
+					}
 				}
 			}
 			cmdP0Delay = 0;
@@ -1361,8 +1471,15 @@ static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO*
 					repMeasure = measureID;
 					// YS3-25.RCP relies on using the actual offset. (*Some* of its measure numbers are off by 1.)
 					inPos = trkBasePos + repeatPos;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCnt, parentPos, measPosCount));
+					if (grdRes)
+					{
+						printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkID, SeqGuard_Reason(grdRes), prevPos);
+						trkEnd = 1;
+						break;
+					}
 					prevPos = inPos;
-				} while(rcpData[inPos] == 0xFC);
+				} while(inPos + cmdSize <= trkEndPos && rcpData[inPos] == 0xFC);
 			}
 			cmdP0Delay = 0;
 			break;
@@ -1427,6 +1544,7 @@ static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO*
 			break;
 		}	// end if (cmdType >= 0x80) / switch(cmdType)
 		MTS->curDly += cmdP0Delay;
+		curTick += cmdP0Delay;
 		
 		// remove ticks from curDly from all events until startTicks reaches 0
 		if (startTick < 0 && MTS->curDly > 0)
@@ -1443,6 +1561,7 @@ static UINT8 RcpTrk2MidTrk(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO*
 			}
 		}
 	}	// end while(! trkEnd)
+	SeqGuard_Free(&seqGuard);
 	free(txtBuffer);
 	free(measurePos);
 	if (midiDev == 0xFF)
@@ -1465,6 +1584,7 @@ static UINT8 PreparseRcpTrack(UINT32 rcpLen, const UINT8* rcpData, const RCP_INF
 	UINT16 measPosCount;
 	UINT32* measurePos;
 	UINT8 trkEnd;
+	UINT8 cmdSize;
 	UINT8 cmdType;
 	UINT8 cmdP1;
 	UINT8 cmdP2;
@@ -1475,9 +1595,10 @@ static UINT8 PreparseRcpTrack(UINT32 rcpLen, const UINT8* rcpData, const RCP_INF
 	UINT32 loopPos[8];
 	UINT32 loopTick[8];
 	UINT16 loopCnt[8];
+	SEQ_GUARD seqGuard;
 	
 	inPos = startPos;
-	if (inPos >= rcpLen)
+	if (inPos + 0x04 > rcpLen)
 		return 0x01;
 	
 	trkBasePos = inPos;
@@ -1512,11 +1633,16 @@ static UINT8 PreparseRcpTrack(UINT32 rcpLen, const UINT8* rcpData, const RCP_INF
 	trkEnd = 0;
 	parentPos = 0x00;
 	loopIdx = 0x00;
+	SeqGuard_Init(&seqGuard);
 	
 	measurePos[measPosCount] = inPos;
 	measPosCount ++;
-	while(inPos < trkEndPos && ! trkEnd)
+	cmdSize = (rcpInf->fileVer == 2) ? 0x04 : 0x06;
+	while(inPos + cmdSize <= trkEndPos && ! trkEnd)
 	{
+		// The conversion will hit the same limit and print the warning.
+		if (SeqGuard_Step(&seqGuard, trkInf->tickCnt, 0))
+			break;
 		if (rcpInf->fileVer == 2)
 		{
 			cmdType = rcpData[inPos + 0x00];
@@ -1554,6 +1680,8 @@ static UINT8 PreparseRcpTrack(UINT32 rcpLen, const UINT8* rcpData, const RCP_INF
 					parentPos = loopPPos[loopIdx];
 					inPos = loopPos[loopIdx];
 					loopIdx ++;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCnt, parentPos, measPosCount)))
+						trkEnd = 1;
 				}
 			}
 			cmdP0Delay = 0;
@@ -1612,8 +1740,13 @@ static UINT8 PreparseRcpTrack(UINT32 rcpLen, const UINT8* rcpData, const RCP_INF
 					if (! parentPos)	// necessary for following FC command chain
 						parentPos = inPos;
 					inPos = trkBasePos + repeatPos;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCnt, parentPos, measPosCount)))
+					{
+						trkEnd = 1;
+						break;
+					}
 					prevPos = inPos;
-				} while(rcpData[inPos] == 0xFC);
+				} while(inPos + cmdSize <= trkEndPos && rcpData[inPos] == 0xFC);
 			}
 			cmdP0Delay = 0;
 			break;
@@ -1663,11 +1796,27 @@ static UINT8 PreparseRcpTrack(UINT32 rcpLen, const UINT8* rcpData, const RCP_INF
 		
 		trkInf->tickCnt += cmdP0Delay;
 	}	// end while(! trkEnd)
+	SeqGuard_Free(&seqGuard);
 	free(measurePos);
 	
 	return 0x00;
 }
 
+// Hashes everything that decides where the track goes after a jump.
+// The number of measures is included, because it decides which "repeat measure" commands are valid.
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT16* loopCnt, UINT32 parentPos, UINT16 measPosCount)
+{
+	UINT64 state;
+	UINT8 curLvl;
+	
+	state = SeqGuard_Hash(0, parentPos);
+	state = SeqGuard_Hash(state, measPosCount);
+	state = SeqGuard_Hash(state, loopIdx);
+	for (curLvl = 0; curLvl < loopIdx; curLvl ++)
+		state = SeqGuard_Hash(state, loopCnt[curLvl]);
+	return state;
+}
+
 static UINT16 GetMultiCmdDataSize(UINT32 rcpLen, const UINT8* rcpData, const RCP_INFO* rcpInf,
 									UINT32 startPos, UINT8 flags)
 {
@@ -1782,6 +1931,8 @@ INLINE UINT32 Tempo2Mid(UINT16 bpm, UINT8 scale)
 {
 	// formula: (60 000 000.0 / bpm) * (scale / 64.0)
 	UINT32 div = bpm * scale;
+	if (! div)
+		return 500000;	// tempo 0 would be infinite - use the MIDI default (120 BPM)
 	// I like rounding, but doing so make most MIDI programs display e.g. "144.99 BPM".
 	return 60000000U * 64U / div;
 	//return (60000000U * 64U + div / 2) / div;
@@ -1906,6 +2057,14 @@ static void WriteRolandSyxData(FILE_INF* fInf, MID_TRK_STATE* MTS, const UINT8*
 	UINT8 chkSum;
 	UINT32 dataLen = 0x09 + len;
 	
+	if (MTS != NULL && (opts & SYXOPT_DELAY))
+	{
+		// delay the message until the device can receive it
+		UINT64 sendTime = SyxSched_Add(&syxSched, 0, dataLen + 1, (opts & SYXOPT_RESET) ? SYXSCHED_RESET : 0x00);	// (dataLen+1) for counting the initial F0 command
+		UINT32 sendTick = SyxSched_Time2Tick(sendTime, midiTickRes, midiTempoTicks);
+		if (sendTick > midiTickCount + MTS->curDly)
+			MTS->curDly = sendTick - midiTickCount;
+	}
 	if (MTS == NULL)
 	{
 		fInf->data[fInf->pos] = 0xF0;
@@ -1938,13 +2097,6 @@ static void WriteRolandSyxData(FILE_INF* fInf, MID_TRK_STATE* MTS, const UINT8*
 	fInf->data[fInf->pos + len + 0x08] = 0xF7;
 	fInf->pos += dataLen;
 	
-	if (MTS != NULL && (opts & SYXOPT_DELAY))
-	{
-		// ticks/second = midiTickRes * 1 000 000 / midiTempoTicks
-		// tick_delay = ceil(ticks/second * dataLength / 3125)
-		MTS->curDly += MulDivCeil(dataLen + 1, midiTickRes * 320, midiTempoTicks);	// (dataLen+1) for counting the initial F0 command
-	}
-	
 	return;
 }
 
@@ -1975,6 +2127,20 @@ static void WriteRolandSyxBulk(FILE_INF* fInf, MID_TRK_STATE* MTS, const UINT8*
 	return;
 }
 
+// delays the next event until the device has processed all scheduled SysEx messages
+static void WaitSyxSchedule(MID_TRK_STATE* MTS)
+{
+	UINT32 endTick;
+	
+	if (MTS == NULL)
+		return;
+	endTick = SyxSched_Time2Tick(SyxSched_GetEndTime(&syxSched), midiTickRes, midiTempoTicks);
+	if (endTick > midiTickCount + MTS->curDly)
+		MTS->curDly = endTick - midiTickCount;
+	
+	return;
+}
+
 static void WriteMetaEventFromStr(FILE_INF* fInf, MID_TRK_STATE* MTS, UINT8 metaType, const char* text)
 {
 	WriteMetaEvent(fInf, MTS, metaType, strlen(text), text);
@@ -2042,6 +2208,7 @@ static UINT8 Cm62MidTrk(const CM6_INFO* cm6Inf, FILE_INF* fInf, MID_TRK_STATE* M
 		WriteMetaEventFromStr(fInf, MTS, 0x01, "CM-32P System");
 	WriteRolandSyxData(fInf, MTS, MT32_SYX_HDR, 0x520000, 0x11, cm6Inf->pcmSystem, SYXOPT_DELAY);
 	
+	WaitSyxSchedule(MTS);
 	if (mode & 0x10)
 		WriteMetaEventFromStr(fInf, MTS, 0x01, "Setup Finished.");
 	
@@ -2208,6 +2375,7 @@ static UINT8 Gsd2MidTrk(const GSD_INFO* gsdInf, FILE_INF* fInf, MID_TRK_STATE* M
 	// Recomposer 3.0 doesn't seem to send SysEx for the additional Master Tuning settings.
 	//gsdInf->masterTune;
 	
+	WaitSyxSchedule(MTS);
 	if (mode & 0x10)
 		WriteMetaEventFromStr(fInf, MTS, 0x01, "Setup Finished.");
 	
@@ -2253,6 +2421,7 @@ UINT8 Control2Mid(const FILE_DATA* ctrlFile, FILE_DATA* midFile, UINT8 fileType,
 		WriteMidiTrackStart(&midFInf, &MTS);
 		midiTickCount = 0;
 		
+		SyxSched_Init(&syxSched, SyxSched_FindDevice((fileType == 0x10) ? "mt32" : "sc55"));
 		if (fileType == 0x10)
 			retVal = Cm62MidTrk(&cm6Inf, &midFInf, &MTS, outMode);
 		else
@@ -2276,16 +2445,6 @@ UINT8 Control2Mid(const FILE_DATA* ctrlFile, FILE_DATA* midFile, UINT8 fileType,
 }
 
 
-INLINE UINT32 MulDivCeil(UINT32 val, UINT32 mul, UINT32 div)
-{
-	return (UINT32)( ((UINT64)val * mul + div - 1) / div );
-}
-
-INLINE UINT32 MulDivRound(UINT32 val, UINT32 mul, UINT32 div)
-{
-	return (UINT32)( ((UINT64)val * mul + div / 2) / div );
-}
-
 INLINE UINT16 ReadLE16(const UINT8* data)
 {
 	return (data[0x01] << 8) | (data[0x00] << 0);
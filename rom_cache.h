@@ -0,0 +1,221 @@
+// ROM Analysis Cache
+// ------------------
+// to be included as header file
+//
+// Stores the results of ROM scans (driver offsets, song counts, decompressed driver data, ...)
+// in a file, so that converting more songs from the same ROM doesn't need to redo them.
+// A cache file can hold entries for many ROMs and tools. Entries are identified by
+// the tool ID, the ROM size and a 64-bit FNV-1a hash of the ROM data.
+//  UINT64 ROMCache_Hash(UINT32 size, const UINT8* data);
+//      Calculates the hash of the ROM data.
+//  UINT8 ROMCache_Load(const char* fileName, UINT32 toolID, UINT32 romSize, UINT64 romHash,
+//                      UINT32 infoSize, void* info, UINT32* blobSize, UINT8** blob);
+//      Searches the cache file for an entry and copies its info structure to "info".
+//      "infoSize" must match the size of the stored structure.
+//      If "blob" is not NULL, the additional data is loaded into a buffer allocated with malloc().
+//      Returns 0x00 on success, 0x01 if there is no entry for the ROM,
+//      0x80 if the file is invalid and 0xFF if the file can't be opened.
+//  UINT8 ROMCache_Save(const char* fileName, UINT32 toolID, UINT32 romSize, UINT64 romHash,
+//                      UINT32 infoSize, const void* info, UINT32 blobSize, const UINT8* blob);
+//      Stores an entry in the cache file. Older entries for the same tool and ROM are removed,
+//      so a stale entry is replaced instead of piling up. (The file is rewritten or created.)
+//      Returns 0x00 on success and 0xFF if the file can't be read or written.
+//
+// Note: The info structures are stored as they are in memory, so cache files can't be
+//       shared between machines with different byte orders.
+
+#ifndef __ROM_CACHE_H__
+#define __ROM_CACHE_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stdtype.h"
+
+// M2MidiDec only uses the hash, so the functions are inline to keep it free of warnings.
+// (not INLINE, which midi_funcs.h defines as plain "static")
+#if defined(_MSC_VER)
+#define ROMCACHE_INLINE	static __inline
+#elif defined(__GNUC__)
+#define ROMCACHE_INLINE	static __inline__
+#else
+#define ROMCACHE_INLINE	static inline
+#endif
+
+#define ROMCACHE_ID(a, b, c, d)	(((UINT32)(a) << 24) | ((UINT32)(b) << 16) | ((UINT32)(c) << 8) | ((UINT32)(d) << 0))
+#define ROMCACHE_SIG	ROMCACHE_ID('R', 'C', 'c', 'h')
+#define ROMCACHE_VER	0x0100
+
+typedef struct _rom_cache_file_header
+{
+	UINT32 signature;
+	UINT32 version;
+} ROMCACHE_FHDR;
+
+typedef struct _rom_cache_entry_header
+{
+	UINT32 toolID;
+	UINT32 romSize;
+	UINT64 romHash;
+	UINT32 infoSize;
+	UINT32 blobSize;
+} ROMCACHE_EHDR;
+
+
+ROMCACHE_INLINE UINT64 ROMCache_Hash(UINT32 size, const UINT8* data)
+{
+	// 64-bit FNV-1a
+	UINT64 hash;
+	UINT32 curPos;
+	
+	hash = 0xCBF29CE484222325ULL;
+	for (curPos = 0x00; curPos < size; curPos ++)
+	{
+		hash ^= data[curPos];
+		hash *= 0x00000100000001B3ULL;
+	}
+	
+	return hash;
+}
+
+ROMCACHE_INLINE UINT8 ROMCache_Load(const char* fileName, UINT32 toolID, UINT32 romSize, UINT64 romHash,
+									UINT32 infoSize, void* info, UINT32* blobSize, UINT8** blob)
+{
+	FILE* hFile;
+	ROMCACHE_FHDR fileHdr;
+	ROMCACHE_EHDR entHdr;
+	UINT8* blobData;
+	
+	hFile = fopen(fileName, "rb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	if (fread(&fileHdr, sizeof(ROMCACHE_FHDR), 1, hFile) != 1 ||
+		fileHdr.signature != ROMCACHE_SIG || fileHdr.version != ROMCACHE_VER)
+	{
+		fclose(hFile);
+		return 0x80;
+	}
+	
+	while(fread(&entHdr, sizeof(ROMCACHE_EHDR), 1, hFile) == 1)
+	{
+		if (entHdr.toolID != toolID || entHdr.romSize != romSize ||
+			entHdr.romHash != romHash || entHdr.infoSize != infoSize)
+		{
+			if (fseek(hFile, (long)entHdr.infoSize + entHdr.blobSize, SEEK_CUR))
+				break;
+			continue;
+		}
+		
+		if (fread(info, 0x01, infoSize, hFile) != infoSize)
+			break;
+		if (blob != NULL)
+		{
+			blobData = NULL;
+			if (entHdr.blobSize)
+			{
+				blobData = (UINT8*)malloc(entHdr.blobSize);
+				if (blobData == NULL || fread(blobData, 0x01, entHdr.blobSize, hFile) != entHdr.blobSize)
+				{
+					free(blobData);
+					break;
+				}
+			}
+			*blobSize = entHdr.blobSize;
+			*blob = blobData;
+		}
+		fclose(hFile);
+		return 0x00;
+	}
+	fclose(hFile);
+	
+	return 0x01;	// not found (or truncated entry)
+}
+
+ROMCACHE_INLINE UINT8 ROMCache_Save(const char* fileName, UINT32 toolID, UINT32 romSize, UINT64 romHash,
+									UINT32 infoSize, const void* info, UINT32 blobSize, const UINT8* blob)
+{
+	FILE* hFile;
+	ROMCACHE_FHDR fileHdr;
+	ROMCACHE_EHDR entHdr;
+	UINT8* oldData;
+	UINT32 oldSize;
+	UINT32 curPos;
+	UINT32 entSize;
+	long fileSize;
+	size_t wrtCnt;
+	
+	// read the current file, so that the entries of other ROMs can be kept
+	oldData = NULL;
+	oldSize = 0x00;
+	hFile = fopen(fileName, "rb");
+	if (hFile != NULL)
+	{
+		fileSize = -1;
+		if (! fseek(hFile, 0, SEEK_END))
+			fileSize = ftell(hFile);
+		if (fileSize > 0)
+		{
+			oldData = (UINT8*)malloc(fileSize);
+			if (oldData == NULL || fseek(hFile, 0, SEEK_SET) ||
+				fread(oldData, 0x01, fileSize, hFile) != (size_t)fileSize)
+				fileSize = -1;
+		}
+		fclose(hFile);
+		if (fileSize < 0)
+		{
+			free(oldData);
+			return 0xFF;	// don't throw away entries that just couldn't be read
+		}
+		oldSize = (UINT32)fileSize;
+		
+		// a file with a different signature or version is replaced completely
+		if (oldSize >= sizeof(ROMCACHE_FHDR))
+			memcpy(&fileHdr, oldData, sizeof(ROMCACHE_FHDR));
+		if (oldSize < sizeof(ROMCACHE_FHDR) ||
+			fileHdr.signature != ROMCACHE_SIG || fileHdr.version != ROMCACHE_VER)
+			oldSize = 0x00;
+	}
+	
+	hFile = fopen(fileName, "wb");
+	if (hFile == NULL)
+	{
+		free(oldData);
+		return 0xFF;
+	}
+	
+	fileHdr.signature = ROMCACHE_SIG;
+	fileHdr.version = ROMCACHE_VER;
+	wrtCnt = fwrite(&fileHdr, sizeof(ROMCACHE_FHDR), 1, hFile);
+	for (curPos = sizeof(ROMCACHE_FHDR); curPos < oldSize; curPos += entSize)
+	{
+		if (oldSize - curPos < sizeof(ROMCACHE_EHDR))
+			break;
+		memcpy(&entHdr, &oldData[curPos], sizeof(ROMCACHE_EHDR));
+		entSize = oldSize - curPos - sizeof(ROMCACHE_EHDR);
+		if (entHdr.infoSize > entSize || entHdr.blobSize > entSize - entHdr.infoSize)
+			break;	// truncated entry - drop it along with the rest
+		entSize = sizeof(ROMCACHE_EHDR) + entHdr.infoSize + entHdr.blobSize;
+		if (entHdr.toolID == toolID && entHdr.romSize == romSize && entHdr.romHash == romHash)
+			continue;	// replaced by the new entry
+		wrtCnt &= fwrite(&oldData[curPos], entSize, 1, hFile);
+	}
+	free(oldData);
+	
+	entHdr.toolID = toolID;
+	entHdr.romSize = romSize;
+	entHdr.romHash = romHash;
+	entHdr.infoSize = infoSize;
+	entHdr.blobSize = blobSize;
+	wrtCnt &= fwrite(&entHdr, sizeof(ROMCACHE_EHDR), 1, hFile);
+	if (infoSize)
+		wrtCnt &= fwrite(info, infoSize, 1, hFile);
+	if (blobSize)
+		wrtCnt &= fwrite(blob, blobSize, 1, hFile);
+	if (fclose(hFile))
+		wrtCnt = 0;
+	
+	return wrtCnt ? 0x00 : 0xFF;
+}
+
+#endif	// __ROM_CACHE_H__
@@ -0,0 +1,307 @@
+// Pattern Scanning Routines
+// -------------------------
+// to be included as header file
+//
+// Searches data for multiple byte patterns (with wildcards) in a single pass.
+//  UINT8 ScanSet_Init(SCAN_SET* set, UINT32 patCnt, const SCAN_PATTERN* pats, UINT8 wildcard);
+//      Prepares a set of patterns for scanning. Bytes that equal "wildcard" match any value.
+//      "pats" is referenced by the set and must stay valid while the set is used.
+//      Returns 0x00 on success, 0x80 if there are too many patterns (see SCAN_MAX_PATS)
+//      and 0x81 if a pattern is shorter than 2 bytes.
+//  UINT32 ScanSet_FindAll(const SCAN_SET* set, UINT32 dataLen, const UINT8* data,
+//                         UINT32 maxMatches, SCAN_MATCH* matches);
+//      Finds all matches of all patterns and stores up to "maxMatches" of them in "matches".
+//      Matches of the same pattern are stored in ascending order.
+//      Returns the total number of matches. (may be larger than maxMatches)
+//  UINT32 ScanSet_FindFirst(const SCAN_SET* set, UINT32 dataLen, const UINT8* data, UINT32* firstPos);
+//      Stores the offset of the first match of each pattern in firstPos[patID]. (or (UINT32)-1 if not found)
+//      The scan stops as soon as every pattern was found.
+//      Returns the number of patterns found.
+//
+//  void ScanCand_Add(UINT32 candMax, UINT32* candCnt, SCAN_CAND* cands, UINT32 pos, UINT32 param, UINT32 score);
+//      Inserts a candidate (e.g. a possible table location) into a list that is sorted by score
+//      (highest first) and keeps only the best "candMax" entries. Earlier candidates win ties.
+//
+// Every pattern has an "anchor", which is the pair of adjacent bytes with the fewest wildcards.
+// The scan looks up the byte pair at each position in a 64 KBit map of all anchors
+// and only compares the full patterns when the lookup hits.
+// When all anchors begin with the same byte, memchr() is used to skip to the next candidate.
+
+#ifndef __SCAN_FUNCS_H__
+#define __SCAN_FUNCS_H__
+
+#include <string.h>	// for memchr()
+#include "stdtype.h"
+
+// not every converter uses every function, so they are inline to avoid "unused function" warnings
+#if defined(_MSC_VER)
+#define SCAN_INLINE	static __inline
+#elif defined(__GNUC__)
+#define SCAN_INLINE	static __inline__
+#else
+#define SCAN_INLINE	static inline
+#endif
+
+#define SCAN_MAX_PATS	32
+
+typedef struct _scan_pattern
+{
+	UINT32 len;
+	const UINT8* data;
+	UINT32 step;	// only match at offsets that are a multiple of "step" (0/1 = any offset)
+} SCAN_PATTERN;
+
+typedef struct _scan_match
+{
+	UINT32 patID;
+	UINT32 offset;
+} SCAN_MATCH;
+
+typedef struct _scan_cand
+{
+	UINT32 pos;
+	UINT32 param;	// additional, user-defined value
+	UINT32 score;
+} SCAN_CAND;
+
+typedef struct _scan_set
+{
+	UINT32 patCnt;
+	const SCAN_PATTERN* pats;
+	UINT8 wildcard;
+	UINT8 firstByte;	// first byte of all anchors (when useMemchr is set)
+	UINT8 useMemchr;
+	UINT32 anchorOfs[SCAN_MAX_PATS];
+	UINT8 anchorMap[0x10000 / 8];
+} SCAN_SET;
+
+
+SCAN_INLINE UINT8 ScanSet_Init(SCAN_SET* set, UINT32 patCnt, const SCAN_PATTERN* pats, UINT8 wildcard)
+{
+	UINT32 curPat;
+	UINT32 curPos;
+	UINT8 firstMap[0x100];
+	UINT16 firstCnt;
+	UINT16 anchorVal;
+	
+	if (patCnt > SCAN_MAX_PATS)
+		return 0x80;
+	for (curPat = 0; curPat < patCnt; curPat ++)
+	{
+		if (pats[curPat].len < 2)
+			return 0x81;
+	}
+	
+	set->patCnt = patCnt;
+	set->pats = pats;
+	set->wildcard = wildcard;
+	memset(set->anchorMap, 0x00, sizeof(set->anchorMap));
+	memset(firstMap, 0x00, sizeof(firstMap));
+	for (curPat = 0; curPat < patCnt; curPat ++)
+	{
+		const UINT8* patData = pats[curPat].data;
+		UINT32 bestPos = 0;
+		UINT8 bestFixed = 0;
+		UINT16 val1;
+		UINT16 val2;
+		
+		// find the first byte pair with the fewest wildcards
+		for (curPos = 0; curPos < pats[curPat].len - 1; curPos ++)
+		{
+			UINT8 fixedCnt = (patData[curPos + 0] != wildcard) + (patData[curPos + 1] != wildcard);
+			if (fixedCnt > bestFixed)
+			{
+				bestFixed = fixedCnt;
+				bestPos = curPos;
+				if (bestFixed == 2)
+					break;
+			}
+		}
+		set->anchorOfs[curPat] = bestPos;
+		
+		// mark all values the anchor can match
+		for (val1 = 0x00; val1 < 0x100; val1 ++)
+		{
+			if (patData[bestPos + 0] != wildcard && patData[bestPos + 0] != val1)
+				continue;
+			firstMap[val1] = 1;
+			for (val2 = 0x00; val2 < 0x100; val2 ++)
+			{
+				if (patData[bestPos + 1] != wildcard && patData[bestPos + 1] != val2)
+					continue;
+				anchorVal = (val1 << 8) | val2;
+				set->anchorMap[anchorVal >> 3] |= (1 << (anchorVal & 0x07));
+			}
+		}
+	}
+	
+	firstCnt = 0;
+	set->firstByte = 0x00;
+	for (anchorVal = 0x00; anchorVal < 0x100; anchorVal ++)
+	{
+		if (firstMap[anchorVal])
+		{
+			firstCnt ++;
+			set->firstByte = (UINT8)anchorVal;
+		}
+	}
+	set->useMemchr = (firstCnt == 1);
+	
+	return 0x00;
+}
+
+// Checks all patterns in "patMask" whose anchor is at "anchorPos".
+// Returns a bit mask of the matching patterns.
+SCAN_INLINE UINT32 ScanSet_CheckAnchor(const SCAN_SET* set, UINT32 dataLen, const UINT8* data,
+									   UINT32 anchorPos, UINT32 patMask)
+{
+	UINT32 curPat;
+	UINT32 matchMask;
+	
+	matchMask = 0x00;
+	for (curPat = 0; curPat < set->patCnt; curPat ++)
+	{
+		const SCAN_PATTERN* pat = &set->pats[curPat];
+		UINT32 startPos;
+		UINT32 curPos;
+		
+		if (! (patMask & (1UL << curPat)))
+			continue;
+		if (anchorPos < set->anchorOfs[curPat])
+			continue;
+		startPos = anchorPos - set->anchorOfs[curPat];
+		if (pat->len > dataLen - startPos)
+			continue;
+		if (pat->step > 1 && (startPos % pat->step))
+			continue;
+		
+		for (curPos = 0; curPos < pat->len; curPos ++)
+		{
+			if (pat->data[curPos] != set->wildcard && pat->data[curPos] != data[startPos + curPos])
+				break;
+		}
+		if (curPos == pat->len)
+			matchMask |= (1UL << curPat);
+	}
+	
+	return matchMask;
+}
+
+// Returns the position of the next byte pair that matches any anchor. (or (UINT32)-1)
+SCAN_INLINE UINT32 ScanSet_NextAnchor(const SCAN_SET* set, UINT32 dataLen, const UINT8* data, UINT32 curPos)
+{
+	UINT16 anchorVal;
+	
+	while(curPos + 1 < dataLen)
+	{
+		if (set->useMemchr)
+		{
+			const UINT8* fndPtr = (const UINT8*)memchr(&data[curPos], set->firstByte, dataLen - 1 - curPos);
+			if (fndPtr == NULL)
+				break;
+			curPos = (UINT32)(fndPtr - data);
+		}
+		anchorVal = (data[curPos + 0] << 8) | data[curPos + 1];
+		if (set->anchorMap[anchorVal >> 3] & (1 << (anchorVal & 0x07)))
+			return curPos;
+		curPos ++;
+	}
+	
+	return (UINT32)-1;
+}
+
+SCAN_INLINE UINT32 ScanSet_FindAll(const SCAN_SET* set, UINT32 dataLen, const UINT8* data,
+								   UINT32 maxMatches, SCAN_MATCH* matches)
+{
+	UINT32 allMask;
+	UINT32 matchMask;
+	UINT32 matchCnt;
+	UINT32 curPos;
+	UINT32 curPat;
+	
+	allMask = (set->patCnt < 32) ? ((1UL << set->patCnt) - 1) : 0xFFFFFFFF;
+	matchCnt = 0;
+	curPos = 0;
+	while(1)
+	{
+		curPos = ScanSet_NextAnchor(set, dataLen, data, curPos);
+		if (curPos == (UINT32)-1)
+			break;
+		
+		matchMask = ScanSet_CheckAnchor(set, dataLen, data, curPos, allMask);
+		for (curPat = 0; matchMask; curPat ++, matchMask >>= 1)
+		{
+			if (! (matchMask & 0x01))
+				continue;
+			if (matchCnt < maxMatches)
+			{
+				matches[matchCnt].patID = curPat;
+				matches[matchCnt].offset = curPos - set->anchorOfs[curPat];
+			}
+			matchCnt ++;
+		}
+		curPos ++;
+	}
+	
+	return matchCnt;
+}
+
+SCAN_INLINE UINT32 ScanSet_FindFirst(const SCAN_SET* set, UINT32 dataLen, const UINT8* data, UINT32* firstPos)
+{
+	UINT32 remMask;
+	UINT32 matchMask;
+	UINT32 fndCnt;
+	UINT32 curPos;
+	UINT32 curPat;
+	
+	for (curPat = 0; curPat < set->patCnt; curPat ++)
+		firstPos[curPat] = (UINT32)-1;
+	remMask = (set->patCnt < 32) ? ((1UL << set->patCnt) - 1) : 0xFFFFFFFF;
+	fndCnt = 0;
+	curPos = 0;
+	while(remMask)
+	{
+		curPos = ScanSet_NextAnchor(set, dataLen, data, curPos);
+		if (curPos == (UINT32)-1)
+			break;
+		
+		matchMask = ScanSet_CheckAnchor(set, dataLen, data, curPos, remMask);
+		remMask &= ~matchMask;
+		for (curPat = 0; matchMask; curPat ++, matchMask >>= 1)
+		{
+			if (! (matchMask & 0x01))
+				continue;
+			firstPos[curPat] = curPos - set->anchorOfs[curPat];
+			fndCnt ++;
+		}
+		curPos ++;
+	}
+	
+	return fndCnt;
+}
+
+SCAN_INLINE void ScanCand_Add(UINT32 candMax, UINT32* candCnt, SCAN_CAND* cands, UINT32 pos, UINT32 param, UINT32 score)
+{
+	UINT32 insIdx;
+	UINT32 curIdx;
+	
+	for (insIdx = 0; insIdx < *candCnt; insIdx ++)
+	{
+		if (score > cands[insIdx].score)
+			break;
+	}
+	if (insIdx >= candMax)
+		return;
+	
+	if (*candCnt < candMax)
+		(*candCnt) ++;
+	for (curIdx = *candCnt - 1; curIdx > insIdx; curIdx --)
+		cands[curIdx] = cands[curIdx - 1];
+	cands[insIdx].pos = pos;
+	cands[insIdx].param = param;
+	cands[insIdx].score = score;
+	
+	return;
+}
+
+#endif	// __SCAN_FUNCS_H__
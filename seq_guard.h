@@ -0,0 +1,173 @@
+// Sequence Execution Guard
+// ------------------------
+// to be included as header file
+//
+// Limits the work a sequence interpreter does for a single track, so that corrupt or tricky data
+// (jump cycles, loops that never end, runaway delays) makes the converter cut the track instead of hanging.
+//  void SeqGuard_Init(SEQ_GUARD* sg);
+//      Prepares the guard for a new track, using the default limits.
+//      The limits (maxCmds, maxTicks, maxOutBytes, 0 = unlimited) can be changed after this call.
+//  UINT8 SeqGuard_Step(SEQ_GUARD* sg, UINT32 tick, UINT32 outBytes);
+//      Call once for every command. "tick" is the current track tick and "outBytes" the amount of data
+//      written for the track so far. (pass 0 for values that aren't tracked)
+//      Returns SEQGRD_OK or the limit that was exceeded.
+//  UINT8 SeqGuard_Jump(SEQ_GUARD* sg, UINT32 destPos, UINT64 state);
+//      Call when the interpreter jumps (loop back, GoTo, subroutine, measure repeat, ...).
+//      "state" is a hash of everything that decides how the track continues (loop counters, return
+//      addresses, ...). Returns SEQGRD_CYCLE when the position was already reached with the same state,
+//      which means that the track would never end.
+//  UINT64 SeqGuard_Hash(UINT64 hash, UINT32 value);
+//      Adds a value to a state hash. Start with hash = 0.
+//  const char* SeqGuard_Reason(UINT8 result);
+//      Returns a description of a SeqGuard_Step/SeqGuard_Jump result for warning messages.
+//  void SeqGuard_Free(SEQ_GUARD* sg);
+//      Frees the list of visited positions.
+//
+// Only jumps are recorded, so well-formed songs only need a few table entries and a counter per command.
+
+#ifndef __SEQ_GUARD_H__
+#define __SEQ_GUARD_H__
+
+#include <stdlib.h>
+#include "stdtype.h"
+
+// INLINE instead of static, so converters that don't need SeqGuard_Jump etc. compile without warnings
+#ifndef INLINE
+#if defined(_MSC_VER)
+#define INLINE	static __inline
+#elif defined(__GNUC__)
+#define INLINE	static __inline__
+#else
+#define INLINE	static inline
+#endif
+#endif	// INLINE
+
+#define SEQGRD_OK		0x00
+#define SEQGRD_CMDS		0x01	// too many commands executed
+#define SEQGRD_TICKS	0x02	// track too long
+#define SEQGRD_OUTPUT	0x03	// too much data written
+#define SEQGRD_CYCLE	0x04	// jumped to a position with the same state again
+
+#define SEQGRD_MAX_VISITS	0x100000	// stop recording jumps when there are this many
+
+typedef struct _seq_guard
+{
+	UINT32 maxCmds;
+	UINT32 maxTicks;
+	UINT32 maxOutBytes;
+	UINT32 cmdCnt;
+	UINT32 visitAlloc;	// size of the hash table (power of 2)
+	UINT32 visitCnt;
+	UINT64* visits;		// hash table of (position, state) hashes, 0 = empty slot
+} SEQ_GUARD;
+
+
+INLINE void SeqGuard_Init(SEQ_GUARD* sg)
+{
+	// The defaults are far beyond what real songs need, even with many loops.
+	sg->maxCmds = 0x1000000;		// 16 M commands
+	sg->maxTicks = 0x10000000;
+	sg->maxOutBytes = 0x4000000;	// 64 MB
+	sg->cmdCnt = 0;
+	sg->visitAlloc = 0;
+	sg->visitCnt = 0;
+	sg->visits = NULL;
+	
+	return;
+}
+
+INLINE UINT8 SeqGuard_Step(SEQ_GUARD* sg, UINT32 tick, UINT32 outBytes)
+{
+	sg->cmdCnt ++;
+	if (sg->maxCmds && sg->cmdCnt > sg->maxCmds)
+		return SEQGRD_CMDS;
+	if (sg->maxTicks && tick > sg->maxTicks)
+		return SEQGRD_TICKS;
+	if (sg->maxOutBytes && outBytes > sg->maxOutBytes)
+		return SEQGRD_OUTPUT;
+	return SEQGRD_OK;
+}
+
+INLINE UINT64 SeqGuard_Hash(UINT64 hash, UINT32 value)
+{
+	// FNV-1a style mixing, one 32-bit value at a time
+	return (hash ^ value) * 0x00000100000001B3ULL;
+}
+
+INLINE UINT8 SeqGuard_Insert(UINT64* table, UINT32 mask, UINT64 key)
+{
+	UINT32 idx;
+	
+	idx = (UINT32)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+	while(table[idx])
+	{
+		if (table[idx] == key)
+			return 0;	// already present
+		idx = (idx + 1) & mask;
+	}
+	table[idx] = key;
+	return 1;
+}
+
+INLINE UINT8 SeqGuard_Jump(SEQ_GUARD* sg, UINT32 destPos, UINT64 state)
+{
+	UINT64 key;
+	UINT32 curIdx;
+	
+	if (sg->visitCnt >= SEQGRD_MAX_VISITS)
+		return SEQGRD_OK;	// The command limit will stop the track.
+	if (sg->visitCnt * 2 >= sg->visitAlloc)
+	{
+		// keep the table at most half full
+		UINT32 newAlloc = sg->visitAlloc ? (sg->visitAlloc * 2) : 0x40;
+		UINT64* newTable = (UINT64*)calloc(newAlloc, sizeof(UINT64));
+		if (newTable == NULL)
+			return SEQGRD_OK;
+		for (curIdx = 0; curIdx < sg->visitAlloc; curIdx ++)
+		{
+			if (sg->visits[curIdx])
+				SeqGuard_Insert(newTable, newAlloc - 1, sg->visits[curIdx]);
+		}
+		free(sg->visits);
+		sg->visits = newTable;
+		sg->visitAlloc = newAlloc;
+	}
+	
+	// With 64 bits, a false "cycle" due to a hash collision is practically impossible.
+	key = SeqGuard_Hash(state, destPos);
+	if (! key)
+		key = 1;	// 0 marks empty slots
+	if (! SeqGuard_Insert(sg->visits, sg->visitAlloc - 1, key))
+		return SEQGRD_CYCLE;
+	sg->visitCnt ++;
+	return SEQGRD_OK;
+}
+
+INLINE const char* SeqGuard_Reason(UINT8 result)
+{
+	switch(result)
+	{
+	case SEQGRD_CMDS:
+		return "too many commands";
+	case SEQGRD_TICKS:
+		return "track too long";
+	case SEQGRD_OUTPUT:
+		return "too much output data";
+	case SEQGRD_CYCLE:
+		return "endless jump cycle";
+	default:
+		return "OK";
+	}
+}
+
+INLINE void SeqGuard_Free(SEQ_GUARD* sg)
+{
+	free(sg->visits);
+	sg->visits = NULL;
+	sg->visitAlloc = 0;
+	sg->visitCnt = 0;
+	
+	return;
+}
+
+#endif	// __SEQ_GUARD_H__
@@ -7,6 +7,12 @@
 #include <string.h>
 
 #include "stdtype.h"
+#include "syx_sched.h"
+
+#ifdef _WIN32
+#include <io.h>	// for _setmode()
+#include <fcntl.h>
+#endif
 
 #ifndef INLINE
 #if defined(_MSC_VER)
@@ -27,9 +33,12 @@ typedef struct file_information
 } FILE_INF;
 
 
-UINT8 Syx2Mid(void);
-static UINT32 GetEventLength(UINT32 startPos);
-static UINT8 WriteFileData(UINT32 dataLen, const UINT8* data, const char* fileName);
+static UINT8 ConvertFile(const char* inName, const char* outName);
+static char* GetBatchOutName(const char* inName, const char* newExt);
+static const char* GetLastDirSepPos(const char* fileName);
+UINT8 Syx2Mid(FILE* hFileIn, FILE* hFileOut);
+static UINT32 ReadSyxEvent(FILE* hFile, UINT32* bufSize, UINT8** buffer);
+static UINT8 FlushEventData(FILE_INF* fInf, FILE* hFile, UINT32* trkLen);
 static void WriteMidiHeader(FILE_INF* fInf, UINT16 format, UINT16 tracks, UINT16 resolution);
 static void WriteMidiValue(FILE_INF* fInf, UINT32 value);
 static void WriteLongEvent(FILE_INF* fInf, UINT32 delay, UINT8 evt, UINT32 dataLen, const void* data);
@@ -39,73 +48,207 @@ INLINE void WriteBE32(UINT8* buffer, UINT32 value);
 INLINE void WriteBE16(UINT8* buffer, UINT16 value);
 
 
-static UINT32 SyxLen;
-static UINT8* SyxData;
-static UINT32 MidLen;
-static UINT8* MidData;
-
 static UINT16 MIDI_RES = 480;
 static UINT32 MIDI_TEMPO = 500000;	// 120 BPM
+static const SYX_DEVICE* SyxDevice = &SYXSCHED_DEVICES[0];	// UART timing only
 
 int main(int argc, char* argv[])
 {
 	int argbase;
-	FILE* hFile;
+	UINT8 batchMode;
 	UINT8 retVal;
+	char* outName;
 	
 	if (argc < 3)
 	{
-		printf("Usage: syx2mid.exe input.syx output.mid\n");
+		printf("Usage: syx2mid.exe [options] input.syx output.mid\n");
+		printf("       syx2mid.exe [options] -b input1.syx [input2.syx ...]\n");
+		printf("Batch mode (-b) writes input1.mid, input2.mid, etc.\n");
+		printf("Use - for stdin/stdout.\n");
+		printf("\n");
+		printf("Options:\n");
+		printf("    -d device   space the events so that the device's receive buffer doesn't overflow\n");
+		printf("                uart = UART speed only (default), mt32 = MT-32/CM-64, sc55 = SC-55/GS\n");
 		return 0;
 	}
 	
 	argbase = 1;
-	if (argc < argbase + 2)
+	batchMode = 0;
+	while(argbase < argc && argv[argbase][0] == '-' && argv[argbase][1] != '\0')
+	{
+		if (! strcmp(argv[argbase], "-b"))
+		{
+			batchMode = 1;
+		}
+		else if (! strcmp(argv[argbase], "-d") && argbase + 1 < argc)
+		{
+			argbase ++;
+			SyxDevice = SyxSched_FindDevice(argv[argbase]);
+			if (SyxDevice == NULL)
+			{
+				fprintf(stderr, "Unknown device %s!\n", argv[argbase]);
+				return 1;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option %s!\n", argv[argbase]);
+			return 1;
+		}
+		argbase ++;
+	}
+	if (argc < argbase + (batchMode ? 1 : 2))
 	{
-		printf("Not enough arguments.\n");
+		fprintf(stderr, "Not enough arguments.\n");
 		return 0;
 	}
 	
-	hFile = fopen(argv[argbase + 0], "rb");
-	if (hFile == NULL)
+#ifdef _WIN32
+	_setmode(_fileno(stdin), _O_BINARY);
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	
+	if (! batchMode)
+		return ConvertFile(argv[argbase + 0], argv[argbase + 1]) ? 1 : 0;
+	
+	retVal = 0;
+	for (; argbase < argc; argbase ++)
+	{
+		outName = GetBatchOutName(argv[argbase], ".mid");
+		if (ConvertFile(argv[argbase], outName))
+			retVal = 1;
+		free(outName);
+	}
+	
+	return retVal;
+}
+
+static UINT8 ConvertFile(const char* inName, const char* outName)
+{
+	FILE* hFileIn;
+	FILE* hFileOut;
+	FILE* hFileTmp;
+	UINT8 buffer[0x1000];
+	size_t readLen;
+	UINT8 retVal;
+	
+	hFileIn = strcmp(inName, "-") ? fopen(inName, "rb") : stdin;
+	if (hFileIn == NULL)
+	{
+		fprintf(stderr, "Error opening %s!\n", inName);
+		return 0xFF;
+	}
+	hFileOut = strcmp(outName, "-") ? fopen(outName, "wb") : stdout;
+	if (hFileOut == NULL)
+	{
+		fprintf(stderr, "Error opening %s!\n", outName);
+		if (hFileIn != stdin)
+			fclose(hFileIn);
+		return 0xFF;
+	}
+	
+	if (hFileOut != stdout)
+	{
+		retVal = Syx2Mid(hFileIn, hFileOut);
+	}
+	else
 	{
-		printf("Error opening file!\n");
-		return 1;
+		// The track length has to be written after the data, so stdout goes through a temporary file.
+		hFileTmp = tmpfile();
+		if (hFileTmp == NULL)
+		{
+			fprintf(stderr, "Error creating temporary file!\n");
+			retVal = 0xFF;
+		}
+		else
+		{
+			retVal = Syx2Mid(hFileIn, hFileTmp);
+			rewind(hFileTmp);
+			while(! retVal && (readLen = fread(buffer, 0x01, sizeof(buffer), hFileTmp)) > 0)
+			{
+				if (fwrite(buffer, 0x01, readLen, hFileOut) != readLen)
+					retVal = 0x80;
+			}
+			fclose(hFileTmp);
+		}
+		fflush(stdout);
 	}
+	if (retVal == 0x80)
+		fprintf(stderr, "Error writing %s!\n", outName);
 	
-	fseek(hFile, 0x00, SEEK_END);
-	SyxLen = ftell(hFile);
-	if (SyxLen > 0x100000)
-		SyxLen = 0x100000;
+	if (hFileOut != stdout)
+		fclose(hFileOut);
+	if (hFileIn != stdin)
+		fclose(hFileIn);
 	
-	fseek(hFile, 0x00, SEEK_SET);
-	SyxData = (UINT8*)malloc(SyxLen);
-	fread(SyxData, 0x01, SyxLen, hFile);
+	return retVal;
+}
+
+static char* GetBatchOutName(const char* inName, const char* newExt)
+{
+	char* outName;
+	char* extPos;
 	
-	fclose(hFile);
+	if (! strcmp(inName, "-"))
+	{
+		outName = (char*)malloc(0x02);
+		strcpy(outName, "-");
+		return outName;
+	}
+	outName = (char*)malloc(strlen(inName) + strlen(newExt) + 1);
+	strcpy(outName, inName);
+	extPos = strrchr(outName, '.');
+	if (extPos != NULL && extPos > GetLastDirSepPos(outName))
+		*extPos = '\0';
+	strcat(outName, newExt);
 	
-	retVal = Syx2Mid();
-	if (! retVal)
-		WriteFileData(MidLen, MidData, argv[argbase + 1]);
-	free(MidData);	MidData = NULL;
-	free(SyxData);	SyxData = NULL;
+	return outName;
+}
+
+static const char* GetLastDirSepPos(const char* fileName)
+{
+	const char* sepPos;
+	const char* wSepPos;	// Windows separator
 	
-	return 0;
+	sepPos = strrchr(fileName, '/');
+	wSepPos = strrchr(fileName, '\\');
+	if (wSepPos == NULL)
+		return sepPos;
+	else if (sepPos == NULL)
+		return wSepPos;
+	return (wSepPos > sepPos) ? wSepPos : sepPos;
 }
 
-UINT8 Syx2Mid(void)
+// Reads the SYX data event by event and writes each MIDI event right away,
+// so only the largest SysEx message has to fit into memory.
+// Returns 0x80 for write errors and 0xFF when running out of memory.
+UINT8 Syx2Mid(FILE* hFileIn, FILE* hFileOut)
 {
 	FILE_INF midFileInf;
 	UINT32 trkBasePos;
-	UINT32 inPos;
+	UINT32 trkLen;
 	UINT32 evtLen;
+	UINT32 evtAlloc;
+	UINT8* evtData;
 	UINT8 tempArr[4];
-	UINT32 ticksSec;	// ticks per second
+	SYX_SCHED syxSched;
+	UINT32 curTick;
+	UINT32 sendTick;
 	UINT32 delay;
+	UINT8 retVal;
 	
-	midFileInf.alloc = SyxLen * 3 / 2 + 0x20;
+	midFileInf.alloc = 0x100;
 	midFileInf.data = (UINT8*)malloc(midFileInf.alloc);
 	midFileInf.pos = 0x00;
+	evtAlloc = 0x100;
+	evtData = (UINT8*)malloc(evtAlloc);
+	if (midFileInf.data == NULL || evtData == NULL)
+	{
+		fprintf(stderr, "Not enough memory!\n");
+		free(midFileInf.data);
+		free(evtData);
+		return 0xFF;
+	}
 	
 	WriteMidiHeader(&midFileInf, 0, 1, MIDI_RES);
 	
@@ -113,84 +256,136 @@ UINT8 Syx2Mid(void)
 	WriteBE32(&midFileInf.data[midFileInf.pos + 0x04], 0x00000000);	// write dummy length
 	midFileInf.pos += 0x08;
 	trkBasePos = midFileInf.pos;
+	trkLen = 0x00;
+	retVal = FlushEventData(&midFileInf, hFileOut, NULL);
 	
 	WriteBE32(tempArr, MIDI_TEMPO);
 	WriteMetaEvent(&midFileInf, 0, 0x51, 0x03, &tempArr[0x01]);
-	ticksSec = MIDI_RES * 1000000 / MIDI_TEMPO;
+	retVal |= FlushEventData(&midFileInf, hFileOut, &trkLen);
 	
-	inPos = 0x00;
-	delay = 0;
-	while(inPos < SyxLen)
+	SyxSched_Init(&syxSched, SyxDevice);
+	curTick = 0;
+	while(! retVal)
 	{
-		evtLen = GetEventLength(inPos);
+		evtLen = ReadSyxEvent(hFileIn, &evtAlloc, &evtData);
 		if (! evtLen)
 			break;
+		if (evtLen == (UINT32)-1)
+		{
+			fprintf(stderr, "Not enough memory for a SysEx message of more than %u bytes!\n", evtAlloc);
+			retVal = 0xFF;
+			break;
+		}
 		
-		if (SyxData[inPos] < 0xF0)
+		// MIDI data is sent via UART at 31250 bps, so the scheduler starts with 3125 bytes per second
+		// and adds the time the device needs to process the data.
+		sendTick = SyxSched_Time2Tick(SyxSched_Add(&syxSched, 0, evtLen,
+						SyxSched_IsReset(evtLen, evtData) ? SYXSCHED_RESET : 0x00), MIDI_RES, MIDI_TEMPO);
+		delay = sendTick - curTick;
+		curTick = sendTick;
+		
+		if (midFileInf.alloc < evtLen + 0x10)
+		{
+			UINT8* newData = (UINT8*)realloc(midFileInf.data, evtLen + 0x10);
+			if (newData == NULL)
+			{
+				fprintf(stderr, "Not enough memory for a SysEx message of %u bytes!\n", evtLen);
+				retVal = 0xFF;
+				break;
+			}
+			midFileInf.alloc = evtLen + 0x10;
+			midFileInf.data = newData;
+		}
+		if (evtData[0x00] < 0xF0)
 		{
 			WriteMidiValue(&midFileInf, delay);
-			memcpy(&midFileInf.data[midFileInf.pos], &SyxData[inPos], evtLen);
+			memcpy(&midFileInf.data[midFileInf.pos], evtData, evtLen);
 			midFileInf.pos += evtLen;
 		}
 		else
 		{
-			WriteLongEvent(&midFileInf, delay, SyxData[inPos], evtLen - 1, &SyxData[inPos + 1]);
+			WriteLongEvent(&midFileInf, delay, evtData[0x00], evtLen - 1, &evtData[0x01]);
 		}
-		inPos += evtLen;
-		// MIDI data is sent via UART at 31250 bps.
-		// For each byte of data, 10 bits are sent. (1 start bit, 8 bits of data, 1 stop bit)
-		// Thus, we get a transfer rate of 3125 data bytes per second.
-		delay = (ticksSec * evtLen + 3124) / 3125;	// calculate with integer ceil()
+		retVal |= FlushEventData(&midFileInf, hFileOut, &trkLen);
 	}
+	free(evtData);
 	
+	// end the track when the device has processed everything
+	delay = SyxSched_Time2Tick(SyxSched_GetEndTime(&syxSched), MIDI_RES, MIDI_TEMPO) - curTick;
 	WriteMetaEvent(&midFileInf, delay, 0x2F, 0x00, NULL);
-	WriteBE32(&midFileInf.data[trkBasePos - 0x04], midFileInf.pos - trkBasePos);	// write Track Length
+	retVal |= FlushEventData(&midFileInf, hFileOut, &trkLen);
+	free(midFileInf.data);
 	
-	MidData = midFileInf.data;
-	MidLen = midFileInf.pos;
-	return 0x00;
+	// write Track Length
+	WriteBE32(tempArr, trkLen);
+	if (fseek(hFileOut, trkBasePos - 0x04, SEEK_SET) || fwrite(tempArr, 0x01, 0x04, hFileOut) != 0x04)
+		retVal |= 0x80;
+	
+	return retVal;
 }
 
-static UINT32 GetEventLength(UINT32 startPos)
+// Reads one event. Returns its length, 0 at the end of the data or (UINT32)-1 when out of memory.
+static UINT32 ReadSyxEvent(FILE* hFile, UINT32* bufSize, UINT8** buffer)
 {
-	UINT8 evtType;
-	UINT32 curPos;
+	UINT8* evtData;
+	UINT32 evtLen;
+	UINT32 dataLen;
+	int inByte;
 	
-	curPos = startPos;
-	evtType = SyxData[curPos];	curPos ++;
-	if (evtType < 0x80)
+	evtData = *buffer;
+	inByte = getc(hFile);
+	if (inByte == EOF || inByte < 0x80)
 		return 0;
-	if (evtType < 0xF0)
-		return ((evtType & 0xE0) == 0xC0) ? 0x02 : 0x03;
-	switch(evtType)
+	evtData[0x00] = (UINT8)inByte;
+	evtLen = 0x01;
+	if (inByte < 0xF0)
 	{
-	case 0xF0:
-	case 0xF7:
-		while(curPos < SyxLen && ! (SyxData[curPos] & 0x80))
-			curPos ++;
-		if (curPos < SyxLen && SyxData[curPos] == 0xF7)
-			curPos ++;	// skip last F7 byte
-		return curPos - startPos;
-	default:
+		dataLen = ((inByte & 0xE0) == 0xC0) ? 0x02 : 0x03;
+		evtLen += (UINT32)fread(&evtData[0x01], 0x01, dataLen - 0x01, hFile);
+		return (evtLen == dataLen) ? evtLen : 0;
+	}
+	if (inByte != 0xF0 && inByte != 0xF7)
 		return 0;
+	
+	while((inByte = getc(hFile)) != EOF)
+	{
+		if (inByte & 0x80)
+		{
+			if (inByte != 0xF7)
+			{
+				ungetc(inByte, hFile);	// the next event begins here
+				break;
+			}
+		}
+		if (evtLen >= *bufSize)
+		{
+			evtData = (UINT8*)realloc(evtData, *bufSize * 2);
+			if (evtData == NULL)
+				return (UINT32)-1;
+			*bufSize *= 2;
+			*buffer = evtData;
+		}
+		evtData[evtLen] = (UINT8)inByte;
+		evtLen ++;
+		if (inByte == 0xF7)
+			break;	// include last F7 byte
 	}
+	
+	return evtLen;
 }
 
-static UINT8 WriteFileData(UINT32 dataLen, const UINT8* data, const char* fileName)
+static UINT8 FlushEventData(FILE_INF* fInf, FILE* hFile, UINT32* trkLen)
 {
-	FILE* hFile;
+	UINT32 wrtLen;
 	
-	hFile = fopen(fileName, "wb");
-	if (hFile == NULL)
-	{
-		printf("Error opening %s!\n", fileName);
-		return 0xFF;
-	}
+	wrtLen = (UINT32)fwrite(fInf->data, 0x01, fInf->pos, hFile);
+	if (wrtLen != fInf->pos)
+		return 0x80;
+	if (trkLen != NULL)
+		*trkLen += fInf->pos;
+	fInf->pos = 0x00;
 	
-	fwrite(data, 0x01, dataLen, hFile);
-	fclose(hFile);
-	
-	return 0;
+	return 0x00;
 }
 
 static void WriteMidiHeader(FILE_INF* fInf, UINT16 format, UINT16 tracks, UINT16 resolution)
@@ -0,0 +1,184 @@
+// SysEx Scheduler
+// ---------------
+// to be included as header file
+//
+// Calculates when SysEx messages can be sent to a device without overflowing its receive buffer.
+// The device receives data via UART (3125 bytes per second) into a buffer of limited size and
+// processes the messages one after another. A message stays in the buffer until it is processed.
+// Each message is scheduled as early as possible, which gives the shortest init time that is still safe.
+//  const SYX_DEVICE* SyxSched_FindDevice(const char* name);
+//      Returns the device profile with the given name or NULL if there is none.
+//  void SyxSched_Init(SYX_SCHED* ss, const SYX_DEVICE* dev);
+//      Initializes the scheduler for a device. All times are in microseconds, starting at 0.
+//  UINT8 SyxSched_IsReset(UINT32 len, const UINT8* data);
+//      Returns 1 if the message (starting with F0) is a GM/GS/XG/MT-32 reset, else 0.
+//  UINT64 SyxSched_Add(SYX_SCHED* ss, UINT64 minTime, UINT32 len, UINT8 flags);
+//      Schedules a message of "len" bytes (including F0/F7) that must not be sent before "minTime".
+//      Returns the time when it can be sent. Set SYXSCHED_RESET in "flags" for reset messages.
+//  UINT64 SyxSched_GetEndTime(const SYX_SCHED* ss);
+//      Returns the time when the device has processed all messages.
+//  UINT32 SyxSched_Time2Tick(UINT64 time, UINT32 tickRes, UINT32 tempo);
+//      Converts a time to MIDI ticks, rounding up. "tempo" is in microseconds per quarter.
+
+#ifndef __SYX_SCHED_H__
+#define __SYX_SCHED_H__
+
+#include <stddef.h>	// for NULL
+#include <string.h>
+#include "stdtype.h"
+
+// INLINE: callers that build their own reset detection (like rcp2mid) don't use all functions.
+#ifndef INLINE
+#if defined(_MSC_VER)
+#define INLINE	static __inline
+#elif defined(__GNUC__)
+#define INLINE	static __inline__
+#else
+#define INLINE	static inline
+#endif
+#endif	// INLINE
+
+#define SYXSCHED_BYTE_TIME	320	// MIDI UART: 31250 bps, 10 bits per byte -> 320 us per byte
+#define SYXSCHED_MAX_PEND	0x40	// number of messages that can be tracked in the receive buffer
+#define SYXSCHED_RESET		0x01
+
+typedef struct _syx_device
+{
+	const char* name;
+	UINT32 bufSize;		// receive buffer size in bytes (0 = unlimited)
+	UINT32 msgTime;		// processing time per message (us)
+	UINT32 byteTime;	// additional processing time per byte (us)
+	UINT32 resetTime;	// time after a reset, nothing can be received during that time (us)
+} SYX_DEVICE;
+
+typedef struct _syx_pending
+{
+	UINT64 procEnd;	// time when the message is processed and its buffer space is free again
+	UINT32 len;
+} SYX_PENDING;
+
+typedef struct _syx_scheduler
+{
+	const SYX_DEVICE* dev;
+	UINT64 sendEnd;	// time when the UART is free again
+	UINT64 procEnd;	// time when the device has processed all messages
+	UINT32 bufUsed;	// bytes in the receive buffer
+	UINT16 pendFirst;
+	UINT16 pendCnt;
+	SYX_PENDING pend[SYXSCHED_MAX_PEND];
+} SYX_SCHED;
+
+
+// The values are conservative estimates. They leave enough room for old MT-32 ROMs, which
+// are known to lose data when bulk dumps are sent back-to-back, and for the Sound Canvas
+// needing some time after a GS reset.
+static const SYX_DEVICE SYXSCHED_DEVICES[] =
+{
+	{"uart",	0x000,     0,  0,      0},	// UART timing only
+	{"mt32",	0x100, 10000, 40, 400000},	// MT-32/CM-32L/CM-64
+	{"sc55",	0x200,  2000, 20,  50000},	// SC-55/SC-88 and other GS devices
+	{NULL,		0x000,     0,  0,      0},
+};
+
+INLINE const SYX_DEVICE* SyxSched_FindDevice(const char* name)
+{
+	const SYX_DEVICE* dev;
+	
+	for (dev = SYXSCHED_DEVICES; dev->name != NULL; dev ++)
+	{
+		if (! strcmp(dev->name, name))
+			return dev;
+	}
+	return NULL;
+}
+
+INLINE void SyxSched_Init(SYX_SCHED* ss, const SYX_DEVICE* dev)
+{
+	ss->dev = dev;
+	ss->sendEnd = 0;
+	ss->procEnd = 0;
+	ss->bufUsed = 0;
+	ss->pendFirst = 0;
+	ss->pendCnt = 0;
+	
+	return;
+}
+
+INLINE UINT8 SyxSched_IsReset(UINT32 len, const UINT8* data)
+{
+	static const UINT8 GM_RESET[0x06] = {0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7};
+	static const UINT8 GS_RESET[0x0B] = {0xF0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7};
+	static const UINT8 XG_RESET[0x09] = {0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7};
+	static const UINT8 MT32_RESET[0x08] = {0xF0, 0x41, 0x10, 0x16, 0x12, 0x7F, 0x00, 0x00};
+	
+	// the device ID (low nibble of byte 2) is ignored
+	if (len < 0x06 || data[0x00] != 0xF0)
+		return 0;
+	if (len == 0x06 && data[0x01] == 0x7E && ! memcmp(&data[0x03], &GM_RESET[0x03], 0x03))
+		return 1;
+	if (len == 0x0B && data[0x01] == 0x41 && ! memcmp(&data[0x03], &GS_RESET[0x03], 0x08))
+		return 1;
+	if (len == 0x09 && data[0x01] == 0x43 && ! memcmp(&data[0x03], &XG_RESET[0x03], 0x06))
+		return 1;
+	if (len >= 0x08 && data[0x01] == 0x41 && ! memcmp(&data[0x03], &MT32_RESET[0x03], 0x05))
+		return 1;
+	return 0;
+}
+
+INLINE UINT64 SyxSched_Add(SYX_SCHED* ss, UINT64 minTime, UINT32 len, UINT8 flags)
+{
+	const SYX_DEVICE* dev = ss->dev;
+	SYX_PENDING* pend;
+	UINT64 sendTime;
+	UINT64 recvEnd;
+	
+	sendTime = (minTime > ss->sendEnd) ? minTime : ss->sendEnd;
+	// The messages are processed in order, so the buffer is freed from the oldest message on.
+	// Wait until the new message fits. (A message larger than the buffer needs an idle device.)
+	while(ss->pendCnt > 0)
+	{
+		pend = &ss->pend[ss->pendFirst];
+		if (pend->procEnd > sendTime)
+		{
+			if (ss->bufUsed + len <= dev->bufSize && ss->pendCnt < SYXSCHED_MAX_PEND)
+				break;
+			sendTime = pend->procEnd;
+		}
+		ss->bufUsed -= pend->len;
+		ss->pendFirst = (ss->pendFirst + 1) % SYXSCHED_MAX_PEND;
+		ss->pendCnt --;
+	}
+	
+	recvEnd = sendTime + (UINT64)len * SYXSCHED_BYTE_TIME;
+	if (ss->procEnd < recvEnd)
+		ss->procEnd = recvEnd;
+	if (flags & SYXSCHED_RESET)
+		ss->procEnd += dev->resetTime;
+	else
+		ss->procEnd += dev->msgTime + (UINT64)len * dev->byteTime;
+	ss->sendEnd = (flags & SYXSCHED_RESET) ? ss->procEnd : recvEnd;
+	
+	if (dev->bufSize > 0)
+	{
+		pend = &ss->pend[(ss->pendFirst + ss->pendCnt) % SYXSCHED_MAX_PEND];
+		pend->procEnd = ss->procEnd;
+		pend->len = len;
+		ss->bufUsed += len;
+		ss->pendCnt ++;
+	}
+	
+	return sendTime;
+}
+
+INLINE UINT64 SyxSched_GetEndTime(const SYX_SCHED* ss)
+{
+	return (ss->procEnd > ss->sendEnd) ? ss->procEnd : ss->sendEnd;
+}
+
+INLINE UINT32 SyxSched_Time2Tick(UINT64 time, UINT32 tickRes, UINT32 tempo)
+{
+	// ticks = time * tickRes / tempo, rounded up so that the message isn't sent too early
+	return (UINT32)((time * tickRes + tempo - 1) / tempo);
+}
+
+#endif	// __SYX_SCHED_H__
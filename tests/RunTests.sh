@@ -0,0 +1,37 @@
+#!/bin/bash
+# Builds and runs all tests (*_test.c) in this directory.
+# Usage: tests/RunTests.sh [test names ...]
+# Additional compiler flags can be passed using the CFLAGS environment variable.
+# The script exits with 1 when any test fails to build or run.
+
+cd "$(dirname "$0")"
+BINDIR=".bin"
+CFLAGS="${CFLAGS:--O2}"
+mkdir -p "$BINDIR"
+
+if [ $# -gt 0 ]; then
+	tests=("$@")
+else
+	tests=()
+	for src in *_test.c; do
+		tests+=("${src%.c}")
+	done
+fi
+
+failed=0
+for test in "${tests[@]}"; do
+	test="${test%.c}"
+	if ! gcc $CFLAGS -o "$BINDIR/$test" "$test.c" -lm -pthread; then
+		echo "$test: BUILD FAILED"
+		failed=1
+		continue
+	fi
+	if "$BINDIR/$test"; then
+		echo "$test: passed"
+	else
+		echo "$test: FAILED"
+		failed=1
+	fi
+done
+
+exit $failed
@@ -0,0 +1,277 @@
+// Equivalence test for chip_tables.h
+// ----------------------------------
+// Compares every table entry with the functions that the converters used before the tables existed.
+// (The reference functions below are copied from M2MidiDec.c, Sys32MidiDec.c and toutrun2mid.c.)
+// Build: gcc -O2 -o chip_tables_test chip_tables_test.c -lm
+// Returns 0 when all entries match, 1 otherwise.
+#include <stdio.h>
+
+#define SCSP_TABLES
+#define SEGAPCM_TABLES
+#include "../chip_tables.h"
+
+static UINT8 Ref_DB2MidiVol(float DB);
+static UINT8 Ref_TrkVol2MidiVol(UINT8 Volume);
+static UINT8 Ref_NoteVel2MidiVol(const UINT8* VelTable, UINT8 Velocity);
+static INT16 Ref_RoundTo16(double Value);
+static INT16 Ref_SCSPtoSF2Rate(UINT16 SCSPRate, UINT8 IsAtk);
+static INT16 Ref_SCSPtoSF2Level(UINT16 SCSPLevel);
+static UINT8 Ref_DB2Mid(double DB);
+static double Ref_Lin2DB(double LinVol);
+static UINT8 Ref_GetPCMVol(const UINT8 VolL, const UINT8 VolR, const double VolMul);
+static UINT8 Ref_GetPCMPan(const UINT8 VolL, const UINT8 VolR, double* RetVolFact);
+
+
+// M2MidiDec velocity table
+static const UINT8 VELOC_DATA[0x80] =
+{	0x00, 0x09, 0x11, 0x19, 0x21, 0x25, 0x29, 0x2D, 0x31, 0x35, 0x39, 0x3D, 0x41, 0x45, 0x49, 0x4D,
+	0x51, 0x55, 0x59, 0x5D, 0x61, 0x69, 0x71, 0x79, 0x81, 0x85, 0x89, 0x8D, 0x91, 0x95, 0x99, 0x9D,
+	0xA1, 0xA3, 0xA5, 0xA7, 0xA9, 0xAB, 0xAD, 0xAF, 0xB1, 0xB3, 0xB5, 0xB7, 0xB9, 0xBB, 0xBD, 0xBF,
+	0xC1, 0xC5, 0xC9, 0xCD, 0xD1, 0xD5, 0xD9, 0xDD, 0xE1, 0xE1, 0xE3, 0xE3, 0xE5, 0xE5, 0xE7, 0xE7,
+	0xE9, 0xE9, 0xE9, 0xE9, 0xEB, 0xEB, 0xEB, 0xEB, 0xED, 0xED, 0xED, 0xED, 0xEF, 0xEF, 0xEF, 0xEF,
+	0xF1, 0xF1, 0xF1, 0xF1, 0xF3, 0xF3, 0xF3, 0xF3, 0xF5, 0xF5, 0xF5, 0xF5, 0xF7, 0xF7, 0xF7, 0xF7,
+	0xF9, 0xF9, 0xF9, 0xF9, 0xFB, 0xFB, 0xFB, 0xFB, 0xFB, 0xFB, 0xFB, 0xFB, 0xFD, 0xFD, 0xFD, 0xFD,
+	0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFD, 0xFF, 0xFF, 0xFF, 0xFF};
+
+int main(void)
+{
+	UINT32 errCnt;
+	UINT16 curVal;
+	UINT8 volL;
+	UINT8 volR;
+	double volMul;
+	UINT8 refVal;
+	
+	errCnt = 0;
+	
+	// Sys32MidiDec: no velocity table (velocity is used 1:1)
+	SCSP_InitTables(NULL);
+	for (curVal = 0x00; curVal < 0x100; curVal ++)
+	{
+		refVal = Ref_NoteVel2MidiVol(NULL, (UINT8)curVal);
+		if (SCSP_Vel2Mid[curVal] != refVal)
+		{
+			printf("SCSP_Vel2Mid[%02X] (no table): %02X != %02X\n", curVal, SCSP_Vel2Mid[curVal], refVal);
+			errCnt ++;
+		}
+	}
+	
+	// M2MidiDec
+	SCSP_InitTables(VELOC_DATA);
+	for (curVal = 0x00; curVal < 0x100; curVal ++)
+	{
+		refVal = Ref_TrkVol2MidiVol((UINT8)curVal);
+		if (SCSP_Vol2Mid[curVal] != refVal)
+		{
+			printf("SCSP_Vol2Mid[%02X]: %02X != %02X\n", curVal, SCSP_Vol2Mid[curVal], refVal);
+			errCnt ++;
+		}
+		refVal = Ref_NoteVel2MidiVol(VELOC_DATA, (UINT8)curVal);
+		if (SCSP_Vel2Mid[curVal] != refVal)
+		{
+			printf("SCSP_Vel2Mid[%02X]: %02X != %02X\n", curVal, SCSP_Vel2Mid[curVal], refVal);
+			errCnt ++;
+		}
+	}
+	for (curVal = 0x00; curVal < 0x20; curVal ++)
+	{
+		if (SCSP_AR2SF2[curVal] != Ref_SCSPtoSF2Rate(curVal, 1))
+		{
+			printf("SCSP_AR2SF2[%02X]: %d != %d\n", curVal, SCSP_AR2SF2[curVal], Ref_SCSPtoSF2Rate(curVal, 1));
+			errCnt ++;
+		}
+		if (SCSP_DR2SF2[curVal] != Ref_SCSPtoSF2Rate(curVal, 0))
+		{
+			printf("SCSP_DR2SF2[%02X]: %d != %d\n", curVal, SCSP_DR2SF2[curVal], Ref_SCSPtoSF2Rate(curVal, 0));
+			errCnt ++;
+		}
+		if (SCSP_DL2SF2[curVal] != Ref_SCSPtoSF2Level(curVal))
+		{
+			printf("SCSP_DL2SF2[%02X]: %d != %d\n", curVal, SCSP_DL2SF2[curVal], Ref_SCSPtoSF2Level(curVal));
+			errCnt ++;
+		}
+	}
+	
+	// toutrun2mid
+	SegaPCM_InitTables();
+	for (volL = 0x00; volL < 0x40; volL ++)
+	{
+		for (volR = 0x00; volR < 0x40; volR ++)
+		{
+			refVal = Ref_GetPCMPan(volL, volR, &volMul);
+			if (SegaPCM_Pan2Mid[volL][volR] != refVal)
+			{
+				printf("SegaPCM_Pan2Mid[%02X][%02X]: %02X != %02X\n", volL, volR, SegaPCM_Pan2Mid[volL][volR], refVal);
+				errCnt ++;
+			}
+			refVal = Ref_GetPCMVol(volL, volR, volMul);
+			if (SegaPCM_Vol2Mid[volL][volR] != refVal)
+			{
+				printf("SegaPCM_Vol2Mid[%02X][%02X]: %02X != %02X\n", volL, volR, SegaPCM_Vol2Mid[volL][volR], refVal);
+				errCnt ++;
+			}
+		}
+	}
+	
+	printf("chip_tables: %u mismatches\n", errCnt);
+	return errCnt ? 1 : 0;
+}
+
+
+static UINT8 Ref_DB2MidiVol(float DB)
+{
+	float TempSng;
+	
+	TempSng = (float)pow(10.0, DB / 40.0);
+	if (TempSng > 1.0f)
+		TempSng = 1.0f;
+	return (UINT8)(TempSng * 0x7F + 0.5);
+}
+
+static UINT8 Ref_TrkVol2MidiVol(UINT8 Volume)
+{
+	// Volume is 00..7F
+	// The driver scales it up to 00 (min) to FF (max). One step is 0.1875 db.
+	// So the non-scaled volume uses 0.375 db steps.
+	UINT8 DBVal;
+	float DBFlt;
+	
+	if (! Volume)
+		return 0x00;
+	
+	DBVal = Volume ^ 0x7F;	// 00..7F -> 7F..00
+	DBFlt = DBVal * -0.375f;
+	return Ref_DB2MidiVol(DBFlt);
+}
+
+static UINT8 Ref_NoteVel2MidiVol(const UINT8* VelTable, UINT8 Velocity)
+{
+	UINT8 DBVal;
+	float DBFlt;
+	
+	if (VelTable == NULL)
+		return Velocity;	// Sys32MidiDec
+	if (! Velocity)
+		return 0x00;
+	
+	DBVal = VelTable[Velocity & 0x7F];
+	// Every entry in the table has bit 0 set, so
+	// I'll scale it down to 00..7F here.
+	DBVal = (DBVal >> 1) ^ 0x7F;
+	DBFlt = DBVal * -0.375f;
+	return Ref_DB2MidiVol(DBFlt);
+}
+
+static INT16 Ref_RoundTo16(double Value)
+{
+	if (Value <= -32768.0)
+		return -32768;
+	else if (Value >= 32767.0)
+		return 32767;
+	
+	if (Value < 0.0)
+		return (INT16)(Value - 0.5);
+	else
+		return (INT16)(Value + 0.5);
+}
+
+static INT16 Ref_SCSPtoSF2Rate(UINT16 SCSPRate, UINT8 IsAtk)
+{
+	// from MAME's scsp.c
+	static const double ARTimes[64] = 
+	{	100000,100000,8100.0,6900.0,6000.0,4800.0,4000.0,3400.0,3000.0,2400.0,2000.0,1700.0,1500.0,
+		1200.0,1000.0,860.0,760.0,600.0,500.0,430.0,380.0,300.0,250.0,220.0,190.0,150.0,130.0,110.0,95.0,
+		76.0,63.0,55.0,47.0,38.0,31.0,27.0,24.0,19.0,15.0,13.0,12.0,9.4,7.9,6.8,6.0,4.7,3.8,3.4,3.0,2.4,
+		2.0,1.8,1.6,1.3,1.1,0.93,0.85,0.65,0.53,0.44,0.40,0.35,0.0,0.0};
+	static const double DRTimes[64] =
+	{	100000,100000,118200.0,101300.0,88600.0,70900.0,59100.0,50700.0,44300.0,35500.0,29600.0,25300.0,22200.0,17700.0,
+		14800.0,12700.0,11100.0,8900.0,7400.0,6300.0,5500.0,4400.0,3700.0,3200.0,2800.0,2200.0,1800.0,1600.0,1400.0,1100.0,
+		920.0,790.0,690.0,550.0,460.0,390.0,340.0,270.0,230.0,200.0,170.0,140.0,110.0,98.0,85.0,68.0,57.0,49.0,43.0,34.0,
+		28.0,25.0,22.0,18.0,14.0,12.0,11.0,8.5,7.1,6.1,5.4,4.3,3.6,3.1};
+	double RateVal;
+	
+	if (SCSPRate == 0x00)
+		return 32767;	// infinite
+	
+	if (IsAtk)
+		RateVal = ARTimes[SCSPRate * 2];
+	else
+		RateVal = DRTimes[SCSPRate * 2];
+	if (RateVal == 0.0)	// I *can* do that here, since I just copied it from the table,
+		return -32768;	// instant
+	
+	return Ref_RoundTo16(1200 * log(RateVal / 1000.0) / log(2.0));
+}
+
+static INT16 Ref_SCSPtoSF2Level(UINT16 SCSPLevel)
+{
+	double LinLevel;
+	double DBLevel;
+	
+	if (SCSPLevel >= 0x1F)
+		return 32767;
+	
+	LinLevel = (SCSPLevel ^ 0x1F) / 31.0;
+	DBLevel = log(LinLevel) / log(2.0) * 6.0;
+	return (INT16)(DBLevel * -10.0 + 0.5);
+}
+
+static UINT8 Ref_DB2Mid(double DB)
+{
+	//DB += 6.0;
+	if (DB > 0.0)
+		DB = 0.0;
+	return (UINT8)(pow(10.0, DB / 40.0) * 0x7F + 0.5);
+}
+
+static double Ref_Lin2DB(double LinVol)
+{
+	//return log(LinVol / 126.0) / log(2.0) * 6.0;
+	return log(LinVol / 126.0) * 8.65617024533378;
+}
+
+static UINT8 Ref_GetPCMVol(const UINT8 VolL, const UINT8 VolR, const double VolMul)
+{
+	double DBVol;
+	UINT8 FinVol;
+	
+	DBVol = Ref_Lin2DB((VolL + VolR) * VolMul);
+	FinVol = Ref_DB2Mid(DBVol);
+	if (FinVol <= 0)
+		FinVol = 1;
+	else if (FinVol > 0x7F)
+		FinVol = 0x7F;
+	return FinVol;
+}
+
+static UINT8 Ref_GetPCMPan(const UINT8 VolL, const UINT8 VolR, double* RetVolFact)
+{
+	// GM Pan Formula:
+	//	PanAmount = (PanCtrlVal - 1) / 126
+	//	Left  Channel Gain [dB] = 20 * log10(cos(Pi / 2 * PanAmount))
+	//	Right Channel Gain [dB] = 20 * log10(sin(Pi / 2 * PanAmount))
+	double VolDiff;
+	double VolBoost;
+	double PanAngle;
+	double PanVal;
+	UINT8 FinPan;
+	
+	if (VolL == VolR)
+	{
+		if (RetVolFact != NULL)
+			*RetVolFact = 1.0;
+		return 0x40;
+	}
+	VolDiff = VolR / (double)(VolL + VolR);
+	
+	PanAngle = atan2(VolDiff, 1.0 - VolDiff);
+	VolBoost = M_SQRT2 / (cos(PanAngle) + sin(PanAngle));
+	PanVal = PanAngle / M_PI_2;
+	
+	FinPan = (UINT8)(PanVal * 0x80 + 0.5);	// actually the range is 1..126, but this looks nicer
+	if (FinPan > 0x7F)
+		FinPan = 0x7F;
+	if (RetVolFact != NULL)
+		*RetVolFact = VolBoost;
+	return FinPan;
+}
@@ -0,0 +1,291 @@
+// Randomized test for the LZSS decoder of wtmd2mid
+// -------------------------------------------------
+// 1. Decodes random streams (also truncated ones and ones with too small output buffers)
+//    with LZSS_Decode and with Okumura's original decoder and compares the results.
+// 2. Compresses random data with a simple LZSS encoder and checks that LZSS_Decode restores it.
+// Build: gcc -O2 -fsanitize=address,undefined -o lzss_test lzss_test.c -lm
+// Usage: lzss_test [iterations] [seed]
+// Returns 0 when all checks pass, 1 otherwise.
+#include <stdio.h>
+#define main	wtmd2mid_main
+#include "../wtmd2mid.c"
+#undef main
+
+static UINT32 Rand32(void);
+static void RefDecode(UINT32 CmpLen, const UINT8* CmpData, UINT32 DecLen, UINT8* DecData);
+static void MakeRandomStream(UINT32 cmpLen, UINT8* cmpData);
+static void MakeRandomData(UINT32 dataLen, UINT8* data);
+static UINT32 SimpleEncode(UINT32 dataLen, const UINT8* data, UINT8* cmpData);
+static UINT32 TestRandomStream(void);
+static UINT32 TestRoundTrip(void);
+
+
+#define MAX_CMP_LEN	0x4000
+#define MAX_DEC_LEN	0x8000
+
+static UINT32 RandState = 1;
+
+int main(int argc, char* argv[])
+{
+	UINT32 iterations;
+	UINT32 curIter;
+	UINT32 errCnt;
+	UINT32 rtErrCnt;
+	
+	iterations = (argc > 1) ? (UINT32)strtoul(argv[1], NULL, 0) : 4000;
+	if (argc > 2)
+		RandState = (UINT32)strtoul(argv[2], NULL, 0) | 1;
+	
+	LZSS_Init();
+	
+	errCnt = 0;
+	rtErrCnt = 0;
+	for (curIter = 0; curIter < iterations; curIter ++)
+	{
+		errCnt += TestRandomStream();
+		if (! (curIter & 0x0F))
+			rtErrCnt += TestRoundTrip();
+	}
+	
+	printf("LZSS: %u iterations, %u decoder mismatches, %u round-trip errors\n", iterations, errCnt, rtErrCnt);
+	return (errCnt || rtErrCnt) ? 1 : 0;
+}
+
+static UINT32 Rand32(void)
+{
+	// xorshift32
+	RandState ^= RandState << 13;
+	RandState ^= RandState >> 17;
+	RandState ^= RandState << 5;
+	return RandState;
+}
+
+// LZSS.C by Haruhiko Okumura, as used by wtmd2mid before (with bounds checks on both streams)
+static void RefDecode(UINT32 CmpLen, const UINT8* CmpData, UINT32 DecLen, UINT8* DecData)
+{
+	UINT8 ring_buf[N + F - 1];
+	int  i, j, k, r;
+	unsigned char c;
+	unsigned int  flags;
+	UINT32 CmpPos;
+	UINT32 DecPos;
+	
+	memset(ring_buf, 0x00, sizeof(ring_buf));
+	memcpy(ring_buf, text_buf, N);	// initial contents from LZSS_Init()
+	r = N - F;  flags = 0;
+	CmpPos = 0;
+	DecPos = 0;
+	for ( ; ; ) {
+		if (((flags >>= 1) & 256) == 0) {
+			if (CmpPos >= CmpLen) break;
+			c = CmpData[CmpPos ++];
+			flags = c | 0xff00;		/* uses higher byte cleverly */
+		}							/* to count eight */
+		if (flags & 1) {
+			if (CmpPos >= CmpLen) break;
+			c = CmpData[CmpPos ++];
+			if (DecPos >= DecLen) break;
+			DecData[DecPos ++] = c;
+			ring_buf[r++] = c;  r &= (N - 1);
+		} else {
+			if (CmpPos >= CmpLen) break;
+			i = CmpData[CmpPos ++];
+			if (CmpPos >= CmpLen) break;
+			j = CmpData[CmpPos ++];
+			i |= ((j & 0xf0) << 4);  j = (j & 0x0f) + THRESHOLD;
+			for (k = 0; k <= j; k++) {
+				c = ring_buf[(i + k) & (N - 1)];
+				if (DecPos >= DecLen) break;
+				DecData[DecPos ++] = c;
+				ring_buf[r++] = c;  r &= (N - 1);
+			}
+		}
+	}
+	return;
+}
+
+static void MakeRandomStream(UINT32 cmpLen, UINT8* cmpData)
+{
+	UINT32 curPos;
+	UINT8 mode;
+	
+	// mode 0: random, 1: mostly matches, 2: mostly literals (flag byte FF), 3: matches close to the output position
+	mode = Rand32() & 0x03;
+	for (curPos = 0; curPos < cmpLen; curPos ++)
+	{
+		cmpData[curPos] = (UINT8)Rand32();
+		if (! (curPos % 9))
+		{
+			if (mode == 1)
+				cmpData[curPos] &= 0x0F;
+			else if (mode == 2)
+				cmpData[curPos] = 0xFF;
+		}
+		else if (mode == 3 && (curPos % 9) == 2)
+		{
+			cmpData[curPos] = (cmpData[curPos] & 0x0F) | 0xF0;	// window position 0xFxx
+		}
+	}
+	
+	return;
+}
+
+static void MakeRandomData(UINT32 dataLen, UINT8* data)
+{
+	UINT32 curPos;
+	UINT32 runLen;
+	UINT32 srcPos;
+	
+	// random bytes mixed with repeated strings (also overlapping ones), so that there is something to compress
+	curPos = 0;
+	while(curPos < dataLen)
+	{
+		runLen = 1 + Rand32() % 40;
+		if (runLen > dataLen - curPos)
+			runLen = dataLen - curPos;
+		if (curPos > 0 && (Rand32() & 0x01))
+		{
+			srcPos = curPos - 1 - Rand32() % ((curPos < 0x100) ? curPos : 0x100);
+			for (; runLen; runLen --, curPos ++, srcPos ++)
+				data[curPos] = data[srcPos];
+		}
+		else
+		{
+			for (; runLen; runLen --, curPos ++)
+				data[curPos] = (UINT8)(Rand32() & 0x07);
+		}
+	}
+	
+	return;
+}
+
+// greedy LZSS encoder that only references the last 0x100 bytes of the data (or the space-filled part of the ring)
+static UINT32 SimpleEncode(UINT32 dataLen, const UINT8* data, UINT8* cmpData)
+{
+	UINT32 inPos;
+	UINT32 outPos;
+	UINT32 flagPos;
+	UINT8 curBit;
+	UINT32 srcPos;
+	UINT32 maxLen;
+	UINT32 curLen;
+	UINT32 bestLen;
+	UINT32 bestDist;
+	UINT16 winPos;
+	
+	inPos = 0;
+	outPos = 0;
+	while(inPos < dataLen)
+	{
+		flagPos = outPos;
+		cmpData[flagPos] = 0x00;
+		outPos ++;
+		for (curBit = 0; curBit < 8 && inPos < dataLen; curBit ++)
+		{
+			maxLen = dataLen - inPos;
+			if (maxLen > F)
+				maxLen = F;
+			bestLen = 0;
+			bestDist = 0;
+			for (srcPos = (inPos > 0x100) ? (inPos - 0x100) : 0; srcPos < inPos; srcPos ++)
+			{
+				// overlapping matches are allowed
+				for (curLen = 0; curLen < maxLen && data[srcPos + curLen] == data[inPos + curLen]; curLen ++)
+					;
+				if (curLen > bestLen)
+				{
+					bestLen = curLen;
+					bestDist = inPos - srcPos;
+				}
+			}
+			if (bestLen < THRESHOLD + 1 && inPos < 0x80 && maxLen >= THRESHOLD + 1)
+			{
+				// use the 0x20 bytes at the end of the initial ring buffer (AF80..AFED)
+				for (curLen = 0; curLen < maxLen && data[inPos + curLen] == 0x20; curLen ++)
+					;
+				if (curLen >= THRESHOLD + 1)
+				{
+					bestLen = curLen;
+					bestDist = 0;
+				}
+			}
+			
+			if (bestLen >= THRESHOLD + 1)
+			{
+				if (bestDist)
+					winPos = (UINT16)((N - F + inPos - bestDist) & (N - 1));
+				else
+					winPos = N - F - 0x20;
+				cmpData[outPos + 0] = (UINT8)(winPos & 0xFF);
+				cmpData[outPos + 1] = (UINT8)(((winPos >> 4) & 0xF0) | (bestLen - (THRESHOLD + 1)));
+				outPos += 2;
+				inPos += bestLen;
+			}
+			else
+			{
+				cmpData[flagPos] |= (1 << curBit);
+				cmpData[outPos] = data[inPos];
+				outPos ++;
+				inPos ++;
+			}
+		}
+	}
+	
+	return outPos;
+}
+
+static UINT32 TestRandomStream(void)
+{
+	static UINT8 cmpData[MAX_CMP_LEN];
+	UINT8* refData;
+	UINT8* decData;
+	UINT32 cmpLen;
+	UINT32 decLen;
+	UINT32 errCnt;
+	
+	// short streams are tested more often, as they hit the end conditions more often
+	cmpLen = Rand32() % ((Rand32() & 0x01) ? 0x40 : MAX_CMP_LEN);
+	decLen = Rand32() % ((Rand32() & 0x01) ? 0x80 : MAX_DEC_LEN);
+	MakeRandomStream(cmpLen, cmpData);
+	
+	// exact buffer sizes, so that ASan can catch overflows
+	refData = (UINT8*)malloc(decLen + 1);
+	decData = (UINT8*)malloc(decLen + 1);
+	memset(refData, 0xCC, decLen + 1);
+	memset(decData, 0xCC, decLen + 1);
+	RefDecode(cmpLen, cmpData, decLen, refData);
+	LZSS_Decode(cmpLen, cmpData, decLen, decData);
+	errCnt = memcmp(refData, decData, decLen + 1) ? 1 : 0;
+	if (errCnt)
+		printf("Mismatch: compressed size 0x%X, output size 0x%X\n", cmpLen, decLen);
+	free(refData);
+	free(decData);
+	
+	return errCnt;
+}
+
+static UINT32 TestRoundTrip(void)
+{
+	static UINT8 srcData[MAX_DEC_LEN];
+	static UINT8 cmpData[MAX_DEC_LEN + MAX_DEC_LEN / 8 + 1];
+	UINT8* decData;
+	UINT32 srcLen;
+	UINT32 cmpLen;
+	UINT32 errCnt;
+	
+	srcLen = Rand32() % MAX_DEC_LEN;
+	MakeRandomData(srcLen, srcData);
+	if (Rand32() & 0x01)
+		memset(srcData, 0x20, (srcLen < 0x20) ? srcLen : 0x20);
+	cmpLen = SimpleEncode(srcLen, srcData, cmpData);
+	
+	decData = (UINT8*)malloc(srcLen + 1);
+	memset(decData, 0xCC, srcLen + 1);
+	LZSS_Decode(cmpLen, cmpData, srcLen, decData);
+	errCnt = memcmp(srcData, decData, srcLen) ? 1 : 0;
+	if (errCnt)
+		printf("Round-trip error: size 0x%X, compressed 0x%X\n", srcLen, cmpLen);
+	free(decData);
+	
+	return errCnt;
+}
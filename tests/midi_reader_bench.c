@@ -0,0 +1,515 @@
+// Benchmark for midi_reader.h
+// ---------------------------
+// Parses a MIDI corpus in merged order, once with an unchecked reader that searches all tracks
+// for the next tick (the way Midi1to0 did it before) and once with SMF_ReadMergedEvent.
+// Both must return the same events in the same order. Reading the tracks one by one and
+// the merged reading with a tempo map (absolute times) are timed as well.
+// Build: gcc -O2 -o midi_reader_bench midi_reader_bench.c
+// Usage: midi_reader_bench [-s MB] [-t tracks] [-n repeats] [file.mid ...]
+// Without files, a synthetic corpus of 100 MB (-s) with 16 tracks (-t) is generated.
+// Returns 0 when both readers agree, 1 otherwise.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../stdtype.h"
+#include "../midi_reader.h"
+
+typedef struct _ref_track
+{
+	UINT32 curPos;
+	UINT32 endPos;
+	UINT32 tick;
+	UINT8 runStatus;
+} REF_TRACK;
+
+typedef struct _bench_result
+{
+	UINT32 evtCnt;
+	UINT32 checksum;
+	UINT64 lastTime;
+	clock_t clocks;
+} BENCH_RESULT;
+
+static UINT8 LoadFile(const char* fileName, UINT32* retSize, UINT8** retData);
+static UINT32 WriteVarLen(UINT8* buffer, UINT32 value);
+static UINT32 MakeSyntheticMIDI(UINT32 fileSize, UINT16 trkCnt, UINT8* fileData);
+static UINT32 EventChecksum(UINT32 checksum, UINT32 tick, UINT8 status, UINT32 len, const UINT8* data);
+static UINT32 ReadMIDIValue(const UINT8* data, UINT32* value);
+static UINT8 Ref_ReadMerged(UINT32 fileSize, const UINT8* fileData, BENCH_RESULT* result);
+static UINT8 SMF_BenchMerged(UINT32 fileSize, const UINT8* fileData, UINT8 useTime, BENCH_RESULT* result);
+static UINT8 SMF_BenchTracks(UINT32 fileSize, const UINT8* fileData, BENCH_RESULT* result);
+static UINT8 BenchFile(const char* name, UINT32 fileSize, const UINT8* fileData);
+static void PrintResult(const char* mode, UINT32 fileSize, const BENCH_RESULT* result);
+
+
+#define MAX_REF_TRACKS	0x1000
+
+static UINT32 REPEATS = 1;
+
+int main(int argc, char* argv[])
+{
+	int argbase;
+	UINT32 corpusMB;
+	UINT16 trkCnt;
+	UINT32 fileSize;
+	UINT8* fileData;
+	UINT8 retVal;
+	
+	corpusMB = 100;
+	trkCnt = 16;
+	argbase = 1;
+	while(argbase + 1 < argc && argv[argbase][0] == '-')
+	{
+		if (! strcmp(argv[argbase], "-s"))
+			corpusMB = (UINT32)strtoul(argv[argbase + 1], NULL, 0);
+		else if (! strcmp(argv[argbase], "-t"))
+			trkCnt = (UINT16)strtoul(argv[argbase + 1], NULL, 0);
+		else if (! strcmp(argv[argbase], "-n"))
+			REPEATS = (UINT32)strtoul(argv[argbase + 1], NULL, 0);
+		else
+			break;
+		argbase += 2;
+	}
+	if (! corpusMB || corpusMB > 0x800)
+		corpusMB = 100;
+	if (! trkCnt || trkCnt > MAX_REF_TRACKS)
+		trkCnt = 16;
+	if (! REPEATS)
+		REPEATS = 1;
+	
+	retVal = 0x00;
+	if (argbase >= argc)
+	{
+		fileSize = corpusMB << 20;
+		fileData = (UINT8*)malloc(fileSize);
+		if (fileData == NULL)
+		{
+			printf("Out of memory!\n");
+			return 1;
+		}
+		fileSize = MakeSyntheticMIDI(fileSize, trkCnt, fileData);
+		retVal |= BenchFile("(synthetic)", fileSize, fileData);
+		free(fileData);
+	}
+	for (; argbase < argc; argbase ++)
+	{
+		if (LoadFile(argv[argbase], &fileSize, &fileData))
+		{
+			printf("Error reading %s!\n", argv[argbase]);
+			retVal = 0xFF;
+			continue;
+		}
+		retVal |= BenchFile(argv[argbase], fileSize, fileData);
+		free(fileData);
+	}
+	
+	return retVal ? 1 : 0;
+}
+
+static UINT8 LoadFile(const char* fileName, UINT32* retSize, UINT8** retData)
+{
+	FILE* hFile;
+	long fileSize;
+	
+	hFile = fopen(fileName, "rb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	fileSize = -1;
+	if (! fseek(hFile, 0, SEEK_END))
+		fileSize = ftell(hFile);
+	if (fileSize < 0 || fseek(hFile, 0, SEEK_SET))
+	{
+		fclose(hFile);
+		return 0xFF;
+	}
+	*retData = (UINT8*)malloc(fileSize ? fileSize : 1);
+	if (*retData == NULL)
+	{
+		fclose(hFile);
+		return 0xFF;
+	}
+	*retSize = (UINT32)fread(*retData, 0x01, fileSize, hFile);
+	fclose(hFile);
+	
+	return 0x00;
+}
+
+static UINT32 WriteVarLen(UINT8* buffer, UINT32 value)
+{
+	UINT8 tempBuf[0x05];
+	UINT32 byteCnt;
+	UINT32 curPos;
+	
+	byteCnt = 0;
+	do
+	{
+		tempBuf[byteCnt] = (UINT8)(value & 0x7F);
+		value >>= 7;
+		byteCnt ++;
+	} while(value);
+	for (curPos = 0; curPos < byteCnt; curPos ++)
+		buffer[curPos] = tempBuf[byteCnt - 1 - curPos] | ((curPos < byteCnt - 1) ? 0x80 : 0x00);
+	
+	return byteCnt;
+}
+
+// Fills the buffer with a format 1 MIDI file: notes with running status, controllers,
+// pitch bends and SysEx messages on all tracks and tempo changes on the first one.
+// Returns the number of bytes used.
+static UINT32 MakeSyntheticMIDI(UINT32 fileSize, UINT16 trkCnt, UINT8* fileData)
+{
+	UINT32 trkSize;
+	UINT32 curPos;
+	UINT32 trkBase;
+	UINT32 trkEnd;
+	UINT16 curTrk;
+	UINT32 evtID;
+	UINT32 randVal;
+	UINT32 delay;
+	UINT8 chn;
+	
+	memcpy(&fileData[0x00], "MThd", 0x04);
+	fileData[0x04] = 0x00;	fileData[0x05] = 0x00;	fileData[0x06] = 0x00;	fileData[0x07] = 0x06;
+	fileData[0x08] = 0x00;	fileData[0x09] = 0x01;	// format 1
+	fileData[0x0A] = (UINT8)(trkCnt >> 8);	fileData[0x0B] = (UINT8)(trkCnt >> 0);
+	fileData[0x0C] = 0x01;	fileData[0x0D] = 0xE0;	// 480 ticks per quarter
+	curPos = 0x0E;
+	
+	trkSize = (fileSize - curPos) / trkCnt;
+	randVal = 1;
+	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+	{
+		trkBase = curPos;
+		trkEnd = trkBase + trkSize - 0x20;	// leave space for the last event and the Track End
+		memcpy(&fileData[curPos], "MTrk", 0x04);
+		curPos += 0x08;
+		chn = (UINT8)(curTrk & 0x0F);
+		
+		for (evtID = 0; curPos < trkEnd; evtID ++)
+		{
+			randVal = randVal * 1103515245 + 12345;
+			delay = (randVal >> 16) & 0x03;
+			if (delay == 3)
+				delay = (randVal >> 18) & 0x3FF;	// 1 or 2 bytes
+			else
+				delay *= 60;	// 0 = more events on the same tick
+			curPos += WriteVarLen(&fileData[curPos], delay);
+			
+			if (curTrk == 0 && (evtID & 0xFF) == 0x80)
+			{
+				UINT32 tempo = 300000 + ((randVal >> 8) & 0x3FFFF);
+				
+				fileData[curPos + 0x00] = 0xFF;
+				fileData[curPos + 0x01] = 0x51;
+				fileData[curPos + 0x02] = 0x03;
+				fileData[curPos + 0x03] = (UINT8)(tempo >> 16);
+				fileData[curPos + 0x04] = (UINT8)(tempo >>  8);
+				fileData[curPos + 0x05] = (UINT8)(tempo >>  0);
+				curPos += 0x06;
+			}
+			else if ((evtID & 0x3FF) == 0x200)
+			{
+				// GS Reset
+				static const UINT8 SYX_DATA[] = {0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7};
+				
+				fileData[curPos + 0x00] = 0xF0;
+				fileData[curPos + 0x01] = sizeof(SYX_DATA);
+				memcpy(&fileData[curPos + 0x02], SYX_DATA, sizeof(SYX_DATA));
+				curPos += 0x02 + sizeof(SYX_DATA);
+			}
+			else if ((evtID & 0x3F) == 0x10)
+			{
+				fileData[curPos + 0x00] = 0xB0 | chn;
+				fileData[curPos + 0x01] = 0x07;
+				fileData[curPos + 0x02] = (UINT8)((randVal >> 8) & 0x7F);
+				curPos += 0x03;
+			}
+			else if ((evtID & 0x3F) == 0x20)
+			{
+				fileData[curPos + 0x00] = 0xE0 | chn;
+				fileData[curPos + 0x01] = 0x00;
+				fileData[curPos + 0x02] = (UINT8)((randVal >> 8) & 0x7F);
+				curPos += 0x03;
+			}
+			else
+			{
+				// Note On/Off (velocity 0) - the status byte is only written after other events
+				if ((evtID & 0x3F) == 0x00 || (evtID & 0x3F) == 0x11 || (evtID & 0x3F) == 0x21 ||
+					(evtID & 0x3FF) == 0x201 || (curTrk == 0 && (evtID & 0xFF) == 0x81))
+				{
+					fileData[curPos] = 0x90 | chn;
+					curPos ++;
+				}
+				fileData[curPos + 0x00] = (UINT8)(0x24 + (evtID >> 1) % 0x30);
+				fileData[curPos + 0x01] = (evtID & 0x01) ? 0x00 : (UINT8)(0x40 + ((randVal >> 8) & 0x3F));
+				curPos += 0x02;
+			}
+		}
+		
+		fileData[curPos + 0x00] = 0x00;
+		fileData[curPos + 0x01] = 0xFF;
+		fileData[curPos + 0x02] = 0x2F;
+		fileData[curPos + 0x03] = 0x00;
+		curPos += 0x04;
+		
+		trkSize = curPos - trkBase - 0x08;
+		fileData[trkBase + 0x04] = (UINT8)(trkSize >> 24);
+		fileData[trkBase + 0x05] = (UINT8)(trkSize >> 16);
+		fileData[trkBase + 0x06] = (UINT8)(trkSize >>  8);
+		fileData[trkBase + 0x07] = (UINT8)(trkSize >>  0);
+		trkSize = (fileSize - 0x0E) / trkCnt;
+	}
+	
+	return curPos;
+}
+
+static UINT32 EventChecksum(UINT32 checksum, UINT32 tick, UINT8 status, UINT32 len, const UINT8* data)
+{
+	checksum = checksum * 31 + tick;
+	checksum = checksum * 31 + status;
+	checksum = checksum * 31 + len;
+	if (len)
+		checksum = checksum * 31 + data[0x00];
+	return checksum;
+}
+
+// ---- the reader of the old Midi1to0 (no bounds checks, linear search for the next track) ----
+static UINT32 ReadMIDIValue(const UINT8* data, UINT32* value)
+{
+	const UINT8* dataPtr;
+	UINT32 tempLng;
+	
+	dataPtr = data;
+	tempLng = 0x00;
+	while(*dataPtr & 0x80)
+	{
+		tempLng <<= 7;
+		tempLng |= *dataPtr & 0x7F;
+		dataPtr ++;
+	}
+	tempLng <<= 7;
+	tempLng |= *dataPtr & 0x7F;
+	dataPtr ++;
+	
+	*value = tempLng;
+	return (UINT32)(dataPtr - data);
+}
+
+static UINT8 Ref_ReadMerged(UINT32 fileSize, const UINT8* fileData, BENCH_RESULT* result)
+{
+	static REF_TRACK trkData[MAX_REF_TRACKS];
+	REF_TRACK* trk;
+	UINT16 trkCnt;
+	UINT16 curTrk;
+	UINT16 nextTrk;
+	UINT32 curPos;
+	UINT32 value;
+	UINT32 dataLen;
+	UINT8 status;
+	
+	trkCnt = (fileData[0x0A] << 8) | (fileData[0x0B] << 0);
+	if (trkCnt > MAX_REF_TRACKS)
+		return 0xFF;
+	curPos = 0x08 + SMF_ReadBE32(&fileData[0x04]);
+	for (curTrk = 0; curTrk < trkCnt && curPos + 0x08 <= fileSize; curTrk ++)
+	{
+		trk = &trkData[curTrk];
+		trk->curPos = curPos + 0x08;
+		trk->endPos = trk->curPos + SMF_ReadBE32(&fileData[curPos + 0x04]);
+		trk->runStatus = 0x00;
+		trk->tick = 0;
+		curPos = trk->endPos;
+		if (trk->curPos < trk->endPos)
+			trk->curPos += ReadMIDIValue(&fileData[trk->curPos], &trk->tick);
+	}
+	trkCnt = curTrk;
+	
+	while(1)
+	{
+		nextTrk = 0xFFFF;
+		for (curTrk = 0; curTrk < trkCnt; curTrk ++)
+		{
+			if (trkData[curTrk].curPos >= trkData[curTrk].endPos)
+				continue;
+			if (nextTrk == 0xFFFF || trkData[curTrk].tick < trkData[nextTrk].tick)
+				nextTrk = curTrk;
+		}
+		if (nextTrk == 0xFFFF)
+			break;
+		
+		trk = &trkData[nextTrk];
+		if (fileData[trk->curPos] & 0x80)
+		{
+			status = fileData[trk->curPos];
+			trk->curPos ++;
+			if (status < 0xF0)
+				trk->runStatus = status;
+		}
+		else
+		{
+			status = trk->runStatus;
+			if (! status)
+				return 0xFF;
+		}
+		switch(status & 0xF0)
+		{
+		case 0xC0:
+		case 0xD0:
+			dataLen = 0x01;
+			break;
+		case 0xF0:
+			if (status == 0xFF)
+				trk->curPos ++;	// skip meta event type
+			trk->curPos += ReadMIDIValue(&fileData[trk->curPos], &dataLen);
+			break;
+		default:
+			dataLen = 0x02;
+			break;
+		}
+		result->checksum = EventChecksum(result->checksum, trk->tick, status, dataLen, &fileData[trk->curPos]);
+		result->evtCnt ++;
+		if (status == 0xFF && fileData[trk->curPos - 0x02] == 0x2F)
+			trk->curPos = trk->endPos;
+		else
+			trk->curPos += dataLen;
+		if (trk->curPos < trk->endPos)
+		{
+			trk->curPos += ReadMIDIValue(&fileData[trk->curPos], &value);
+			trk->tick += value;
+		}
+	}
+	
+	return 0x00;
+}
+
+// ---- midi_reader.h ----
+static UINT8 SMF_BenchMerged(UINT32 fileSize, const UINT8* fileData, UINT8 useTime, BENCH_RESULT* result)
+{
+	SMF_FILE smf;
+	SMF_EVENT evt;
+	UINT8 retVal;
+	
+	retVal = SMF_Open(&smf, fileSize, fileData);
+	if (retVal)
+		return retVal;
+	if (useTime)
+	{
+		retVal = SMF_BuildTempoMap(&smf);
+		if (retVal)
+		{
+			SMF_Close(&smf);
+			return retVal;
+		}
+	}
+	
+	SMF_MergeStart(&smf);
+	while((retVal = SMF_ReadMergedEvent(&smf, &evt)) != 0x01)
+	{
+		if (retVal)
+			break;
+		result->checksum = EventChecksum(result->checksum, evt.tick, evt.status, evt.len, evt.data);
+		result->lastTime = evt.time;
+		result->evtCnt ++;
+	}
+	SMF_Close(&smf);
+	
+	return (retVal == 0x01) ? 0x00 : retVal;
+}
+
+static UINT8 SMF_BenchTracks(UINT32 fileSize, const UINT8* fileData, BENCH_RESULT* result)
+{
+	SMF_FILE smf;
+	SMF_EVENT evt;
+	UINT16 curTrk;
+	UINT8 retVal;
+	
+	retVal = SMF_Open(&smf, fileSize, fileData);
+	if (retVal)
+		return retVal;
+	for (curTrk = 0; curTrk < smf.trkCnt; curTrk ++)
+	{
+		while((retVal = SMF_ReadTrackEvent(&smf, curTrk, &evt)) == 0x00)
+			result->evtCnt ++;
+		if (retVal != 0x01)
+			break;
+	}
+	SMF_Close(&smf);
+	
+	return (retVal == 0x01) ? 0x00 : retVal;
+}
+
+static UINT8 BenchFile(const char* name, UINT32 fileSize, const UINT8* fileData)
+{
+	BENCH_RESULT refRes;
+	BENCH_RESULT mrgRes;
+	BENCH_RESULT trkRes;
+	BENCH_RESULT timeRes;
+	UINT32 curRep;
+	UINT8 retVal;
+	
+	printf("%s: %.1f MB\n", name, fileSize / 1048576.0);
+	retVal = 0x00;
+	memset(&refRes, 0x00, sizeof(BENCH_RESULT));
+	memset(&mrgRes, 0x00, sizeof(BENCH_RESULT));
+	memset(&trkRes, 0x00, sizeof(BENCH_RESULT));
+	memset(&timeRes, 0x00, sizeof(BENCH_RESULT));
+	
+	refRes.clocks = clock();
+	for (curRep = 0; curRep < REPEATS && ! retVal; curRep ++)
+		retVal = Ref_ReadMerged(fileSize, fileData, &refRes);
+	refRes.clocks = clock() - refRes.clocks;
+	if (retVal)
+	{
+		printf("    The old reader can't parse this file.\n");
+		refRes.evtCnt = 0;
+	}
+	
+	mrgRes.clocks = clock();
+	for (curRep = 0; curRep < REPEATS; curRep ++)
+		retVal = SMF_BenchMerged(fileSize, fileData, 0, &mrgRes);
+	mrgRes.clocks = clock() - mrgRes.clocks;
+	
+	trkRes.clocks = clock();
+	for (curRep = 0; curRep < REPEATS; curRep ++)
+		retVal |= SMF_BenchTracks(fileSize, fileData, &trkRes);
+	trkRes.clocks = clock() - trkRes.clocks;
+	
+	timeRes.clocks = clock();
+	for (curRep = 0; curRep < REPEATS; curRep ++)
+		retVal |= SMF_BenchMerged(fileSize, fileData, 1, &timeRes);
+	timeRes.clocks = clock() - timeRes.clocks;
+	
+	PrintResult("old merged", fileSize, &refRes);
+	PrintResult("SMF merged", fileSize, &mrgRes);
+	PrintResult("SMF per track", fileSize, &trkRes);
+	PrintResult("SMF merged+time", fileSize, &timeRes);
+	if (retVal)
+	{
+		printf("    midi_reader.h reported invalid data (error 0x%02X)\n", retVal);
+		return 0x01;
+	}
+	if (refRes.evtCnt && (refRes.evtCnt != mrgRes.evtCnt || refRes.checksum != mrgRes.checksum))
+	{
+		printf("    MISMATCH between the old reader and SMF_ReadMergedEvent\n");
+		return 0x01;
+	}
+	if (mrgRes.evtCnt != trkRes.evtCnt || mrgRes.checksum != timeRes.checksum)
+	{
+		printf("    MISMATCH between merged and per-track reading\n");
+		return 0x01;
+	}
+	printf("    %u events per pass, length %.1f s - ok\n", mrgRes.evtCnt / REPEATS, timeRes.lastTime / 1000000.0);
+	
+	return 0x00;
+}
+
+static void PrintResult(const char* mode, UINT32 fileSize, const BENCH_RESULT* result)
+{
+	double msec = result->clocks * 1000.0 / CLOCKS_PER_SEC / REPEATS;
+	
+	printf("    %-16s %10.1f ms %10.1f MB/s\n", mode, msec, msec ? fileSize / 1048576.0 * 1000.0 / msec : 0.0);
+	return;
+}
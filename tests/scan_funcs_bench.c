@@ -0,0 +1,209 @@
+// Benchmark for scan_funcs.h
+// --------------------------
+// Searches ROMs for the sound driver patterns of cdmd2mid and wtmd2mid, once with
+// a separate memcmp pass per pattern (the way the converters did it before) and once
+// with a single ScanSet pass. The first match of every pattern must be the same for both.
+// Build: gcc -O2 -o scan_funcs_bench scan_funcs_bench.c
+// Usage: scan_funcs_bench [-n repeats] [rom.bin ...]      e.g. scan_funcs_bench roms/*.bin
+// Without ROMs, a synthetic 4 MB ROM with the patterns near its end is used.
+// Returns 0 when all results match, 1 otherwise.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../stdtype.h"
+#include "../scan_funcs.h"
+
+static UINT8 LoadFile(const char* fileName, UINT32* retSize, UINT8** retData);
+static void MakeSyntheticROM(UINT32 romSize, UINT8* romData);
+static UINT8 BenchROM(const char* name, UINT32 romSize, const UINT8* romData);
+static UINT32 ScanForData_WC(UINT32 scanLen, const UINT8* scanData, UINT32 matchLen, const UINT8* matchData, UINT32 step);
+
+
+// cdmd2mid: 68000 driver loader, Z80 bank loader, Z80 driver base, Z80 sequence command loader
+// wtmd2mid: 68000 driver loader, Z80 music list
+static const UINT8 PAT_CD_DRV_LOADER[] = {0x41, 0xF9, 0xAA, 0xAA, 0xAA, 0xAA, 0x43, 0xF9, 0x00, 0xA0, 0x00, 0x00, 0x3E, 0x3C};
+static const UINT8 PAT_CD_BANK_LOADER[] = {0x13, 0xFC, 0x00, 0xAA, 0x00, 0xA0, 0x00, 0x40};
+static const UINT8 PAT_CD_DRV_BASE[] = {0x7E, 0x23, 0x66, 0x6F, 0xED, 0x5B, 0xAA, 0xAA, 0x19};
+static const UINT8 PAT_CD_SEQCMD_LOADER[] = {0xFD, 0x7E, 0x00, 0x32, 0xAA, 0xAA, 0xFD, 0x7E, 0x01, 0x32, 0xAA, 0xAA, 0x7B, 0xC3};
+static const UINT8 PAT_WT_DRVLOAD[] = {0x43, 0xF9, 0x00, 0xA0, 0x00, 0x00};
+static const UINT8 PAT_WT_MUSLIST[] = {0x26, 0x00, 0x6F, 0x29, 0x11};
+#define PAT_COUNT	6
+static const SCAN_PATTERN PATTERNS[PAT_COUNT] = {
+	{sizeof(PAT_CD_DRV_LOADER), PAT_CD_DRV_LOADER, 0x02},
+	{sizeof(PAT_CD_BANK_LOADER), PAT_CD_BANK_LOADER, 0x02},
+	{sizeof(PAT_CD_DRV_BASE), PAT_CD_DRV_BASE, 0x01},
+	{sizeof(PAT_CD_SEQCMD_LOADER), PAT_CD_SEQCMD_LOADER, 0x01},
+	{sizeof(PAT_WT_DRVLOAD), PAT_WT_DRVLOAD, 0x01},
+	{sizeof(PAT_WT_MUSLIST), PAT_WT_MUSLIST, 0x01},
+};
+
+static UINT32 REPEATS = 10;
+
+int main(int argc, char* argv[])
+{
+	int argbase;
+	UINT32 romSize;
+	UINT8* romData;
+	UINT8 retVal;
+	
+	argbase = 1;
+	if (argbase + 1 < argc && ! strcmp(argv[argbase], "-n"))
+	{
+		REPEATS = (UINT32)strtoul(argv[argbase + 1], NULL, 0);
+		if (! REPEATS)
+			REPEATS = 1;
+		argbase += 2;
+	}
+	
+	printf("%-24s %8s %10s %10s %8s %s\n", "ROM", "KB", "old [ms]", "new [ms]", "speedup", "result");
+	retVal = 0x00;
+	if (argbase >= argc)
+	{
+		romSize = 0x400000;	// 4 MB
+		romData = (UINT8*)malloc(romSize);
+		MakeSyntheticROM(romSize, romData);
+		retVal |= BenchROM("(synthetic)", romSize, romData);
+		free(romData);
+	}
+	for (; argbase < argc; argbase ++)
+	{
+		if (LoadFile(argv[argbase], &romSize, &romData))
+		{
+			printf("Error reading %s!\n", argv[argbase]);
+			retVal = 0xFF;
+			continue;
+		}
+		retVal |= BenchROM(argv[argbase], romSize, romData);
+		free(romData);
+	}
+	
+	return retVal ? 1 : 0;
+}
+
+static UINT8 LoadFile(const char* fileName, UINT32* retSize, UINT8** retData)
+{
+	FILE* hFile;
+	long fileSize;
+	
+	hFile = fopen(fileName, "rb");
+	if (hFile == NULL)
+		return 0xFF;
+	
+	fileSize = -1;
+	if (! fseek(hFile, 0, SEEK_END))
+		fileSize = ftell(hFile);
+	if (fileSize < 0 || fseek(hFile, 0, SEEK_SET))
+	{
+		fclose(hFile);
+		return 0xFF;
+	}
+	*retData = (UINT8*)malloc(fileSize ? fileSize : 1);
+	if (*retData == NULL)
+	{
+		fclose(hFile);
+		return 0xFF;
+	}
+	*retSize = (UINT32)fread(*retData, 0x01, fileSize, hFile);
+	fclose(hFile);
+	
+	return 0x00;
+}
+
+static void MakeSyntheticROM(UINT32 romSize, UINT8* romData)
+{
+	UINT32 curPos;
+	UINT32 patID;
+	UINT32 patPos;
+	UINT32 randVal;
+	
+	// pseudo-random data with a bias towards the first bytes of the patterns, so that there are many partial matches
+	randVal = 1;
+	for (curPos = 0x00; curPos < romSize; curPos ++)
+	{
+		randVal = randVal * 1103515245 + 12345;
+		romData[curPos] = (UINT8)(randVal >> 16);
+		if (! (randVal & 0x70000000))
+			romData[curPos] = PATTERNS[(randVal >> 8) % PAT_COUNT].data[0];
+	}
+	// place the patterns in the last 64 KB, so that a separate pass per pattern has to scan almost everything
+	for (patID = 0; patID < PAT_COUNT; patID ++)
+	{
+		patPos = (romSize - 0x10000 + patID * 0x1000) & ~0x01;
+		for (curPos = 0; curPos < PATTERNS[patID].len; curPos ++)
+		{
+			if (PATTERNS[patID].data[curPos] != 0xAA)
+				romData[patPos + curPos] = PATTERNS[patID].data[curPos];
+		}
+	}
+	
+	return;
+}
+
+static UINT8 BenchROM(const char* name, UINT32 romSize, const UINT8* romData)
+{
+	SCAN_SET scanSet;
+	UINT32 oldPos[PAT_COUNT];
+	UINT32 newPos[PAT_COUNT];
+	UINT32 curRep;
+	UINT32 patID;
+	clock_t oldTime;
+	clock_t newTime;
+	UINT8 retVal;
+	
+	oldTime = clock();
+	for (curRep = 0; curRep < REPEATS; curRep ++)
+	{
+		for (patID = 0; patID < PAT_COUNT; patID ++)
+			oldPos[patID] = ScanForData_WC(romSize, romData, PATTERNS[patID].len, PATTERNS[patID].data, PATTERNS[patID].step);
+	}
+	oldTime = clock() - oldTime;
+	
+	newTime = clock();
+	for (curRep = 0; curRep < REPEATS; curRep ++)
+	{
+		ScanSet_Init(&scanSet, PAT_COUNT, PATTERNS, 0xAA);
+		ScanSet_FindFirst(&scanSet, romSize, romData, newPos);
+	}
+	newTime = clock() - newTime;
+	
+	retVal = 0x00;
+	for (patID = 0; patID < PAT_COUNT; patID ++)
+	{
+		if (oldPos[patID] != newPos[patID])
+			retVal = 0x01;
+	}
+	printf("%-24s %8u %10.3f %10.3f %7.1fx %s\n", name, romSize / 0x400,
+			oldTime * 1000.0 / CLOCKS_PER_SEC / REPEATS, newTime * 1000.0 / CLOCKS_PER_SEC / REPEATS,
+			newTime ? (double)oldTime / newTime : 0.0, retVal ? "MISMATCH" : "ok");
+	if (retVal)
+	{
+		for (patID = 0; patID < PAT_COUNT; patID ++)
+			printf("    pattern %u: old 0x%06X, new 0x%06X\n", patID, oldPos[patID], newPos[patID]);
+	}
+	
+	return retVal;
+}
+
+// the search that cdmd2mid used before (It checks the last possible position as well.)
+static UINT32 ScanForData_WC(UINT32 scanLen, const UINT8* scanData, UINT32 matchLen, const UINT8* matchData, UINT32 step)
+{
+	UINT32 curPos;
+	UINT32 cmpPos;
+	
+	if (scanLen < matchLen)
+		return (UINT32)-1;
+	for (curPos = 0x00; curPos <= scanLen - matchLen; curPos += step)
+	{
+		for (cmpPos = 0; cmpPos < matchLen; cmpPos ++)
+		{
+			if (matchData[cmpPos] != 0xAA && scanData[curPos + cmpPos] != matchData[cmpPos])
+				break;
+		}
+		if (cmpPos >= matchLen)
+			return curPos;
+	}
+	
+	return (UINT32)-1;
+}
@@ -0,0 +1,164 @@
+// Threading Routines
+// ------------------
+// to be included as header file
+//
+// Minimal wrapper around Win32 threads and pthreads.
+//  UINT8 Thread_Start(OS_THREAD* thr, THREAD_FUNC func, void* param);
+//      Starts a thread that calls func(param). Returns 0 on success.
+//  void Thread_Join(OS_THREAD* thr);
+//      Waits for the thread to finish.
+//  UINT32 Thread_GetCPUCount(void);
+//      Returns the number of logical CPUs. (at least 1)
+//  void Mutex_Init(OS_MUTEX* mtx);
+//  void Mutex_Deinit(OS_MUTEX* mtx);
+//  void Mutex_Lock(OS_MUTEX* mtx);
+//  void Mutex_Unlock(OS_MUTEX* mtx);
+//
+// Note: On Unix systems, you need to link with -lpthread.
+
+#ifndef __THREAD_FUNCS_H__
+#define __THREAD_FUNCS_H__
+
+#include "stdtype.h"
+
+// The helpers are inline - some programs need only the threads, others only the mutexes.
+// (A separate macro, as the INLINE of other headers may be plain "static".)
+#if defined(_MSC_VER)
+#define THREAD_INLINE	static __inline
+#elif defined(__GNUC__)
+#define THREAD_INLINE	static __inline__
+#else
+#define THREAD_INLINE	static inline
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>	// for sysconf()
+#endif
+
+typedef void (*THREAD_FUNC)(void* param);
+
+typedef struct _os_thread
+{
+	THREAD_FUNC func;
+	void* param;
+#ifdef _WIN32
+	HANDLE hThread;
+#else
+	pthread_t thread;
+#endif
+} OS_THREAD;
+
+typedef struct _os_mutex
+{
+#ifdef _WIN32
+	CRITICAL_SECTION cs;
+#else
+	pthread_mutex_t mtx;
+#endif
+} OS_MUTEX;
+
+
+#ifdef _WIN32
+THREAD_INLINE DWORD WINAPI Thread_Main(LPVOID param)
+{
+	OS_THREAD* thr = (OS_THREAD*)param;
+	thr->func(thr->param);
+	return 0;
+}
+#else
+THREAD_INLINE void* Thread_Main(void* param)
+{
+	OS_THREAD* thr = (OS_THREAD*)param;
+	thr->func(thr->param);
+	return NULL;
+}
+#endif
+
+THREAD_INLINE UINT8 Thread_Start(OS_THREAD* thr, THREAD_FUNC func, void* param)
+{
+	thr->func = func;
+	thr->param = param;
+#ifdef _WIN32
+	thr->hThread = CreateThread(NULL, 0, &Thread_Main, thr, 0, NULL);
+	return (thr->hThread == NULL) ? 0xFF : 0x00;
+#else
+	return pthread_create(&thr->thread, NULL, &Thread_Main, thr) ? 0xFF : 0x00;
+#endif
+}
+
+THREAD_INLINE void Thread_Join(OS_THREAD* thr)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thr->hThread, INFINITE);
+	CloseHandle(thr->hThread);
+	thr->hThread = NULL;
+#else
+	pthread_join(thr->thread, NULL);
+#endif
+	
+	return;
+}
+
+THREAD_INLINE UINT32 Thread_GetCPUCount(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO sysInfo;
+	
+	GetSystemInfo(&sysInfo);
+	return sysInfo.dwNumberOfProcessors ? sysInfo.dwNumberOfProcessors : 1;
+#else
+	long cpuCnt;
+	
+	cpuCnt = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpuCnt > 0) ? (UINT32)cpuCnt : 1;
+#endif
+}
+
+THREAD_INLINE void Mutex_Init(OS_MUTEX* mtx)
+{
+#ifdef _WIN32
+	InitializeCriticalSection(&mtx->cs);
+#else
+	pthread_mutex_init(&mtx->mtx, NULL);
+#endif
+	
+	return;
+}
+
+THREAD_INLINE void Mutex_Deinit(OS_MUTEX* mtx)
+{
+#ifdef _WIN32
+	DeleteCriticalSection(&mtx->cs);
+#else
+	pthread_mutex_destroy(&mtx->mtx);
+#endif
+	
+	return;
+}
+
+THREAD_INLINE void Mutex_Lock(OS_MUTEX* mtx)
+{
+#ifdef _WIN32
+	EnterCriticalSection(&mtx->cs);
+#else
+	pthread_mutex_lock(&mtx->mtx);
+#endif
+	
+	return;
+}
+
+THREAD_INLINE void Mutex_Unlock(OS_MUTEX* mtx)
+{
+#ifdef _WIN32
+	LeaveCriticalSection(&mtx->cs);
+#else
+	pthread_mutex_unlock(&mtx->mtx);
+#endif
+	
+	return;
+}
+
+#endif	// __THREAD_FUNCS_H__
@@ -8,14 +8,9 @@
 #include <math.h>
 #include <memory.h>
 
-#ifndef M_PI_2
-#define M_PI_2	1.57079632679489661923 
-#endif
-#ifndef M_SQRT2
-#define M_SQRT2	1.41421356237309504880
-#endif
-
 #include "stdtype.h"
+#define SEGAPCM_TABLES
+#include "chip_tables.h"
 
 #define INLINE	static __inline
 
@@ -24,10 +19,7 @@ int main(int argc, char* argv[]);
 void ConvertTORun2MID(void);
 INLINE UINT8 ArcSmpsVol2Mid(UINT8 TrkMode, UINT8 Vol, UINT8 PanBoost);
 INLINE double FMVol2DB(UINT8 Vol);
-static UINT8 GetPCMVol(const UINT8 VolL, const UINT8 VolR, const double VolMul);
-static UINT8 GetPCMPan(const UINT8 VolL, const UINT8 VolR, double* RetVolFact);
 INLINE double SegaPCMVol2DB(UINT8 Vol);
-INLINE double Lin2DB(double LinVol);
 INLINE UINT8 DB2Mid(double DB);
 INLINE UINT32 Tempo2Mid(UINT8 TempoVal);
 
@@ -79,6 +71,7 @@ int main(int argc, char* argv[])
 	}
 	
 	MIDI_RES = 48;
+	SegaPCM_InitTables();
 	NUM_LOOPS = 2;
 	
 	hFile = fopen(argv[1], "rb");
@@ -148,7 +141,6 @@ void ConvertTORun2MID(void)
 	UINT8 CurChnVol;
 	UINT8 CurPcmVolL;
 	UINT8 CurPcmVolR;
-	double CurPcmVolMul;
 	UINT8 ChnPanOn;
 	UINT8 CurTickMul;
 	UINT8 CurIns;
@@ -266,7 +258,6 @@ void ConvertTORun2MID(void)
 		CurChnVol = 0x00;
 		CurTickMul = TrkHdrs[CurTrk].TickMul;
 		ChnPanOn = 0x00;
-		CurPcmVolMul = 1.0;
 		CurIns = 0xFF;
 		HoldNote = 0x00;
 		LoopIdx = 0x00;
@@ -377,7 +368,7 @@ void ConvertTORun2MID(void)
 					CurPcmVolL = SeqData[SeqPos];	SeqPos ++;
 					if (CurPcmVolL >= 0x40)
 						CurPcmVolL = 0x00;
-					TempByt = GetPCMPan(CurPcmVolL, CurPcmVolR, &CurPcmVolMul);
+					TempByt = SegaPCM_Pan2Mid[CurPcmVolL][CurPcmVolR];
 					if (MidChn == 9 && CurIns < 0x20)
 					{
 						if (DRUM_MAP[CurIns] != 0xFF)
@@ -393,7 +384,7 @@ void ConvertTORun2MID(void)
 						WriteEvent(MidData, &MidPos, &CurDly, 0xB0 | MidChn, 0x0A, TempByt);
 					}
 					
-					TempByt = GetPCMVol(CurPcmVolL, CurPcmVolR, CurPcmVolMul);
+					TempByt = SegaPCM_Vol2Mid[CurPcmVolL][CurPcmVolR];
 					if (! USE_VELOCITY)
 						WriteEvent(MidData, &MidPos, &CurDly, 0xB0 | MidChn, 0x07, TempByt);
 					else
@@ -611,64 +602,12 @@ INLINE double FMVol2DB(UINT8 Vol)
 	return Vol * -0.75;
 }
 
-static UINT8 GetPCMVol(const UINT8 VolL, const UINT8 VolR, const double VolMul)
-{
-	double DBVol;
-	UINT8 FinVol;
-	
-	DBVol = Lin2DB((VolL + VolR) * VolMul);
-	FinVol = DB2Mid(DBVol);
-	if (FinVol <= 0)
-		FinVol = 1;
-	else if (FinVol > 0x7F)
-		FinVol = 0x7F;
-	return FinVol;
-}
-
-static UINT8 GetPCMPan(const UINT8 VolL, const UINT8 VolR, double* RetVolFact)
-{
-	// GM Pan Formula:
-	//	PanAmount = (PanCtrlVal - 1) / 126
-	//	Left  Channel Gain [dB] = 20 * log10(cos(Pi / 2 * PanAmount))
-	//	Right Channel Gain [dB] = 20 * log10(sin(Pi / 2 * PanAmount))
-	double VolDiff;
-	double VolBoost;
-	double PanAngle;
-	double PanVal;
-	UINT8 FinPan;
-	
-	if (VolL == VolR)
-	{
-		if (RetVolFact != NULL)
-			*RetVolFact = 1.0;
-		return 0x40;
-	}
-	VolDiff = VolR / (double)(VolL + VolR);
-	
-	PanAngle = atan2(VolDiff, 1.0 - VolDiff);
-	VolBoost = M_SQRT2 / (cos(PanAngle) + sin(PanAngle));
-	PanVal = PanAngle / M_PI_2;
-	
-	FinPan = (UINT8)(PanVal * 0x80 + 0.5);	// actually the range is 1..126, but this looks nicer
-	if (FinPan > 0x7F)
-		FinPan = 0x7F;
-	if (RetVolFact != NULL)
-		*RetVolFact = VolBoost;
-	return FinPan;
-}
-
 INLINE double SegaPCMVol2DB(UINT8 Vol)
 {
 	//return log(Vol / 63.0) / log(2.0) * 6.0;
 	return log(Vol / 63.0) * 8.65617024533378;
 }
 
-INLINE double Lin2DB(double LinVol)
-{
-	//return log(LinVol / 126.0) / log(2.0) * 6.0;
-	return log(LinVol / 126.0) * 8.65617024533378;
-}
-
 INLINE UINT8 DB2Mid(double DB)
 {
 	//DB += 6.0;
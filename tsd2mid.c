@@ -30,7 +30,9 @@
 #endif
 
 
+#include "conv_stats.h"
 #include "midi_funcs.h"
+#include "seq_guard.h"
 
 typedef struct _track_info
 {
@@ -121,6 +123,7 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 							TRK_INF* trkInf, FILE_INF* fInf, MID_TRK_STATE* MTS);
 static UINT8 LookAheadCommand(UINT32 songLen, const UINT8* songData, UINT32 startPos, UINT8 cmd, UINT8 chnMode);
 static UINT8 PreparseTsdTrack(UINT32 songLen, const UINT8* songData, TRK_INF* trkInf, UINT8 mode);
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT32* loopPos, const UINT16* loopMax, const UINT16* loopCnt, UINT16 mstLoopCnt);
 INLINE INT32 NoteFrac2PitchBend(INT16 noteTransp, INT32 noteFrac);
 static void WritePitchBend(FILE_INF* fInf, MID_TRK_STATE* MTS, INT32 pbVal);
 INLINE UINT32 Tempo2Mid(UINT16 bpm, UINT16 scale);
@@ -188,6 +191,7 @@ static UINT8 ED4_MODE = 0;
 static UINT8 NO_TRK_NAMES = 0;
 static UINT8 HIGH_PREC_PB = 0;
 static UINT8 HIGH_PREC_VIB = 0;
+static UINT8 STATS_MODE = STATS_OFF;
 
 int main(int argc, char* argv[])
 {
@@ -210,6 +214,7 @@ int main(int argc, char* argv[])
 		printf("    -PrecisePB  enable higher-precision pitch bend calculations\n");
 		printf("    -PreciseVib enable higher-precision vibrato (requires -PrecisePB)\n");
 		printf("                Warning: This may result in slightly stronger vibarto.\n");
+		printf("    -Stats      print profiling statistics (-StatsJSON: as JSON, requires compiling with CONV_STATS)\n");
 		return 0;
 	}
 	
@@ -240,10 +245,15 @@ int main(int argc, char* argv[])
 			HIGH_PREC_PB = 1;
 		else if (! stricmp(argv[argbase] + 1, "PreciseVib"))
 			HIGH_PREC_VIB = 1;
+		else if (! stricmp(argv[argbase] + 1, "Stats"))
+			STATS_MODE = STATS_TEXT;
+		else if (! stricmp(argv[argbase] + 1, "StatsJSON"))
+			STATS_MODE = STATS_JSON;
 		else
 			break;
 		argbase ++;
 	}
+	STATS_ENABLE(STATS_MODE);
 	if (argc < argbase + 2)
 	{
 		printf("Not enough arguments.\n");
@@ -274,6 +284,7 @@ int main(int argc, char* argv[])
 	free(MidData);	MidData = NULL;
 	
 	printf("Done.\n");
+	STATS_PRINT(STATS_MODE);
 	
 	free(ROMData);	ROMData = NULL;
 	
@@ -288,15 +299,18 @@ static UINT8 WriteFileData(UINT32 DataLen, const UINT8* Data, const char* FileNa
 {
 	FILE* hFile;
 	
+	STATS_PHASE_BEGIN(STATS_WRITE);
 	hFile = fopen(FileName, "wb");
 	if (hFile == NULL)
 	{
+		STATS_PHASE_END(STATS_WRITE);
 		printf("Error opening %s!\n", FileName);
 		return 0xFF;
 	}
 	
 	fwrite(Data, 0x01, DataLen, hFile);
 	fclose(hFile);
+	STATS_PHASE_END(STATS_WRITE);
 	
 	return 0;
 }
@@ -339,6 +353,7 @@ UINT8 Tsd2Mid(UINT32 songLen, const UINT8* songData)
 	FILE_INF midFInf;
 	MID_TRK_STATE MTS;
 	
+	STATS_PHASE_BEGIN(STATS_CONVERT);
 	midFInf.alloc = 0x20000;	// 128 KB should be enough
 	midFInf.data = (UINT8*)malloc(midFInf.alloc);
 	midFInf.pos = 0x00;
@@ -354,6 +369,7 @@ UINT8 Tsd2Mid(UINT32 songLen, const UINT8* songData)
 	//songData[0x43];	// number of SSG instruments
 	//inPos = 0x50;	// start of GM instruments
 	
+	STATS_PHASE_BEGIN(STATS_PREPARSE);
 	for (curTrk = 0; curTrk < trkCnt; curTrk ++)
 	{
 		tempTInf = &trkInf[curTrk];
@@ -373,6 +389,7 @@ UINT8 Tsd2Mid(UINT32 songLen, const UINT8* songData)
 	
 	if (! NO_LOOP_EXT)
 		BalanceTrackTimes(trkCnt, trkInf, MIDI_RES / 4, 0xFF);
+	STATS_PHASE_END(STATS_PREPARSE);
 	
 	WriteMidiHeader(&midFInf, 0x0001, trkCnt, MIDI_RES);
 	
@@ -408,6 +425,7 @@ UINT8 Tsd2Mid(UINT32 songLen, const UINT8* songData)
 	
 	midFInf.pos = 0x00;
 	WriteMidiHeader(&midFInf, 0x0001, curTrk, MIDI_RES);
+	STATS_PHASE_END(STATS_CONVERT);
 	
 	return retVal;
 }
@@ -603,6 +621,8 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 	UINT8 trkEnd;
 	UINT8 cmdType;
 	UINT16 mstLoopCnt;
+	SEQ_GUARD seqGuard;
+	UINT8 grdRes;
 	char tempStr[0x20];
 	UINT16 songTempo;
 	
@@ -728,10 +748,17 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 		WriteEvent(fInf, MTS, 0xB0, 0x5D, 0);
 	
 	trkTick = MTS->curDly;
+	SeqGuard_Init(&seqGuard);
 	while(inPos < songLen && ! trkEnd)
 	{
 		UINT32 prevPos = inPos;
 		
+		grdRes = SeqGuard_Step(&seqGuard, trkTick, fInf->pos - MTS->trkBase);
+		if (grdRes)
+		{
+			printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkInf->id, SeqGuard_Reason(grdRes), prevPos);
+			break;
+		}
 		if (MTS->curDly > trk->noteStartTick && trk->lastNote != 0xFF)
 			ProcessTsdTrkFX(trk, fInf, MTS);
 		
@@ -739,6 +766,7 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 			WriteEvent(fInf, MTS, 0xB0, 0x6F, (UINT8)mstLoopCnt);
 		
 		cmdType = songData[inPos];
+		STATS_CMD(cmdType);
 		if (cmdType == 0x7F)
 		{
 			UINT16 noteDelay = songData[inPos + 0x01];
@@ -765,6 +793,7 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 			trk->noteStartTick = MTS->curDly;
 			MTS->curDly += noteDelay;
 			trkTick += noteDelay;
+			STATS_FRAMES(noteDelay);
 		}
 		else if (cmdType < 0x80)
 		{
@@ -916,6 +945,7 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 			trk->noteStartTick = MTS->curDly;
 			MTS->curDly += noteDelay;
 			trkTick += noteDelay;
+			STATS_FRAMES(noteDelay);
 		}
 		else switch(cmdType)
 		{
@@ -972,6 +1002,13 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 				{
 					inPos += exitOfs;
 					trk->loopIdx = exitLpIdx;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos,
+								GetLoopState(trk->loopIdx, trk->loopPos, trk->loopMax, trk->loopCnt, mstLoopCnt));
+					if (grdRes)
+					{
+						printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkInf->id, SeqGuard_Reason(grdRes), prevPos);
+						trkEnd = 1;
+					}
 				}
 			}
 			break;
@@ -1022,6 +1059,13 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 				{
 					inPos += loopOfs + 0x01;
 					trk->loopIdx ++;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos,
+								GetLoopState(trk->loopIdx, trk->loopPos, trk->loopMax, trk->loopCnt, mstLoopCnt));
+					if (grdRes)
+					{
+						printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkInf->id, SeqGuard_Reason(grdRes), prevPos);
+						trkEnd = 1;
+					}
 				}
 			}
 			break;
@@ -1123,9 +1167,20 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 					if (mstLoopCnt < 0x80)
 						WriteEvent(fInf, MTS, 0xB0, 0x6F, (UINT8)mstLoopCnt);
 					if (mstLoopCnt < trkInf->loopTimes)
+					{
 						inPos += jumpOfs;
+						grdRes = SeqGuard_Jump(&seqGuard, inPos,
+									GetLoopState(trk->loopIdx, trk->loopPos, trk->loopMax, trk->loopCnt, mstLoopCnt));
+						if (grdRes)
+						{
+							printf("Warning Track %u: %s at 0x%04X - track cut!\n", trkInf->id, SeqGuard_Reason(grdRes), prevPos);
+							trkEnd = 1;
+						}
+					}
 					else
+					{
 						trkEnd = 1;
+					}
 				}
 			}
 			break;
@@ -1320,6 +1375,7 @@ static UINT8 TsdTrk2MidTrk(UINT32 songLen, const UINT8* songData,
 			break;
 		}	// end if (cmdType >= 0x80) / switch(cmdType)
 	}	// end while(! trkEnd)
+	SeqGuard_Free(&seqGuard);
 	if (trk->lastNote != 0xFF)
 		WriteEvent(fInf, MTS, 0x90, (trk->lastNote + trk->noteTransp) & 0x7F, 0x00);
 	
@@ -1422,6 +1478,7 @@ static UINT8 PreparseTsdTrack(UINT32 songLen, const UINT8* songData, TRK_INF* tr
 	UINT8 lastNote;
 	UINT16 ctrlUse;
 	UINT16 useFlags;
+	SEQ_GUARD seqGuard;
 	
 	if (! mode)
 	{
@@ -1442,9 +1499,13 @@ static UINT8 PreparseTsdTrack(UINT32 songLen, const UINT8* songData, TRK_INF* tr
 	ctrlUse = 0x00;
 	useFlags = 0x0000;
 	lastNote = 0xFF;
+	SeqGuard_Init(&seqGuard);
 	
 	while(inPos < songLen && ! trkEnd)
 	{
+		// The conversion will hit the same limit and print the warning.
+		if (SeqGuard_Step(&seqGuard, mode ? trkInf->loopTick : trkInf->tickCnt, 0))
+			break;
 		if (mode && inPos == trkInf->loopOfs)
 			break;
 		cmdType = songData[inPos];
@@ -1578,9 +1639,15 @@ static UINT8 PreparseTsdTrack(UINT32 songLen, const UINT8* songData, TRK_INF* tr
 				loopIdx --;
 				
 				if (loopCnt[loopIdx] == loopMax[loopIdx] - 1)
+				{
 					inPos += exitOfs;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPos, loopMax, loopCnt, 0)))
+						trkEnd = 1;
+				}
 				else
+				{
 					loopIdx ++;
+				}
 			}
 			break;
 		case 0x82:	// Loop End
@@ -1598,6 +1665,8 @@ static UINT8 PreparseTsdTrack(UINT32 songLen, const UINT8* songData, TRK_INF* tr
 				{
 					inPos += loopOfs + 0x01;
 					loopIdx ++;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopPos, loopMax, loopCnt, 0)))
+						trkEnd = 1;
 				}
 			}
 			break;
@@ -1626,12 +1695,30 @@ static UINT8 PreparseTsdTrack(UINT32 songLen, const UINT8* songData, TRK_INF* tr
 			break;
 		}	// end switch(cmdType)
 	}	// end while(! trkEnd)
+	SeqGuard_Free(&seqGuard);
 	if (! mode)
 		trkInf->useFlags = useFlags;
 	
 	return 0x00;
 }
 
+// Hashes everything that decides where the track goes after a jump.
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT32* loopPos, const UINT16* loopMax, const UINT16* loopCnt, UINT16 mstLoopCnt)
+{
+	UINT64 state;
+	UINT8 curLvl;
+	
+	state = SeqGuard_Hash(0, mstLoopCnt);
+	state = SeqGuard_Hash(state, loopIdx);
+	for (curLvl = 0; curLvl < loopIdx; curLvl ++)
+	{
+		state = SeqGuard_Hash(state, loopPos[curLvl]);
+		state = SeqGuard_Hash(state, loopMax[curLvl]);
+		state = SeqGuard_Hash(state, loopCnt[curLvl]);
+	}
+	return state;
+}
+
 
 INLINE INT32 NoteFrac2PitchBend(INT16 noteTransp, INT32 noteFrac)
 {
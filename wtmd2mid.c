@@ -11,6 +11,14 @@
 
 #include "stdtype.h"
 #include <stdbool.h>
+#include "scan_funcs.h"
+#include "rom_cache.h"
+
+#ifdef _MSC_VER
+#define stricmp	_stricmp
+#else
+#define stricmp	strcasecmp
+#endif
 
 void ConvertAllSongs(UINT16 MusBankList);
 UINT8 Wolfteam2Mid(UINT32 SongStartPos);
@@ -36,6 +44,8 @@ static UINT32 ScanForData(UINT32 DataLen, const UINT8* Data, UINT32 MagicLen,
 						  const UINT8* MagicData, UINT32 StartPos);
 static UINT32 ReadLEA(const UINT8* Code, UINT32 InstPos);
 void WolfTeamDriver_Autodetection(void);
+static UINT8 LoadDriverCache(const char* FileName, UINT64 ROMHash);
+static UINT8 SaveDriverCache(const char* FileName, UINT64 ROMHash);
 
 
 typedef struct running_note
@@ -50,6 +60,15 @@ typedef struct running_note
 #define RAMMODE_PTR		0x01	// Z80 RAM data is pointer to ROM data
 #define RAMMODE_ALLOC	0x02	// Z80 RAM data was allocated and has to be free'd
 
+typedef struct _driver_cache
+{
+	UINT32 DrvPos;	// ROM offset of the driver (RAMMODE_PTR only)
+	UINT32 DrvLen;
+	UINT16 MusList;
+	UINT8 DrvMode;	// RAMMODE_PTR: driver is in ROM, RAMMODE_ALLOC: decompressed driver follows
+	UINT8 Reserved;
+} DRV_CACHE;
+
 UINT32 ROMLen;
 UINT8* ROMData;
 UINT8 Z80DrvMode;
@@ -70,28 +89,54 @@ char OutFileBase[0x100];
 int main(int argc, char* argv[])
 {
 	FILE* hFile;
+	int argbase;
 	char* StrPtr;
 	UINT8 PLMode;
 	UINT32 SongPos;
 	char* TempPnt;
+	const char* CacheFile;
+	UINT64 ROMHash;
 	
 	printf("Wolf Team MegaDrive -> Midi Converter\n-------------------------------------\n");
 	if (argc < 3)
 	{
-		printf("Usage: wtmd2mid.exe Options ROM.bin\n");
+		printf("Usage: wtmd2mid.exe [-Cache fn] Options ROM.bin\n");
 		printf("Options: (options can be combined, default setting is 'dv')\n");
 		printf("    r   Raw conversion (other options are ignored)\n");
 		printf("    d   fix Drums (remaps to GM drums)\n");
 		printf("    v   fix Volume (convert linear to logarithmic MIDI)\n");
+		printf("    -Cache fn   store/reuse the detected (and decompressed) sound driver in file \"fn\"\n");
 		printf("Supported/verified games: Earnest Evans, El Viento, Arcus Odyssey.\n");
 		return 0;
 	}
 	
+	argbase = 1;
+	CacheFile = NULL;
+	while(argbase < argc && argv[argbase][0] == '-')
+	{
+		if (! stricmp(argv[argbase] + 1, "Cache"))
+		{
+			argbase ++;
+			if (argbase < argc)
+				CacheFile = argv[argbase];
+		}
+		else
+		{
+			break;
+		}
+		argbase ++;
+	}
+	if (argc < argbase + 2)
+	{
+		printf("Not enough arguments.\n");
+		return 0;
+	}
+	
 	FixDrumSet = true;
 	FixVolume = true;
 	PLMode = 0x00;
 	SongPos = 0x00;
-	StrPtr = argv[1];
+	StrPtr = argv[argbase + 0];
 	while(*StrPtr != '\0')
 	{
 		switch(toupper(*StrPtr))
@@ -110,13 +155,13 @@ int main(int argc, char* argv[])
 		StrPtr ++;
 	}
 	
-	strcpy(OutFileBase, argv[2]);
+	strcpy(OutFileBase, argv[argbase + 1]);
 	TempPnt = strrchr(OutFileBase, '.');
 	if (TempPnt == NULL)
 		TempPnt = OutFileBase + strlen(OutFileBase);
 	*TempPnt = 0x00;
 	
-	hFile = fopen(argv[2], "rb");
+	hFile = fopen(argv[argbase + 1], "rb");
 	if (hFile == NULL)
 	{
 		printf("Error opening file!\n");
@@ -138,7 +183,20 @@ int main(int argc, char* argv[])
 	{
 		Z80DrvMode = RAMMODE_NONE;
 		Z80MusList = 0x0000;
-		WolfTeamDriver_Autodetection();
+		if (CacheFile != NULL)
+		{
+			ROMHash = ROMCache_Hash(ROMLen, ROMData);
+			if (LoadDriverCache(CacheFile, ROMHash))
+			{
+				WolfTeamDriver_Autodetection();
+				if (Z80DrvMode != RAMMODE_NONE && SaveDriverCache(CacheFile, ROMHash))
+					printf("Error writing cache file %s!\n", CacheFile);
+			}
+		}
+		else
+		{
+			WolfTeamDriver_Autodetection();
+		}
 		
 		ConvertAllSongs(Z80MusList);
 	}
@@ -937,15 +995,19 @@ UINT8 DecompressArcOdyssey(const UINT8* ComprData, UINT32* RetDataLen, UINT8** R
 #define F		   18	/* upper limit for match_length */
 #define THRESHOLD	2   /* encode string into position and length
 						   if match_length is greater than this */
-UINT8	text_buf[N + F - 1];	/* ring buffer of size N,
-			with extra F-1 bytes to facilitate string comparison */
+UINT8	text_buf[N];	/* initial contents of the ring buffer */
 
 static void LZSS_Init(void)	// ported from the Arcus Odyssey ROM
 {
+	static bool InitDone = false;
 	UINT16 BufPos;
 	UINT16 RegD0;
 	UINT16 RegD1;
 	
+	if (InitDone)
+		return;	// The decoder doesn't modify text_buf, so it needs to be filled only once.
+	InitDone = true;
+	
 	// Important Note: These are non-standard values and ARE used by the compressed data.
 	BufPos = 0x0000;
 	// 01E7B2 - A000..ACFF
@@ -975,44 +1037,84 @@ static void LZSS_Init(void)	// ported from the Arcus Odyssey ROM
 	return;
 }
 
-void LZSS_Decode(UINT32 CmpLen, const UINT8* CmpData, UINT32 DecLen, UINT8* DecData)	// from LZSS.C by Haruhiko Okumura
+void LZSS_Decode(UINT32 CmpLen, const UINT8* CmpData, UINT32 DecLen, UINT8* DecData)	// based on LZSS.C by Haruhiko Okumura
 {
-	int  i, j, k, r;
-	unsigned char c;
-	unsigned int  flags;
+	// The ring buffer always contains the last 4096 bytes of the output, so matches are copied
+	// directly from the output data. Only matches that reach back before the beginning of
+	// the output need to read the initial contents of the ring buffer (text_buf).
 	UINT32 CmpPos;
 	UINT32 DecPos;
+	UINT32 MatchPos;
+	UINT32 MatchDist;
+	UINT32 MatchLen;
+	UINT16 WinPos;
+	UINT8 Flags;
+	UINT8 CurBit;
 	
-	//for (i = 0; i < N - F; i++) text_buf[i] = ' ';
-	r = N - F;  flags = 0;
 	CmpPos = 0;
 	DecPos = 0;
-	for ( ; ; ) {
-		if (((flags >>= 1) & 256) == 0) {
-			if (CmpPos >= CmpLen) break;
-			c = CmpData[CmpPos ++];
-			flags = c | 0xff00;		/* uses higher byte cleverly */
-		}							/* to count eight */
-		if (flags & 1) {
-			if (CmpPos >= CmpLen) break;
-			c = CmpData[CmpPos ++];
-			if (DecPos >= DecLen) break;
-			DecData[DecPos ++] = c;
-			text_buf[r++] = c;  r &= (N - 1);
-		} else {
-			if (CmpPos >= CmpLen) break;
-			i = CmpData[CmpPos ++];
-			if (CmpPos >= CmpLen) break;
-			j = CmpData[CmpPos ++];
-			i |= ((j & 0xf0) << 4);  j = (j & 0x0f) + THRESHOLD;
-			for (k = 0; k <= j; k++) {
-				c = text_buf[(i + k) & (N - 1)];
-				if (DecPos >= DecLen) break;
-				DecData[DecPos ++] = c;
-				text_buf[r++] = c;  r &= (N - 1);
+	while(CmpPos < CmpLen)
+	{
+		Flags = CmpData[CmpPos];
+		CmpPos ++;
+		if (Flags == 0xFF && CmpLen - CmpPos >= 8 && DecLen - DecPos >= 8)
+		{
+			// 8 literals in a row
+			memcpy(&DecData[DecPos], &CmpData[CmpPos], 8);
+			CmpPos += 8;
+			DecPos += 8;
+			continue;
+		}
+		
+		for (CurBit = 0; CurBit < 8; CurBit ++, Flags >>= 1)
+		{
+			if (Flags & 0x01)
+			{
+				// literal
+				if (CmpPos >= CmpLen || DecPos >= DecLen)
+					return;
+				DecData[DecPos] = CmpData[CmpPos];
+				CmpPos ++;
+				DecPos ++;
+				continue;
+			}
+			
+			// match: 12-bit ring buffer position, 4-bit length
+			if (CmpLen - CmpPos < 2)
+				return;
+			WinPos = CmpData[CmpPos + 0x00] | ((CmpData[CmpPos + 0x01] & 0xF0) << 4);
+			MatchLen = (CmpData[CmpPos + 0x01] & 0x0F) + THRESHOLD + 1;
+			CmpPos += 0x02;
+			if (MatchLen > DecLen - DecPos)
+				MatchLen = DecLen - DecPos;
+			
+			// distance to the current ring buffer position (0 = the byte that is about to be overwritten)
+			MatchDist = (N - F + DecPos - WinPos) & (N - 1);
+			if (! MatchDist)
+				MatchDist = N;
+			for (; MatchLen && DecPos < MatchDist; MatchLen --, DecPos ++)
+			{
+				DecData[DecPos] = text_buf[WinPos];
+				WinPos = (WinPos + 1) & (N - 1);
+			}
+			if (! MatchLen)
+				continue;
+			
+			MatchPos = DecPos - MatchDist;
+			if (MatchDist >= MatchLen)
+			{
+				memcpy(&DecData[DecPos], &DecData[MatchPos], MatchLen);
+				DecPos += MatchLen;
+			}
+			else
+			{
+				// overlapping copy (repeats the last MatchDist bytes)
+				for (; MatchLen; MatchLen --, DecPos ++, MatchPos ++)
+					DecData[DecPos] = DecData[MatchPos];
 			}
 		}
 	}
+	
 	return;
 }
 
@@ -1020,15 +1122,23 @@ void LZSS_Decode(UINT32 CmpLen, const UINT8* CmpData, UINT32 DecLen, UINT8* DecD
 static UINT32 ScanForData(UINT32 DataLen, const UINT8* Data, UINT32 MagicLen,
 						  const UINT8* MagicData, UINT32 StartPos)
 {
-	UINT32 CurPos;
-	
-	for (CurPos = StartPos; CurPos < DataLen; CurPos ++)
-	{
-		if (! memcmp(Data + CurPos, MagicData, MagicLen))
-			return CurPos;
-	}
-	
-	return (UINT32)-1;
+	// Note: The magic values don't contain 0xAA, so there are no wildcards.
+	SCAN_PATTERN Pattern;
+	SCAN_SET ScanSet;
+	UINT32 FoundPos;
+	
+	if (StartPos >= DataLen)
+		return (UINT32)-1;
+	Pattern.len = MagicLen;
+	Pattern.data = MagicData;
+	Pattern.step = 1;
+	if (ScanSet_Init(&ScanSet, 1, &Pattern, 0xAA))
+		return (UINT32)-1;
+	
+	ScanSet_FindFirst(&ScanSet, DataLen - StartPos, Data + StartPos, &FoundPos);
+	if (FoundPos == (UINT32)-1)
+		return (UINT32)-1;
+	return StartPos + FoundPos;
 }
 
 static UINT32 ReadLEA(const UINT8* Code, UINT32 InstPos)
@@ -1095,7 +1205,7 @@ void WolfTeamDriver_Autodetection(void)
 	}
 	else if (Instr == 0x4EB9)	// JSR ... (Arcus Odyssey - call decompression routine)
 	{
-		Z80DrvMode = RAMMODE_PTR;
+		Z80DrvMode = RAMMODE_ALLOC;
 		Z80DrvLen = ReadBE32(&ROMData[DrvPos]);	// DBF loops execute once more
 		printf("Compressed driver found at %06X (size: %04X)\n", DrvPos, Z80DrvLen);
 		DecompressArcOdyssey(ROMData + DrvPos, &Z80DrvLen, &Z80DrvData);
@@ -1128,3 +1238,57 @@ NoDrvFoundError:
 	
 	return;
 }
+
+static UINT8 LoadDriverCache(const char* FileName, UINT64 ROMHash)
+{
+	DRV_CACHE DrvCache;
+	UINT32 BlobLen;
+	UINT8* BlobData;
+	UINT8 RetVal;
+	
+	RetVal = ROMCache_Load(FileName, ROMCACHE_ID('W', 'T', 'M', 'D'), ROMLen, ROMHash,
+							sizeof(DRV_CACHE), &DrvCache, &BlobLen, &BlobData);
+	if (RetVal)
+		return RetVal;
+	
+	if (DrvCache.DrvMode == RAMMODE_ALLOC && BlobLen == DrvCache.DrvLen)
+	{
+		Z80DrvData = BlobData;
+		printf("Using cached decompressed driver (size: %04X)\n", DrvCache.DrvLen);
+	}
+	else if (DrvCache.DrvMode == RAMMODE_PTR &&
+			DrvCache.DrvPos <= ROMLen && DrvCache.DrvLen <= ROMLen - DrvCache.DrvPos)
+	{
+		free(BlobData);
+		Z80DrvData = ROMData + DrvCache.DrvPos;
+		printf("Using cached driver offset %06X (size: %04X)\n", DrvCache.DrvPos, DrvCache.DrvLen);
+	}
+	else
+	{
+		free(BlobData);
+		return 0x80;
+	}
+	Z80DrvMode = DrvCache.DrvMode;
+	Z80DrvLen = DrvCache.DrvLen;
+	Z80MusList = DrvCache.MusList;
+	printf("Music List Offset: %04X\n", Z80MusList);
+	
+	return 0x00;
+}
+
+static UINT8 SaveDriverCache(const char* FileName, UINT64 ROMHash)
+{
+	DRV_CACHE DrvCache;
+	
+	memset(&DrvCache, 0x00, sizeof(DRV_CACHE));
+	DrvCache.DrvMode = Z80DrvMode;
+	DrvCache.DrvLen = Z80DrvLen;
+	DrvCache.MusList = Z80MusList;
+	if (Z80DrvMode == RAMMODE_ALLOC)
+		return ROMCache_Save(FileName, ROMCACHE_ID('W', 'T', 'M', 'D'), ROMLen, ROMHash,
+							sizeof(DRV_CACHE), &DrvCache, Z80DrvLen, Z80DrvData);
+	
+	DrvCache.DrvPos = (UINT32)(Z80DrvData - ROMData);
+	return ROMCache_Save(FileName, ROMCACHE_ID('W', 'T', 'M', 'D'), ROMLen, ROMHash,
+						sizeof(DRV_CACHE), &DrvCache, 0, NULL);
+}
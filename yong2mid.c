@@ -23,13 +23,13 @@
 
 
 #include "midi_funcs.h"
+#include "mem_map.h"
 
 
-UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs);
+UINT8 Yong2Mid(UINT16 songID, UINT16 songAddr, UINT16 patListAddr);
 static UINT8 WriteFileData(UINT32 dataLen, const UINT8* data, const char* fileName);
 
-INLINE UINT16 ReadLE16(const UINT8* data);
-INLINE UINT32 AddrGB2ROM(UINT16 addr, UINT32 romBankOfs);
+INLINE UINT16 ROM2GBAddr(UINT32 romOfs);
 INLINE double Lin2DB(UINT8 LinVol);
 INLINE UINT8 DB2Mid(double DB);
 INLINE UINT32 GBTimer2Mid(UINT8 valTMA);
@@ -38,6 +38,9 @@ INLINE UINT32 BPM2Mid(UINT8 valBPM);
 
 static UINT32 ROMLen;
 static UINT8* ROMData;
+static MEM_MAP GBMap;
+static UINT32 songBankOfs;	// ROM offset of the bank with the song list and track data
+static UINT32 patBankOfs;	// ROM offset of the bank with the pattern lists and pattern data
 static UINT32 MidAlloc;
 static UINT32 MidLen;
 static UINT8* MidData;
@@ -58,8 +61,8 @@ int main(int argc, char* argv[])
 	const char* fileExt;
 	char* outName;
 	char* outExt;
-	UINT32 songOfs;
-	UINT32 patOfs;
+	UINT16 songAddr;
+	UINT16 patListAddr;
 	
 	printf("YongYong -> Midi Converter\n--------------------------\n");
 	if (argc < 3)
@@ -126,14 +129,23 @@ int main(int argc, char* argv[])
 	if (! patListOfs)
 		patListOfs = songListOfs + songCnt * 0x02;
 	
+	// The song list and the pattern list may be in different banks,
+	// so the matching bank is mapped to 4000..7FFF before reading from either of them.
+	songBankOfs = songListOfs & ~0x3FFF;
+	patBankOfs = patListOfs & ~0x3FFF;
+	MemMap_Init(&GBMap, ROMLen, ROMData, 0x8000, 14);
+	MemMap_MapROM(&GBMap, 0x0000, 0x4000, 0x0000);
+	
 	for (curSng = 0x00; curSng < songCnt; curSng ++)
 	{
 		printf("File %02X / %02X ...", curSng, songCnt);
 		
-		songOfs = AddrGB2ROM(ReadLE16(&ROMData[songListOfs + curSng * 0x02]), songListOfs);
-		patOfs = AddrGB2ROM(ReadLE16(&ROMData[patListOfs + curSng * 0x02]), patListOfs);
+		MemMap_MapROM(&GBMap, 0x4000, 0x4000, patBankOfs);
+		patListAddr = MemMap_Read16LE(&GBMap, ROM2GBAddr(patListOfs + curSng * 0x02));
+		MemMap_MapROM(&GBMap, 0x4000, 0x4000, songBankOfs);
+		songAddr = MemMap_Read16LE(&GBMap, ROM2GBAddr(songListOfs + curSng * 0x02));
 		
-		retVal = Yong2Mid(curSng, songOfs, patOfs);
+		retVal = Yong2Mid(curSng, songAddr, patListAddr);
 		if (retVal)
 		{
 			printf("Error converting file!\n");
@@ -158,7 +170,7 @@ int main(int argc, char* argv[])
 	return 0;
 }
 
-UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
+UINT8 Yong2Mid(UINT16 songID, UINT16 songAddr, UINT16 patListAddr)
 {
 	static const char* TRK_NAMES[4] = {"Square 1", "Square 2", "Wave", "Noise"};
 	UINT8 trkCnt;
@@ -183,8 +195,9 @@ UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
 	UINT8 tempBuf[0x04];
 	char tempStr[0x20];
 	
-	inPos = songOfs;
-	tempByt = ROMData[inPos];	inPos ++;
+	GBMap.badRead = 0;
+	inPos = songAddr;
+	tempByt = MemMap_Read8(&GBMap, inPos);	inPos ++;
 	if (tempByt >= 0x10)
 	{
 		printf("Invalid channel mask!\n");
@@ -195,7 +208,7 @@ UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
 	{
 		if (tempByt & 0x01)
 		{
-			trkPtrs[curTrk] = ReadLE16(&ROMData[inPos]);
+			trkPtrs[curTrk] = MemMap_Read16LE(&GBMap, inPos);
 			inPos += 0x02;
 			trkCnt ++;
 		}
@@ -223,7 +236,7 @@ UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
 		
 		WriteMidiTrackStart(&midFInf, &MTS);
 		MTS.midChn = curTrk;
-		basePos = AddrGB2ROM(trkPtrs[curTrk], songOfs);
+		basePos = trkPtrs[curTrk];
 		
 		WriteMetaEvent(&midFInf, &MTS, 0x03, strlen(TRK_NAMES[curTrk]), TRK_NAMES[curTrk]);
 		if (curTrk == 3)
@@ -240,7 +253,7 @@ UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
 		trkEnd = 0;
 		while(! trkEnd)
 		{
-			curCmd = ROMData[mainPos];	mainPos ++;
+			curCmd = MemMap_Read8(&GBMap, mainPos);	mainPos ++;
 			switch(curCmd)
 			{
 			case 0xFF:	// set master params
@@ -250,7 +263,7 @@ UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
 				}
 				else
 				{
-					if (ROMData[mainPos + 0x03] == 0xFC)
+					if (MemMap_Read8(&GBMap, mainPos + 0x03) == 0xFC)
 						mainPos += 0x03;	// workaround for "silence" song in Sonic Adventure 7.
 					else if (curTrk == 0)
 						mainPos += 0x06;	// Square 1 channel
@@ -260,7 +273,7 @@ UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
 				break;
 			case 0xFE:	// set Tempo
 				// Is the parameter intended to be in BPM?
-				tempByt = ROMData[mainPos];
+				tempByt = MemMap_Read8(&GBMap, mainPos);
 				mainPos ++;
 				if (DRV_VER == 1)
 				{
@@ -288,15 +301,15 @@ UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
 				break;
 			case 0xFD:	// set Volume
 				if (DRV_VER == 1)
-					tempByt = ROMData[mainPos] & 0x0F;
+					tempByt = MemMap_Read8(&GBMap, mainPos) & 0x0F;
 				else
-					tempByt = (ROMData[mainPos] >> 4) & 0x0F;
+					tempByt = (MemMap_Read8(&GBMap, mainPos) >> 4) & 0x0F;
 				mainPos ++;
 				
 				WriteEvent(&midFInf, &MTS, 0xB0, 0x07, DB2Mid(Lin2DB(tempByt)));
 				break;
 			case 0xFC:	// Track End
-				tempByt = ROMData[mainPos];
+				tempByt = MemMap_Read8(&GBMap, mainPos);
 				mainPos ++;
 				if (tempByt)
 				{
@@ -315,25 +328,35 @@ UINT8 Yong2Mid(UINT16 songID, UINT32 songOfs, UINT32 patListOfs)
 				break;
 			default:
 				curPat = curCmd;
-				patPos = AddrGB2ROM(ReadLE16(&ROMData[patListOfs + curPat * 0x02]), patListOfs);
-				while(ROMData[patPos] != 0)
+				MemMap_MapROM(&GBMap, 0x4000, 0x4000, patBankOfs);
+				patPos = MemMap_Read16LE(&GBMap, patListAddr + curPat * 0x02);
+				// (reading beyond the ROM returns 00 and ends the pattern)
+				while(MemMap_Read8(&GBMap, patPos) != 0)
 				{
-					if (! ROMData[patPos + 0x01])
+					tempByt = MemMap_Read8(&GBMap, patPos + 0x01);
+					if (! tempByt)
 					{
 						lastNote = 0xFF;
-						MTS.curDly += ROMData[patPos + 0x00];
+						MTS.curDly += MemMap_Read8(&GBMap, patPos + 0x00);
 					}
 					else
 					{
-						lastNote = ROMData[patPos + 0x01] + noteMove;
+						lastNote = tempByt + noteMove;
 						WriteEvent(&midFInf, &MTS, 0x90, lastNote, 0x7F);
-						MTS.curDly += ROMData[patPos + 0x00];
+						MTS.curDly += MemMap_Read8(&GBMap, patPos + 0x00);
 						WriteEvent(&midFInf, &MTS, 0x90, lastNote, 0x00);
 					}
 					patPos += 0x02;
 				}
+				MemMap_MapROM(&GBMap, 0x4000, 0x4000, songBankOfs);
 				break;
 			}
+			if (GBMap.badRead)
+			{
+				printf("Error: %s track reads outside of the ROM!\n", TRK_NAMES[curTrk]);
+				GBMap.badRead = 0;
+				trkEnd = 1;
+			}
 		}
 		WriteEvent(&midFInf, &MTS, 0xFF, 0x2F, 0x00);
 		WriteMidiTrackEnd(&midFInf, &MTS);
@@ -390,15 +413,11 @@ INLINE UINT32 BPM2Mid(UINT8 valBPM)
 }
 
 
-INLINE UINT16 ReadLE16(const UINT8* data)
-{
-	return (data[0x01] << 8) | (data[0x00] << 0);
-}
-
-INLINE UINT32 AddrGB2ROM(UINT16 addr, UINT32 romBankOfs)
+INLINE UINT16 ROM2GBAddr(UINT32 romOfs)
 {
-	if (addr < 0x4000)
-		return addr;
+	// assumes that the bank of romOfs is mapped to 4000..7FFF
+	if (romOfs < 0x4000)
+		return (UINT16)romOfs;
 	else
-		return (romBankOfs & ~0x3FFF) | (addr & 0x3FFF);
+		return 0x4000 | (romOfs & 0x3FFF);
 }
@@ -23,6 +23,7 @@
 
 
 #include "midi_funcs.h"
+#include "seq_guard.h"
 
 
 #define FLAG_START_THIS_TICK	0x01
@@ -47,6 +48,7 @@ typedef struct _track_info
 
 UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData);
 static void PreparseZmd(UINT32 songLen, const UINT8* songData, TRK_INFO* trkInf);
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT16* loopCur, const UINT16* loopMax, UINT16 mstLoopCur);
 static void GuessLoopTimes(UINT16 TrkCnt, TRK_INFO* trkInf);
 static void CheckRunningNotes(FILE_INF* fInf, UINT32* delay);
 static UINT8 MidiDelayHandler(FILE_INF* fInf, UINT32* delay);
@@ -175,6 +177,9 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 	UINT16 loopCur[8];	// current loop number
 	UINT16 mstLoopPos;	// master loop file offset
 	UINT16 mstLoopCur;
+	SEQ_GUARD seqGuard;
+	UINT8 grdRes;
+	UINT32 curTick;	// track tick, for the guard's tick limit
 	
 	UINT32 tempLng;
 	UINT16 tempSht;
@@ -371,9 +376,17 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 		curChnVol = 0x00;
 		RunNoteCnt = 0;
 		MTS.curDly += initDelay;
+		curTick = 0;
+		SeqGuard_Init(&seqGuard);
 		
 		while(! trkEnd && inPos < songLen)
 		{
+			grdRes = SeqGuard_Step(&seqGuard, curTick, midFileInf.pos - MTS.trkBase);
+			if (grdRes)
+			{
+				printf("Warning: %s on track %u at %04X - track cut!\n", SeqGuard_Reason(grdRes), curTrk, inPos);
+				break;
+			}
 			curCmd = songData[inPos];
 			if (curCmd <= 0x80)
 			{
@@ -418,6 +431,7 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 				}
 				
 				MTS.curDly += songData[inPos + 0x01];
+				curTick += songData[inPos + 0x01];
 				inPos += 0x03;
 			}
 			else
@@ -612,6 +626,12 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 						if (mstLoopCur >= trkInf[curTrk].loopTimes)
 							break;
 						inPos = mstLoopPos;
+						grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCur, loopMax, mstLoopCur));
+						if (grdRes)
+						{
+							printf("Warning: %s on track %u at %04X - track cut!\n", SeqGuard_Reason(grdRes), curTrk, inPos);
+							trkEnd = 1;
+						}
 						break;
 					//case 0x0B:	// "!"
 					//case 0x0C:	// "@"
@@ -624,6 +644,12 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 					inPos += 0x02;
 					break;
 				case 0xC1:	// Loop Start
+					if (loopIdx >= 8)
+					{
+						printf("Warning: More than 8 nested loops on track %u at %04X - ignoring!\n", curTrk, inPos);
+						inPos += 0x01;
+						break;
+					}
 					loopCur[loopIdx] = 0;
 					loopMax[loopIdx] = 0;
 					inPos += 0x01;
@@ -674,6 +700,12 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 					tempLng = sprintf(tempStr, "Loop End %u = %u (loop)", 1 + loopIdx, loopCur[loopIdx]);
 					WriteMetaEvent(&midFileInf, &MTS, 0x01, tempLng, tempStr);
 					loopIdx ++;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCur, loopMax, mstLoopCur));
+					if (grdRes)
+					{
+						printf("Warning: %s on track %u at %04X - track cut!\n", SeqGuard_Reason(grdRes), curTrk, inPos);
+						trkEnd = 1;
+					}
 					break;
 				case 0xC3:	// Loop Conditional
 					// confirmed working with sion268snd/HEADQUATERS.ZMD
@@ -694,6 +726,12 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 						WriteMetaEvent(&midFileInf, &MTS, 0x01, tempLng, tempStr);
 					}
 					loopIdx ++;
+					grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCur, loopMax, mstLoopCur));
+					if (grdRes)
+					{
+						printf("Warning: %s on track %u at %04X - track cut!\n", SeqGuard_Reason(grdRes), curTrk, inPos);
+						trkEnd = 1;
+					}
 					break;
 				case 0xC4:	// Loop Exit
 					printf("Warning: Loop Exit found!\n");
@@ -713,6 +751,12 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 						inPos += tempSht;
 						tempLng = sprintf(tempStr, "Loop End %u = %u (exit)", 1 + loopIdx, loopCur[loopIdx]);
 						WriteMetaEvent(&midFileInf, &MTS, 0x01, tempLng, tempStr);
+						grdRes = SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCur, loopMax, mstLoopCur));
+						if (grdRes)
+						{
+							printf("Warning: %s on track %u at %04X - track cut!\n", SeqGuard_Reason(grdRes), curTrk, inPos);
+							trkEnd = 1;
+						}
 						break;
 					}
 					tempLng = sprintf(tempStr, "Loop End %u = %u (cont)", 1 + loopIdx, loopCur[loopIdx]);
@@ -825,6 +869,7 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 					}
 					
 					MTS.curDly += ReadBE16(&songData[inPos + 0x01]);
+					curTick += ReadBE16(&songData[inPos + 0x01]);
 					inPos += 0x0E;
 					break;
 				case 0xE3:	// Channel Pressure Envelope
@@ -982,6 +1027,7 @@ UINT8 Zmd2Mid(UINT16 songLen, const UINT8* songData)
 				}
 			}
 		}
+		SeqGuard_Free(&seqGuard);
 		
 		// stop all notes like the ZMD driver would do
 		for (curNote = 0; curNote < RunNoteCnt; curNote ++)
@@ -1014,13 +1060,18 @@ static void PreparseZmd(UINT32 songLen, const UINT8* songData, TRK_INFO* trkInf)
 	UINT16 loopCur[8];
 	UINT8 tempByt;
 	UINT16 tempSht;
+	SEQ_GUARD seqGuard;
 	
 	trkEnd = 0;
 	loopIdx = 0x00;
 	trkInf->loopOfs = 0x0000;
 	inPos = trkInf->startOfs;
+	SeqGuard_Init(&seqGuard);
 	while(inPos < songLen && ! trkEnd)
 	{
+		// The conversion will hit the same limit and print the warning.
+		if (SeqGuard_Step(&seqGuard, trkInf->tickCnt, 0))
+			break;
 		curCmd = songData[inPos];
 		if (curCmd <= 0x80)
 		{
@@ -1115,9 +1166,11 @@ static void PreparseZmd(UINT32 songLen, const UINT8* songData, TRK_INFO* trkInf)
 				}
 				break;
 			case 0xC1:	// Loop Start
+				cmdLen = 0x01;
+				if (loopIdx >= 8)
+					break;
 				loopCur[loopIdx] = 0x00;
 				loopMax[loopIdx] = 0x00;
-				cmdLen = 0x01;
 				
 				if (songData[inPos + 0x01] == 0xCF)	// look ahead for Master Loop marker
 				{
@@ -1148,6 +1201,8 @@ static void PreparseZmd(UINT32 songLen, const UINT8* songData, TRK_INFO* trkInf)
 					inPos = inPos + cmdLen - tempSht;
 					cmdLen = 0x00;
 					loopIdx ++;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCur, loopMax, 0)))
+						trkEnd = 1;
 				}
 				break;
 			case 0xC3:	// Loop Conditional
@@ -1160,6 +1215,8 @@ static void PreparseZmd(UINT32 songLen, const UINT8* songData, TRK_INFO* trkInf)
 					if (loopCur[loopIdx] + 1 != tempByt)
 						inPos += tempSht;
 					loopIdx ++;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCur, loopMax, 0)))
+						trkEnd = 1;
 				}
 				break;
 			case 0xC4:	// Loop Exit
@@ -1177,6 +1234,8 @@ static void PreparseZmd(UINT32 songLen, const UINT8* songData, TRK_INFO* trkInf)
 					// jump out of the loop
 					inPos += cmdLen + tempSht;
 					cmdLen = 0x00;
+					if (SeqGuard_Jump(&seqGuard, inPos, GetLoopState(loopIdx, loopCur, loopMax, 0)))
+						trkEnd = 1;
 					break;
 				}
 				loopIdx ++;
@@ -1209,15 +1268,33 @@ static void PreparseZmd(UINT32 songLen, const UINT8* songData, TRK_INFO* trkInf)
 				cmdLen = 0x01;
 				break;
 			default:
-				return;
+				trkEnd = 1;
+				break;
 			}
 		}
 		inPos += cmdLen;
 	}
+	SeqGuard_Free(&seqGuard);
 	
 	return;
 }
 
+// Hashes everything that decides where the track goes after a jump.
+static UINT64 GetLoopState(UINT8 loopIdx, const UINT16* loopCur, const UINT16* loopMax, UINT16 mstLoopCur)
+{
+	UINT64 state;
+	UINT8 curLvl;
+	
+	state = SeqGuard_Hash(0, mstLoopCur);
+	state = SeqGuard_Hash(state, loopIdx);
+	for (curLvl = 0; curLvl < loopIdx; curLvl ++)
+	{
+		state = SeqGuard_Hash(state, loopCur[curLvl]);
+		state = SeqGuard_Hash(state, loopMax[curLvl]);
+	}
+	return state;
+}
+
 static void GuessLoopTimes(UINT16 TrkCnt, TRK_INFO* trkInf)
 {
 	UINT16 CurTrk;